@@ -3,14 +3,13 @@ import numpy as np
 from flexflow.core import *
 
 
-def test_sampling(ffconfig, input_arr: np.ndarray, top_p: float, name=None):
+def test_sampling(ffconfig, input_arr: np.ndarray, name=None):
     ffmodel = FFModel(ffconfig)
 
     input_tensor = ffmodel.create_tensor(input_arr.shape, DataType.DT_FLOAT)
 
     sampling_output = ffmodel.sampling(
         input_tensor,
-        top_p,
         name="sampling_layer",
     )
 
@@ -41,12 +40,10 @@ if __name__ == '__main__':
     ffconfig = FFConfig()
 
     input_data = np.random.randn(ffconfig.batch_size, 10).astype(np.float32)
-    top_p_value = 0.8
 
     output_result = test_sampling(
         ffconfig,
         input_data,
-        top_p=top_p_value,
     )
 
     print("Input Array:")
@@ -21,6 +21,8 @@
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <vector>
 
 // #define MAX_SEQ_LEN 1024
 // #define BATCH_SIZE 2
@@ -64,18 +66,32 @@ public:
   static int max_verify_tokens_per_batch();
   static int max_spec_tree_token_num();
   static int max_sequence_length();
+  static int kv_cache_block_size();
+  static int num_kv_cache_blocks();
   friend std::ostream &operator<<(std::ostream &os, BatchConfig const &bc);
   void print() const;
   void save_to_file(std::string const &filename) const;
   virtual InferenceMode get_mode() const;
   static BatchConfig const *from_future(BatchConfigFuture const &future);
+  // Compact wire format of incremental decoding batches: only the active
+  // requests and tokens and the used part of the KV block table are written
+  void serialize(Legion::Serializer &sez) const;
+  void deserialize(Legion::Deserializer &dez);
   // Maximum possible values for different parameters
   // These maximum values are used for copying BatchConfig
   // across workers
   static int const MAX_NUM_REQUESTS = 65;
   static int const MAX_NUM_TOKENS = 3000;
-  static int const MAX_SPEC_TREE_TOKEN_NUM = 64;
-  static int const MAX_PEFT_CONFIG_SIZE = 1024;
+  static int const MAX_SPEC_TREE_TOKEN_NUM = 128;
+  // Maximum number of paged KV cache block ids shipped with a batch
+  static int const MAX_KV_BLOCK_TABLE_SIZE = 8192;
+  // Maximum number of batches the serving loop keeps in flight
+  static int const MAX_INFLIGHT_BATCHES = 8;
+  // Maximum number of distinct recent tokens of a request that its repetition
+  // penalty applies to
+  static int const MAX_PENALTY_TOKENS_PER_REQUEST = 64;
+  static int const MAX_PENALTY_TOKENS =
+      MAX_NUM_REQUESTS * MAX_PENALTY_TOKENS_PER_REQUEST;
 
   //  Set by update
 
@@ -96,7 +112,15 @@ public:
       batch_config_request_id = -1;
       peft_bwd = false;
       optimizer_tasks = {true, false, false, false};
-      std::memset(peft_model_config_str, 0, MAX_PEFT_CONFIG_SIZE);
+      kv_block_table_offset = 0;
+      do_sample = false;
+      temperature = 1.0f;
+      top_p = 1.0f;
+      top_k = 0;
+      repetition_penalty = 1.0f;
+      seed = 0;
+      penalty_tokens_offset = 0;
+      num_penalty_tokens = 0;
     }
     int first_token_depth_in_request;
     int first_token_offset_in_batch;
@@ -107,11 +131,24 @@ public:
     int batch_config_request_id = -1;
     bool prompt_phase = false;
     RequestGuid request_guid;
-    // PEFT fields
+    // PEFT fields. Ops look up the adapter config by id with
+    // RequestManager::get_peft_config
     PEFTModelID peft_model_id;
-    char peft_model_config_str[MAX_PEFT_CONFIG_SIZE];
     bool peft_bwd;
     OptimizerTasks optimizer_tasks;
+    // offset of this request's block table in kv_block_table (paged KV
+    // cache only)
+    int kv_block_table_offset;
+    // Sampling parameters, applied by the Sampling operator. Requests with
+    // do_sample == false are decoded greedily
+    bool do_sample;
+    float temperature, top_p;
+    int top_k;
+    float repetition_penalty;
+    unsigned long long seed;
+    // the tokens penalized by repetition_penalty are
+    // penalty_tokens[penalty_tokens_offset, + num_penalty_tokens)
+    int penalty_tokens_offset, num_penalty_tokens;
   };
   struct PerTokenInfo {
     int abs_depth_in_request;
@@ -120,7 +157,21 @@ public:
   };
 
   struct BitMask {
-    unsigned long long mask[MAX_SPEC_TREE_TOKEN_NUM] = {0};
+    static int const MAX_WORDS_PER_ROW = (MAX_SPEC_TREE_TOKEN_NUM + 63) / 64;
+
+    void set_bit(int row, int col) {
+      mask[row * words_per_row + col / 64] |= 1ULL << (col % 64);
+    }
+    bool test_bit(int row, int col) const {
+      return (mask[row * words_per_row + col / 64] >> (col % 64)) & 1ULL;
+    }
+    // bytes at the front of a BitMask that trees of up to max_tree_tokens
+    // tokens use, i.e. what has to be copied to the GPU
+    static size_t used_size(int max_tree_tokens) {
+      size_t words_per_row = (max_tree_tokens + 63) / 64;
+      return offsetof(BitMask, mask) +
+             sizeof(unsigned long long) * max_tree_tokens * words_per_row;
+    }
 
     // how many tokens before the tree, every sub requests need this part of
     // cache
@@ -133,6 +184,13 @@ public:
 
     // input length-> prompt/root
     int prompt_size = 0;
+
+    int words_per_row = 1;
+    // Row i of the mask holds one bit per tree token: bit j is set if token j
+    // attends to token i. Rows are packed `words_per_row` 64-bit words apart,
+    // which is derived from the configured max_spec_tree_token_num, so only
+    // the first max_spec_tree_token_num * words_per_row words are used
+    unsigned long long mask[MAX_SPEC_TREE_TOKEN_NUM * MAX_WORDS_PER_ROW] = {0};
   };
 
   BitMask causalMask[MAX_NUM_REQUESTS];
@@ -142,6 +200,44 @@ public:
 
   bool request_completed[MAX_NUM_REQUESTS];
   bool request_running[MAX_NUM_REQUESTS];
+
+  // Paged KV cache: the block tables of all active requests, concatenated.
+  // Entry kv_block_table[requestsInfo[i].kv_block_table_offset + j] is the
+  // physical block that stores tokens [j * block_size, (j + 1) * block_size)
+  // of request i.
+  int num_kv_block_table_entries = 0;
+  int kv_block_table[MAX_KV_BLOCK_TABLE_SIZE];
+
+  // Recent tokens of the active requests that use a repetition penalty,
+  // concatenated, at most MAX_PENALTY_TOKENS. Only incremental decoding
+  // batches, which are sent in the compact format, fill it; the speculative
+  // batch configs are shipped as plain objects and leave it empty
+  std::vector<TokenId> penalty_tokens;
+};
+
+// An incremental decoding BatchConfig in its compact serialized form. Tasks
+// that produce a BatchConfig return this type, so that the size of a batch
+// future scales with the number of active tokens instead of with the
+// MAX_NUM_* limits. BatchConfig::from_future turns it back into a
+// BatchConfig. Speculative inference batches are still stored as plain
+// objects.
+class SerializedBatchConfig {
+public:
+  SerializedBatchConfig() = default;
+  SerializedBatchConfig(BatchConfig const &bc);
+  BatchConfigFuture to_future() const;
+  // the BatchConfig stored in `buffer`, deserialized once per buffer
+  static std::shared_ptr<BatchConfig const> materialize(void const *buffer,
+                                                        size_t size);
+  // Legion serialization interface, used for task return values
+  size_t legion_buffer_size() const;
+  size_t legion_serialize(void *buffer) const;
+  size_t legion_deserialize(void const *buffer);
+
+private:
+  // starts with the total size and a unique batch id, followed by the
+  // output of BatchConfig::serialize
+  std::vector<char> data;
 };
 
 class TreeVerifyBatchConfig : public BatchConfig {
@@ -186,6 +282,11 @@ public:
   bool done() const;
   int max_beam_depth_all_requests() const;
   int current_depth_all_requests() const;
+  // widest tree among the requests; the SSM returns this many candidates for
+  // every token
+  int max_beam_size_all_requests() const;
+  // number of SSM steps needed to build the speculation trees of this batch
+  int get_num_ssm_steps() const;
   int get_speculative_request_num() const;
 
   size_t beam_width;
@@ -193,11 +294,13 @@ public:
 
   // how many requests is in speculative phase
   int speculative_request_num = 0;
-  inline static int const MAX_BEAM_WIDTH = 3;
+  // BeamTopK keeps MAX_BEAM_WIDTH^2 candidates per token in shared memory,
+  // which bounds the width
+  inline static int const MAX_BEAM_WIDTH = 8;
   inline static int const MAX_BEAM_DEPTH = 8;
 
   // maximum tree branches for a request
-  inline static int const MAX_SPECULATIVE_TREE_BRANCHES = 3;
+  inline static int const MAX_SPECULATIVE_TREE_BRANCHES = MAX_BEAM_WIDTH;
 
   int model_id;
 
@@ -0,0 +1,64 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_BATCH_STEP_STATS_H_
+#define _FLEXFLOW_BATCH_STEP_STATS_H_
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace FlexFlow {
+
+// Counters of one serving step (one batch launched on the LLM)
+struct BatchStepStats {
+  // set by BatchStepStatsBuffer::push, starting from 0
+  size_t step = 0;
+  // when the batch was prepared, in microseconds
+  double timestamp = 0;
+  int num_active_requests = 0;
+  int num_prefill_tokens = 0, num_decode_tokens = 0, num_peft_tokens = 0;
+  // token slots of the batch left unused
+  int num_padding_tokens = 0;
+  // time spent in the prepare_next_batch tasks and by the serving loop
+  // waiting on in-flight batches since the previous step, in microseconds
+  double scheduling_time = 0, wait_time = 0;
+  // KV cache entries in use and available, in tokens
+  long long num_kv_tokens_in_use = 0, kv_token_capacity = 0;
+};
+
+// Keeps the stats of the most recent CAPACITY steps. Written by the
+// scheduling tasks and read by any thread
+class BatchStepStatsBuffer {
+public:
+  static constexpr size_t CAPACITY = 4096;
+
+  void push(BatchStepStats const &stats);
+  // up to the `max_steps` most recent steps, oldest first
+  std::vector<BatchStepStats> get_recent(size_t max_steps) const;
+  size_t get_num_steps() const;
+  void clear();
+
+private:
+  mutable std::mutex mutex;
+  std::vector<BatchStepStats> steps;
+  // number of steps pushed so far, the next one goes to
+  // steps[num_steps % CAPACITY]
+  size_t num_steps = 0;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_BATCH_STEP_STATS_H_
@@ -83,6 +83,8 @@ struct CombinedBatchConfigMetaStruct {
 
   TreeVerifyBatchConfig::CommittedTokensInfo
       committed_tokens[TreeVerifyBatchConfig::MAX_NUM_TOKENS];
+
+  int kv_block_table[BatchConfig::MAX_KV_BLOCK_TABLE_SIZE];
 };
 
 struct FFHandler {
@@ -177,6 +179,9 @@ public:
   // PEFT related fields
   bool enable_peft;
   size_t peft_activation_reserve_space_size;
+  // when set, the loaded weights are cached there, after their layout
+  // transformations, and read back as is on later starts
+  std::string weight_cache_folder;
   // Control parallelizable dimensions
   bool only_data_parallel;
   bool enable_sample_parallel;
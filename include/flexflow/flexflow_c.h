@@ -616,7 +616,6 @@ flexflow_tensor_t flexflow_model_add_beam_top_k(flexflow_model_t handle_,
 
 flexflow_tensor_t flexflow_model_add_sampling(flexflow_model_t handle_,
                                               const flexflow_tensor_t input_,
-                                              float top_p,
                                               char const *name);
 
 flexflow_tensor_t flexflow_model_add_argmax(flexflow_model_t handle_,
@@ -660,6 +659,12 @@ void flexflow_model_generate(flexflow_model_t handle_,
                              int *max_lengths,
                              int *max_new_tokens_,
                              bool *add_special_tokens_,
+                             bool *do_samples,
+                             float *temperatures,
+                             float *topps,
+                             int *topks,
+                             float *repetition_penalties,
+                             long long *seeds,
                              flexflow_peft_model_id_t *peft_model_ids,
                              char const **dataset_filepaths,
                              int *training_steps,
@@ -1029,6 +1034,77 @@ void flexflow_request_manager_set_max_sequence_length(
 int flexflow_request_manager_get_max_sequence_length(
     flexflow_request_manager_t handle_);
 
+void flexflow_request_manager_set_kv_cache_block_size(
+    flexflow_request_manager_t handle_, int block_size);
+
+void flexflow_request_manager_set_num_kv_cache_blocks(
+    flexflow_request_manager_t handle_, int num_blocks);
+
+void flexflow_request_manager_set_enable_prefix_caching(
+    flexflow_request_manager_t handle_, bool enable_prefix_caching_);
+
+void flexflow_request_manager_set_scheduling_policy(
+    flexflow_request_manager_t handle_, char const *policy_name);
+
+void flexflow_request_manager_set_max_prefill_tokens_per_batch(
+    flexflow_request_manager_t handle_, int max_num_tokens);
+
+void flexflow_request_manager_set_enable_preemption(
+    flexflow_request_manager_t handle_, bool enable_preemption_);
+
+void flexflow_request_manager_set_max_inflight_batches(
+    flexflow_request_manager_t handle_, int max_inflight_batches);
+
+void flexflow_request_manager_set_request_metrics_filepath(
+    flexflow_request_manager_t handle_, char const *filepath);
+
+bool flexflow_request_manager_dump_request_metrics(
+    flexflow_request_manager_t handle_, char const *filepath);
+
+// summary = {count, mean, min, max, p50, p90, p95, p99}, in milliseconds.
+// Returns false if metric_name is not a known metric
+bool flexflow_request_manager_get_request_metrics_summary(
+    flexflow_request_manager_t handle_,
+    char const *metric_name,
+    double *summary);
+
+// counts must have room for num_bounds + 1 entries. Returns false if
+// metric_name is not a known metric
+bool flexflow_request_manager_get_request_metrics_histogram(
+    flexflow_request_manager_t handle_,
+    char const *metric_name,
+    int num_bounds,
+    double const *bounds,
+    size_t *counts);
+
+void flexflow_request_manager_clear_request_metrics(
+    flexflow_request_manager_t handle_);
+
+// mirrors FlexFlow::BatchStepStats, times in microseconds
+typedef struct flexflow_batch_step_stats_t {
+  int64_t step;
+  double timestamp;
+  int num_active_requests;
+  int num_prefill_tokens;
+  int num_decode_tokens;
+  int num_peft_tokens;
+  int num_padding_tokens;
+  double scheduling_time;
+  double wait_time;
+  int64_t num_kv_tokens_in_use;
+  int64_t kv_token_capacity;
+} flexflow_batch_step_stats_t;
+
+// copies the stats of up to max_steps most recent steps, oldest first, and
+// returns the number of steps copied
+int flexflow_request_manager_get_batch_step_stats(
+    flexflow_request_manager_t handle_,
+    int max_steps,
+    flexflow_batch_step_stats_t *stats);
+
+void flexflow_request_manager_clear_batch_step_stats(
+    flexflow_request_manager_t handle_);
+
 void flexflow_request_manager_set_max_concurrent_adapters(
     flexflow_request_manager_t handle_, int max_concurrent_adapters);
 
@@ -24,6 +24,12 @@ struct GenerationConfig {
   bool do_sample = false;
   float temperature = 0.8;
   float topp = 0.6;
+  // only sample from the topk most likely tokens, 0 disables top-k filtering
+  int topk = 0;
+  // > 1 makes recent tokens of the request less likely to be generated again
+  float repetition_penalty = 1.0f;
+  // seed of the request's random number generator, -1 to pick one at random
+  long long seed = -1;
   GenerationConfig(bool _do_sample, float _temperature, float _topp) {
     temperature = _temperature > 0 ? _temperature : temperature;
     topp = _topp > 0 ? _topp : topp;
@@ -43,6 +49,21 @@ struct GenerationResult {
   std::vector<float> finetuning_losses;
 };
 
+// Output of a request as it is being generated, see
+// RequestManager::set_streaming_callback
+struct StreamingOutput {
+  using RequestGuid = BatchConfig::RequestGuid;
+  using TokenId = BatchConfig::TokenId;
+  RequestGuid guid;
+  // tokens generated since the previous update
+  std::vector<TokenId> new_tokens;
+  // text of the new tokens. Can be empty while the tokens do not form a
+  // complete UTF-8 sequence; the text is then returned with a later update
+  std::string new_text;
+  // the last update of the request, sent after its GenerationResult is ready
+  bool finished = false;
+};
+
 struct RotaryEmbeddingMeta {
   bool apply_rotary_embedding = false;
   float rope_theta = 10000.0f;
@@ -0,0 +1,75 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_MOCK_MODEL_H_
+#define _FLEXFLOW_MOCK_MODEL_H_
+
+#include "flexflow/batch_config.h"
+
+namespace FlexFlow {
+
+// A synthetic model served by a CPU task instead of a compiled graph. The
+// next token is a hash of the previous token and its position, so the LLM
+// and its SSMs agree on every sequence and runs are reproducible
+struct MockModelConfig {
+  // INC_DECODING_MODE or TREE_VERIFY_MODE for an LLM, BEAM_SEARCH_MODE for
+  // an SSM
+  InferenceMode mode = INC_DECODING_MODE;
+  int vocab_size = 32000;
+  // time the task takes for a batch: step_latency_us plus token_latency_us
+  // per token in the batch
+  double step_latency_us = 0;
+  double token_latency_us = 0;
+  // SSMs only: probability that the top draft token is the one the LLM
+  // produces
+  float draft_accuracy = 0.8f;
+  // must be the same for an LLM and its SSMs
+  unsigned long long seed = 0;
+};
+
+class MockModel {
+public:
+  // the token that follows `token` at depth `depth` of a request
+  static BatchConfig::TokenId next_token(MockModelConfig const &config,
+                                         BatchConfig::TokenId token,
+                                         int depth);
+  // the k-th draft candidate of an SSM for the token that follows `token`
+  static BatchConfig::TokenId draft_token(MockModelConfig const &config,
+                                          BatchConfig::TokenId token,
+                                          int depth,
+                                          int k);
+  // one result per token of the batch
+  static void generate(MockModelConfig const &config,
+                       BatchConfig const &bc,
+                       InferenceResult &ir);
+  // `max_beam_size_all_requests` candidates per token of the batch
+  static void generate_beam(MockModelConfig const &config,
+                            BeamSearchBatchConfig const &bc,
+                            BeamInferenceResult &ir);
+  static InferenceResult
+      inference_task(Legion::Task const *task,
+                     std::vector<Legion::PhysicalRegion> const &regions,
+                     Legion::Context ctx,
+                     Legion::Runtime *runtime);
+  static BeamInferenceResult
+      beam_inference_task(Legion::Task const *task,
+                          std::vector<Legion::PhysicalRegion> const &regions,
+                          Legion::Context ctx,
+                          Legion::Runtime *runtime);
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_MOCK_MODEL_H_
@@ -273,12 +273,15 @@ enum TaskIDs {
   RM_LOAD_TOKENS_TASK_ID,
   RM_LOAD_POSITION_TASK_ID,
   RM_LOAD_BATCH_CONFIG_TASK_ID,
+  RM_REGISTER_PEFT_CONFIG_TASK_ID,
   RM_PREPARE_NEXT_BATCH_TASK_ID,
   RM_PREPARE_NEXT_BATCH_INIT_TASK_ID,
   RM_PREPARE_NEXT_BATCH_BEAM_TASK_ID,
   RM_PREPARE_NEXT_BATCH_VERIFY_TASK_ID,
   RM_BACKGROUND_SERVING_TASK_ID,
   LOAD_WEIGHT_TASK_ID,
+  MOCK_MODEL_INF_TASK_ID,
+  MOCK_MODEL_BEAM_INF_TASK_ID,
   // Custom tasks
   CUSTOM_GPU_TASK_ID_FIRST,
   CUSTOM_GPU_TASK_ID_1,
@@ -719,7 +722,7 @@ public:
                    bool speculative_decoding,
                    char const *name = NULL);
   Tensor argmax(const Tensor input, bool beam_search, char const *name = NULL);
-  Tensor sampling(const Tensor input, float top_p, char const *name = NULL);
+  Tensor sampling(const Tensor input, char const *name = NULL);
   Tensor multihead_attention(const Tensor query,
                              const Tensor key,
                              const Tensor value,
@@ -833,6 +836,11 @@ public:
       bool qk_prod_scaling = true,
       bool position_bias = false,
       char const *name = NULL);
+  // Number of K/V heads the QKV projection feeding the multiquery attention
+  // layers above should produce: (num_q_heads + 2 * result) * kdim outputs.
+  // K/V heads are shared by their query heads when they split evenly across
+  // tensor parallel shards, and replicated to one per query head otherwise
+  int get_num_stored_kv_heads(int num_q_heads, int num_kv_heads) const;
   // ========================================
   // PEFT Layers
   // ========================================
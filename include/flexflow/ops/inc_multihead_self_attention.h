@@ -175,6 +175,9 @@ public:
   int qSize, kSize, vSize, qProjSize, kProjSize, vProjSize, oProjSize;
   int global_num_q_heads, global_num_kv_heads, num_q_heads, num_kv_heads,
       hidden_size;
+  // size of the K (or V) heads of a token, smaller than hidden_size when
+  // query heads share K/V heads
+  int kv_hidden_size;
   RotaryEmbeddingMeta *rotary_embedding_meta;
   bool *scaling_query;
   bool *qk_prod_scaling;
@@ -185,6 +188,11 @@ public:
   void *attn_heads;
   BatchConfig::PerTokenInfo *token_infos;
   BatchConfig::PerRequestInfo *request_infos;
+  // paged KV cache (INC_DECODING_MODE only): number of tokens per block, or 0
+  // if each request slot owns a contiguous max_sequence_length region
+  int kv_block_size;
+  int *kv_block_table;
+  void *kv_gather_buffer;
   DataType quantization_type;
   bool offload;
 #if defined(FF_USE_CUDA) || defined(FF_USE_HIP_CUDA)
@@ -32,6 +32,32 @@ void compute_qkv_kernel(IncMultiHeadSelfAttentionMeta const *m,
                         DT *output_ptr,
                         ffStream_t stream);
 
+#if defined(FF_USE_CUDA) || defined(FF_USE_HIP_CUDA)
+// cublasGemmStridedBatchedEx with one batch per query head, where one
+// operand (A if kv_is_a, B otherwise) holds K/V heads, each shared by
+// num_q_heads / num_kv_heads consecutive query heads. The stride of that
+// operand steps from one K/V head to the next
+template <typename DT>
+void gemm_per_query_head(IncMultiHeadSelfAttentionMeta const *m,
+                         cublasOperation_t transa,
+                         cublasOperation_t transb,
+                         int m_,
+                         int n,
+                         int k,
+                         DT const *alpha,
+                         DT const *A,
+                         int lda,
+                         long long strideA,
+                         DT const *B,
+                         int ldb,
+                         long long strideB,
+                         DT const *beta,
+                         DT *C,
+                         int ldc,
+                         long long strideC,
+                         bool kv_is_a);
+#endif
+
 template <typename DT>
 __global__ void apply_position_bias_qkprd(DT *input_ptr,
                                           int num_tokens,
@@ -2,6 +2,7 @@
 #define _FLEXFLOW_OPS_KERNELS_INC_MULTIHEAD_SELF_UTILS_H
 
 #include "flexflow/inference.h"
+#include "flexflow/utils/paged_kv_cache.h"
 
 namespace FlexFlow {
 
@@ -267,6 +268,16 @@ inline __device__ __host__ T div_up(T m, T n) {
   return (m + n - 1) / n;
 }
 
+// whether tree token `col` attends to tree token `row`, see
+// BatchConfig::BitMask
+inline __device__ bool tree_mask_bit(BatchConfig::BitMask const &bitmask,
+                                     int row,
+                                     int col) {
+  return (bitmask.mask[row * bitmask.words_per_row + col / 64] >>
+          (col % 64)) &
+         1ULL;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 inline __device__ float sum(float2 v) {
@@ -16,22 +16,36 @@
 
 namespace FlexFlow {
 
+// Sampling parameters of one row (token) of the batch, gathered from the
+// PerRequestInfo of the request the row belongs to
+struct SamplingRowInfo {
+  float temperature;
+  float top_p;
+  float repetition_penalty;
+  int top_k;
+  bool do_sample;
+  unsigned long long seed;
+  // position of the token in its request, used as the Philox subsequence so
+  // that a request's samples only depend on its seed
+  int position;
+  int penalty_tokens_offset;
+  int num_penalty_tokens;
+};
+
 class SamplingMeta : public OpMeta {
 public:
-  float top_p;
-  void *sorted_logits;
+  // probabilities after temperature and repetition penalty
+  float *adjusted_probs;
+  float *sorted_probs;
   int *sorted_idx;
   int *begin_offset;
   int *end_offset;
   int *idx;
   void *d_temp_storage;
   size_t temp_storage_bytes;
+  SamplingRowInfo *row_info;
+  BatchConfig::TokenId *penalty_tokens;
   Realm::RegionInstance reserveInst;
-#if defined(FF_USE_CUDA) || defined(FF_USE_HIP_CUDA)
-  curandState *state;
-#elif defined(FF_USE_HIP_ROCM)
-  hiprandState *state;
-#endif
   SamplingMeta(FFHandler handle,
                Op const *op,
                int batch_size,
@@ -47,7 +61,6 @@ public:
   using Input = ParallelTensor;
   Sampling(FFModel &model,
            const ParallelTensor input,
-           float top_p,
            char const *name);
   Sampling(FFModel &model, Sampling const &other, const ParallelTensor input);
   Sampling(FFModel &model,
@@ -96,20 +109,18 @@ public:
                              CostMetrics &cost_metrics) const override;
   template <typename DT>
   static void forward_kernel(SamplingMeta const *m,
-                             DT *input_ptr,
+                             BatchConfig const *bc,
+                             DT const *input_ptr,
                              int *indices_ptr,
-                             float top_p,
                              int length,
                              int batch_size,
                              ffStream_t stream);
   static void forward_kernel_wrapper(SamplingMeta const *m,
+                                     BatchConfig const *bc,
                                      GenericTensorAccessorW const &input,
                                      GenericTensorAccessorW const &indices,
                                      int batch_size);
   Params get_params() const;
-
-public:
-  float top_p;
 };
 
 }; // namespace FlexFlow
@@ -7,7 +7,6 @@
 namespace FlexFlow {
 
 struct SamplingParams {
-  float top_p;
   char name[MAX_OPNAME];
   bool is_valid(ParallelTensorShape const &) const;
 };
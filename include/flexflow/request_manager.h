@@ -16,11 +16,23 @@
 #pragma once
 
 #include "flexflow/batch_config.h"
+#include "flexflow/batch_step_stats.h"
 #include "flexflow/inference.h"
+#include "flexflow/mock_model.h"
 #include "flexflow/model.h"
+#include "flexflow/request_metrics.h"
+#include "flexflow/scheduling_policy.h"
 #include "flexflow/utils/file_loader.h"
+#include "flexflow/utils/incremental_detokenizer.h"
+#include "flexflow/utils/kv_cache_block_manager.h"
+#include "flexflow/utils/mpsc_queue.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <future>
 #include <mutex>
+#include <optional>
+#include <thread>
 #include <tokenizers_cpp.h>
 
 namespace FlexFlow {
@@ -52,10 +64,16 @@ public:
   void load_inference_metadata_batch_config(FFModel *model,
                                             BatchConfigFuture const &bc,
                                             FFHandler *handlers);
+  // serve `model` with a MockModel task instead of its operators. The model
+  // needs no layers, weights loader or compilation
+  void register_mock_model(FFModel *model, MockModelConfig const &config);
+  bool is_mock_model(FFModel *model) const;
+  Legion::FutureMap mock_inference(FFModel *model, BatchConfigFuture const &bc);
 
 public:
   std::unordered_map<ParallelTensor, std::vector<ParallelTensor>> tensor_buffer;
   std::unordered_map<FFModel *, FileDataLoader *> model_weights_loaders;
+  std::unordered_map<FFModel *, MockModelConfig> mock_models;
 };
 
 struct Request {
@@ -70,9 +88,32 @@ struct Request {
   int max_length = -1;
   int max_new_tokens = -1;
   bool add_special_tokens = true;
+  // sampling parameters of the request. Requests registered without one use
+  // the RequestManager's default generation config
+  std::optional<GenerationConfig> generation_config;
+  // scheduling hints, used by the SCHEDULING_PRIORITY policy
+  int priority = 0;
+  double ttft_deadline_ms = -1;
+  // set by the RequestManager when the request is registered, and updated
+  // when it is admitted
+  PendingRequest scheduling_info;
+  double registration_time = 0;
+  int num_preemptions = 0;
+  // number of tokens already passed to the output thread
+  int num_output_tokens = 0;
   int initial_len;
   int ssm_cache_size = 0;
   int llm_cache_size = 0;
+  // speculative inference: moving averages of the number of draft tokens
+  // the LLM accepted per verification, and of the fraction of draft tokens
+  // accepted (-1 before the first verification), and the depth of the
+  // request's next speculation tree
+  float spec_accepted_tokens_avg = -1;
+  float spec_acceptance_rate = -1;
+  int spec_depth = BeamSearchBatchConfig::MAX_BEAM_DEPTH;
+  // depth of the tree being drafted, i.e. spec_depth clamped to the room
+  // left in the request and the batch (0 while no tree is drafted)
+  int spec_drafted_depth = 0;
 
   Status status = PENDING;
   std::vector<BatchConfig::TokenId> tokens;
@@ -91,9 +132,10 @@ struct Request {
   std::vector<int> finetuning_tokens_per_batch;
   bool warmup = false;
   std::string dataset_filepath;
-  std::vector<std::pair<std::vector<BatchConfig::TokenId>,
-                        std::vector<BatchConfig::TokenId>>>
-      dataset;
+  // (input tokens, output tokens) of each dataset entry
+  using Dataset = std::vector<std::pair<std::vector<BatchConfig::TokenId>,
+                                        std::vector<BatchConfig::TokenId>>>;
+  Dataset dataset;
   std::vector<float> finetuning_losses;
   friend std::ostream &operator<<(std::ostream &os, Request const &req);
 };
@@ -125,6 +167,7 @@ public:
   };
   using RequestGuid = BatchConfig::RequestGuid;
   using TokenId = BatchConfig::TokenId;
+  using StreamingCallback = std::function<void(StreamingOutput const &)>;
 
   static const RequestGuid INVALID_GUID = 0;
   RequestManager();
@@ -142,7 +185,30 @@ public:
   void set_max_sequence_length(int max_seq_length);
   void push_spec_infer_tree_width(int tree_width);
   int get_max_sequence_length();
+  void set_kv_cache_block_size(int block_size);
+  int get_kv_cache_block_size();
+  void set_num_kv_cache_blocks(int num_blocks);
+  int get_num_kv_cache_blocks();
+  bool is_kv_cache_paged();
+  void set_enable_prefix_caching(bool enable_prefix_caching_);
+  void set_scheduling_policy(SchedulingPolicyType policy_type);
+  void set_max_prefill_tokens_per_batch(int max_num_tokens);
+  void set_enable_preemption(bool enable_preemption_);
+  int get_max_prefill_tokens_per_batch();
+  // number of batches the serving loop keeps in flight, 0 to tune it from
+  // the measured scheduling and inference times
+  void set_max_inflight_batches(int max_inflight_batches_);
+  int get_max_inflight_batches();
   void set_enable_peft_finetuning(bool enable_peft_finetuning_);
+  void set_default_generation_config(GenerationConfig const &config);
+  // Called on the output thread every time a request produces new tokens,
+  // and once more when it finishes. Must not call back into the
+  // RequestManager
+  void set_streaming_callback(StreamingCallback callback);
+  // latency records of finished inference requests
+  RequestMetricsCollector &get_request_metrics();
+  // batch composition and timing of the most recent serving steps
+  BatchStepStatsBuffer &get_batch_step_stats();
   static void set_inference_finished(bool finished = true);
   int register_ssm_model(FFModel *model);
   void register_tokenizer(ModelType model_type,
@@ -168,6 +234,9 @@ public:
   void updateBitMask(BatchConfig::BitMask &bitmask,
                      int initLength,
                      int non_tree_size);
+  // number of 64-bit words per bit mask row needed for
+  // max_spec_tree_token_num tree tokens
+  int get_bitmask_words_per_row();
 
   FFModel *get_ssm_model(int model_id);
 
@@ -176,6 +245,11 @@ public:
   GenerationResult get_generation_result(RequestGuid const &guid);
   RequestGuid register_new_request(Request const &request_);
   RequestGuid register_new_peft_request(Request const &request_);
+  // Registers inference and finetuning requests in bulk: prompts and dataset
+  // entries are tokenized in parallel before the requests are enqueued
+  // together. Returns one guid per request, INVALID_GUID for rejected ones
+  std::vector<RequestGuid>
+      register_new_requests(std::vector<Request> const &requests);
 
   // Methods to start and terminate request manager's background task
   void start_background_server(FFModel *model);
@@ -189,9 +263,6 @@ public:
   bool is_eos_token(int token_id);
   bool check_inf_req_completion(BatchConfig const &old_bc, int i);
   void check_batch(BatchConfig const &old_bc, BatchConfig const &new_bc);
-  void add_peft_config_to_request_info(BatchConfig &bc,
-                                       int req_idx,
-                                       LoraLinearConfig const &peft_config);
   BatchConfig prepare_next_batch(BatchConfig const &bc,
                                  InferenceResult const &result);
   BatchConfigFuture prepare_next_batch(BatchConfigFuture const &bc,
@@ -200,10 +271,14 @@ public:
                                        Legion::Runtime *runtime);
   BeamSearchBatchConfig
       prepare_next_batch_beam(BeamSearchBatchConfig const &old_bc,
-                              BeamInferenceResult const &result);
+                              BeamInferenceResult const &result,
+                              int model_id);
+  // `result` is the output of the ssm `model_id` on `old_bc`. All ssms start
+  // drafting from the same batch returned by prepare_next_batch_init
   BeamSearchBatchConfigFuture
       prepare_next_batch_beam(BeamSearchBatchConfigFuture const &old_bc,
                               BeamInferenceResultFuture const &result,
+                              int model_id,
                               Legion::Context ctx,
                               Legion::Runtime *runtime);
   BeamSearchBatchConfig
@@ -224,7 +299,8 @@ public:
       Legion::Runtime *runtime);
 
   void store_beam_metadata(BeamSearchBatchConfig const &old_bc,
-                           BeamInferenceResult const &result);
+                           BeamInferenceResult const &result,
+                           int model_id);
   void update_beam_metadata(BeamSearchBatchConfig &new_bc,
                             BeamSearchBatchConfig const &old_bc,
                             BeamTree &tree,
@@ -235,19 +311,24 @@ public:
                          int request_index,
                          int first_token_depth_in_request);
 
-  // remove guid after put the cached tree in request
+  // Merge the draft trees of all ssms into a single tree in which common
+  // token paths are shared, and write the causal mask of the merged tree to
+  // `merged_mask`. input_masks[i] is the causal mask of input_trees[i].
   std::vector<std::pair<BatchConfig::TokenId, int>> merge_dfs_trees(
-      std::vector<std::vector<std::pair<BatchConfig::TokenId, int>>>
-          input_trees,
+      std::vector<std::vector<std::pair<BatchConfig::TokenId, int>>> const
+          &input_trees,
+      std::vector<BatchConfig::BitMask const *> const &input_masks,
       int root_depth,
-      RequestGuid guid);
+      RequestGuid guid,
+      BatchConfig::BitMask &merged_mask);
 
   std::vector<std::pair<BatchConfig::TokenId, int>> traverse_verify_tree(
       size_t guid,
       std::vector<std::pair<BatchConfig::TokenId, int>> const
           &inputSerializedTree,
       std::vector<std::pair<BatchConfig::TokenId, int>> const
-          &outputSerializedTree);
+          &outputSerializedTree,
+      BatchConfig::BitMask const &bitmask);
   static void background_serving_task(
       Legion::Task const *task,
       std::vector<Legion::PhysicalRegion> const &regions,
@@ -269,7 +350,12 @@ public:
                              std::vector<Legion::PhysicalRegion> const &regions,
                              Legion::Context ctx,
                              Legion::Runtime *runtime);
-  static BatchConfig prepare_next_batch_task(
+  static void register_peft_config_task(
+      Legion::Task const *task,
+      std::vector<Legion::PhysicalRegion> const &regions,
+      Legion::Context ctx,
+      Legion::Runtime *runtime);
+  static SerializedBatchConfig prepare_next_batch_task(
       Legion::Task const *task,
       std::vector<Legion::PhysicalRegion> const &regions,
       Legion::Context ctx,
@@ -299,10 +385,36 @@ private:
   int max_tokens_per_batch;
   int max_spec_tree_token_num;
   int max_sequence_length;
+  // paged KV cache, disabled when kv_cache_block_size is 0
+  int kv_cache_block_size = 0;
+  int num_kv_cache_blocks = -1;
+  // share the KV cache blocks of common prompt prefixes (paged KV cache only)
+  bool enable_prefix_caching = false;
+  // maximum number of prompt tokens in a batch, the rest of the token budget
+  // is kept for requests in the decoding phase. -1 means no limit
+  int max_prefill_tokens_per_batch = -1;
+  // evict running requests that the scheduling policy orders after a
+  // waiting request to admit it
+  bool enable_preemption = false;
+  // 0 means the depth is picked by a PipelineDepthTuner
+  int max_inflight_batches = 4;
+  // total time spent in prepare_next_batch tasks, in microseconds. Written
+  // by the scheduling tasks and read by the serving loop
+  std::atomic<long long> scheduling_time_us{0};
+  // total time the serving loop spent blocked on in-flight batches
+  std::atomic<long long> inflight_wait_time_us{0};
+  // totals already attributed to a step in batch_step_stats, only used by
+  // the scheduling tasks
+  long long recorded_scheduling_time_us = 0, recorded_wait_time_us = 0;
+  BatchStepStatsBuffer batch_step_stats;
+  void record_batch_step_stats(BatchConfig const &bc, int max_num_tokens);
   Status request_manager_status;
 
   // peft
+  // adapter configs, registered once in every process and referenced by
+  // PEFTModelID in batches. Ops read them concurrently with registration
   std::unordered_map<PEFTModelID, LoraLinearConfig> peft_configs;
+  std::mutex peft_config_mutex;
   int max_lora_rank = 32;
   int max_concurrent_adapters = 0;
   // peft benchmarking
@@ -311,23 +423,56 @@ private:
 
   // tree width in each speculative step, if not specified 1
   std::vector<int> spec_infer_tree_width;
+  // Adaptive speculation: weight of the latest verification in the
+  // acceptance averages, and the acceptance rate above which requests
+  // speculate a single chain instead of a tree
+  static constexpr float SPEC_ACCEPTANCE_EMA_WEIGHT = 0.5f;
+  static constexpr float SPEC_CHAIN_ACCEPTANCE_RATE = 0.8f;
+  void update_spec_depth(Request &request, int num_accepted_tokens);
+  int get_spec_tree_width(Request const &request, int ssm_decoding_steps);
 
   // private fields
+  // creates a new instance of the registered tokenizer. Tokenizers are not
+  // thread safe: tokenizer_ is only used under tokenizer_mutex, the output
+  // thread and the bulk registration workers have their own instances
+  std::function<std::unique_ptr<Tokenizer>()> tokenizer_factory;
   std::unique_ptr<Tokenizer> tokenizer_;
+  std::mutex tokenizer_mutex;
+  std::unique_ptr<Tokenizer> output_tokenizer_;
+  std::vector<std::unique_ptr<Tokenizer>> worker_tokenizers;
+  std::mutex worker_tokenizers_mutex;
   bool verbose;
   ModelType model_type;
   int bos_token_id;
   std::vector<int> eos_token_ids;
   bool old_llama_tokenizer = false;
   std::string output_filepath;
-  std::queue<Request> pending_infr_request_queue;
+  // Requests registered by client threads. Each registration call pushes
+  // its requests as one batch; the serving loop moves them to the scheduling
+  // policy and all_requests before preparing a batch, so registration never
+  // takes request_queue_mutex
+  MPSCQueue<std::vector<Request>> request_intake_queue;
+  // pending inference requests, in the order chosen by the scheduling policy
+  std::unique_ptr<SchedulingPolicy> scheduling_policy;
   std::queue<Request> pending_peft_request_queue;
   std::unordered_map<RequestGuid, Request> all_requests;
-  std::unordered_map<RequestGuid, GenerationResult> request_generation_results;
+  // held by the serving loop while it prepares a batch
   std::mutex request_queue_mutex;
-  std::unordered_map<RequestGuid, std::promise<void> *> request_to_promise;
-  std::mutex request_to_promise_mutex;
-  RequestGuid next_available_guid;
+  std::atomic<RequestGuid> next_available_guid;
+  // Results of the requests, sharded by guid so that client threads waiting
+  // for results do not contend with each other or with the serving loop
+  struct CompletionState {
+    GenerationResult result;
+    std::promise<void> promise;
+    std::shared_future<void> future;
+    bool completed = false;
+  };
+  struct CompletionShard {
+    std::mutex mutex;
+    std::unordered_map<RequestGuid, CompletionState> states;
+  };
+  static int const NUM_COMPLETION_SHARDS = 16;
+  CompletionShard completion_shards[NUM_COMPLETION_SHARDS];
 
   // TODO: Move this two vector to request struct
   std::unordered_map<RequestGuid,
@@ -339,6 +484,94 @@ private:
   // Multi-model support
   std::vector<FFModel *> ssm_models;
 
+  // Paged KV cache
+  std::unique_ptr<KVCacheBlockManager> kv_block_manager;
+  KVCacheBlockManager *get_kv_block_manager();
+  void fill_kv_block_tables(BatchConfig &bc);
+  // extra blocks reserved whenever a request's block table grows, so that
+  // decoding requests only reserve blocks every few steps
+  static int const KV_CACHE_GROWTH_BLOCKS = 4;
+  // grow the block table of `request` to hold at least `num_tokens` tokens,
+  // plus up to KV_CACHE_GROWTH_BLOCKS blocks of room to grow
+  bool reserve_kv_cache(Request const &request, int num_tokens);
+
+  // Per-request sampling
+  GenerationConfig default_generation_config;
+  void fill_sampling_info(BatchConfig &bc);
+
+  // Preemption
+  // the running request that `pending_request` may preempt, or -1
+  int select_preemption_victim(BatchConfig const &bc,
+                               int batch_size,
+                               PendingRequest const &pending_request);
+  void preempt_request(BatchConfig &bc, int batch_idx);
+  // how a running request is queued again if it is preempted
+  PendingRequest get_requeued_scheduling_info(Request const &request);
+  // Create the request and its completion state, and append the request to
+  // new_requests. Returns INVALID_GUID if the request is rejected
+  RequestGuid add_tokenized_request(Request const &request_,
+                                    std::vector<int32_t> const &tokens,
+                                    std::vector<Request> &new_requests);
+  RequestGuid add_tokenized_peft_request(Request const &request_,
+                                         Request::Dataset const &dataset,
+                                         std::vector<Request> &new_requests);
+  void enqueue_new_requests(std::vector<Request> &&requests);
+  // The caller must hold request_queue_mutex
+  void drain_request_intake_queue();
+  CompletionShard &get_completion_shard(RequestGuid const &guid);
+  void init_completion_state(GenerationResult const &result);
+  std::vector<std::string>
+      load_peft_dataset(std::string const &dataset_filepath);
+  std::pair<std::vector<int32_t>, std::vector<int32_t>>
+      tokenize_dataset_entry(Tokenizer &tokenizer, std::string const &text);
+  // keeps bulk registration of a few requests on a single thread
+  static int const MIN_TOKENIZATION_ITEMS_PER_THREAD = 32;
+  void update_batch_config_request_ids(BatchConfig &bc, int batch_size);
+
+  // Output thread: detokenizes outputs, writes them to output_filepath,
+  // completes GenerationResults and streams new tokens, so that the serving
+  // loop never waits for the tokenizer or for file I/O
+  struct OutputEvent {
+    // INVALID_GUID for events that only append file_header to the output file
+    RequestGuid guid = INVALID_GUID;
+    // tokens of the request not passed in a previous event. The first event
+    // of a request starts with its prompt
+    std::vector<TokenId> new_tokens;
+    int num_prompt_tokens = 0;
+    bool add_special_tokens = true;
+    bool finished = false;
+    // written to output_filepath, followed by the token ids and the output
+    // text of the request if write_output is set
+    std::string file_header;
+    bool write_output = false;
+  };
+  // state of an unfinished request, only accessed by the output thread
+  struct OutputState {
+    IncrementalDetokenizer detokenizer;
+    bool add_special_tokens;
+  };
+  void push_output_event(Request &request,
+                         bool finished,
+                         std::string const &file_header = "",
+                         bool write_output = false);
+  void push_output_file_text(std::string const &text);
+  void enqueue_output_event(OutputEvent &&event);
+  void stop_output_thread();
+  void output_thread_loop();
+  void process_output_event(OutputEvent &event);
+  void write_to_output_file(std::string const &text);
+  MPSCQueue<OutputEvent> output_queue;
+  std::unordered_map<RequestGuid, OutputState> output_states;
+  std::thread output_thread;
+  std::once_flag output_thread_started;
+  std::mutex output_thread_mutex;
+  std::condition_variable output_thread_cv;
+  std::atomic<bool> output_thread_sleeping{false};
+  std::atomic<bool> output_thread_stopping{false};
+  StreamingCallback streaming_callback;
+  std::atomic<bool> has_streaming_callback{false};
+  std::mutex streaming_callback_mutex;
+
   // Performance profiling
   size_t num_processed_requests;
 
@@ -352,9 +585,14 @@ private:
     double start_time, finish_time;
     double registration_time, first_token_time;
     bool first_token_time_set = false;
+    // speculative inference: draft tokens verified and accepted so far
+    int num_speculated_tokens = 0, num_accepted_tokens = 0;
   };
   std::unordered_map<RequestGuid, ProfileInfo> profiling_requests;
   double total_request_run_time;
+  RequestMetricsCollector request_metrics;
+  void record_request_metrics(Request const &request,
+                              ProfileInfo const &profile_info);
 };
 
 }; // namespace FlexFlow
@@ -0,0 +1,105 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_REQUEST_METRICS_H_
+#define _FLEXFLOW_REQUEST_METRICS_H_
+
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace FlexFlow {
+
+enum RequestMetricType {
+  // time from registration until the request is first admitted into a batch
+  METRIC_QUEUE_TIME = 0,
+  // time from registration until the first output token
+  METRIC_TTFT = 1,
+  // mean time between output tokens after the first one
+  METRIC_TPOT = 2,
+  // time from registration until the request finishes
+  METRIC_E2E_LATENCY = 3,
+};
+
+// accepts "queue_time", "ttft", "tpot" and "e2e_latency", returns false and
+// leaves `type` untouched for any other name
+bool request_metric_type_from_string(std::string const &name,
+                                     RequestMetricType &type);
+
+// Latency record of a finished inference request. Timestamps are in
+// microseconds, derived latencies in milliseconds
+struct RequestMetrics {
+  size_t guid = 0;
+  bool warmup = false;
+  double registration_time = 0, start_time = 0, first_token_time = 0,
+         finish_time = 0;
+  int prompt_length = 0, output_length = 0;
+  int llm_decoding_steps = 0;
+  int num_preemptions = 0;
+  // speculative inference: draft tokens sent to verification and accepted
+  int num_speculated_tokens = 0, num_accepted_tokens = 0;
+
+  // in milliseconds, -1 if the metric does not apply to the request (e.g.
+  // the TPOT of a request with a single output token)
+  double get(RequestMetricType type) const;
+  // one JSON object, without a trailing newline
+  std::string to_json() const;
+};
+
+struct RequestMetricsSummary {
+  size_t count = 0;
+  double mean = 0, min = 0, max = 0;
+  double p50 = 0, p90 = 0, p95 = 0, p99 = 0;
+};
+
+// Collects the records of finished requests. Records are added by the
+// serving loop and read by any thread; only the most recent MAX_RECORDS are
+// kept
+class RequestMetricsCollector {
+public:
+  static constexpr size_t MAX_RECORDS = 1 << 20;
+
+  void add(RequestMetrics const &metrics);
+  // also append every new record to `filepath` as a JSON line. Writes are
+  // buffered until flush() or the file is closed
+  void set_output_filepath(std::string const &filepath);
+  void flush();
+  std::vector<RequestMetrics> get_records() const;
+  // warmup requests are left out of the aggregates
+  RequestMetricsSummary summarize(RequestMetricType type) const;
+  // counts[i] is the number of values in [bounds[i - 1], bounds[i]), with
+  // counts[0] covering everything below bounds[0] and the last of the
+  // bounds.size() + 1 counts everything from bounds.back() up
+  std::vector<size_t> histogram(RequestMetricType type,
+                                std::vector<double> const &bounds) const;
+  // writes all kept records as JSON lines, returns false if the file could
+  // not be opened
+  bool dump(std::string const &filepath) const;
+  void clear();
+
+private:
+  std::vector<double> values(RequestMetricType type) const;
+
+  mutable std::mutex mutex;
+  std::deque<RequestMetrics> records;
+  std::ofstream output_file;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_REQUEST_METRICS_H_
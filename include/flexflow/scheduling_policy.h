@@ -0,0 +1,103 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_SCHEDULING_POLICY_H_
+#define _FLEXFLOW_SCHEDULING_POLICY_H_
+
+#include "flexflow/fftype.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace FlexFlow {
+
+enum SchedulingPolicyType {
+  // first come, first served
+  SCHEDULING_FCFS = 0,
+  // shortest prompt first, minimizes the mean time to first token
+  SCHEDULING_SHORTEST_PROMPT_FIRST = 1,
+  // highest priority first, earliest deadline first within a priority class
+  SCHEDULING_PRIORITY = 2,
+  // the adapter (PEFT model) that received the fewest tokens so far first
+  SCHEDULING_FAIR_SHARE = 3,
+};
+
+// accepts "fcfs", "spf", "priority" and "fair-share"
+SchedulingPolicyType
+    scheduling_policy_type_from_string(std::string const &name);
+
+// What the scheduler knows about a request waiting to be admitted
+struct PendingRequest {
+  size_t guid;
+  int prompt_length = 0;
+  PEFTModelID peft_model_id = PEFTModelID::NO_ID;
+  // larger values are admitted first (SCHEDULING_PRIORITY)
+  int priority = 0;
+  // absolute time (in microseconds) by which the first token should be
+  // produced, or -1 if the request has no deadline (SCHEDULING_PRIORITY)
+  double deadline = -1;
+  // registration order, set by SchedulingPolicy::push
+  size_t arrival_order = 0;
+};
+
+// Decides in which order the RequestManager admits pending inference requests
+// into the batch.
+class SchedulingPolicy {
+public:
+  virtual ~SchedulingPolicy() = default;
+  static std::unique_ptr<SchedulingPolicy> create(SchedulingPolicyType type);
+
+  void push(PendingRequest const &request);
+  // put back a preempted request, keeping its original arrival order
+  void requeue(PendingRequest const &request);
+  bool empty() const;
+  size_t size() const;
+  // the request to admit next
+  PendingRequest const &front();
+  void pop();
+  // true if `a` should be admitted before `b`. A waiting request may only
+  // preempt running requests that it goes before, or the requeued victim
+  // would be admitted again ahead of it.
+  bool admits_before(PendingRequest const &a, PendingRequest const &b) const;
+  // called by the RequestManager for every request in a batch, with the
+  // number of tokens scheduled for it
+  virtual void on_tokens_scheduled(PEFTModelID const &peft_model_id,
+                                   int num_tokens);
+
+protected:
+  // true if `a` should be admitted before `b`
+  virtual bool before(PendingRequest const &a,
+                      PendingRequest const &b) const = 0;
+  // must be called when the result of `before` may have changed
+  void invalidate_front();
+
+private:
+  // orders the heap in `pending` so that its first entry is front()
+  struct HeapOrder {
+    SchedulingPolicy const *policy;
+    bool operator()(PendingRequest const &a, PendingRequest const &b) const {
+      return policy->before(b, a);
+    }
+  };
+
+  std::vector<PendingRequest> pending;
+  size_t next_arrival_order = 0;
+  // false when `pending` must be re-heapified before the next front()
+  bool is_heap = true;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_SCHEDULING_POLICY_H_
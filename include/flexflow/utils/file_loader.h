@@ -18,6 +18,10 @@
 #include "flexflow/batch_config.h"
 #include "flexflow/inference.h"
 #include "flexflow/model.h"
+#include "flexflow/utils/weight_container.h"
+#include "flexflow/utils/weight_io_pool.h"
+#include "flexflow/utils/weight_snapshot_cache.h"
+#include <memory>
 
 using namespace std;
 using namespace FlexFlow;
@@ -75,6 +79,13 @@ private:
   std::string prompts_filepath;
   std::string weights_folder;
   bool use_full_precision;
+  // set when the weights folder has a packed WeightContainer
+  std::unique_ptr<WeightContainer> weight_container;
+  // reads the weights of all the load_weight_tasks of the process, held
+  // while load_weights_parallel runs
+  std::shared_ptr<WeightIOPool> io_pool;
+  // set by load_weights_parallel when FFConfig::weight_cache_folder is set
+  std::unique_ptr<WeightSnapshotCache> snapshot_cache;
 };
 
 struct WeightLoadTaskArgs {
@@ -0,0 +1,68 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_UTILS_INCREMENTAL_DETOKENIZER_H_
+#define _FLEXFLOW_UTILS_INCREMENTAL_DETOKENIZER_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace FlexFlow {
+
+// Turns the tokens of a request into text as they are generated, without
+// decoding the whole sequence again for every new token. Only a small window
+// of tokens is decoded per append: the text of the new tokens is the
+// difference between the decoded window and the decoded window minus the new
+// tokens, so that tokenizers that merge or strip spaces at token boundaries
+// produce the same text as a full decode. Text that ends in an incomplete
+// UTF-8 sequence (decoded as U+FFFD) is held back until the next tokens
+// complete it, or until flush().
+class IncrementalDetokenizer {
+public:
+  using TokenId = int;
+  using DecodeFunction =
+      std::function<std::string(std::vector<TokenId> const &)>;
+
+  // The prompt is decoded once; its text starts get_text()
+  IncrementalDetokenizer(DecodeFunction decode,
+                         std::vector<TokenId> const &prompt_tokens);
+  // Appends generated tokens and returns the text they complete, which can be
+  // empty
+  std::string append(std::vector<TokenId> const &new_tokens);
+  // Returns the text held back by previous appends
+  std::string flush();
+  std::vector<TokenId> const &get_tokens() const;
+  // Text of the prompt followed by all the text returned so far
+  std::string const &get_text() const;
+  int get_num_prompt_tokens() const;
+
+  // number of tokens before the first unread token decoded with it
+  static int const NUM_CONTEXT_TOKENS = 5;
+
+private:
+  std::string decode_unread_tokens(bool flush);
+
+  DecodeFunction decode;
+  std::vector<TokenId> tokens;
+  std::string text;
+  int num_prompt_tokens;
+  // the text of tokens [prefix_offset, read_offset) is already in `text`
+  int prefix_offset, read_offset;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_UTILS_INCREMENTAL_DETOKENIZER_H_
@@ -0,0 +1,128 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_UTILS_KV_CACHE_BLOCK_MANAGER_H_
+#define _FLEXFLOW_UTILS_KV_CACHE_BLOCK_MANAGER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace FlexFlow {
+
+// Host-side allocator for the paged KV cache. The KV cache of every attention
+// layer is a pool of `num_blocks` fixed-size blocks, each holding the keys and
+// values of `block_size` consecutive tokens. Every request owns a block table
+// mapping its logical blocks (token_depth / block_size) to physical blocks in
+// the pool. All layers share the same block tables, so a single manager owned
+// by the RequestManager is sufficient.
+//
+// Blocks are reference counted so that requests with a common prompt prefix
+// can share the blocks of that prefix. Full blocks whose keys and values have
+// been computed can be published in a prefix cache, a trie keyed by the token
+// ids of each block. A new request looks up its prompt in the trie and maps the
+// matching blocks into its own block table, skipping their prefill. Shared
+// blocks are never written: a request only matches full blocks strictly before
+// its last prompt token, so all of its writes go to blocks it owns exclusively.
+// Cached blocks that are no longer used by any request stay in the trie until
+// their space is needed, at which point they are evicted in LRU order.
+class KVCacheBlockManager {
+public:
+  using RequestGuid = size_t;
+  using TokenId = int;
+
+  KVCacheBlockManager(int num_blocks, int block_size);
+
+  int get_num_blocks() const;
+  int get_block_size() const;
+  int get_num_free_blocks() const;
+  // number of cached prefix blocks not used by any request, which can be
+  // evicted to serve new reservations
+  int get_num_evictable_blocks() const;
+  int get_num_cached_blocks() const;
+  // number of blocks needed to store `num_tokens` tokens
+  int num_blocks_needed(int num_tokens) const;
+  // true if the block table of `guid` can be grown to hold `num_tokens`
+  bool can_reserve(RequestGuid guid, int num_tokens) const;
+  // grow the block table of `guid` so that it covers `num_tokens` tokens,
+  // evicting unused cached prefixes if needed. Returns false (and leaves the
+  // table unchanged) if there are not enough free blocks.
+  bool reserve(RequestGuid guid, int num_tokens);
+  // drop the reference of `guid` on all its blocks; blocks that are no longer
+  // referenced by a request or the prefix cache return to the free list
+  void release(RequestGuid guid);
+  // map the longest cached prefix of `tokens` into the (empty) block table of
+  // `guid`. At least the last token is left out so that the request still
+  // computes the logits of its prompt. Returns the number of matched tokens,
+  // always a multiple of the block size.
+  int match_prefix(RequestGuid guid, std::vector<TokenId> const &tokens);
+  // publish the full blocks covering tokens [0, num_computed_tokens) of
+  // `guid` in the prefix cache. The keys and values of these tokens must
+  // already be stored in the KV cache.
+  void cache_prefix(RequestGuid guid,
+                    std::vector<TokenId> const &tokens,
+                    int num_computed_tokens);
+  bool has_block_table(RequestGuid guid) const;
+  std::vector<int> const &get_block_table(RequestGuid guid) const;
+
+private:
+  struct PrefixNode {
+    int block_id = -1;
+    PrefixNode *parent = nullptr;
+    uint64_t last_access = 0;
+    std::map<std::vector<TokenId>, std::unique_ptr<PrefixNode>> children;
+  };
+  void acquire_block(int block_id);
+  void release_block(int block_id);
+  // evict the least recently used cached block not used by any request
+  bool evict_prefix_block();
+
+  int num_blocks;
+  int block_size;
+  // free physical blocks, used as a stack so recently released (and likely
+  // still cached) blocks are handed out first
+  std::vector<int> free_blocks;
+  std::unordered_map<RequestGuid, std::vector<int>> block_tables;
+  // number of block tables (and prefix cache entries) using each block
+  std::vector<int> ref_counts;
+  // the prefix cache node of each block, if any
+  std::vector<PrefixNode *> cached_nodes;
+  PrefixNode prefix_root;
+  int num_cached_blocks;
+  int num_evictable_blocks;
+  uint64_t access_clock;
+};
+
+// CPU reference of single-query attention over a paged KV cache, indexed
+// with the same helpers as the GPU kernels. `key_cache` and `value_cache`
+// are laid out as [num_blocks, block_size, num_heads, head_dim]; `query` and
+// `output` as [num_heads, head_dim].
+void paged_attention_reference(float const *query,
+                               float const *key_cache,
+                               float const *value_cache,
+                               std::vector<int> const &block_table,
+                               int block_size,
+                               int num_tokens,
+                               int num_heads,
+                               int head_dim,
+                               float scale,
+                               float *output);
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_UTILS_KV_CACHE_BLOCK_MANAGER_H_
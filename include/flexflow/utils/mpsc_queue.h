@@ -0,0 +1,77 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_UTILS_MPSC_QUEUE_H_
+#define _FLEXFLOW_UTILS_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+namespace FlexFlow {
+
+// Unbounded multi-producer single-consumer queue (Vyukov). push() is
+// wait-free and can be called from any thread; try_pop() and empty() must
+// only be called from the single consumer thread.
+template <typename T>
+class MPSCQueue {
+public:
+  MPSCQueue() : head(new Node()), tail(head.load()) {}
+  ~MPSCQueue() {
+    T value;
+    while (try_pop(value)) {
+    }
+    delete tail;
+  }
+  MPSCQueue(MPSCQueue const &) = delete;
+  MPSCQueue &operator=(MPSCQueue const &) = delete;
+
+  void push(T value) {
+    Node *node = new Node();
+    node->value = std::move(value);
+    Node *prev = head.exchange(node, std::memory_order_acq_rel);
+    // between the exchange and this store the consumer sees the queue as
+    // empty, so it may miss this element until its next try_pop
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  bool try_pop(T &value) {
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    value = std::move(next->value);
+    // `next` becomes the new stub node
+    delete tail;
+    tail = next;
+    return true;
+  }
+
+  bool empty() const {
+    return tail->next.load(std::memory_order_acquire) == nullptr;
+  }
+
+private:
+  struct Node {
+    std::atomic<Node *> next{nullptr};
+    T value;
+  };
+  // producers append after `head`, the consumer pops after `tail`
+  std::atomic<Node *> head;
+  Node *tail;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_UTILS_MPSC_QUEUE_H_
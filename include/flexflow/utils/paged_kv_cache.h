@@ -0,0 +1,54 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_UTILS_PAGED_KV_CACHE_H_
+#define _FLEXFLOW_UTILS_PAGED_KV_CACHE_H_
+
+#include <cstddef>
+
+// Index arithmetic of the paged KV cache, shared by the attention kernels and
+// the host code that tests them. The cache of a layer is laid out as
+// [num_blocks, block_size, kv_hidden_size], and the block table of a request
+// lists the physical block holding each run of block_size tokens.
+#if defined(__CUDACC__) || defined(__HIPCC__)
+#define FF_PAGED_KV_CACHE_FUNC __host__ __device__ inline
+#else
+#define FF_PAGED_KV_CACHE_FUNC inline
+#endif
+
+namespace FlexFlow {
+
+// slot of the tok_id-th token of a request in a paged KV cache
+FF_PAGED_KV_CACHE_FUNC size_t paged_kv_cache_slot(int const *block_table,
+                                                  int block_size,
+                                                  int tok_id) {
+  return (size_t)block_table[tok_id / block_size] * block_size +
+         tok_id % block_size;
+}
+
+// index in the paged KV cache of element i of the contiguous
+// [num_tokens, kv_hidden_size] copy of a request's keys or values
+FF_PAGED_KV_CACHE_FUNC size_t paged_kv_cache_gather_index(
+    int const *block_table, int block_size, int kv_hidden_size, size_t i) {
+  int tok_id = i / kv_hidden_size;
+  int offset = i % kv_hidden_size;
+  return paged_kv_cache_slot(block_table, block_size, tok_id) *
+             kv_hidden_size +
+         offset;
+}
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_UTILS_PAGED_KV_CACHE_H_
@@ -0,0 +1,86 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_UTILS_PIPELINE_DEPTH_TUNER_H_
+#define _FLEXFLOW_UTILS_PIPELINE_DEPTH_TUNER_H_
+
+#include <algorithm>
+#include <cassert>
+
+namespace FlexFlow {
+
+// Picks the number of batches the serving loop keeps in flight. Every
+// WINDOW batches it compares the time spent in the scheduler
+// (prepare_next_batch tasks) and the time the serving loop was blocked on
+// the oldest batch with the elapsed time of the window:
+//  - when scheduling takes a large share of each batch, one more batch in
+//    flight lets the runtime get further ahead of the scheduler;
+//  - when scheduling is cheap and the loop spends most of its time blocked
+//    on a full pipeline, the extra batches only add latency, so one is
+//    dropped.
+class PipelineDepthTuner {
+public:
+  static int const WINDOW = 16;
+  static constexpr double GROW_SCHEDULING_FRACTION = 0.2;
+  static constexpr double SHRINK_SCHEDULING_FRACTION = 0.05;
+  static constexpr double SHRINK_BLOCKED_FRACTION = 0.5;
+
+  PipelineDepthTuner(int min_depth, int max_depth, int initial_depth)
+      : min_depth(min_depth), max_depth(max_depth),
+        current_depth(std::min(std::max(initial_depth, min_depth),
+                               max_depth)) {
+    assert(min_depth >= 1 && min_depth <= max_depth);
+  }
+
+  int depth() const {
+    return current_depth;
+  }
+
+  // Records one batch: the time (in microseconds) the serving loop was
+  // blocked before launching it, the time the scheduler spent on it, and the
+  // time since the previous batch was launched
+  void record_batch(double blocked_us,
+                    double scheduling_us,
+                    double elapsed_us) {
+    window_blocked_us += blocked_us;
+    window_scheduling_us += scheduling_us;
+    window_elapsed_us += elapsed_us;
+    if (++window_batches < WINDOW) {
+      return;
+    }
+    if (window_elapsed_us > 0) {
+      double scheduling_fraction = window_scheduling_us / window_elapsed_us;
+      double blocked_fraction = window_blocked_us / window_elapsed_us;
+      if (scheduling_fraction >= GROW_SCHEDULING_FRACTION) {
+        current_depth = std::min(current_depth + 1, max_depth);
+      } else if (scheduling_fraction < SHRINK_SCHEDULING_FRACTION &&
+                 blocked_fraction >= SHRINK_BLOCKED_FRACTION) {
+        current_depth = std::max(current_depth - 1, min_depth);
+      }
+    }
+    window_batches = 0;
+    window_blocked_us = window_scheduling_us = window_elapsed_us = 0;
+  }
+
+private:
+  int min_depth, max_depth, current_depth;
+  int window_batches = 0;
+  double window_blocked_us = 0, window_scheduling_us = 0,
+         window_elapsed_us = 0;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_UTILS_PIPELINE_DEPTH_TUNER_H_
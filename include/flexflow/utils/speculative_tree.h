@@ -0,0 +1,53 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_UTILS_SPECULATIVE_TREE_H_
+#define _FLEXFLOW_UTILS_SPECULATIVE_TREE_H_
+
+#include "flexflow/batch_config.h"
+#include <utility>
+#include <vector>
+
+namespace FlexFlow {
+
+// A speculative token tree, serialized layer by layer as (token id, depth)
+// pairs. The first token is the root, i.e. the last committed token. In the
+// causal mask of a tree, bit (i, j) is set if token j attends to token i,
+// that is if token i is token j or one of its ancestors.
+using SerializedTokenTree = std::vector<std::pair<BatchConfig::TokenId, int>>;
+
+// Merge the draft trees of several ssms, which share the root, into a single
+// tree in which common token paths appear once. masks[i] is the causal mask
+// of trees[i]. At most max_tree_size tokens are kept, dropping the deepest
+// layers first, and the causal mask of the merged tree is written to
+// merged_mask.
+SerializedTokenTree merge_speculative_trees(
+    std::vector<SerializedTokenTree> const &trees,
+    std::vector<BatchConfig::BitMask const *> const &masks,
+    int max_tree_size,
+    BatchConfig::BitMask &merged_mask);
+
+// The indices in input_tree of the tokens the llm accepts, starting with the
+// root. output_tree[i] is the llm's prediction after input_tree[i]; a draft
+// token is accepted if it is a child of the last accepted token and matches
+// the llm's prediction after it.
+std::vector<int>
+    accept_speculative_tokens(SerializedTokenTree const &input_tree,
+                              SerializedTokenTree const &output_tree,
+                              BatchConfig::BitMask const &mask);
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_UTILS_SPECULATIVE_TREE_H_
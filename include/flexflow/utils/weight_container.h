@@ -0,0 +1,91 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_UTILS_WEIGHT_CONTAINER_H_
+#define _FLEXFLOW_UTILS_WEIGHT_CONTAINER_H_
+
+#include "flexflow/ffconst.h"
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace FlexFlow {
+
+// A single file holding all the weight tensors of a model, which is mapped
+// in memory once so that tensors are read without opening a file each.
+// Layout (native byte order):
+//   char     magic[8]         "FFWEIGHT"
+//   uint32   version
+//   uint32   num_tensors
+//   then, for each tensor:
+//   uint32   name_length, followed by the name
+//   int32    data_type
+//   uint32   num_dims, followed by uint64 dims[num_dims]
+//   uint64   offset of the payload from the start of the file
+//   uint64   size of the payload in bytes
+// Payloads start at multiples of ALIGNMENT bytes
+class WeightContainer {
+public:
+  static constexpr char const *MAGIC = "FFWEIGHT";
+  static constexpr unsigned VERSION = 1;
+  static constexpr size_t ALIGNMENT = 64;
+  // name of the container in a weights folder
+  static constexpr char const *FILENAME = "weights.ffw";
+
+  struct TensorInfo {
+    std::string name;
+    DataType data_type;
+    std::vector<size_t> dims;
+    size_t offset, size;
+  };
+
+  // maps the container at `filepath`, which must be valid
+  WeightContainer(std::string const &filepath);
+  ~WeightContainer();
+  WeightContainer(WeightContainer const &) = delete;
+  WeightContainer &operator=(WeightContainer const &) = delete;
+
+  // nullptr if there is no tensor named `name`
+  TensorInfo const *find(std::string const &name) const;
+  // payload of a tensor, valid as long as the container
+  char const *get_data(TensorInfo const &info) const;
+  std::vector<TensorInfo> const &get_tensors() const;
+
+private:
+  std::string filepath;
+  char const *mapped = nullptr;
+  size_t mapped_size = 0;
+  std::vector<TensorInfo> tensors;
+  std::unordered_map<std::string, size_t> tensor_index;
+};
+
+// Packs tensors read from separate files into a WeightContainer
+class WeightContainerWriter {
+public:
+  void add_tensor(std::string const &name,
+                  DataType data_type,
+                  std::vector<size_t> const &dims,
+                  std::string const &source_filepath);
+  void write(std::string const &filepath) const;
+
+private:
+  std::vector<WeightContainer::TensorInfo> tensors;
+  std::vector<std::string> source_filepaths;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_UTILS_WEIGHT_CONTAINER_H_
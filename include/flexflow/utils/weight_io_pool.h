@@ -0,0 +1,115 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_UTILS_WEIGHT_IO_POOL_H_
+#define _FLEXFLOW_UTILS_WEIGHT_IO_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FlexFlow {
+
+// A fixed set of threads that reads large weight ranges in chunks, so that
+// many reads are in flight at once, which local NVMe drives need to reach
+// their bandwidth. At most max_pending_chunks chunks are queued; callers
+// block until there is room, so that read-ahead stays bounded. The pool is
+// shared by the weight loading tasks of a process, whose chunks interleave
+// (see acquire_shared)
+class WeightIOPool {
+public:
+  static constexpr size_t DEFAULT_CHUNK_SIZE = 8 << 20;
+  static constexpr int MAX_DEFAULT_THREADS = 16;
+  // called with the bytes [begin, begin + size) of a range, one chunk at a
+  // time but from several threads at once and in any order
+  using ChunkConsumer =
+      std::function<void(char const *src, size_t begin, size_t size)>;
+
+  // num_threads <= 0 picks a default from the number of cores
+  WeightIOPool(int num_threads = 0,
+               size_t chunk_size = DEFAULT_CHUNK_SIZE,
+               size_t max_pending_chunks = 0);
+  ~WeightIOPool();
+  WeightIOPool(WeightIOPool const &) = delete;
+  WeightIOPool &operator=(WeightIOPool const &) = delete;
+
+  // reads `size` bytes at `offset` of `fd` into `dst`, and returns once
+  // they are all read, or false if the file does not hold the whole range
+  bool pread(int fd, size_t offset, size_t size, char *dst);
+  // copies `size` bytes, e.g. from a mapped file whose pages are then
+  // faulted in by several threads
+  void copy(char const *src, size_t size, char *dst);
+  // like pread and copy, but hand every chunk to `consume` instead of
+  // storing it, for data that must be transformed on its way to `dst`. Each
+  // thread reads its chunks into its own staging buffer, so that the
+  // transform of a chunk overlaps the reads of the next ones
+  bool pread(int fd,
+             size_t offset,
+             size_t size,
+             ChunkConsumer const &consume);
+  void copy(char const *src, size_t size, ChunkConsumer const &consume);
+
+  size_t get_chunk_size() const;
+  int get_num_threads() const;
+
+  // the pool of the process with default settings. It is created by the
+  // first caller and its threads exit once no caller holds it anymore, so
+  // that they only live while weights are being loaded
+  static std::shared_ptr<WeightIOPool> acquire_shared();
+
+private:
+  // a group of chunks a caller waits for
+  struct Batch {
+    size_t num_pending = 0;
+    bool failed = false;
+  };
+  struct Chunk {
+    Batch *batch;
+    int fd; // -1 for a memory copy
+    char const *src;
+    size_t offset, size;
+    char *dst;
+    // nullptr to store the chunk at dst
+    ChunkConsumer const *consume;
+    // position of the chunk in its range
+    size_t begin;
+  };
+
+  bool run_batch(int fd,
+                 char const *src,
+                 size_t offset,
+                 size_t size,
+                 char *dst,
+                 ChunkConsumer const *consume);
+  static bool
+      run_chunk(Chunk const &chunk, std::vector<char> &staging_buffer);
+  void worker();
+
+  size_t chunk_size, max_pending_chunks;
+  std::mutex mutex;
+  std::condition_variable queue_not_empty, queue_not_full, batch_done;
+  std::deque<Chunk> queue;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_UTILS_WEIGHT_IO_POOL_H_
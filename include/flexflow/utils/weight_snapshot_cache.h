@@ -0,0 +1,63 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FLEXFLOW_UTILS_WEIGHT_SNAPSHOT_CACHE_H_
+#define _FLEXFLOW_UTILS_WEIGHT_SNAPSHOT_CACHE_H_
+
+#include "flexflow/utils/weight_io_pool.h"
+#include <cstddef>
+#include <string>
+
+namespace FlexFlow {
+
+// Caches weight tensors as the loader leaves them in their regions, after
+// fusing the q/k/v projections, replicating kv heads, striping tensor
+// parallel shards and packing quantized data, so that later starts read
+// them back as is. Each tensor is a raw file in
+// <cache_folder>/<key>/, where the key hashes the files of the weights
+// folder (names, sizes and modification times) with the loader settings.
+// Changing the weights or the settings thus starts a new snapshot
+class WeightSnapshotCache {
+public:
+  // bump when the layout the loader produces changes
+  static constexpr unsigned FORMAT_VERSION = 1;
+
+  // `settings` describes everything, other than the weights themselves,
+  // that the transformed tensors depend on
+  WeightSnapshotCache(std::string const &cache_folder,
+                      std::string const &weights_folder,
+                      std::string const &settings);
+
+  // reads the `size` bytes of the snapshot of tensor `name` into `dst`.
+  // Returns false if there is no snapshot of that size
+  bool load(std::string const &name,
+            size_t size,
+            char *dst,
+            WeightIOPool *io_pool) const;
+  // writes a snapshot of tensor `name`. A snapshot only appears once it is
+  // complete, so that a crash while writing it leaves no partial file
+  void store(std::string const &name, size_t size, char const *src) const;
+
+  std::string const &get_snapshot_folder() const;
+
+private:
+  std::string get_filepath(std::string const &name) const;
+
+  std::string snapshot_folder;
+};
+
+}; // namespace FlexFlow
+
+#endif // _FLEXFLOW_UTILS_WEIGHT_SNAPSHOT_CACHE_H_
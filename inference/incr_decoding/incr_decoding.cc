@@ -47,7 +47,14 @@ void parse_input_args(char **argv,
                       float &topp,
                       int &max_requests_per_batch,
                       int &max_tokens_per_batch,
-                      int &max_sequence_length) {
+                      int &max_sequence_length,
+                      int &kv_cache_block_size,
+                      int &num_kv_cache_blocks,
+                      bool &enable_prefix_caching,
+                      std::string &scheduling_policy,
+                      int &max_prefill_tokens_per_batch,
+                      bool &enable_preemption,
+                      int &max_inflight_batches) {
   for (int i = 1; i < argc; i++) {
     // llm model type
     if (!strcmp(argv[i], "-llm-model")) {
@@ -105,6 +112,34 @@ void parse_input_args(char **argv,
       max_sequence_length = std::stoi(argv[++i]);
       continue;
     }
+    if (!strcmp(argv[i], "--kv-cache-block-size")) {
+      kv_cache_block_size = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--num-kv-cache-blocks")) {
+      num_kv_cache_blocks = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--enable-prefix-caching")) {
+      enable_prefix_caching = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--scheduling-policy")) {
+      scheduling_policy = std::string(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--max-prefill-tokens-per-batch")) {
+      max_prefill_tokens_per_batch = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--enable-preemption")) {
+      enable_preemption = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--max-inflight-batches")) {
+      max_inflight_batches = std::stoi(argv[++i]);
+      continue;
+    }
   }
   if (paths.cache_folder_path.empty()) {
     char const *ff_cache_path = std::getenv("FF_CACHE_PATH");
@@ -136,6 +171,14 @@ void FlexFlow::top_level_task(Task const *task,
   int max_requests_per_batch = 8;
   int max_tokens_per_batch = 128;
   int max_sequence_length = 256;
+  int kv_cache_block_size = 0;
+  int num_kv_cache_blocks = -1;
+  bool enable_prefix_caching = false;
+  std::string scheduling_policy = "fcfs";
+  int max_prefill_tokens_per_batch = -1;
+  bool enable_preemption = false;
+  // 0 tunes the number of batches in flight automatically
+  int max_inflight_batches = 4;
 
   InputArgs const &command_args = HighLevelRuntime::get_input_args();
   char **argv = command_args.argv;
@@ -151,7 +194,14 @@ void FlexFlow::top_level_task(Task const *task,
                    topp,
                    max_requests_per_batch,
                    max_tokens_per_batch,
-                   max_sequence_length);
+                   max_sequence_length,
+                   kv_cache_block_size,
+                   num_kv_cache_blocks,
+                   enable_prefix_caching,
+                   scheduling_policy,
+                   max_prefill_tokens_per_batch,
+                   enable_preemption,
+                   max_inflight_batches);
 
   assert(ffconfig.data_parallelism_degree * ffconfig.tensor_parallelism_degree *
              ffconfig.pipeline_parallelism_degree ==
@@ -222,6 +272,19 @@ void FlexFlow::top_level_task(Task const *task,
   rm->set_max_requests_per_batch(max_requests_per_batch);
   rm->set_max_tokens_per_batch(max_tokens_per_batch);
   rm->set_max_sequence_length(max_sequence_length);
+  rm->set_kv_cache_block_size(kv_cache_block_size);
+  if (num_kv_cache_blocks > 0) {
+    rm->set_num_kv_cache_blocks(num_kv_cache_blocks);
+  }
+  rm->set_enable_prefix_caching(enable_prefix_caching);
+  rm->set_scheduling_policy(
+      scheduling_policy_type_from_string(scheduling_policy));
+  if (max_prefill_tokens_per_batch > 0) {
+    rm->set_max_prefill_tokens_per_batch(max_prefill_tokens_per_batch);
+  }
+  rm->set_enable_preemption(enable_preemption);
+  rm->set_max_inflight_batches(max_inflight_batches);
+  rm->set_default_generation_config(generationConfig);
   rm->register_tokenizer(
       model_type, bos_token_id, eos_token_ids, tokenizer_filepath);
   rm->register_output_filepath(file_paths.output_file_path);
@@ -98,11 +98,14 @@ void FALCON::create_falcon_model(FFModel &ff,
       att_norm = res_ln_outputs[1];
     }
 
+    int num_stored_kv_heads = ff.get_num_stored_kv_heads(
+        falcon_config.n_head, falcon_config.n_head_kv);
     qkv_proj = ff.dense(
         att_norm,
-        falcon_config.hidden_size *
-            3, // q, k, v. need to change if want to remove replication.
-               // (q_heads + 2 * kv_heads) * proj_size
+        // q, k, v: (q_heads + 2 * kv_heads) * proj_size, where the kv heads
+        // are replicated to one per q head when they cannot be shared
+        (falcon_config.n_head + 2 * num_stored_kv_heads) *
+            (falcon_config.hidden_size / falcon_config.n_head),
         AC_MODE_NONE,
         false,         // seems like it does not use bias
         DT_NONE,       // what is this
@@ -265,6 +268,10 @@ void FALCON::create_falcon_model(FFModel &ff,
   if (mode == BEAM_SEARCH_MODE) {
     Tensor softmax = ff.softmax(lm_head, -1);
     output = ff.argmax(softmax, /*beam_Search*/ true);
+  } else if (mode == INC_DECODING_MODE) {
+    // the sampling parameters of each request are set in the BatchConfig
+    Tensor softmax = ff.softmax(lm_head, -1);
+    output = ff.sampling(softmax);
   } else {
     output = ff.argmax(lm_head, /*beam_Search*/ false);
   }
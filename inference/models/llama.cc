@@ -91,11 +91,14 @@ void LLAMA::create_llama_model(FFModel &ff,
       token = token_att_norm[0];
       att_norm = token_att_norm[1];
     }
+    int num_stored_kv_heads = ff.get_num_stored_kv_heads(
+        llama_config.num_attention_heads, llama_config.num_key_value_heads);
     Tensor qkv_proj = ff.dense(
         att_norm,
-        llama_config.hidden_size *
-            3, // q, k, v. need to change if want to remove replication.
-               // (q_heads + 2 * kv_heads) * proj_size
+        // q, k, v: (q_heads + 2 * kv_heads) * proj_size, where the kv heads
+        // are replicated to one per q head when they cannot be shared
+        (llama_config.num_attention_heads + 2 * num_stored_kv_heads) *
+            (llama_config.hidden_size / llama_config.num_attention_heads),
         AC_MODE_NONE,
         false,         // seems like llama does not use bias
         DT_NONE,       // what is this
@@ -281,17 +284,14 @@ void LLAMA::create_llama_model(FFModel &ff,
     // output = ff.argmax(softmax, /*beam_Search*/ true);
     output = ff.arg_top_k(softmax, llama_config.max_beam_width, false, true);
     // output = ff.top_k(softmax, )
+  } else if (mode == INC_DECODING_MODE) {
+    // the sampling parameters of each request are set in the BatchConfig
+    Tensor softmax = ff.softmax(dense, -1);
+    output = ff.sampling(softmax);
   } else {
-    // Tensor softmax = ff.softmax(dense, -1);
-    if (generation_config.do_sample) {
-      dense = ff.scalar_truediv(dense, generation_config.temperature, false);
-      Tensor softmax = ff.softmax(dense, -1);
-      output = ff.sampling(softmax, generation_config.topp);
-    } else {
-      // output = ff.arg_top_k(dense, /*k=*/1, false);
-      Tensor softmax = ff.softmax(dense, -1);
-      output = ff.argmax(softmax, /*beam_Search*/ false);
-    }
+    // output = ff.arg_top_k(dense, /*k=*/1, false);
+    Tensor softmax = ff.softmax(dense, -1);
+    output = ff.argmax(softmax, /*beam_Search*/ false);
   }
 
   // If PEFT is enabled, add LoRA layers
@@ -269,6 +269,10 @@ void MPT::create_mpt_model(FFModel &ff,
   if (mode == BEAM_SEARCH_MODE) {
     Tensor softmax = ff.softmax(lm_head, -1);
     output = ff.argmax(softmax, /*beam_Search*/ true);
+  } else if (mode == INC_DECODING_MODE) {
+    // the sampling parameters of each request are set in the BatchConfig
+    Tensor softmax = ff.softmax(lm_head, -1);
+    output = ff.sampling(softmax);
   } else {
     output = ff.argmax(lm_head, /*beam_Search*/ false);
   }
@@ -277,6 +277,10 @@ void OPT::create_opt_model(FFModel &ff,
     Tensor softmax = ff.softmax(lm_head, -1);
     // output = ff.beam_top_k(softmax, opt_config.max_beam_width, false);
     output = ff.argmax(softmax, /*beam_Search*/ true);
+  } else if (mode == INC_DECODING_MODE) {
+    // the sampling parameters of each request are set in the BatchConfig
+    Tensor softmax = ff.softmax(lm_head, -1);
+    output = ff.sampling(softmax);
   } else {
     // output = ff.arg_top_k(lm_head, /*k=*/1, false);
     Tensor softmax = ff.softmax(lm_head, -1);
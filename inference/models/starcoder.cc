@@ -102,11 +102,15 @@ void STARCODER::create_starcoder_model(
     Tensor hidden_states = res_ln_outputs[0];
     Tensor ln_1 = res_ln_outputs[1];
 
+    int num_stored_kv_heads =
+        ff.get_num_stored_kv_heads(startcoder_config.num_attention_heads, 1);
     Tensor qkv_proj = ff.dense(
         ln_1,
-        startcoder_config.hidden_size *
-            3, // q, k, v. need to change if want to remove replication.
-               // (q_heads + 2 * kv_heads) * proj_size
+        // q, k, v: (q_heads + 2 * kv_heads) * proj_size, where the kv heads
+        // are replicated to one per q head when they cannot be shared
+        (startcoder_config.num_attention_heads + 2 * num_stored_kv_heads) *
+            (startcoder_config.hidden_size /
+             startcoder_config.num_attention_heads),
         AC_MODE_NONE,
         false,         // seems like it does not use bias
         DT_NONE,       // what is this
@@ -241,16 +245,13 @@ void STARCODER::create_starcoder_model(
     Tensor softmax = ff.softmax(lm_head, -1);
     // output = ff.beam_top_k(softmax, startcoder_config.max_beam_width, false);
     output = ff.argmax(softmax, /*beam_Search*/ true);
+  } else if (mode == INC_DECODING_MODE) {
+    // the sampling parameters of each request are set in the BatchConfig
+    Tensor softmax = ff.softmax(lm_head, -1);
+    output = ff.sampling(softmax);
   } else {
-    // Tensor softmax = ff.softmax(dense, -1);
-    if (generationConfig.do_sample) {
-      lm_head = ff.scalar_truediv(lm_head, generationConfig.temperature, false);
-      Tensor softmax = ff.softmax(lm_head, -1);
-      output = ff.sampling(softmax, generationConfig.topp);
-    } else {
-      // output = ff.arg_top_k(lm_head, /*k=*/1, false);
-      output = ff.argmax(lm_head, /*beam_Search*/ false);
-    }
+    // output = ff.arg_top_k(lm_head, /*k=*/1, false);
+    output = ff.argmax(lm_head, /*beam_Search*/ false);
   }
 
   // If PEFT is enabled, add LoRA layers
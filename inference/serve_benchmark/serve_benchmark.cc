@@ -0,0 +1,615 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays a trace of inference requests against the RequestManager with
+// open-loop arrivals: requests are registered at their arrival time whether
+// or not earlier requests have finished. Each line of the trace is a JSON
+// object with the fields
+//   arrival_time      seconds since the start of the replay
+//   prompt            prompt text, or
+//   prompt_length     number of synthetic prompt tokens
+//   max_new_tokens    number of tokens to generate
+// and optionally
+//   adapter           name of the PEFT adapter to use
+//   do_sample, temperature, topp, topk, repetition_penalty, seed
+//   priority, ttft_deadline_ms
+// Throughput and latency percentiles are printed at the end, and the
+// per-request records can be written as JSON lines with -metrics-file.
+// With --mock-model, the LLM (and the SSMs given by --mock-ssms) are
+// MockModels running on a CPU, so the RequestManager can be benchmarked
+// without a GPU model. Mock models need traces with prompt_length only.
+
+#include "flexflow/inference.h"
+#include "flexflow/request_manager.h"
+#include "models/falcon.h"
+#include "models/llama.h"
+#include "models/mpt.h"
+#include "models/opt.h"
+#include "models/starcoder.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <thread>
+#include <wordexp.h>
+
+#include <nlohmann/json.hpp>
+
+using namespace FlexFlow;
+using namespace Legion;
+using json = nlohmann::json;
+
+Legion::Logger log_app("serve_benchmark");
+
+struct FilePaths {
+  std::string cache_folder_path;
+  std::string trace_file_path;
+  std::string output_file_path;
+  std::string metrics_file_path;
+};
+
+struct MockOptions {
+  bool enabled = false;
+  int num_ssms = 0;
+  MockModelConfig config;
+};
+
+struct TraceEntry {
+  double arrival_time;
+  std::string prompt;
+  int prompt_length = -1;
+  int max_new_tokens;
+  std::string adapter;
+  std::optional<GenerationConfig> generation_config;
+  int priority = 0;
+  double ttft_deadline_ms = -1;
+};
+
+void parse_input_args(char **argv,
+                      int argc,
+                      FilePaths &paths,
+                      std::string &llm_model_name,
+                      bool &use_full_precision,
+                      bool &verbose,
+                      int &max_requests_per_batch,
+                      int &max_tokens_per_batch,
+                      int &max_sequence_length,
+                      int &kv_cache_block_size,
+                      int &num_kv_cache_blocks,
+                      bool &enable_prefix_caching,
+                      std::string &scheduling_policy,
+                      int &max_prefill_tokens_per_batch,
+                      bool &enable_preemption,
+                      int &max_inflight_batches,
+                      int &num_warmup_requests,
+                      double &time_scale,
+                      MockOptions &mock) {
+  for (int i = 1; i < argc; i++) {
+    // llm model type
+    if (!strcmp(argv[i], "-llm-model")) {
+      llm_model_name = std::string(argv[++i]);
+      for (char &c : llm_model_name) {
+        c = std::tolower(c);
+      }
+      continue;
+    }
+    // cache folder
+    if (!strcmp(argv[i], "-cache-folder")) {
+      paths.cache_folder_path = std::string(argv[++i]);
+      continue;
+    }
+    // request trace, one JSON object per line
+    if (!strcmp(argv[i], "-trace")) {
+      paths.trace_file_path = std::string(argv[++i]);
+      continue;
+    }
+    // output file
+    if (!strcmp(argv[i], "-output-file")) {
+      paths.output_file_path = std::string(argv[++i]);
+      continue;
+    }
+    // per-request metrics, as JSON lines
+    if (!strcmp(argv[i], "-metrics-file")) {
+      paths.metrics_file_path = std::string(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--use-full-precision")) {
+      use_full_precision = true;
+      continue;
+    }
+    // verbose logging to stdout
+    if (!strcmp(argv[i], "--verbose")) {
+      verbose = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--max-requests-per-batch")) {
+      max_requests_per_batch = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--max-tokens-per-batch")) {
+      max_tokens_per_batch = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--max-sequence-length")) {
+      max_sequence_length = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--kv-cache-block-size")) {
+      kv_cache_block_size = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--num-kv-cache-blocks")) {
+      num_kv_cache_blocks = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--enable-prefix-caching")) {
+      enable_prefix_caching = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--scheduling-policy")) {
+      scheduling_policy = std::string(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--max-prefill-tokens-per-batch")) {
+      max_prefill_tokens_per_batch = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--enable-preemption")) {
+      enable_preemption = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--max-inflight-batches")) {
+      max_inflight_batches = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--num-warmup-requests")) {
+      num_warmup_requests = std::stoi(argv[++i]);
+      continue;
+    }
+    // arrival times are multiplied by this factor, < 1 replays the trace
+    // at a higher request rate
+    if (!strcmp(argv[i], "--time-scale")) {
+      time_scale = std::stod(argv[++i]);
+      continue;
+    }
+    // serve a synthetic model instead of -llm-model
+    if (!strcmp(argv[i], "--mock-model")) {
+      mock.enabled = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--mock-vocab-size")) {
+      mock.config.vocab_size = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--mock-step-latency-us")) {
+      mock.config.step_latency_us = std::stod(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--mock-token-latency-us")) {
+      mock.config.token_latency_us = std::stod(argv[++i]);
+      continue;
+    }
+    // number of mock SSMs, > 0 serves the trace with speculative inference
+    if (!strcmp(argv[i], "--mock-ssms")) {
+      mock.num_ssms = std::stoi(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--mock-draft-accuracy")) {
+      mock.config.draft_accuracy = std::stof(argv[++i]);
+      continue;
+    }
+    if (!strcmp(argv[i], "--mock-seed")) {
+      mock.config.seed = std::stoull(argv[++i]);
+      continue;
+    }
+  }
+  if (paths.cache_folder_path.empty()) {
+    char const *ff_cache_path = std::getenv("FF_CACHE_PATH");
+    paths.cache_folder_path = ff_cache_path ? std::string(ff_cache_path)
+                                            : std::string("~/.cache/flexflow");
+  }
+  // Expand ~ to the home directory if needed
+  wordexp_t p;
+  wordexp(paths.cache_folder_path.c_str(), &p, 0);
+  paths.cache_folder_path = p.we_wordv[0];
+  wordfree(&p);
+}
+
+std::vector<TraceEntry> load_trace(std::string const &trace_file_path) {
+  std::ifstream file_handle(trace_file_path);
+  assert(file_handle.good() && "Trace file does not exist.");
+  std::vector<TraceEntry> trace;
+  std::string line;
+  while (std::getline(file_handle, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    json record = json::parse(line);
+    TraceEntry entry;
+    entry.arrival_time = record.at("arrival_time").get<double>();
+    if (record.contains("prompt")) {
+      entry.prompt = record["prompt"].get<std::string>();
+    } else {
+      entry.prompt_length = record.at("prompt_length").get<int>();
+      assert(entry.prompt_length > 0);
+    }
+    entry.max_new_tokens = record.at("max_new_tokens").get<int>();
+    entry.adapter = record.value("adapter", std::string());
+    if (record.contains("do_sample") || record.contains("temperature") ||
+        record.contains("topp") || record.contains("topk") ||
+        record.contains("repetition_penalty") || record.contains("seed")) {
+      GenerationConfig config;
+      config.do_sample = record.value("do_sample", config.do_sample);
+      config.temperature = record.value("temperature", config.temperature);
+      config.topp = record.value("topp", config.topp);
+      config.topk = record.value("topk", config.topk);
+      config.repetition_penalty =
+          record.value("repetition_penalty", config.repetition_penalty);
+      config.seed = record.value("seed", config.seed);
+      entry.generation_config = config;
+    }
+    entry.priority = record.value("priority", 0);
+    entry.ttft_deadline_ms = record.value("ttft_deadline_ms", -1.0);
+    trace.push_back(entry);
+  }
+  std::stable_sort(trace.begin(),
+                   trace.end(),
+                   [](TraceEntry const &a, TraceEntry const &b) {
+                     return a.arrival_time < b.arrival_time;
+                   });
+  return trace;
+}
+
+void print_summary(RequestMetricsCollector const &metrics, double duration_s) {
+  size_t num_requests = 0;
+  long long num_output_tokens = 0;
+  for (RequestMetrics const &record : metrics.get_records()) {
+    if (!record.warmup) {
+      num_requests++;
+      num_output_tokens += record.output_length;
+    }
+  }
+  printf("Requests: %zu in %.2lf s\n", num_requests, duration_s);
+  printf("Throughput: %.2lf requests/s, %.2lf output tokens/s\n",
+         num_requests / duration_s,
+         num_output_tokens / duration_s);
+  std::vector<std::pair<char const *, RequestMetricType>> const types = {
+      {"queue_time", METRIC_QUEUE_TIME},
+      {"ttft", METRIC_TTFT},
+      {"tpot", METRIC_TPOT},
+      {"e2e_latency", METRIC_E2E_LATENCY},
+  };
+  printf("%-12s %10s %10s %10s %10s %10s %10s (ms)\n",
+         "metric",
+         "mean",
+         "p50",
+         "p90",
+         "p95",
+         "p99",
+         "max");
+  for (auto const &type : types) {
+    RequestMetricsSummary summary = metrics.summarize(type.second);
+    printf("%-12s %10.2lf %10.2lf %10.2lf %10.2lf %10.2lf %10.2lf\n",
+           type.first,
+           summary.mean,
+           summary.p50,
+           summary.p90,
+           summary.p95,
+           summary.p99,
+           summary.max);
+  }
+}
+
+void FlexFlow::top_level_task(Task const *task,
+                              std::vector<PhysicalRegion> const &regions,
+                              Context ctx,
+                              Runtime *runtime) {
+  FFConfig ffconfig;
+  if (ffconfig.cpu_offload == false && ffconfig.quantization_type != DT_NONE) {
+    assert(false && "Doesn't support quantization in non-offload mode");
+  }
+  FilePaths file_paths;
+  std::string llm_model_name;
+  bool use_full_precision = false;
+  bool verbose = false;
+  int max_requests_per_batch = 8;
+  int max_tokens_per_batch = 128;
+  int max_sequence_length = 256;
+  int kv_cache_block_size = 0;
+  int num_kv_cache_blocks = -1;
+  bool enable_prefix_caching = false;
+  std::string scheduling_policy = "fcfs";
+  int max_prefill_tokens_per_batch = -1;
+  bool enable_preemption = false;
+  int max_inflight_batches = 4;
+  int num_warmup_requests = 0;
+  double time_scale = 1.0;
+  int max_spec_tree_token_num = 23;
+  MockOptions mock;
+
+  InputArgs const &command_args = HighLevelRuntime::get_input_args();
+  char **argv = command_args.argv;
+  int argc = command_args.argc;
+  parse_input_args(argv,
+                   argc,
+                   file_paths,
+                   llm_model_name,
+                   use_full_precision,
+                   verbose,
+                   max_requests_per_batch,
+                   max_tokens_per_batch,
+                   max_sequence_length,
+                   kv_cache_block_size,
+                   num_kv_cache_blocks,
+                   enable_prefix_caching,
+                   scheduling_policy,
+                   max_prefill_tokens_per_batch,
+                   enable_preemption,
+                   max_inflight_batches,
+                   num_warmup_requests,
+                   time_scale,
+                   mock);
+  assert(!file_paths.trace_file_path.empty() && "A trace file is required.");
+
+  std::string config_filepath, tokenizer_filepath, weights_filepath;
+  ModelType model_type = ModelType::UNKNOWN;
+  int bos_token_id = -1;
+  std::vector<int> eos_token_ids;
+  if (!mock.enabled) {
+    assert(ffconfig.data_parallelism_degree *
+               ffconfig.tensor_parallelism_degree *
+               ffconfig.pipeline_parallelism_degree ==
+           ffconfig.numNodes * ffconfig.workersPerNode);
+
+    config_filepath = join_path({file_paths.cache_folder_path,
+                                 "configs",
+                                 llm_model_name,
+                                 "config.json"});
+    tokenizer_filepath = join_path(
+        {file_paths.cache_folder_path, "tokenizers", llm_model_name});
+    weights_filepath =
+        join_path({file_paths.cache_folder_path,
+                   "weights",
+                   llm_model_name,
+                   use_full_precision ? "full-precision" : "half-precision"});
+    std::ifstream config_file_handle(config_filepath);
+    if (!config_file_handle.good()) {
+      std::cout << "Model config file " << config_filepath << " not found."
+                << std::endl;
+      assert(false);
+    }
+    json model_config = json::parse(config_file_handle,
+                                    /*parser_callback_t */ nullptr,
+                                    /*allow_exceptions */ true,
+                                    /*ignore_comments */ true);
+    auto architectures = model_config["architectures"];
+    for (auto const &str : architectures) {
+      if (str == "LlamaForCausalLM" || str == "LLaMAForCausalLM") {
+        model_type = ModelType::LLAMA;
+        break;
+      } else if (str == "OPTForCausalLM") {
+        model_type = ModelType::OPT;
+        break;
+      } else if (str == "RWForCausalLM" || str == "FalconForCausalLM") {
+        model_type = ModelType::FALCON;
+        break;
+      } else if (str == "GPTBigCodeForCausalLM") {
+        model_type = ModelType::STARCODER;
+        break;
+      } else if (str == "MPTForCausalLM") {
+        model_type = ModelType::MPT;
+        break;
+      }
+    }
+    bos_token_id = model_config.find("bos_token_id") == model_config.end()
+                       ? -1
+                       : (int)model_config.at("bos_token_id");
+    // parse eos token id, which can be either a single integer or an array
+    // of integers. Convert to std::vector<int>
+    if (model_config.find("eos_token_id") != model_config.end()) {
+      if (model_config["eos_token_id"].is_array()) {
+        for (auto &eos_token_id : model_config["eos_token_id"]) {
+          eos_token_ids.push_back(eos_token_id);
+        }
+      } else {
+        eos_token_ids.push_back(model_config["eos_token_id"]);
+      }
+    } else {
+      eos_token_ids.push_back(-1);
+    }
+
+    assert(model_type != ModelType::UNKNOWN &&
+           "Invalid LLM model type passed (or no type was passed).");
+  }
+
+  std::vector<TraceEntry> trace = load_trace(file_paths.trace_file_path);
+  std::vector<std::string> adapter_names;
+  for (TraceEntry const &entry : trace) {
+    if (!entry.adapter.empty() &&
+        std::find(adapter_names.begin(),
+                  adapter_names.end(),
+                  entry.adapter) == adapter_names.end()) {
+      adapter_names.push_back(entry.adapter);
+    }
+  }
+  if (!adapter_names.empty() && !ffconfig.enable_peft) {
+    std::cout << "The trace uses PEFT adapters, but PEFT is not enabled"
+              << std::endl;
+    assert(false);
+  }
+  if (mock.enabled) {
+    assert(adapter_names.empty() && "Mock models do not support adapters");
+    for (TraceEntry const &entry : trace) {
+      assert(entry.prompt_length > 0 &&
+             "Mock models need traces with prompt_length");
+    }
+  }
+
+  GenerationConfig generationConfig;
+  RequestManager *rm = RequestManager::get_request_manager();
+  rm->set_max_requests_per_batch(max_requests_per_batch);
+  if (!adapter_names.empty()) {
+    rm->set_max_concurrent_adapters(max_requests_per_batch);
+  }
+  rm->set_max_tokens_per_batch(max_tokens_per_batch);
+  rm->set_max_sequence_length(max_sequence_length);
+  if (mock.num_ssms > 0) {
+    assert(mock.enabled && "--mock-ssms requires --mock-model");
+    rm->set_max_spec_tree_token_num(max_spec_tree_token_num);
+  }
+  rm->set_kv_cache_block_size(kv_cache_block_size);
+  if (num_kv_cache_blocks > 0) {
+    rm->set_num_kv_cache_blocks(num_kv_cache_blocks);
+  }
+  rm->set_enable_prefix_caching(enable_prefix_caching);
+  rm->set_scheduling_policy(
+      scheduling_policy_type_from_string(scheduling_policy));
+  if (max_prefill_tokens_per_batch > 0) {
+    rm->set_max_prefill_tokens_per_batch(max_prefill_tokens_per_batch);
+  }
+  rm->set_enable_preemption(enable_preemption);
+  rm->set_max_inflight_batches(max_inflight_batches);
+  rm->set_default_generation_config(generationConfig);
+  rm->register_tokenizer(
+      model_type, bos_token_id, eos_token_ids, tokenizer_filepath);
+  rm->register_output_filepath(file_paths.output_file_path);
+  if (!file_paths.metrics_file_path.empty()) {
+    rm->get_request_metrics().set_output_filepath(file_paths.metrics_file_path);
+  }
+
+  FFModel model(ffconfig, ffconfig.cpu_offload);
+  // the SSMs must outlive the background server
+  std::deque<FFModel> ssm_models;
+  if (mock.enabled) {
+    InferenceManager *im = InferenceManager::get_inference_manager();
+    MockModelConfig llm_config = mock.config;
+    llm_config.mode = mock.num_ssms > 0 ? TREE_VERIFY_MODE : INC_DECODING_MODE;
+    im->register_mock_model(&model, llm_config);
+    for (int i = 0; i < mock.num_ssms; i++) {
+      ssm_models.emplace_back(ffconfig);
+      MockModelConfig ssm_config = mock.config;
+      ssm_config.mode = BEAM_SEARCH_MODE;
+      im->register_mock_model(&ssm_models.back(), ssm_config);
+      rm->register_ssm_model(&ssm_models.back());
+    }
+  } else if (model_type == ModelType::LLAMA) {
+    LLAMA::create_llama_model(model,
+                              config_filepath,
+                              weights_filepath,
+                              INC_DECODING_MODE,
+                              generationConfig,
+                              use_full_precision);
+  } else if (model_type == ModelType::OPT) {
+    OPT::create_opt_model(model,
+                          config_filepath,
+                          weights_filepath,
+                          INC_DECODING_MODE,
+                          use_full_precision);
+  } else if (model_type == ModelType::FALCON) {
+    FALCON::create_falcon_model(model,
+                                config_filepath,
+                                weights_filepath,
+                                INC_DECODING_MODE,
+                                use_full_precision);
+  } else if (model_type == ModelType::STARCODER) {
+    STARCODER::create_starcoder_model(model,
+                                      config_filepath,
+                                      weights_filepath,
+                                      INC_DECODING_MODE,
+                                      generationConfig,
+                                      use_full_precision);
+  } else if (model_type == ModelType::MPT) {
+    MPT::create_mpt_model(model,
+                          config_filepath,
+                          weights_filepath,
+                          INC_DECODING_MODE,
+                          generationConfig,
+                          use_full_precision);
+  } else {
+    assert(false && "unknow model type");
+  }
+
+  rm->start_background_server(&model);
+
+  std::map<std::string, PEFTModelID> adapters;
+  for (std::string const &name : adapter_names) {
+    LoraLinearConfig peft_config(file_paths.cache_folder_path, name);
+    adapters[name] = *model.register_peft_adapter(peft_config);
+  }
+
+  // Warmup stage, excluded from the reported metrics
+  if (num_warmup_requests > 0) {
+    std::vector<Request> requests;
+    for (int i = 0; i < num_warmup_requests; i++) {
+      Request inference_req;
+      inference_req.benchmarking_tokens = 128;
+      inference_req.max_new_tokens = 32;
+      inference_req.warmup = true;
+      requests.push_back(inference_req);
+    }
+    std::vector<GenerationResult> result = model.generate(requests);
+    std::cout << "----------warmup finished--------------" << std::endl;
+  }
+
+  // Replay the trace. Requests are registered at their arrival time, and
+  // their results are only collected once all of them have been registered
+  std::vector<RequestManager::RequestGuid> guids;
+  auto start_time = std::chrono::steady_clock::now();
+  for (TraceEntry const &entry : trace) {
+    std::this_thread::sleep_until(
+        start_time + std::chrono::microseconds((long long)(
+                         entry.arrival_time * time_scale * 1000000)));
+    Request inference_req;
+    if (entry.prompt_length > 0) {
+      inference_req.benchmarking_tokens = entry.prompt_length;
+    } else {
+      inference_req.prompt = entry.prompt;
+    }
+    inference_req.max_new_tokens = entry.max_new_tokens;
+    if (!entry.adapter.empty()) {
+      inference_req.peft_model_id = adapters.at(entry.adapter);
+    }
+    inference_req.generation_config = entry.generation_config;
+    inference_req.priority = entry.priority;
+    inference_req.ttft_deadline_ms = entry.ttft_deadline_ms;
+    RequestManager::RequestGuid guid = rm->register_new_request(inference_req);
+    if (guid != RequestManager::INVALID_GUID) {
+      guids.push_back(guid);
+    } else {
+      log_app.print("Request arriving at %.3lf s was rejected",
+                    entry.arrival_time);
+    }
+  }
+  for (RequestManager::RequestGuid guid : guids) {
+    GenerationResult result = rm->get_generation_result(guid);
+  }
+  double duration_s = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start_time)
+                          .count();
+
+  // terminate the request manager by stopping the background thread
+  rm->terminate_background_server();
+
+  // Execution fence
+  {
+    Future future = runtime->issue_execution_fence(ctx);
+    future.get_void_result();
+  }
+
+  std::cout << "----------benchmark finished--------------" << std::endl;
+  print_summary(rm->get_request_metrics(), duration_s);
+}
+
+void FlexFlow::register_custom_tasks() {}
@@ -64,7 +64,8 @@ void parse_input_args(char **argv,
                       int &max_requests_per_batch,
                       int &max_tokens_per_batch,
                       int &max_sequence_length,
-                      int &expansion_degree) {
+                      int &expansion_degree,
+                      int &max_inflight_batches) {
   for (int i = 1; i < argc; i++) {
     // llm model name
     if (!strcmp(argv[i], "-llm-model")) {
@@ -123,6 +124,10 @@ void parse_input_args(char **argv,
       expansion_degree = std::stoi(argv[++i]);
       continue;
     }
+    if (!strcmp(argv[i], "--max-inflight-batches")) {
+      max_inflight_batches = std::stoi(argv[++i]);
+      continue;
+    }
   }
   if (paths.cache_folder_path.empty()) {
     char const *ff_cache_path = std::getenv("FF_CACHE_PATH");
@@ -290,6 +295,8 @@ void FlexFlow::top_level_task(Task const *task,
   int max_sequence_length = 1024;
   int max_spec_tree_token_num = 23;
   int expansion_degree = 3;
+  // 0 tunes the number of batches in flight automatically
+  int max_inflight_batches = 4;
 
   InputArgs const &command_args = HighLevelRuntime::get_input_args();
   char **argv = command_args.argv;
@@ -303,7 +310,8 @@ void FlexFlow::top_level_task(Task const *task,
                    max_requests_per_batch,
                    max_tokens_per_batch,
                    max_sequence_length,
-                   expansion_degree);
+                   expansion_degree,
+                   max_inflight_batches);
 
   get_model_meta(file_paths, model_metadata, use_full_precision);
 
@@ -319,6 +327,7 @@ void FlexFlow::top_level_task(Task const *task,
   rm->set_max_tokens_per_batch(max_tokens_per_batch);
   rm->set_max_spec_tree_token_num(max_spec_tree_token_num);
   rm->set_max_sequence_length(max_sequence_length);
+  rm->set_max_inflight_batches(max_inflight_batches);
   rm->register_tokenizer(model_metadata.llm_model_type,
                          model_metadata.bos_token_id,
                          model_metadata.eos_token_ids,
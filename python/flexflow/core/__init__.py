@@ -92,6 +92,7 @@ ff_arg_to_sysarg = {
     "use_8bit_quantization": "--8bit-quantization",
     "enable_peft": "-enable-peft",
     "peft_activation_reserve_space_size": "-peft-activation-reserve-space-size",
+    "weight_cache_folder": "-weight-cache-folder",
 }
 
 
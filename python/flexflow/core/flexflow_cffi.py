@@ -1633,6 +1633,111 @@ class RequestManager(object):
 
     def get_max_sequence_length(self):
         return ffc().flexflow_request_manager_get_max_sequence_length(self.handle)
+
+    def set_kv_cache_block_size(self, block_size):
+        return ffc().flexflow_request_manager_set_kv_cache_block_size(
+            self.handle, block_size
+        )
+
+    def set_num_kv_cache_blocks(self, num_blocks):
+        return ffc().flexflow_request_manager_set_num_kv_cache_blocks(
+            self.handle, num_blocks
+        )
+
+    def set_enable_prefix_caching(self, enable_prefix_caching):
+        return ffc().flexflow_request_manager_set_enable_prefix_caching(
+            self.handle, enable_prefix_caching
+        )
+
+    def set_scheduling_policy(self, policy_name):
+        c_policy_name = get_c_name(policy_name)
+        return ffc().flexflow_request_manager_set_scheduling_policy(
+            self.handle, c_policy_name
+        )
+
+    def set_max_prefill_tokens_per_batch(self, max_tokens):
+        return ffc().flexflow_request_manager_set_max_prefill_tokens_per_batch(
+            self.handle, max_tokens
+        )
+
+    def set_enable_preemption(self, enable_preemption):
+        return ffc().flexflow_request_manager_set_enable_preemption(
+            self.handle, enable_preemption
+        )
+
+    def set_max_inflight_batches(self, max_inflight_batches):
+        return ffc().flexflow_request_manager_set_max_inflight_batches(
+            self.handle, max_inflight_batches
+        )
+
+    def set_request_metrics_filepath(self, filepath):
+        c_filepath = get_c_name(filepath)
+        return ffc().flexflow_request_manager_set_request_metrics_filepath(
+            self.handle, c_filepath
+        )
+
+    def dump_request_metrics(self, filepath):
+        c_filepath = get_c_name(filepath)
+        return ffc().flexflow_request_manager_dump_request_metrics(
+            self.handle, c_filepath
+        )
+
+    def get_request_metrics_summary(self, metric_name):
+        """Aggregates of a latency metric ("queue_time", "ttft", "tpot" or
+        "e2e_latency") over the finished requests, in milliseconds."""
+        c_metric_name = get_c_name(metric_name)
+        c_summary = ffi.new("double[]", 8)
+        if not ffc().flexflow_request_manager_get_request_metrics_summary(
+            self.handle, c_metric_name, c_summary
+        ):
+            raise ValueError(f"Unknown request metric: {metric_name}")
+        keys = ["count", "mean", "min", "max", "p50", "p90", "p95", "p99"]
+        summary = dict(zip(keys, list(c_summary)))
+        summary["count"] = int(summary["count"])
+        return summary
+
+    def get_request_metrics_histogram(self, metric_name, bounds):
+        """Number of requests whose metric falls below bounds[0], in each
+        [bounds[i - 1], bounds[i]) and from bounds[-1] up."""
+        c_metric_name = get_c_name(metric_name)
+        c_bounds = ffi.new("double[]", bounds)
+        c_counts = ffi.new("size_t[]", len(bounds) + 1)
+        if not ffc().flexflow_request_manager_get_request_metrics_histogram(
+            self.handle, c_metric_name, len(bounds), c_bounds, c_counts
+        ):
+            raise ValueError(f"Unknown request metric: {metric_name}")
+        return list(c_counts)
+
+    def clear_request_metrics(self):
+        return ffc().flexflow_request_manager_clear_request_metrics(self.handle)
+
+    def get_batch_step_stats(self, max_steps=4096):
+        """Batch composition and timing (in microseconds) of the most recent
+        serving steps, oldest first."""
+        c_stats = ffi.new("flexflow_batch_step_stats_t[]", max_steps)
+        num_steps = ffc().flexflow_request_manager_get_batch_step_stats(
+            self.handle, max_steps, c_stats
+        )
+        fields = [
+            "step",
+            "timestamp",
+            "num_active_requests",
+            "num_prefill_tokens",
+            "num_decode_tokens",
+            "num_peft_tokens",
+            "num_padding_tokens",
+            "scheduling_time",
+            "wait_time",
+            "num_kv_tokens_in_use",
+            "kv_token_capacity",
+        ]
+        return [
+            {field: getattr(c_stats[i], field) for field in fields}
+            for i in range(num_steps)
+        ]
+
+    def clear_batch_step_stats(self):
+        return ffc().flexflow_request_manager_clear_batch_step_stats(self.handle)
     
     def set_max_concurrent_adapters(self, max_adapters):
         return ffc().flexflow_request_manager_set_max_concurrent_adapters(
@@ -1731,7 +1836,9 @@ class GenerationConfig(object):
         do_sample: bool = False,
         temperature: float = 0.9,
         topp: float = 0.8,
-        topk: int = 1,
+        topk: int = 0,
+        repetition_penalty: float = 1.0,
+        seed: int = -1,
     ):
         """Initialize the sampling configs
 
@@ -1741,13 +1848,19 @@ class GenerationConfig(object):
         :type temperature: float, optional
         :param topp: The top probabilities (top-p) setting, defaults to 0.8
         :type topp: float, optional
-        :param topk: The top-k setting, defaults to 1
+        :param topk: The top-k setting, 0 disables top-k filtering, defaults to 0
         :type topk: int, optional
+        :param repetition_penalty: Penalty (> 1) for the request's recent tokens, defaults to 1.0 (no penalty)
+        :type repetition_penalty: float, optional
+        :param seed: Seed of the request's random number generator, -1 picks one at random, defaults to -1
+        :type seed: int, optional
         """
         self.do_sample = do_sample
         self.temperature = temperature
         self.topp = topp
         self.topk = topk
+        self.repetition_penalty = repetition_penalty
+        self.seed = seed
 
 
 # -----------------------------------------------------------------------
@@ -2081,6 +2194,7 @@ class Request:
     peft_model_id: Optional[PEFTModelID] = None
     dataset_filepath: Optional[str] = None
     max_training_steps: int = 1
+    generation_config: Optional[GenerationConfig] = None
 
 
 # -----------------------------------------------------------------------
@@ -4255,24 +4369,20 @@ class FFModel(object):
         self.add_layer(OpType.BEAM_TOPK, name)
         return Tensor(handle, owner_op_type=OpType.BEAM_TOPK)
 
-    def sampling(self, input, top_p, name=None):
-        """Defines the Sampling layer.
+    def sampling(self, input, name=None):
+        """Defines the Sampling layer. The sampling parameters are taken from
+        the generation config of each request.
 
         :param input: the input Tensor.
         :type input: Tensor
 
-        :param top_p: The top_p parameter of the sampling
-        :type top_p: float
-
         :param name: the name of the layer. Default is None.
         :type name: string
 
         :returns:  Tensor -- the output tensor.
         """
         c_name = get_c_name(name)
-        handle = ffc().flexflow_model_add_sampling(
-            self.handle, input.handle, top_p, c_name
-        )
+        handle = ffc().flexflow_model_add_sampling(self.handle, input.handle, c_name)
         self.add_layer(OpType.SAMPLING, name)
         return Tensor(handle, owner_op_type=OpType.SAMPLING)
 
@@ -4714,6 +4824,22 @@ class FFModel(object):
         max_lengths = [request.max_length for request in requests_list]
         max_new_tokens_ = [request.max_new_tokens for request in requests_list]
         add_special_tokens_ = [request.add_special_tokens for request in requests_list]
+        generation_configs = [
+            (
+                request.generation_config
+                if request.generation_config is not None
+                else GenerationConfig()
+            )
+            for request in requests_list
+        ]
+        do_samples = [config.do_sample for config in generation_configs]
+        temperatures = [config.temperature for config in generation_configs]
+        topps = [config.topp for config in generation_configs]
+        topks = [config.topk for config in generation_configs]
+        repetition_penalties = [
+            config.repetition_penalty for config in generation_configs
+        ]
+        seeds = [config.seed for config in generation_configs]
 
         peft_model_ids = [
             (
@@ -4741,6 +4867,12 @@ class FFModel(object):
             max_lengths,
             max_new_tokens_,
             add_special_tokens_,
+            do_samples,
+            temperatures,
+            topps,
+            topks,
+            repetition_penalties,
+            seeds,
             peft_model_ids,
             dataset_filepaths,
             training_steps,
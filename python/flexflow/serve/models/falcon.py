@@ -246,17 +246,13 @@ class FlexFlowFalcon(FlexFlowModel):
             softmax = ffmodel.softmax(lm_head, -1)
             # output = ffmodel.beam_top_k(softmax, self.falcon_config.max_beam_width, False)
             output = ffmodel.argmax(softmax, True)
+        elif self.mode == InferenceMode.INC_DECODING_MODE:
+            # the sampling parameters of each request are set in the BatchConfig
+            softmax = ffmodel.softmax(lm_head, -1)
+            output = ffmodel.sampling(softmax)
         else:
-            if self.generation_config.do_sample:
-                dense = ffmodel.scalar_true_divide(
-                    lm_head, self.generation_config.temperature, False
-                )
-                softmax = ffmodel.softmax(dense, -1)
-                output = ffmodel.sampling(softmax, self.generation_config.topp)
-            else:
-                # output = ffmodel.arg_top_k(lm_head, 1, False)
-                softmax = ffmodel.softmax(lm_head, -1)
-                output = ffmodel.argmax(softmax, False)
+            softmax = ffmodel.softmax(lm_head, -1)
+            output = ffmodel.argmax(softmax, False)
         
         if self.ffconfig.enable_peft:
             # TODO: add attention projections
@@ -248,12 +248,10 @@ class FlexFlowMPT(FlexFlowModel):
             name="lm_head",
         )
 
-        if self.generation_config.do_sample:
-            dense = ffmodel.scalar_true_divide(
-                lm_head, self.generation_config.temperature, False
-            )
-            softmax = ffmodel.softmax(dense, -1)
-            output = ffmodel.sampling(softmax, self.generation_config.topp)
+        if self.mode == InferenceMode.INC_DECODING_MODE:
+            # the sampling parameters of each request are set in the BatchConfig
+            softmax = ffmodel.softmax(lm_head, -1)
+            output = ffmodel.sampling(softmax)
         else:
             softmax = ffmodel.softmax(lm_head, -1)
             output = ffmodel.argmax(softmax, False)
@@ -449,7 +449,8 @@ class LLM:
         :type ssms: list, optional
         """
         self.ssms = ssms
-        self.generation_config = GenerationConfig()
+        # default sampling parameters of requests without a generation config
+        self.generation_config = generation_config
         self.ffconfig = FFConfig()
         if len(ssms) > 0:
             assert type(self) == LLM
@@ -568,6 +569,8 @@ class LLM:
                     raise ValueError(
                         f"max_length ({req.max_length}) or max_new_tokens ({req.max_new_tokens}) exceeds the maximum sequence length ({self.max_seq_length})"
                     )
+                if req.generation_config is None:
+                    req.generation_config = self.generation_config
             else:
                 if req.max_new_tokens != -1:
                     raise ValueError(
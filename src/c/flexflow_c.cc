@@ -1594,11 +1594,10 @@ flexflow_tensor_t flexflow_model_add_beam_top_k(flexflow_model_t handle_,
 
 flexflow_tensor_t flexflow_model_add_sampling(flexflow_model_t handle_,
                                               const flexflow_tensor_t input_,
-                                              float top_p,
                                               char const *name) {
   FFModel *handle = FFCObjectWrapper::unwrap(handle_);
   Tensor input = FFCObjectWrapper::unwrap(input_);
-  Tensor tensor = handle->sampling(input, top_p, name);
+  Tensor tensor = handle->sampling(input, name);
   return FFCObjectWrapper::wrap(tensor);
 }
 
@@ -1706,6 +1705,12 @@ void flexflow_model_generate(flexflow_model_t handle_,
                              int *max_lengths,
                              int *max_new_tokens_,
                              bool *add_special_tokens_,
+                             bool *do_samples,
+                             float *temperatures,
+                             float *topps,
+                             int *topks,
+                             float *repetition_penalties,
+                             long long *seeds,
                              flexflow_peft_model_id_t *peft_model_ids,
                              char const **dataset_filepaths,
                              int *training_steps,
@@ -1723,6 +1728,14 @@ void flexflow_model_generate(flexflow_model_t handle_,
       inference_req.max_length = max_lengths[i];
       inference_req.max_new_tokens = max_new_tokens_[i];
       inference_req.add_special_tokens = add_special_tokens_[i];
+      GenerationConfig generation_config;
+      generation_config.do_sample = do_samples[i];
+      generation_config.temperature = temperatures[i];
+      generation_config.topp = topps[i];
+      generation_config.topk = topks[i];
+      generation_config.repetition_penalty = repetition_penalties[i];
+      generation_config.seed = seeds[i];
+      inference_req.generation_config = generation_config;
       PEFTModelID *peft_model_id = FFCObjectWrapper::unwrap(peft_model_ids[i]);
       if (peft_model_id != nullptr) {
         inference_req.peft_model_id = *peft_model_id;
@@ -2785,6 +2798,154 @@ int flexflow_request_manager_get_max_sequence_length(
   return handle->get_max_sequence_length();
 }
 
+void flexflow_request_manager_set_kv_cache_block_size(
+    flexflow_request_manager_t handle_, int block_size) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  handle->set_kv_cache_block_size(block_size);
+  DEBUG_PRINT("[RequestManager] set kv_cache_block_size %d", block_size);
+}
+
+void flexflow_request_manager_set_num_kv_cache_blocks(
+    flexflow_request_manager_t handle_, int num_blocks) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  handle->set_num_kv_cache_blocks(num_blocks);
+  DEBUG_PRINT("[RequestManager] set num_kv_cache_blocks %d", num_blocks);
+}
+
+void flexflow_request_manager_set_enable_prefix_caching(
+    flexflow_request_manager_t handle_, bool enable_prefix_caching_) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  handle->set_enable_prefix_caching(enable_prefix_caching_);
+  DEBUG_PRINT("[RequestManager] set_enable_prefix_caching %d",
+              enable_prefix_caching_);
+}
+
+void flexflow_request_manager_set_scheduling_policy(
+    flexflow_request_manager_t handle_, char const *policy_name) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  std::string const policy_name_str(policy_name);
+  handle->set_scheduling_policy(
+      scheduling_policy_type_from_string(policy_name_str));
+  DEBUG_PRINT("[RequestManager] set scheduling_policy %s",
+              policy_name_str.c_str());
+}
+
+void flexflow_request_manager_set_max_prefill_tokens_per_batch(
+    flexflow_request_manager_t handle_, int max_num_tokens) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  handle->set_max_prefill_tokens_per_batch(max_num_tokens);
+  DEBUG_PRINT("[RequestManager] set max_prefill_tokens_per_batch %d",
+              max_num_tokens);
+}
+
+void flexflow_request_manager_set_enable_preemption(
+    flexflow_request_manager_t handle_, bool enable_preemption_) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  handle->set_enable_preemption(enable_preemption_);
+  DEBUG_PRINT("[RequestManager] set_enable_preemption %d", enable_preemption_);
+}
+
+void flexflow_request_manager_set_max_inflight_batches(
+    flexflow_request_manager_t handle_, int max_inflight_batches) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  handle->set_max_inflight_batches(max_inflight_batches);
+  DEBUG_PRINT("[RequestManager] set max_inflight_batches %d",
+              max_inflight_batches);
+}
+
+void flexflow_request_manager_set_request_metrics_filepath(
+    flexflow_request_manager_t handle_, char const *filepath) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  assert(filepath != nullptr && "Cannot convert nullptr char * to std::string");
+  handle->get_request_metrics().set_output_filepath(std::string(filepath));
+  DEBUG_PRINT("[RequestManager] set request_metrics_filepath %s", filepath);
+}
+
+bool flexflow_request_manager_dump_request_metrics(
+    flexflow_request_manager_t handle_, char const *filepath) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  assert(filepath != nullptr && "Cannot convert nullptr char * to std::string");
+  return handle->get_request_metrics().dump(std::string(filepath));
+}
+
+bool flexflow_request_manager_get_request_metrics_summary(
+    flexflow_request_manager_t handle_,
+    char const *metric_name,
+    double *summary) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  assert(metric_name != nullptr &&
+         "Cannot convert nullptr char * to std::string");
+  RequestMetricType type;
+  if (!request_metric_type_from_string(std::string(metric_name), type)) {
+    return false;
+  }
+  RequestMetricsSummary result =
+      handle->get_request_metrics().summarize(type);
+  summary[0] = result.count;
+  summary[1] = result.mean;
+  summary[2] = result.min;
+  summary[3] = result.max;
+  summary[4] = result.p50;
+  summary[5] = result.p90;
+  summary[6] = result.p95;
+  summary[7] = result.p99;
+  return true;
+}
+
+bool flexflow_request_manager_get_request_metrics_histogram(
+    flexflow_request_manager_t handle_,
+    char const *metric_name,
+    int num_bounds,
+    double const *bounds,
+    size_t *counts) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  assert(metric_name != nullptr &&
+         "Cannot convert nullptr char * to std::string");
+  RequestMetricType type;
+  if (!request_metric_type_from_string(std::string(metric_name), type)) {
+    return false;
+  }
+  std::vector<size_t> result = handle->get_request_metrics().histogram(
+      type, std::vector<double>(bounds, bounds + num_bounds));
+  std::copy(result.begin(), result.end(), counts);
+  return true;
+}
+
+void flexflow_request_manager_clear_request_metrics(
+    flexflow_request_manager_t handle_) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  handle->get_request_metrics().clear();
+}
+
+int flexflow_request_manager_get_batch_step_stats(
+    flexflow_request_manager_t handle_,
+    int max_steps,
+    flexflow_batch_step_stats_t *stats) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  std::vector<BatchStepStats> steps =
+      handle->get_batch_step_stats().get_recent(max_steps);
+  for (size_t i = 0; i < steps.size(); i++) {
+    stats[i].step = steps[i].step;
+    stats[i].timestamp = steps[i].timestamp;
+    stats[i].num_active_requests = steps[i].num_active_requests;
+    stats[i].num_prefill_tokens = steps[i].num_prefill_tokens;
+    stats[i].num_decode_tokens = steps[i].num_decode_tokens;
+    stats[i].num_peft_tokens = steps[i].num_peft_tokens;
+    stats[i].num_padding_tokens = steps[i].num_padding_tokens;
+    stats[i].scheduling_time = steps[i].scheduling_time;
+    stats[i].wait_time = steps[i].wait_time;
+    stats[i].num_kv_tokens_in_use = steps[i].num_kv_tokens_in_use;
+    stats[i].kv_token_capacity = steps[i].kv_token_capacity;
+  }
+  return (int)steps.size();
+}
+
+void flexflow_request_manager_clear_batch_step_stats(
+    flexflow_request_manager_t handle_) {
+  RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
+  handle->get_batch_step_stats().clear();
+}
+
 void flexflow_request_manager_set_max_concurrent_adapters(
     flexflow_request_manager_t handle_, int max_concurrent_adapters) {
   RequestManager *handle = FFCObjectWrapper::unwrap(handle_);
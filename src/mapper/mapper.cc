@@ -292,6 +292,12 @@ void FFMapper::select_task_options(const MapperContext ctx,
     output.initial_proc = all_cpus[0];
     return;
   }
+  if ((task.task_id == MOCK_MODEL_INF_TASK_ID) ||
+      (task.task_id == MOCK_MODEL_BEAM_INF_TASK_ID)) {
+    // keep the simulated model off the processor of the serving loop
+    output.initial_proc = all_cpus.back();
+    return;
+  }
   if (task.task_id == TOP_LEVEL_TASK_ID) {
     output.initial_proc = all_cpus[0];
     // control replicate top level task
@@ -402,17 +402,9 @@ void ArgTopK::forward_kernel(ArgTopKMeta const *m,
   if (m->speculative_decoding) {
     assert(bc->num_active_requests() >= 0);
 
-    // check
-    int beam_size = -1;
-    for (int i = 1; i < bc->max_requests_per_batch(); i++) {
-      if (bc->request_completed[i]) {
-        continue;
-      } else if (beam_size == -1) {
-        beam_size = bc->beamRequestsInfo[i].beam_size;
-      } else {
-        assert(beam_size == bc->beamRequestsInfo[i].beam_size);
-      }
-    }
+    // requests may use different tree widths, the request manager reads the
+    // first beam_size candidates of each token
+    int beam_size = bc->max_beam_size_all_requests();
 
     assert(num_shards >= (size_t)beam_size);
     num_shards = k;
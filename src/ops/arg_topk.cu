@@ -403,23 +403,9 @@ void ArgTopK::forward_kernel(ArgTopKMeta const *m,
   if (m->speculative_decoding) {
     assert(bc->num_active_requests() >= 0);
 
-    // check
-    // allow last request different with others
-    int beam_size = -1;
-    int num_activate_requests = bc->num_active_requests();
-    int last_request_idx =
-        bc->requestsInfo[num_activate_requests - 1].batch_config_request_id;
-    for (int i = 0; i < bc->max_requests_per_batch(); i++) {
-      if (bc->request_completed[i]) {
-        continue;
-      } else if (beam_size == -1) {
-        beam_size = bc->beamRequestsInfo[i].beam_size;
-
-      } else if (i != last_request_idx) {
-        assert(beam_size == bc->beamRequestsInfo[i].beam_size);
-      } else if (i == last_request_idx) {
-      }
-    }
+    // requests may use different tree widths, the request manager reads the
+    // first beam_size candidates of each token
+    int beam_size = bc->max_beam_size_all_requests();
     assert(num_shards >= (size_t)beam_size);
     num_shards = k;
     arg_topk_forward_kernel<<<num_blocks, num_shards, 0, stream>>>(
@@ -88,6 +88,23 @@ Tensor FFModel::inc_multihead_self_attention(
                                        name);
 }
 
+int FFModel::get_num_stored_kv_heads(int num_q_heads,
+                                     int num_kv_heads) const {
+  assert(num_q_heads % num_kv_heads == 0);
+#ifdef FF_USE_HIP_ROCM
+  // the HIP attention kernels expect one K/V head per query head
+  return num_q_heads;
+#else
+  // each shard must own whole K/V heads, and the PEFT backward kernels
+  // expect one K/V head per query head
+  if (num_kv_heads % config.tensor_parallelism_degree != 0 ||
+      config.enable_peft) {
+    return num_q_heads;
+  }
+  return num_kv_heads;
+#endif
+}
+
 Tensor FFModel::inc_multiquery_self_attention(
     const Tensor input,
     int embed_dim,
@@ -509,9 +526,11 @@ OpMeta *IncMultiHeadSelfAttention::init_task(
   assert(attn->qoSeqLength == input.domain.hi()[1] - input.domain.lo()[1] + 1);
   assert(attn->kvSeqLength == input.domain.hi()[1] - input.domain.lo()[1] + 1);
   int num_q_heads = attn->num_q_heads / attn->tensor_parallelism_degree;
-  int num_kv_heads =
-      attn->num_kv_heads / attn->tensor_parallelism_degree +
-      (attn->num_kv_heads % attn->tensor_parallelism_degree != 0);
+  // the input holds the K/V heads chosen by FFModel::get_num_stored_kv_heads
+  int num_stored_kv_heads =
+      (attn->qSize / attn->qProjSize - attn->num_q_heads) / 2;
+  assert(num_stored_kv_heads % attn->tensor_parallelism_degree == 0);
+  int num_kv_heads = num_stored_kv_heads / attn->tensor_parallelism_degree;
 
   Memory gpu_mem = get_proc_mem(Machine::get_machine(), task->target_proc);
   MemoryAllocator gpu_mem_allocator(gpu_mem);
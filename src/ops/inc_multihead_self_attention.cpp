@@ -58,6 +58,9 @@ __global__ void store_kv_cache(DT const *devQKVProjArray,
                                DT *kCache_ptr,
                                DT *vCache_ptr,
                                BatchConfig::PerTokenInfo const *tokenInfos,
+                               BatchConfig::PerRequestInfo const *requestInfos,
+                               int const *kv_block_table,
+                               int kv_block_size,
                                int num_tokens,
                                int max_seq_len,
                                int hidden_size) {
@@ -73,11 +76,37 @@ __global__ void store_kv_cache(DT const *devQKVProjArray,
     int const req_id = tokenInfos[token_idx].request_index;
     int const tok_id = tokenInfos[token_idx].abs_depth_in_request;
 
+    size_t slot;
+    if (kv_block_size > 0) {
+      // paged KV cache: look up the physical block in the request's table
+      slot = paged_kv_cache_slot(kv_block_table +
+                                     requestInfos[req_id].kv_block_table_offset,
+                                 kv_block_size,
+                                 tok_id);
+    } else {
+      slot = (size_t)req_id * max_seq_len + tok_id;
+    }
+
     // key cache
-    kCache_ptr[req_id * (hidden_size * max_seq_len) + tok_id * hidden_size +
-               offset] = kVal;
-    vCache_ptr[req_id * (hidden_size * max_seq_len) + tok_id * hidden_size +
-               offset] = vVal;
+    kCache_ptr[slot * hidden_size + offset] = kVal;
+    vCache_ptr[slot * hidden_size + offset] = vVal;
+  }
+}
+
+template <typename DT>
+__global__ void gather_paged_kv_cache(DT const *kCache_ptr,
+                                      DT const *vCache_ptr,
+                                      DT *kGather_ptr,
+                                      DT *vGather_ptr,
+                                      int const *block_table,
+                                      int kv_block_size,
+                                      int num_tokens,
+                                      int hidden_size) {
+  CUDA_KERNEL_LOOP(i, num_tokens * hidden_size) {
+    size_t idx = paged_kv_cache_gather_index(
+        block_table, kv_block_size, hidden_size, i);
+    kGather_ptr[i] = kCache_ptr[idx];
+    vGather_ptr[i] = vCache_ptr[idx];
   }
 }
 
@@ -170,6 +199,29 @@ void compute_attention_kernel_prompt(IncMultiHeadSelfAttentionMeta *m,
                          num_tokens,
                          m->hidden_size);
     }
+    // Keys and values of this request: with a paged KV cache, gather them into
+    // contiguous buffers first so the batched GEMMs below can use fixed strides
+    DT *k_cache_req = static_cast<DT *>(m->keyCache) + i * kt_req_block_size;
+    DT *v_cache_req = static_cast<DT *>(m->valueCache) + i * vt_req_block_size;
+    if (m->kv_block_size > 0) {
+      k_cache_req = static_cast<DT *>(m->kv_gather_buffer);
+      v_cache_req = k_cache_req + kt_req_block_size;
+      int parallelism = m->hidden_size * total_tokens;
+      hipLaunchKernelGGL(
+          HIP_KERNEL_NAME(gather_paged_kv_cache),
+          GET_BLOCKS(parallelism),
+          min(CUDA_NUM_THREADS, parallelism),
+          0,
+          stream,
+          static_cast<DT *>(m->keyCache),
+          static_cast<DT *>(m->valueCache),
+          k_cache_req,
+          v_cache_req,
+          m->kv_block_table + bc->requestsInfo[i].kv_block_table_offset,
+          m->kv_block_size,
+          total_tokens,
+          m->hidden_size);
+    }
     // Step 1: compute query-key product QK.T/sqrt(d_k)
     {
       // Scale by sqrt(d_k) as per the original attention paper
@@ -199,7 +251,7 @@ void compute_attention_kernel_prompt(IncMultiHeadSelfAttentionMeta *m,
       // matrix B's layout: [kProjSize * num_heads, total_tokens]
       // To get B, skip over K entries from previous requests (all heads +
       // padding)
-      DT const *B = static_cast<DT *>(m->keyCache) + i * kt_req_block_size;
+      DT const *B = k_cache_req;
       // matrix C: qk_prods
       // matrix C's layout: [num_new_tokens, total_tokens, num_heads]
       // To get C, skip over QK.T products from previous requests
@@ -337,7 +389,7 @@ void compute_attention_kernel_prompt(IncMultiHeadSelfAttentionMeta *m,
       // matrix A's layout: [vProjSize, num_heads, total_tokens]
       // To get A, skip over V.T entries from previous requests (all heads +
       // padding)
-      DT *A = static_cast<DT *>(m->valueCache) + i * vt_req_block_size;
+      DT *A = v_cache_req;
       // matrix B: qk_prods_softmax
       // matrix B's layout: [num_new_tokens, total_tokens, num_heads]
       // To get B, skip over softmax(QK.T/sqrt(d_k)) entries from previous
@@ -405,7 +457,9 @@ __global__ void compute_attention_kernel_generation_kernel(
     int max_seq_length,
     int per_head_size,
     int hidden_size,
-    BatchConfig::PerRequestInfo *request_infos) {
+    BatchConfig::PerRequestInfo *request_infos,
+    int const *kv_block_table,
+    int kv_block_size) {
 
   // q, k
   using Q_vec = typename VEC_K<DT, THREADS_PER_KEY>::Type;
@@ -487,8 +541,15 @@ __global__ void compute_attention_kernel_generation_kernel(
   //   // The number of keys per warp.
   constexpr int K_PER_WARP = WARP_SIZE / THREADS_PER_KEY;
 
+  // with a paged KV cache, token slots are looked up in the block table
+  int const *block_table =
+      kv_block_table +
+      request_infos[batch_config_request_id].kv_block_table_offset;
   DT const *k_cache_batch =
-      key_cache + batch_config_request_id * max_seq_length * hidden_size + ki;
+      kv_block_size > 0
+          ? key_cache + ki
+          : key_cache + batch_config_request_id * max_seq_length * hidden_size +
+                ki;
 
   int ti_end =
       div_up(tlength - first_step, K_PER_WARP) * K_PER_WARP + first_step;
@@ -501,9 +562,12 @@ __global__ void compute_attention_kernel_generation_kernel(
     for (int ii = 0; ii < K_VECS_PER_THREAD; ++ii) {
       int jj = ii * THREADS_PER_KEY * K_VEC_SIZE;
       if (ti < tlength) {
-        k[ii] = *reinterpret_cast<K_vec const *>(k_cache_batch +
-                                                 ti_circ * hidden_size +
-                                                 head_idx * per_head_size + jj);
+        size_t const slot =
+            kv_block_size > 0
+                ? paged_kv_cache_slot(block_table, kv_block_size, ti_circ)
+                : ti_circ;
+        k[ii] = *reinterpret_cast<K_vec const *>(
+            k_cache_batch + slot * hidden_size + head_idx * per_head_size + jj);
       }
       // Compute dot product.
       // This includes a reduction across the threads in the same thread group.
@@ -591,15 +655,22 @@ __global__ void compute_attention_kernel_generation_kernel(
 
   // The base pointer for the value in the cache buffer.
   DT const *v_cache_batch =
-      value_cache + batch_config_request_id * max_seq_length * hidden_size + vi;
+      kv_block_size > 0
+          ? value_cache + vi
+          : value_cache +
+                batch_config_request_id * max_seq_length * hidden_size + vi;
 
   if (Dh == Dh_MAX || vi < Dh) {
     for (int ti = first_step + vo; ti < tlength; ti += V_PER_ITER) {
       // Load the values from the cache.
       int const ti_circ = ti % max_seq_length;
+      size_t const slot =
+          kv_block_size > 0
+              ? paged_kv_cache_slot(block_table, kv_block_size, ti_circ)
+              : ti_circ;
 
       V_vec v = *reinterpret_cast<V_vec const *>(
-          v_cache_batch + ti_circ * hidden_size + head_idx * per_head_size);
+          v_cache_batch + slot * hidden_size + head_idx * per_head_size);
       float logit = qk_smem[ti - first_step];
       out = FlexFlow::fma(logit, cast_to_float(v), out);
     }
@@ -897,6 +968,9 @@ void update_kv_cache_kernel(IncMultiHeadSelfAttentionMeta const *m,
                        static_cast<DT *>(m->keyCache),
                        static_cast<DT *>(m->valueCache),
                        m->token_infos,
+                       m->request_infos,
+                       m->kv_block_table,
+                       m->kv_block_size,
                        num_tokens,
                        BatchConfig::max_sequence_length(),
                        m->hidden_size);
@@ -924,7 +998,9 @@ void update_kv_cache_kernel(IncMultiHeadSelfAttentionMeta const *m,
           BatchConfig::max_sequence_length(),                                  \
           m->qProjSize,                                                        \
           m->hidden_size,                                                      \
-          m->request_infos)
+          m->request_infos,                                                    \
+          m->kv_block_table,                                                   \
+          m->kv_block_size)
 
 template <typename DT>
 void compute_attention_kernel_generation(IncMultiHeadSelfAttentionMeta const *m,
@@ -1093,6 +1169,8 @@ void peft_bwd_kernel(IncMultiHeadSelfAttentionMeta const *m,
                      DT const *output_grad_ptr,
                      hipStream_t stream) {
   assert(!m->offload);
+  assert(m->kv_block_size == 0 &&
+         "PEFT backward does not support a paged KV cache");
   checkCUDA(hipblasSetStream(m->handle.blas, stream));
   checkCUDNN(miopenSetStream(m->handle.dnn, stream));
   hipblasDatatype_t cublas_data_type = ff_to_cuda_datatype(m->output_type[0]);
@@ -1686,7 +1764,10 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
   global_num_kv_heads = _global_num_kv_heads;
   num_q_heads = _num_q_heads;
   num_kv_heads = _num_kv_heads;
+  // the HIP kernels only support K/V replicated to one head per query head
+  assert(num_kv_heads == num_q_heads);
   hidden_size = num_q_heads * qProjSize;
+  kv_hidden_size = num_kv_heads * kProjSize;
 
   rotary_embedding_meta =
       (RotaryEmbeddingMeta *)calloc(1, sizeof(RotaryEmbeddingMeta));
@@ -1707,9 +1788,22 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
     size_t qkv_max_proj_size = max_tokens_per_batch * (qProjSize * num_q_heads +
                                                        kProjSize * num_q_heads +
                                                        vProjSize * num_q_heads);
-    size_t key_cache_size = 0, value_cache_size = 0;
+    size_t key_cache_size = 0, value_cache_size = 0, kv_gather_size = 0;
+    kv_block_size = 0;
     switch (infer_mode) {
       case INC_DECODING_MODE: {
+        kv_block_size = BatchConfig::kv_cache_block_size();
+        if (kv_block_size > 0) {
+          // paged KV cache: a pool of blocks shared by all requests, plus a
+          // buffer to gather the keys/values of one request for prefilling
+          size_t num_cache_tokens =
+              (size_t)BatchConfig::num_kv_cache_blocks() * kv_block_size;
+          key_cache_size = num_q_heads * kProjSize * num_cache_tokens;
+          value_cache_size = num_q_heads * vProjSize * num_cache_tokens;
+          kv_gather_size = (num_q_heads * kProjSize + num_q_heads * vProjSize) *
+                           BatchConfig::max_sequence_length();
+          break;
+        }
         key_cache_size = num_q_heads * kProjSize *
                          BatchConfig::max_requests_per_batch() *
                          BatchConfig::max_sequence_length();
@@ -1744,7 +1838,7 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
                           2;
     size_t totalSize =
         (qkv_max_proj_size + key_cache_size + value_cache_size +
-         2 * qk_prod_size + attn_heads_size) *
+         kv_gather_size + 2 * qk_prod_size + attn_heads_size) *
             size_of_dt +
         complex_size * sizeof(hipFloatComplex); // more components will
                                                 // be added here later
@@ -1755,13 +1849,15 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
               ? totalSize -
                     (key_cache_size + value_cache_size + qkv_max_proj_size) *
                         size_of_dt
-              : totalSize - (key_cache_size + value_cache_size) * size_of_dt;
+              : totalSize -
+                    (key_cache_size + value_cache_size + kv_gather_size) *
+                        size_of_dt;
 
       size_t instance_size =
           size_of_dt *
           (infer_mode == TREE_VERIFY_MODE
                ? key_cache_size + value_cache_size + qkv_max_proj_size
-               : key_cache_size + value_cache_size);
+               : key_cache_size + value_cache_size + kv_gather_size);
 
       assert(gpu_mem_allocator.reserved_total_size -
                  gpu_mem_allocator.reserved_allocated_size >=
@@ -1788,6 +1884,12 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
                                                            size_of_dt);
     valueCache = gpu_mem_allocator.allocate_instance_untyped(value_cache_size *
                                                              size_of_dt);
+    kv_gather_buffer = nullptr;
+    if (kv_block_size > 0) {
+      kv_gather_buffer = gpu_mem_allocator.allocate_instance_untyped(
+          kv_gather_size * size_of_dt);
+    }
+    kv_block_table = handler.batch_config_metadata->kv_block_table;
 
     token_infos = static_cast<BatchConfig::PerTokenInfo *>(
         handler.batch_config_metadata->tokens_info);
@@ -37,26 +37,56 @@ __global__ void store_kv_cache(DT const *devQKVProjArray,
                                DT *kCache_ptr,
                                DT *vCache_ptr,
                                BatchConfig::PerTokenInfo const *tokenInfos,
+                               BatchConfig::PerRequestInfo const *requestInfos,
+                               int const *kv_block_table,
+                               int kv_block_size,
                                int num_tokens,
                                int max_seq_len,
-                               int hidden_size) {
-  CUDA_KERNEL_LOOP(i, num_tokens * hidden_size) {
-    int token_idx = i / hidden_size;
-    int offset = i % hidden_size;
+                               int hidden_size,
+                               int kv_hidden_size) {
+  CUDA_KERNEL_LOOP(i, num_tokens * kv_hidden_size) {
+    int token_idx = i / kv_hidden_size;
+    int offset = i % kv_hidden_size;
 
-    size_t val_idx =
-        token_idx * QKV_WEIGHT_NUM * hidden_size + hidden_size + offset;
+    size_t val_idx = token_idx * (hidden_size + 2 * kv_hidden_size) +
+                     hidden_size + offset;
 
     DT kVal = devQKVProjArray[val_idx];
-    DT vVal = devQKVProjArray[val_idx + hidden_size];
+    DT vVal = devQKVProjArray[val_idx + kv_hidden_size];
     int const req_id = tokenInfos[token_idx].request_index;
     int const tok_id = tokenInfos[token_idx].abs_depth_in_request;
 
+    size_t slot;
+    if (kv_block_size > 0) {
+      // paged KV cache: look up the physical block in the request's table
+      slot = paged_kv_cache_slot(kv_block_table +
+                                     requestInfos[req_id].kv_block_table_offset,
+                                 kv_block_size,
+                                 tok_id);
+    } else {
+      slot = (size_t)req_id * max_seq_len + tok_id;
+    }
+
     // key cache
-    kCache_ptr[req_id * (hidden_size * max_seq_len) + tok_id * hidden_size +
-               offset] = kVal;
-    vCache_ptr[req_id * (hidden_size * max_seq_len) + tok_id * hidden_size +
-               offset] = vVal;
+    kCache_ptr[slot * kv_hidden_size + offset] = kVal;
+    vCache_ptr[slot * kv_hidden_size + offset] = vVal;
+  }
+}
+
+template <typename DT>
+__global__ void gather_paged_kv_cache(DT const *kCache_ptr,
+                                      DT const *vCache_ptr,
+                                      DT *kGather_ptr,
+                                      DT *vGather_ptr,
+                                      int const *block_table,
+                                      int kv_block_size,
+                                      int num_tokens,
+                                      int kv_hidden_size) {
+  CUDA_KERNEL_LOOP(i, num_tokens * kv_hidden_size) {
+    size_t idx = paged_kv_cache_gather_index(
+        block_table, kv_block_size, kv_hidden_size, i);
+    kGather_ptr[i] = kCache_ptr[idx];
+    vGather_ptr[i] = vCache_ptr[idx];
   }
 }
 
@@ -64,12 +94,13 @@ template <typename DT>
 __global__ void store_query_cache(DT const *devQKVProjArray,
                                   DT *qCache_ptr,
                                   int num_tokens,
-                                  int hidden_size) {
+                                  int hidden_size,
+                                  int kv_hidden_size) {
   CUDA_KERNEL_LOOP(i, num_tokens * hidden_size) {
     int token_idx = i / hidden_size;
     int offset = i % hidden_size;
 
-    size_t val_idx = token_idx * QKV_WEIGHT_NUM * hidden_size + offset;
+    size_t val_idx = token_idx * (hidden_size + 2 * kv_hidden_size) + offset;
 
     DT qVal = devQKVProjArray[val_idx];
 
@@ -95,6 +126,66 @@ __global__ void fill_entries_above_diagonal(DT *matrix,
   }
 }
 
+template <typename DT>
+void gemm_per_query_head(IncMultiHeadSelfAttentionMeta const *m,
+                         cublasOperation_t transa,
+                         cublasOperation_t transb,
+                         int m_,
+                         int n,
+                         int k,
+                         DT const *alpha,
+                         DT const *A,
+                         int lda,
+                         long long strideA,
+                         DT const *B,
+                         int ldb,
+                         long long strideB,
+                         DT const *beta,
+                         DT *C,
+                         int ldc,
+                         long long strideC,
+                         bool kv_is_a) {
+  cudaDataType_t cublas_data_type = ff_to_cuda_datatype(m->output_type[0]);
+  cudaDataType_t compute_type = cublas_data_type;
+  assert(m->num_q_heads % m->num_kv_heads == 0);
+  int q_heads_per_kv = m->num_q_heads / m->num_kv_heads;
+  // without sharing, all heads are a single batch. Otherwise, the query
+  // heads of each K/V head are a batch that reuses it through a zero stride
+  int num_groups = q_heads_per_kv == 1 ? 1 : m->num_kv_heads;
+  int heads_per_group = m->num_q_heads / num_groups;
+  long long kv_stride = kv_is_a ? strideA : strideB;
+  long long q_stride = kv_is_a ? strideB : strideA;
+  for (int g = 0; g < num_groups; g++) {
+    DT const *kv = (kv_is_a ? A : B) + g * kv_stride;
+    DT const *q = (kv_is_a ? B : A) + g * heads_per_group * q_stride;
+    long long group_kv_stride = q_heads_per_kv == 1 ? kv_stride : 0;
+    checkCUDA(cublasGemmStridedBatchedEx(
+        m->handle.blas,
+        transa,
+        transb,
+        m_,
+        n,
+        k,
+        alpha,
+        kv_is_a ? kv : q,
+        cublas_data_type,
+        lda,
+        kv_is_a ? group_kv_stride : q_stride,
+        kv_is_a ? q : kv,
+        cublas_data_type,
+        ldb,
+        kv_is_a ? q_stride : group_kv_stride,
+        beta,
+        C + g * heads_per_group * strideC,
+        cublas_data_type,
+        ldc,
+        strideC,
+        heads_per_group,
+        compute_type,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  }
+}
+
 template <typename DT>
 void compute_attention_kernel_prompt(IncMultiHeadSelfAttentionMeta *m,
                                      BatchConfig const *bc,
@@ -102,20 +193,18 @@ void compute_attention_kernel_prompt(IncMultiHeadSelfAttentionMeta *m,
                                      cudaStream_t stream) {
   checkCUDA(cublasSetStream(m->handle.blas, stream));
   checkCUDNN(cudnnSetStream(m->handle.dnn, stream));
-  cudaDataType_t cublas_data_type = ff_to_cuda_datatype(m->output_type[0]);
   cudnnDataType_t cudnn_data_type = ff_to_cudnn_datatype(m->output_type[0]);
   assert(data_type_size(m->output_type[0]) == sizeof(DT));
-  cudaDataType_t compute_type = cublas_data_type;
 
   int num_tokens = bc->num_active_tokens();
   int tokens_previous_requests = 0;
   int q_block_size = m->qProjSize;
   int kt_block_size = m->kProjSize;
   int kt_req_block_size =
-      kt_block_size * m->num_q_heads * BatchConfig::max_sequence_length();
+      kt_block_size * m->num_kv_heads * BatchConfig::max_sequence_length();
   int vt_block_size = m->vProjSize;
   int vt_req_block_size =
-      vt_block_size * m->num_q_heads * BatchConfig::max_sequence_length();
+      vt_block_size * m->num_kv_heads * BatchConfig::max_sequence_length();
   assert(m->qProjSize == m->kProjSize);
 
   for (int i = 0; i < bc->max_requests_per_batch(); i++) {
@@ -146,7 +235,29 @@ void compute_attention_kernel_prompt(IncMultiHeadSelfAttentionMeta *m,
           static_cast<DT *>(m->devQKVProjArray),
           static_cast<DT *>(m->query_activation_buffer),
           num_tokens,
-          m->hidden_size);
+          m->hidden_size,
+          m->kv_hidden_size);
+    }
+    // Keys and values of this request: with a paged KV cache, gather them into
+    // contiguous buffers first so the batched GEMMs below can use fixed strides
+    DT *k_cache_req = static_cast<DT *>(m->keyCache) + i * kt_req_block_size;
+    DT *v_cache_req = static_cast<DT *>(m->valueCache) + i * vt_req_block_size;
+    if (m->kv_block_size > 0) {
+      k_cache_req = static_cast<DT *>(m->kv_gather_buffer);
+      v_cache_req = k_cache_req + kt_req_block_size;
+      int parallelism = m->kv_hidden_size * total_tokens;
+      gather_paged_kv_cache<<<GET_BLOCKS(parallelism),
+                              min(CUDA_NUM_THREADS, parallelism),
+                              0,
+                              stream>>>(
+          static_cast<DT *>(m->keyCache),
+          static_cast<DT *>(m->valueCache),
+          k_cache_req,
+          v_cache_req,
+          m->kv_block_table + bc->requestsInfo[i].kv_block_table_offset,
+          m->kv_block_size,
+          total_tokens,
+          m->kv_hidden_size);
     }
     // Step 1: compute query-key product QK.T/sqrt(d_k)
     {
@@ -160,51 +271,46 @@ void compute_attention_kernel_prompt(IncMultiHeadSelfAttentionMeta *m,
       int n = total_tokens;
       int k = m->qProjSize;
       // before transpositions
-      int lda = k * m->num_q_heads * QKV_WEIGHT_NUM, ldb = k * m->num_q_heads,
-          ldc = m_;
+      int lda = m->hidden_size + 2 * m->kv_hidden_size,
+          ldb = k * m->num_kv_heads, ldc = m_;
       // N.B. strides are applied before transpose operations
       int strideA = q_block_size;
       int strideB = kt_block_size;
       int strideC = num_new_tokens * total_tokens;
 
       // matrix A: devQKVProjArray
-      // matrix A's layout: [qProjSize, num_heads, 3, num_new_tokens]
+      // matrix A's layout: [qProjSize * num_q_heads + 2 * kProjSize *
+      // num_kv_heads, num_new_tokens]
       // To get query projection, skip over Q entries from previous requests
       DT const *A = static_cast<DT *>(m->devQKVProjArray) +
-                    bc->requestsInfo[i].first_token_offset_in_batch *
-                        m->qProjSize * m->num_q_heads * QKV_WEIGHT_NUM;
+                    bc->requestsInfo[i].first_token_offset_in_batch * lda;
       // matrix B: key cache
-      // matrix B's layout: [kProjSize * num_heads, total_tokens]
+      // matrix B's layout: [kProjSize * num_kv_heads, total_tokens]
       // To get B, skip over K entries from previous requests (all heads +
       // padding)
-      DT const *B = static_cast<DT *>(m->keyCache) + i * kt_req_block_size;
+      DT const *B = k_cache_req;
       // matrix C: qk_prods
       // matrix C's layout: [num_new_tokens, total_tokens, num_heads]
       // To get C, skip over QK.T products from previous requests
       DT *C = static_cast<DT *>(m->qk_prods);
-      checkCUDA(cublasGemmStridedBatchedEx(m->handle.blas,
-                                           CUBLAS_OP_T,
-                                           CUBLAS_OP_N,
-                                           m_,
-                                           n,
-                                           k,
-                                           &alpha,
-                                           A,
-                                           cublas_data_type,
-                                           lda,
-                                           strideA,
-                                           B,
-                                           cublas_data_type,
-                                           ldb,
-                                           strideB,
-                                           &beta,
-                                           C,
-                                           cublas_data_type,
-                                           ldc,
-                                           strideC,
-                                           m->num_q_heads,
-                                           compute_type,
-                                           CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+      gemm_per_query_head<DT>(m,
+                              CUBLAS_OP_T,
+                              CUBLAS_OP_N,
+                              m_,
+                              n,
+                              k,
+                              &alpha,
+                              A,
+                              lda,
+                              strideA,
+                              B,
+                              ldb,
+                              strideB,
+                              &beta,
+                              C,
+                              ldc,
+                              strideC,
+                              false /*kv_is_a*/);
     }
     // Step 2: Add alibi position bias to qk production
     // matrix C: qk_prods
@@ -307,16 +413,16 @@ void compute_attention_kernel_prompt(IncMultiHeadSelfAttentionMeta *m,
       int n = num_new_tokens;
       int k = total_tokens;
       // before transpositions
-      int lda = m_ * m->num_q_heads, ldb = n, ldc = m_ * m->num_q_heads;
+      int lda = m_ * m->num_kv_heads, ldb = n, ldc = m_ * m->num_q_heads;
       // N.B. strides are applied before transpose operations
       int strideA = vt_block_size;
       int strideB = num_new_tokens * total_tokens;
       int strideC = m->vProjSize;
       // matrix A: value cache
-      // matrix A's layout: [vProjSize, num_heads, total_tokens]
+      // matrix A's layout: [vProjSize, num_kv_heads, total_tokens]
       // To get A, skip over V.T entries from previous requests (all heads +
       // padding)
-      DT *A = static_cast<DT *>(m->valueCache) + i * vt_req_block_size;
+      DT *A = v_cache_req;
       // matrix B: qk_prods_softmax
       // matrix B's layout: [num_new_tokens, total_tokens, num_heads]
       // To get B, skip over softmax(QK.T/sqrt(d_k)) entries from previous
@@ -330,29 +436,24 @@ void compute_attention_kernel_prompt(IncMultiHeadSelfAttentionMeta *m,
       DT *C = static_cast<DT *>(m->attn_heads) +
               (bc->requestsInfo[i].first_token_offset_in_batch) *
                   m->num_q_heads * m->vProjSize;
-      checkCUDA(cublasGemmStridedBatchedEx(m->handle.blas,
-                                           CUBLAS_OP_N,
-                                           CUBLAS_OP_T,
-                                           m_,
-                                           n,
-                                           k,
-                                           &alpha,
-                                           A,
-                                           cublas_data_type,
-                                           lda,
-                                           strideA,
-                                           B,
-                                           cublas_data_type,
-                                           ldb,
-                                           strideB,
-                                           &beta,
-                                           C,
-                                           cublas_data_type,
-                                           ldc,
-                                           strideC,
-                                           m->num_q_heads,
-                                           compute_type,
-                                           CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+      gemm_per_query_head<DT>(m,
+                              CUBLAS_OP_N,
+                              CUBLAS_OP_T,
+                              m_,
+                              n,
+                              k,
+                              &alpha,
+                              A,
+                              lda,
+                              strideA,
+                              B,
+                              ldb,
+                              strideB,
+                              &beta,
+                              C,
+                              ldc,
+                              strideC,
+                              true /*kv_is_a*/);
     }
     tokens_previous_requests += num_new_tokens;
   }
@@ -384,7 +485,10 @@ __global__ void compute_attention_kernel_generation_kernel(
     int max_seq_length,
     int per_head_size,
     int hidden_size,
-    BatchConfig::PerRequestInfo *request_infos) {
+    int kv_hidden_size,
+    BatchConfig::PerRequestInfo *request_infos,
+    int const *kv_block_table,
+    int kv_block_size) {
 
   // q, k
   using Q_vec = typename VEC_K<DT, THREADS_PER_KEY>::Type;
@@ -409,6 +513,8 @@ __global__ void compute_attention_kernel_generation_kernel(
   int const tidx = threadIdx.x;
   // head id
   int const head_idx = blockIdx.x;
+  // the K/V head shared by this query head
+  int const kv_head_idx = head_idx / (hidden_size / kv_hidden_size);
   // request idx
   int const request_idx = blockIdx.y;
 
@@ -432,7 +538,8 @@ __global__ void compute_attention_kernel_generation_kernel(
   // first WARPS_PER_BLOCK for store qk_max, second WARPS_PER_BLOCK for sum
   __shared__ float red_smem[WARPS_PER_BLOCK * 2];
 
-  const DT *q_ptr = query + request_idx * hidden_size * QKV_WEIGHT_NUM +
+  const DT *q_ptr = query +
+                    request_idx * (hidden_size + 2 * kv_hidden_size) +
                     head_idx * per_head_size;
   __shared__ Q_vec q_vecs[THREADS_PER_KEY][K_VECS_PER_THREAD];
   // DT const *q_ptr =
@@ -466,8 +573,15 @@ __global__ void compute_attention_kernel_generation_kernel(
   //   // The number of keys per warp.
   constexpr int K_PER_WARP = WARP_SIZE / THREADS_PER_KEY;
 
+  // with a paged KV cache, token slots are looked up in the block table
+  int const *block_table =
+      kv_block_table +
+      request_infos[batch_config_request_id].kv_block_table_offset;
   DT const *k_cache_batch =
-      key_cache + batch_config_request_id * max_seq_length * hidden_size + ki;
+      kv_block_size > 0
+          ? key_cache + ki
+          : key_cache +
+                batch_config_request_id * max_seq_length * kv_hidden_size + ki;
 
   int ti_end =
       div_up(tlength - first_step, K_PER_WARP) * K_PER_WARP + first_step;
@@ -480,9 +594,13 @@ __global__ void compute_attention_kernel_generation_kernel(
     for (int ii = 0; ii < K_VECS_PER_THREAD; ++ii) {
       int jj = ii * THREADS_PER_KEY * K_VEC_SIZE;
       if (ti < tlength) {
-        k[ii] = *reinterpret_cast<K_vec const *>(k_cache_batch +
-                                                 ti_circ * hidden_size +
-                                                 head_idx * per_head_size + jj);
+        size_t const slot =
+            kv_block_size > 0
+                ? paged_kv_cache_slot(block_table, kv_block_size, ti_circ)
+                : ti_circ;
+        k[ii] = *reinterpret_cast<K_vec const *>(
+            k_cache_batch + slot * kv_hidden_size +
+            kv_head_idx * per_head_size + jj);
       }
       // Compute dot product.
       // This includes a reduction across the threads in the same thread group.
@@ -570,15 +688,22 @@ __global__ void compute_attention_kernel_generation_kernel(
 
   // The base pointer for the value in the cache buffer.
   DT const *v_cache_batch =
-      value_cache + batch_config_request_id * max_seq_length * hidden_size + vi;
+      kv_block_size > 0
+          ? value_cache + vi
+          : value_cache +
+                batch_config_request_id * max_seq_length * kv_hidden_size + vi;
 
   if (Dh == Dh_MAX || vi < Dh) {
     for (int ti = first_step + vo; ti < tlength; ti += V_PER_ITER) {
       // Load the values from the cache.
       int const ti_circ = ti % max_seq_length;
+      size_t const slot =
+          kv_block_size > 0
+              ? paged_kv_cache_slot(block_table, kv_block_size, ti_circ)
+              : ti_circ;
 
       V_vec v = *reinterpret_cast<V_vec const *>(
-          v_cache_batch + ti_circ * hidden_size + head_idx * per_head_size);
+          v_cache_batch + slot * kv_hidden_size + kv_head_idx * per_head_size);
       float logit = qk_smem[ti - first_step];
       out = FlexFlow::fma(logit, cast_to_float(v), out);
     }
@@ -653,10 +778,12 @@ __global__ void scaling_query_kernel(DT *input_ptr,
                                      int num_tokens,
                                      int num_q_heads,
                                      float scaling_factor,
-                                     int hidden_size) {
+                                     int hidden_size,
+                                     int kv_hidden_size) {
   CUDA_KERNEL_LOOP(i, num_tokens * hidden_size) {
     int token_idx = i / hidden_size;
-    input_ptr[i % hidden_size + token_idx * hidden_size * QKV_WEIGHT_NUM] *=
+    input_ptr[i % hidden_size +
+              token_idx * (hidden_size + 2 * kv_hidden_size)] *=
         scaling_factor;
   }
 }
@@ -676,19 +803,21 @@ __global__ void
                               int kProjSize,
                               int num_tokens,
                               size_t q_array_size,
-                              int hidden_size) {
-  CUDA_KERNEL_LOOP(i, num_tokens * hidden_size) {
+                              int hidden_size,
+                              int kv_hidden_size) {
+  CUDA_KERNEL_LOOP(i, num_tokens * (hidden_size + kv_hidden_size) / 2) {
     // create complex number
     bool q_tensor = i < (q_array_size / 2);
     int proj_size = q_tensor ? qProjSize : kProjSize;
     int real_i = q_tensor ? i : i - q_array_size / 2;
+    int tensor_size = q_tensor ? hidden_size : kv_hidden_size;
 
-    int token_idx = real_i / (hidden_size / 2);
+    int token_idx = real_i / (tensor_size / 2);
     int idx = real_i % (proj_size / 2);
-    int head_idx = (real_i - (token_idx * (hidden_size / 2))) / (proj_size / 2);
+    int head_idx = (real_i - (token_idx * (tensor_size / 2))) / (proj_size / 2);
 
     int real_part_index = idx + head_idx * proj_size +
-                          token_idx * hidden_size * QKV_WEIGHT_NUM +
+                          token_idx * (hidden_size + 2 * kv_hidden_size) +
                           hidden_size * (q_tensor ? 0 : 1);
     int complex_part_index = real_part_index + (proj_size / 2);
 
@@ -828,13 +957,14 @@ void compute_qkv_kernel(IncMultiHeadSelfAttentionMeta const *m,
                                      num_tokens,
                                      m->num_q_heads,
                                      m->scaling_factor,
-                                     m->hidden_size);
+                                     m->hidden_size,
+                                     m->kv_hidden_size);
   }
 
   // Step 3: apply rotary embedding if needed
   if (m->rotary_embedding_meta->apply_rotary_embedding) {
     /*q&k*/
-    parallelism = num_tokens * m->hidden_size;
+    parallelism = num_tokens * (m->hidden_size + m->kv_hidden_size) / 2;
     apply_rotary_embedding_hf<<<GET_BLOCKS(parallelism),
                                 min(CUDA_NUM_THREADS, parallelism),
                                 0,
@@ -852,7 +982,8 @@ void compute_qkv_kernel(IncMultiHeadSelfAttentionMeta const *m,
         m->kProjSize,
         num_tokens,
         q_array_size,
-        m->hidden_size);
+        m->hidden_size,
+        m->kv_hidden_size);
   }
 }
 
@@ -862,7 +993,7 @@ void update_kv_cache_kernel(IncMultiHeadSelfAttentionMeta const *m,
                             cudaStream_t stream) {
   int num_tokens = bc->num_active_infr_tokens();
   if (num_tokens > 0) {
-    int parallelism = m->hidden_size * num_tokens;
+    int parallelism = m->kv_hidden_size * num_tokens;
     store_kv_cache<<<GET_BLOCKS(parallelism),
                      min(CUDA_NUM_THREADS, parallelism),
                      0,
@@ -870,9 +1001,13 @@ void update_kv_cache_kernel(IncMultiHeadSelfAttentionMeta const *m,
                                static_cast<DT *>(m->keyCache),
                                static_cast<DT *>(m->valueCache),
                                m->token_infos,
+                               m->request_infos,
+                               m->kv_block_table,
+                               m->kv_block_size,
                                num_tokens,
                                BatchConfig::max_sequence_length(),
-                               m->hidden_size);
+                               m->hidden_size,
+                               m->kv_hidden_size);
   }
 }
 
@@ -897,7 +1032,10 @@ void update_kv_cache_kernel(IncMultiHeadSelfAttentionMeta const *m,
           BatchConfig::max_sequence_length(),                                  \
           m->qProjSize,                                                        \
           m->hidden_size,                                                      \
-          m->request_infos)
+          m->kv_hidden_size,                                                   \
+          m->request_infos,                                                    \
+          m->kv_block_table,                                                   \
+          m->kv_block_size)
 
 template <typename DT>
 void compute_attention_kernel_generation(IncMultiHeadSelfAttentionMeta const *m,
@@ -945,9 +1083,9 @@ void inference_kernel(IncMultiHeadSelfAttentionMeta *m,
                       cudaStream_t stream) {
 
   // phase 0: copy calculated qkv into devQKVProjArray
-  // [qProjSize, num_heads, 3, num_new_tokens]
+  // [qProjSize * num_q_heads + 2 * kProjSize * num_kv_heads, num_new_tokens]
   size_t qkv_proj_size =
-      m->qProjSize * m->num_q_heads * QKV_WEIGHT_NUM * bc->num_active_tokens();
+      (m->hidden_size + 2 * m->kv_hidden_size) * bc->num_active_tokens();
 
   cudaMemcpyAsync(m->devQKVProjArray,
                   qkv_ptr,
@@ -1065,6 +1203,10 @@ void peft_bwd_kernel(IncMultiHeadSelfAttentionMeta const *m,
                      DT const *output_grad_ptr,
                      cudaStream_t stream) {
   assert(!m->offload);
+  assert(m->kv_block_size == 0 &&
+         "PEFT backward does not support a paged KV cache");
+  assert(m->num_kv_heads == m->num_q_heads &&
+         "PEFT backward does not support shared K/V heads");
   checkCUDA(cublasSetStream(m->handle.blas, stream));
   checkCUDNN(cudnnSetStream(m->handle.dnn, stream));
   cudaDataType_t cublas_data_type = ff_to_cuda_datatype(m->output_type[0]);
@@ -1660,7 +1802,9 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
   global_num_kv_heads = _global_num_kv_heads;
   num_q_heads = _num_q_heads;
   num_kv_heads = _num_kv_heads;
+  assert(num_q_heads % num_kv_heads == 0);
   hidden_size = num_q_heads * qProjSize;
+  kv_hidden_size = num_kv_heads * kProjSize;
 
   rotary_embedding_meta =
       (RotaryEmbeddingMeta *)calloc(1, sizeof(RotaryEmbeddingMeta));
@@ -1678,16 +1822,31 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
     int max_tokens_per_batch = infer_mode == TREE_VERIFY_MODE
                                    ? BatchConfig::max_verify_tokens_per_batch()
                                    : BatchConfig::max_tokens_per_batch();
-    size_t qkv_max_proj_size = max_tokens_per_batch * (qProjSize * num_q_heads +
-                                                       kProjSize * num_q_heads +
-                                                       vProjSize * num_q_heads);
-    size_t key_cache_size = 0, value_cache_size = 0;
+    size_t qkv_max_proj_size =
+        max_tokens_per_batch *
+        (qProjSize * num_q_heads + kProjSize * num_kv_heads +
+         vProjSize * num_kv_heads);
+    size_t key_cache_size = 0, value_cache_size = 0, kv_gather_size = 0;
+    kv_block_size = 0;
     switch (infer_mode) {
       case INC_DECODING_MODE: {
-        key_cache_size = num_q_heads * kProjSize *
+        kv_block_size = BatchConfig::kv_cache_block_size();
+        if (kv_block_size > 0) {
+          // paged KV cache: a pool of blocks shared by all requests, plus a
+          // buffer to gather the keys/values of one request for prefilling
+          size_t num_cache_tokens =
+              (size_t)BatchConfig::num_kv_cache_blocks() * kv_block_size;
+          key_cache_size = num_kv_heads * kProjSize * num_cache_tokens;
+          value_cache_size = num_kv_heads * vProjSize * num_cache_tokens;
+          kv_gather_size =
+              (num_kv_heads * kProjSize + num_kv_heads * vProjSize) *
+              BatchConfig::max_sequence_length();
+          break;
+        }
+        key_cache_size = num_kv_heads * kProjSize *
                          BatchConfig::max_requests_per_batch() *
                          BatchConfig::max_sequence_length();
-        value_cache_size = num_q_heads * vProjSize *
+        value_cache_size = num_kv_heads * vProjSize *
                            BatchConfig::max_requests_per_batch() *
                            BatchConfig::max_sequence_length();
         break;
@@ -1695,11 +1854,11 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
       case BEAM_SEARCH_MODE:
       case TREE_VERIFY_MODE: {
         // a K-ary tree max node is (k^n - 1) / 2
-        key_cache_size = num_q_heads * kProjSize *
+        key_cache_size = num_kv_heads * kProjSize *
                          BeamSearchBatchConfig::max_requests_per_batch() *
                          (BatchConfig::max_sequence_length() +
                           BatchConfig::max_spec_tree_token_num());
-        value_cache_size = num_q_heads * vProjSize *
+        value_cache_size = num_kv_heads * vProjSize *
                            BeamSearchBatchConfig::max_requests_per_batch() *
                            (BatchConfig::max_sequence_length() +
                             BatchConfig::max_spec_tree_token_num());
@@ -1714,11 +1873,11 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
         max_tokens_per_batch * BatchConfig::max_sequence_length() * num_q_heads;
     size_t attn_heads_size = max_tokens_per_batch * num_q_heads * vProjSize;
     size_t complex_size = (max_tokens_per_batch * (qProjSize * num_q_heads +
-                                                   kProjSize * num_q_heads)) /
+                                                   kProjSize * num_kv_heads)) /
                           2;
     size_t totalSize =
         (qkv_max_proj_size + key_cache_size + value_cache_size +
-         2 * qk_prod_size + attn_heads_size) *
+         kv_gather_size + 2 * qk_prod_size + attn_heads_size) *
             size_of_dt +
         complex_size * sizeof(cuFloatComplex); // more components will
                                                // be added here later
@@ -1729,13 +1888,15 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
               ? totalSize -
                     (key_cache_size + value_cache_size + qkv_max_proj_size) *
                         size_of_dt
-              : totalSize - (key_cache_size + value_cache_size) * size_of_dt;
+              : totalSize -
+                    (key_cache_size + value_cache_size + kv_gather_size) *
+                        size_of_dt;
 
       size_t instance_size =
           size_of_dt *
           (infer_mode == TREE_VERIFY_MODE
                ? key_cache_size + value_cache_size + qkv_max_proj_size
-               : key_cache_size + value_cache_size);
+               : key_cache_size + value_cache_size + kv_gather_size);
 
       assert(gpu_mem_allocator.reserved_total_size -
                  gpu_mem_allocator.reserved_allocated_size >=
@@ -1762,6 +1923,12 @@ IncMultiHeadSelfAttentionMeta::IncMultiHeadSelfAttentionMeta(
                                                            size_of_dt);
     valueCache = gpu_mem_allocator.allocate_instance_untyped(value_cache_size *
                                                              size_of_dt);
+    kv_gather_buffer = nullptr;
+    if (kv_block_size > 0) {
+      kv_gather_buffer = gpu_mem_allocator.allocate_instance_untyped(
+          kv_gather_size * size_of_dt);
+    }
+    kv_block_table = handler.batch_config_metadata->kv_block_table;
 
     token_infos = static_cast<BatchConfig::PerTokenInfo *>(
         handler.batch_config_metadata->tokens_info);
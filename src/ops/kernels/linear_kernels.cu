@@ -17,6 +17,7 @@
 #include "flexflow/ops/kernels/decompress_kernels.h"
 #include "flexflow/ops/kernels/linear_kernels.h"
 #include "flexflow/ops/lora_linear_params.h"
+#include "flexflow/request_manager.h"
 #include "flexflow/utils/cuda_helper.h"
 
 namespace FlexFlow {
@@ -638,10 +639,9 @@ void peft_bwd_kernel(LinearMeta const *m,
       continue;
     }
     num_peft_requests++;
-    std::string peft_model_config_str =
-        std::string(bc->requestsInfo[i].peft_model_config_str);
-    LoraLinearConfig lora_config =
-        LoraLinearConfig::deserialize_from_json_string(peft_model_config_str);
+    LoraLinearConfig const &lora_config =
+        RequestManager::get_request_manager()->get_peft_config(
+            bc->requestsInfo[i].peft_model_id);
     if (!lora_applies_to_this_layer(m, lora_config)) {
       continue;
     }
@@ -16,6 +16,7 @@
 #include "flexflow/ffconst_utils.h"
 #include "flexflow/ops/kernels/decompress_kernels.h"
 #include "flexflow/ops/kernels/lora_linear_kernels.h"
+#include "flexflow/request_manager.h"
 #include "flexflow/utils/cuda_helper.h"
 #include <random>
 #include <vector>
@@ -196,15 +197,13 @@ void inference_kernel(LoraLinearMeta *m,
     if (bc->requestsInfo[i].peft_bwd) {
       num_peft_requests++;
     }
-    std::string peft_model_config_str =
-        std::string(bc->requestsInfo[i].peft_model_config_str);
-    LoraLinearConfig lora_config =
-        LoraLinearConfig::deserialize_from_json_string(peft_model_config_str);
+    LoraLinearConfig const &lora_config =
+        RequestManager::get_request_manager()->get_peft_config(
+            bc->requestsInfo[i].peft_model_id);
     if (!lora_applies_to_this_layer(m, lora_config)) {
       continue;
     }
     // std::cout << "Lora layer activated!" << std::endl;
-    // std::cout << "Lora Config: " << peft_model_config_str << std::endl;
     assert(lora_config.trainable == bc->requestsInfo[i].peft_bwd &&
            "Trainable flag mismatch");
     int num_peft_tokens = bc->requestsInfo[i].num_tokens_in_batch;
@@ -328,15 +327,13 @@ void peft_bwd_kernel(Context ctx,
         !bc->requestsInfo[i].peft_bwd) {
       continue;
     }
-    std::string peft_model_config_str =
-        std::string(bc->requestsInfo[i].peft_model_config_str);
-    LoraLinearConfig lora_config =
-        LoraLinearConfig::deserialize_from_json_string(peft_model_config_str);
+    LoraLinearConfig const &lora_config =
+        RequestManager::get_request_manager()->get_peft_config(
+            bc->requestsInfo[i].peft_model_id);
     if (!lora_applies_to_this_layer(m, lora_config)) {
       continue;
     }
     // std::cout << "Lora layer activated!" << std::endl;
-    // std::cout << "Lora Config: " << peft_model_config_str << std::endl;
     assert(lora_config.trainable == bc->requestsInfo[i].peft_bwd &&
            "Trainable flag mismatch");
     m->peft_memory_manager->check_ft_model_id(
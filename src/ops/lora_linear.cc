@@ -481,10 +481,9 @@ void LoraLinear::inference_task(Task const *task,
           bc->requestsInfo[i].peft_model_id == PEFTModelID::NO_ID) {
         continue;
       }
-      std::string peft_model_config_str =
-          std::string(bc->requestsInfo[i].peft_model_config_str);
-      LoraLinearConfig lora_config =
-          LoraLinearConfig::deserialize_from_json_string(peft_model_config_str);
+      LoraLinearConfig const &lora_config =
+          RequestManager::get_request_manager()->get_peft_config(
+              bc->requestsInfo[i].peft_model_id);
       if (!lora_applies_to_this_layer(m, lora_config)) {
         continue;
       }
@@ -640,10 +639,9 @@ void lora_inference_debugging(LoraLinearMeta *m,
         !bc->requestsInfo[i].peft_bwd) {
       continue;
     }
-    std::string peft_model_config_str =
-        std::string(bc->requestsInfo[i].peft_model_config_str);
-    LoraLinearConfig lora_config =
-        LoraLinearConfig::deserialize_from_json_string(peft_model_config_str);
+    LoraLinearConfig const &lora_config =
+        RequestManager::get_request_manager()->get_peft_config(
+            bc->requestsInfo[i].peft_model_id);
     if (!lora_applies_to_this_layer(m, lora_config)) {
       continue;
     }
@@ -775,10 +773,9 @@ void save_peft_weights_if_needed(LoraLinearMeta *m,
         !bc->requestsInfo[i].peft_bwd) {
       continue;
     }
-    std::string peft_model_config_str =
-        std::string(bc->requestsInfo[i].peft_model_config_str);
-    LoraLinearConfig lora_config =
-        LoraLinearConfig::deserialize_from_json_string(peft_model_config_str);
+    LoraLinearConfig const &lora_config =
+        RequestManager::get_request_manager()->get_peft_config(
+            bc->requestsInfo[i].peft_model_id);
     if (!lora_applies_to_this_layer(m, lora_config)) {
       continue;
     }
@@ -44,10 +44,11 @@ using Legion::TaskArgument;
 using Legion::TaskLauncher;
 using PCG::Node;
 
-// For an input tensor, computes the top k entries in each row
-// (resp. vector along the last dimension). Thus,
-// values.shape = indices.shape = input.shape[:-1] + [k]
-Tensor FFModel::sampling(const Tensor input, float top_p, char const *name) {
+// Samples one token from each row of the input probabilities, using the
+// sampling parameters (temperature, top-k, top-p, repetition penalty and
+// seed) of the request the row belongs to in the current BatchConfig.
+// indices.shape = input.shape[:-1] + [1]
+Tensor FFModel::sampling(const Tensor input, char const *name) {
   Layer *li = new Layer(this,
                         OP_SAMPLING,
                         input->data_type,
@@ -70,7 +71,6 @@ Tensor FFModel::sampling(const Tensor input, float top_p, char const *name) {
         numdims, dims, DT_INT32, li, 0, false /*create_grad*/);
   }
   layers.push_back(li);
-  li->add_float_property("top_p", top_p);
   // outputs[0] = li->outputs[0];
   // outputs[1] = li->outputs[1];
   return li->outputs[0];
@@ -80,14 +80,11 @@ Op *Sampling::create_operator_from_layer(
     FFModel &model,
     Layer const *layer,
     std::vector<ParallelTensor> const &inputs) {
-  float top_p;
-  layer->get_float_property("top_p", top_p);
-  return new Sampling(model, inputs[0], top_p, layer->name);
+  return new Sampling(model, inputs[0], layer->name);
 }
 
 SamplingParams Sampling::get_params() const {
   SamplingParams params;
-  params.top_p = this->top_p;
   if (strlen(this->name) < MAX_OPNAME) {
     strcpy(params.name, this->name);
   }
@@ -99,12 +96,12 @@ bool SamplingParams::is_valid(ParallelTensorShape const &) const {
 }
 
 bool operator==(SamplingParams const &lhs, SamplingParams const &rhs) {
-  return lhs.top_p == rhs.top_p;
+  // sampling parameters are passed per request through the BatchConfig
+  return true;
 }
 
 Sampling::Sampling(FFModel &model,
                    const ParallelTensor _input,
-                   float _top_p,
                    char const *name)
     : Op(model,
          OP_SAMPLING,
@@ -113,8 +110,7 @@ Sampling::Sampling(FFModel &model,
          1 /*inputs*/,
          0 /*weights*/,
          1 /*outputs*/,
-         _input),
-      top_p(_top_p) {
+         _input) {
   int numdim = inputs[0]->num_dims;
   ParallelDim dims[MAX_TENSOR_DIM];
   for (int i = 0; i < numdim; i++) {
@@ -133,13 +129,13 @@ Sampling::Sampling(FFModel &model,
 Sampling::Sampling(FFModel &model,
                    Sampling const &other,
                    const ParallelTensor input)
-    : Sampling(model, input, other.top_p, other.name) {}
+    : Sampling(model, input, other.name) {}
 
 Sampling::Sampling(FFModel &model,
                    SamplingParams const &params,
                    const ParallelTensor input,
                    char const *name)
-    : Sampling(model, input, params.top_p, params.name) {}
+    : Sampling(model, input, params.name) {}
 
 void Sampling::init_inference(FFModel const &ff,
                               std::vector<ParallelTensor> const &batch_inputs,
@@ -234,7 +230,6 @@ OpMeta *Sampling::init_task(Task const *task,
   m->inference_debugging = s->inference_debugging;
   std::strcpy(m->op_name, s->name);
   m->layer_guid = s->layer_guid;
-  m->top_p = s->top_p;
   return m;
 }
 
@@ -303,7 +298,7 @@ InferenceResult
       DT_INT32, regions[1], task->regions[1], FID_DATA, ctx, runtime);
 
   int batch_size = bc->num_active_infr_tokens();
-  Sampling::forward_kernel_wrapper(m, input, indices, batch_size);
+  Sampling::forward_kernel_wrapper(m, bc, input, indices, batch_size);
 
   if (m->inference_debugging) {
     assert(task->index_point.get_dim() == 1);
@@ -324,7 +319,6 @@ void Sampling::backward(FFModel const &ff) {
 }
 
 void Sampling::serialize(Legion::Serializer &sez) const {
-  sez.serialize(this->top_p);
   sez.serialize(strlen(this->name));
   sez.serialize(this->name, strlen(this->name));
 }
@@ -334,14 +328,11 @@ Node Sampling::deserialize(FFModel &ff,
                            ParallelTensor inputs[],
                            int num_inputs) {
   assert(num_inputs == 1);
-  float top_p;
-  dez.deserialize(top_p);
   size_t name_len;
   char name[MAX_OPNAME] = {0};
   dez.deserialize(name_len);
   dez.deserialize(name, name_len);
   SamplingParams params;
-  params.top_p = top_p;
   strcpy(params.name, name);
   return ff.get_or_create_node<Sampling>(inputs[0], params);
 }
@@ -365,7 +356,6 @@ namespace std {
 size_t hash<FlexFlow::SamplingParams>::operator()(
     FlexFlow::SamplingParams const &params) const {
   size_t key = 0;
-  hash_combine(key, params.top_p);
   return key;
 }
 }; // namespace std
@@ -16,6 +16,7 @@
 #include "flexflow/ops/sampling.h"
 #include "flexflow/ffconst_utils.h"
 #include "flexflow/utils/hip_helper.h"
+#include <cfloat>
 #include <hip/hip_runtime.h>
 #include <hipcub/hipcub.hpp>
 
@@ -53,113 +54,223 @@ __global__ void init_idxs(int batch_size,
   }
 }
 
-__global__ void
-    init_random_kernel(hiprandState *state, int batch_size, long rand) {
-  CUDA_KERNEL_LOOP(i, batch_size) {
-    hiprand_init(rand, i, 0, &state[i]);
+// Turns the probabilities of each row into the distribution to sample from:
+// log-probabilities are scaled by 1 / temperature, those of the request's
+// recent tokens by the repetition penalty, and the result is renormalized.
+// Rows decoded greedily are only penalized.
+template <typename DT, int BLOCK_SIZE>
+__global__ void adjust_probs_kernel(int const vocab_size,
+                                    DT const *input_ptr,
+                                    SamplingRowInfo const *row_info,
+                                    BatchConfig::TokenId const *penalty_tokens,
+                                    float *adjusted_probs) {
+  int const row = blockIdx.x;
+  SamplingRowInfo const info = row_info[row];
+  DT const *probs = input_ptr + (size_t)row * vocab_size;
+  float *out = adjusted_probs + (size_t)row * vocab_size;
+  float scale = 1.0f;
+  if (info.do_sample && info.temperature > 0.0f) {
+    scale = 1.0f / info.temperature;
+  }
+  for (int j = threadIdx.x; j < vocab_size; j += blockDim.x) {
+    out[j] = logf(fmaxf((float)probs[j], FLT_MIN)) * scale;
+  }
+  __syncthreads();
+  // log-probabilities are negative, so multiplying by a penalty > 1 makes
+  // the token less likely; penalty tokens of a request are distinct
+  for (int i = threadIdx.x; i < info.num_penalty_tokens; i += blockDim.x) {
+    out[penalty_tokens[info.penalty_tokens_offset + i]] *=
+        info.repetition_penalty;
+  }
+  __syncthreads();
+
+  typedef hipcub::BlockReduce<float, BLOCK_SIZE> BlockReduce;
+  __shared__ typename BlockReduce::TempStorage temp_storage;
+  __shared__ float row_max, row_sum;
+  float local_max = -FLT_MAX;
+  for (int j = threadIdx.x; j < vocab_size; j += blockDim.x) {
+    local_max = fmaxf(local_max, out[j]);
+  }
+  float max_val = BlockReduce(temp_storage).Reduce(local_max, hipcub::Max());
+  if (threadIdx.x == 0) {
+    row_max = max_val;
+  }
+  __syncthreads();
+  float local_sum = 0.0f;
+  for (int j = threadIdx.x; j < vocab_size; j += blockDim.x) {
+    out[j] = expf(out[j] - row_max);
+    local_sum += out[j];
+  }
+  float sum_val = BlockReduce(temp_storage).Sum(local_sum);
+  if (threadIdx.x == 0) {
+    row_sum = sum_val;
+  }
+  __syncthreads();
+  for (int j = threadIdx.x; j < vocab_size; j += blockDim.x) {
+    out[j] /= row_sum;
   }
 }
 
-// multinominal and gather
-template <typename DT, int BLOCK_SIZE>
-__global__ void sampling_topp_kernel(int batch_size,
-                                     int const vocab_size,
-                                     hiprandState *state,
-                                     DT *sorted_logits,
-                                     int *sorted_idx,
-                                     int *indices_ptr,
-                                     float topp) {
-  // int const vocab_id = threadIdx.x;
-  int const batch_idx = blockIdx.x;
-  __shared__ float random_n;
-  __shared__ unsigned long long result_idx;
+// top-k / top-p (nucleus) sampling over probabilities sorted in descending
+// order, or argmax of the unsorted probabilities for rows decoded greedily
+// (sorted_probs and sorted_idx are not set if no row samples)
+template <int BLOCK_SIZE>
+__global__ void sampling_kernel(int const vocab_size,
+                                SamplingRowInfo const *row_info,
+                                float const *adjusted_probs,
+                                float const *sorted_probs,
+                                int const *sorted_idx,
+                                int *indices_ptr) {
+  int const row = blockIdx.x;
+  SamplingRowInfo const info = row_info[row];
+  size_t const offset = (size_t)row * vocab_size;
+  if (!info.do_sample) {
+    typedef hipcub::KeyValuePair<int, float> ArgMaxPair;
+    typedef hipcub::BlockReduce<ArgMaxPair, BLOCK_SIZE> BlockArgMax;
+    __shared__ typename BlockArgMax::TempStorage argmax_storage;
+    ArgMaxPair local_max(0, -FLT_MAX);
+    for (int j = threadIdx.x; j < vocab_size; j += blockDim.x) {
+      if (adjusted_probs[offset + j] > local_max.value) {
+        local_max = ArgMaxPair(j, adjusted_probs[offset + j]);
+      }
+    }
+    ArgMaxPair max_pair =
+        BlockArgMax(argmax_storage).Reduce(local_max, hipcub::ArgMax());
+    if (threadIdx.x == 0) {
+      indices_ptr[row] = max_pair.key;
+    }
+    return;
+  }
+  int const top_k =
+      info.top_k > 0 ? min(info.top_k, vocab_size) : vocab_size;
 
-  // random num
-  if (threadIdx.x == 0) {
-    // number must < topp
-    random_n = hiprand_uniform(state + batch_idx) * topp;
-    // printf("batch idx: %d, random num%f\n", batch_idx, random_n);
+  typedef hipcub::BlockReduce<float, BLOCK_SIZE> BlockReduce;
+  __shared__ typename BlockReduce::TempStorage reduce_storage;
+  float local_mass = 0.0f;
+  for (int j = threadIdx.x; j < top_k; j += blockDim.x) {
+    local_mass += sorted_probs[offset + j];
   }
+  float top_k_mass = BlockReduce(reduce_storage).Sum(local_mass);
 
+  __shared__ float random_n;
+  __shared__ int result_idx;
+  if (threadIdx.x == 0) {
+    // the draw only depends on the request's seed and the token position,
+    // so a request samples the same tokens whatever batch it runs in
+    hiprandStatePhilox4_32_10_t state;
+    hiprand_init(info.seed, info.position, 0, &state);
+    // threshold within the nucleus of the top-k tokens
+    random_n = hiprand_uniform(&state) * fminf(info.top_p, top_k_mass);
+    result_idx = top_k - 1;
+  }
   __syncthreads();
 
-  // cumsum;
+  // cumsum
   typedef hipcub::BlockScan<float, BLOCK_SIZE> BlockScan;
-  __shared__ typename BlockScan::TempStorage temp_storage;
-
-  int offset = batch_idx * vocab_size;
-  float prefix_sum = 0.0f;
+  __shared__ typename BlockScan::TempStorage scan_storage;
   BlockPrefixCallbackOp prefix_op(0);
-  result_idx = vocab_size - 1;
-
-  for (unsigned long long j = threadIdx.x; j < vocab_size; j += blockDim.x) {
-    float logit = (float)(sorted_logits[offset + j]);
-    BlockScan(temp_storage).InclusiveSum(logit, prefix_sum, prefix_op);
-    prefix_sum /= topp;
-    if (prefix_sum >= random_n) {
+  for (int base = 0; base < top_k; base += BLOCK_SIZE) {
+    int j = base + threadIdx.x;
+    float prob = j < top_k ? sorted_probs[offset + j] : 0.0f;
+    float prefix_sum;
+    BlockScan(scan_storage).InclusiveSum(prob, prefix_sum, prefix_op);
+    __syncthreads();
+    if (j < top_k && prefix_sum >= random_n) {
       atomicMin(&result_idx, j);
     }
   }
-  indices_ptr[batch_idx] = sorted_idx[offset + result_idx];
-
-  // if (threadIdx.x == 0) {
-  //   printf("selected idx: %d, %d\n", blockIdx.x, result_idx);
-  // }
+  __syncthreads();
+  if (threadIdx.x == 0) {
+    indices_ptr[row] = sorted_idx[offset + result_idx];
+  }
 }
 
 /*static*/
 template <typename DT>
 void Sampling::forward_kernel(SamplingMeta const *m,
-                              DT *input_ptr,
+                              BatchConfig const *bc,
+                              DT const *input_ptr,
                               int *indices_ptr,
-                              float const top_p,
                               int const length,
                               int const batch_size,
                               hipStream_t stream) {
-
-  size_t temp_storage_bytes = m->temp_storage_bytes;
-  // checkCUDA(hipcub::DeviceSegmentedRadixSort::SortPairsDescending(
-  //     m->d_temp_storage,
-  //     temp_storage_bytes,
-  //     input_ptr,
-  //     static_cast<DT *>(m->sorted_logits),
-  //     m->idx,
-  //     m->sorted_idx,
-  //     length * batch_size,
-  //     batch_size,
-  //     m->begin_offset,
-  //     m->end_offset + 1,
-  //     0,              // begin_bit
-  //     sizeof(DT) * 8, // end_bit = sizeof(KeyT) * 8
-  //     stream));
-  return;
-  int parallelism = batch_size;
-  hipLaunchKernelGGL(init_random_kernel,
-                     GET_BLOCKS(parallelism),
-                     min(CUDA_NUM_THREADS, parallelism),
-                     0,
-                     stream,
-                     m->state,
-                     batch_size,
-                     rand());
-  // sampling
+  // 1. gather the sampling parameters of each row
+  std::vector<SamplingRowInfo> row_info(batch_size);
+  bool any_sample = false;
+  for (int i = 0; i < batch_size; i++) {
+    BatchConfig::PerRequestInfo const &request =
+        bc->requestsInfo[bc->tokensInfo[i].request_index];
+    row_info[i].temperature = request.temperature;
+    row_info[i].top_p = request.top_p;
+    row_info[i].repetition_penalty = request.repetition_penalty;
+    row_info[i].top_k = request.top_k;
+    row_info[i].do_sample = request.do_sample;
+    row_info[i].seed = request.seed;
+    row_info[i].position = bc->tokensInfo[i].abs_depth_in_request;
+    row_info[i].penalty_tokens_offset = request.penalty_tokens_offset;
+    row_info[i].num_penalty_tokens = request.num_penalty_tokens;
+    any_sample = any_sample || request.do_sample;
+  }
+  checkCUDA(hipMemcpyAsync(m->row_info,
+                           row_info.data(),
+                           sizeof(SamplingRowInfo) * batch_size,
+                           hipMemcpyHostToDevice,
+                           stream));
+  if (!bc->penalty_tokens.empty()) {
+    checkCUDA(hipMemcpyAsync(m->penalty_tokens,
+                             bc->penalty_tokens.data(),
+                             sizeof(BatchConfig::TokenId) *
+                                 bc->penalty_tokens.size(),
+                             hipMemcpyHostToDevice,
+                             stream));
+  }
+  // 2. temperature and repetition penalty
   hipLaunchKernelGGL(
-      HIP_KERNEL_NAME(sampling_topp_kernel<DT, SamplingNumThreads>),
+      HIP_KERNEL_NAME(adjust_probs_kernel<DT, SamplingNumThreads>),
       batch_size,
       SamplingNumThreads,
       0,
       stream,
-      batch_size,
       length,
-      m->state,
-      static_cast<DT *>(m->sorted_logits),
-      m->sorted_idx,
-      indices_ptr,
-      top_p);
+      input_ptr,
+      m->row_info,
+      m->penalty_tokens,
+      m->adjusted_probs);
+  // 3. sort, only needed for top-k / top-p sampling
+  if (any_sample) {
+    size_t temp_storage_bytes = m->temp_storage_bytes;
+    checkCUDA(hipcub::DeviceSegmentedRadixSort::SortPairsDescending(
+        m->d_temp_storage,
+        temp_storage_bytes,
+        m->adjusted_probs,
+        m->sorted_probs,
+        m->idx,
+        m->sorted_idx,
+        length * batch_size,
+        batch_size,
+        m->begin_offset,
+        m->end_offset + 1,
+        0,                 // begin_bit
+        sizeof(float) * 8, // end_bit = sizeof(KeyT) * 8
+        stream));
+  }
+  // 4. sampling
+  hipLaunchKernelGGL(HIP_KERNEL_NAME(sampling_kernel<SamplingNumThreads>),
+                     batch_size,
+                     SamplingNumThreads,
+                     0,
+                     stream,
+                     length,
+                     m->row_info,
+                     m->adjusted_probs,
+                     m->sorted_probs,
+                     m->sorted_idx,
+                     indices_ptr);
 }
 
 /*static*/
 void Sampling::forward_kernel_wrapper(SamplingMeta const *m,
+                                      BatchConfig const *bc,
                                       GenericTensorAccessorW const &input,
                                       GenericTensorAccessorW const &indices,
                                       int batch_size) {
@@ -192,27 +303,31 @@ SamplingMeta::SamplingMeta(FFHandler handler,
                            GenericTensorAccessorW input,
                            MemoryAllocator &gpu_mem_allocator)
     : OpMeta(handler, op) {
-  DataType data_type = op->data_type;
-
   size_t begin_offset_size, end_offset_size;
   begin_offset_size = end_offset_size = batch_size + 1;
-  size_t idx_size, sorted_idx_size, sorted_logits_size;
-  idx_size = sorted_idx_size = sorted_logits_size = total_ele;
-  size_t state_size = batch_size;
+  size_t idx_size, sorted_idx_size, adjusted_probs_size, sorted_probs_size;
+  idx_size = sorted_idx_size = adjusted_probs_size = sorted_probs_size =
+      total_ele;
 
-  size_t totalSize = sizeof(int) * (begin_offset_size + end_offset_size +
-                                    idx_size + sorted_idx_size) +
-                     data_type_size(data_type) * sorted_logits_size +
-                     sizeof(hiprandState) * state_size;
+  size_t totalSize =
+      sizeof(int) *
+          (begin_offset_size + end_offset_size + idx_size + sorted_idx_size) +
+      sizeof(float) * (adjusted_probs_size + sorted_probs_size) +
+      sizeof(SamplingRowInfo) * batch_size +
+      sizeof(BatchConfig::TokenId) * BatchConfig::MAX_PENALTY_TOKENS;
   gpu_mem_allocator.create_legion_instance(
       reserveInst, totalSize, "SamplingMeta");
+  // row_info goes first, as it holds 8-byte fields
+  row_info = gpu_mem_allocator.allocate_instance<SamplingRowInfo>(batch_size);
   begin_offset = gpu_mem_allocator.allocate_instance<int>(begin_offset_size);
   end_offset = gpu_mem_allocator.allocate_instance<int>(end_offset_size);
   idx = gpu_mem_allocator.allocate_instance<int>(idx_size);
   sorted_idx = gpu_mem_allocator.allocate_instance<int>(sorted_idx_size);
-  sorted_logits = gpu_mem_allocator.allocate_instance_untyped(
-      sorted_logits_size * data_type_size(data_type));
-  state = gpu_mem_allocator.allocate_instance<hiprandState>(state_size);
+  adjusted_probs =
+      gpu_mem_allocator.allocate_instance<float>(adjusted_probs_size);
+  sorted_probs = gpu_mem_allocator.allocate_instance<float>(sorted_probs_size);
+  penalty_tokens = gpu_mem_allocator.allocate_instance<BatchConfig::TokenId>(
+      BatchConfig::MAX_PENALTY_TOKENS);
   hipStream_t stream;
   checkCUDA(get_legion_stream(&stream));
 
@@ -228,40 +343,22 @@ SamplingMeta::SamplingMeta(FFHandler handler,
                         begin_offset,
                         end_offset);
 
-  // init sort function
-  // if (data_type == DT_FLOAT) {
-  //   checkCUDA(hipcub::DeviceSegmentedRadixSort::SortPairsDescending(
-  //       d_temp_storage,
-  //       temp_storage_bytes,
-  //       input.get_float_ptr(),
-  //       input.get_float_ptr(),
-  //       idx,
-  //       idx,
-  //       total_ele,
-  //       batch_size,
-  //       begin_offset,
-  //       end_offset + 1,
-  //       0,                             // begin_bit
-  //       data_type_size(data_type) * 8, // end_bit = sizeof(KeyT) * 8
-  //       stream));
-  // } else if (data_type == DT_HALF) {
-  //   checkCUDA(hipcub::DeviceSegmentedRadixSort::SortPairsDescending(
-  //       d_temp_storage,
-  //       temp_storage_bytes,
-  //       input.get_half_ptr(),
-  //       input.get_half_ptr(),
-  //       idx,
-  //       idx,
-  //       total_ele,
-  //       batch_size,
-  //       begin_offset,
-  //       end_offset + 1,
-  //       0,                             // begin_bit
-  //       data_type_size(data_type) * 8, // end_bit = sizeof(KeyT) * 8
-  //       stream));
-  // } else {
-  //   assert(false && "input type in float and half");
-  // }
+  // init sort function, which always sorts the adjusted float probabilities
+  d_temp_storage = nullptr;
+  checkCUDA(hipcub::DeviceSegmentedRadixSort::SortPairsDescending(
+      d_temp_storage,
+      temp_storage_bytes,
+      adjusted_probs,
+      sorted_probs,
+      idx,
+      sorted_idx,
+      total_ele,
+      batch_size,
+      begin_offset,
+      end_offset + 1,
+      0,                 // begin_bit
+      sizeof(float) * 8, // end_bit = sizeof(KeyT) * 8
+      stream));
 
   gpu_mem_allocator.create_legion_instance(
       reserveInst, temp_storage_bytes, "SamplingMeta");
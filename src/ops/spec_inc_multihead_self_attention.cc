@@ -470,7 +470,8 @@ OpMeta *SpecIncMultiHeadSelfAttention::init_task(
   assert(attn->qoSeqLength == input.domain.hi()[1] - input.domain.lo()[1] + 1);
   assert(attn->kvSeqLength == input.domain.hi()[1] - input.domain.lo()[1] + 1);
   int num_q_heads = attn->num_q_heads;
-  int num_kv_heads = attn->num_kv_heads;
+  // the input holds the K/V heads chosen by FFModel::get_num_stored_kv_heads
+  int num_kv_heads = (attn->qSize / attn->qProjSize - attn->num_q_heads) / 2;
   assert(attn->oProjSize == output.domain.hi()[0] - output.domain.lo()[0] + 1);
 
   Memory gpu_mem = get_proc_mem(Machine::get_machine(), task->target_proc);
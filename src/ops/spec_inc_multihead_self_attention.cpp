@@ -100,7 +100,7 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
 
   // request_idx = re
 
-  BatchConfig::BitMask bitmask = causalMask[batch_config_request_id];
+  BatchConfig::BitMask const &bitmask = causalMask[batch_config_request_id];
 
   int const first_step = 0;
 
@@ -184,8 +184,9 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
         // todo add alobi here
         // bool const mask = ti_circ >= totalCacheSize;
         bool const mask = (ti >= bitmask.non_tree_cache_size &&
-                           (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                              (1 << query_token))));
+                           !tree_mask_bit(bitmask,
+                                          ti - bitmask.non_tree_cache_size,
+                                          query_token));
 
         // if (head_idx == 0 && ti == 0 && request_idx == 15 && !mask) {
         //   printf("spec inc attn qkqkqk  request id %d,  %.10f, %d\n",
@@ -236,8 +237,9 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
     for (int ti = first_step + tidx; ti < totalCacheSize;
          ti += THREADS_PER_BLOCK) {
       bool const mask = (ti >= bitmask.non_tree_cache_size &&
-                         (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                            (1 << query_token))));
+                         !tree_mask_bit(bitmask,
+                                        ti - bitmask.non_tree_cache_size,
+                                        query_token));
       float logit = mask ? 0.0f : __expf(qk_smem[ti - first_step] - qk_max);
       exp_sum += logit;
       qk_smem[ti - first_step] = mask ? 0.0f : logit;
@@ -283,8 +285,9 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
             v_cache_batch + ti_circ * hidden_size + head_idx * per_head_size);
 
         bool const mask = (ti >= bitmask.non_tree_cache_size &&
-                           (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                              (1 << query_token))));
+                           !tree_mask_bit(bitmask,
+                                          ti - bitmask.non_tree_cache_size,
+                                          query_token));
         float logit = mask ? 0.0f : qk_smem[ti - first_step];
         out = FlexFlow::fma(logit, cast_to_float(v), out);
       }
@@ -362,7 +365,7 @@ __global__ void spec_inc_store_kv_cache(
     int const request_token_offset =
         requestInfo[req_id].first_token_offset_in_batch;
 
-    BatchConfig::BitMask bitmask = causalMask[req_id];
+    BatchConfig::BitMask const &bitmask = causalMask[req_id];
 
     // if prompt token -> token id
     // if tree token:
@@ -48,6 +48,7 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
     int const max_seq_length,
     int per_head_size,
     int hidden_size,
+    int kv_hidden_size,
     BatchConfig::PerRequestInfo *request_infos,
     BeamSearchBatchConfig::BeamSearchPerRequestInfo *beam_request_infos,
     BatchConfig::BitMask *causalMask,
@@ -70,6 +71,8 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
   int const tidx = threadIdx.x;
   // head id
   int const head_idx = blockIdx.x;
+  // the K/V head shared by this query head
+  int const kv_head_idx = head_idx / (hidden_size / kv_hidden_size);
   // nth request idx
   int const request_idx = blockIdx.y;
 
@@ -79,7 +82,7 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
 
   // request_idx = re
 
-  BatchConfig::BitMask bitmask = causalMask[batch_config_request_id];
+  BatchConfig::BitMask const &bitmask = causalMask[batch_config_request_id];
 
   int const first_step = 0;
 
@@ -109,8 +112,9 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
   // first WARPS_PER_BLOCK for store qk_max, second WARPS_PER_BLOCK for sum
   __shared__ float red_smem[WARPS_PER_BLOCK * 2];
 
-  const DT *q_ptr = query + first_token_idx * hidden_size * QKV_WEIGHT_NUM +
-                    head_idx * per_head_size;
+  int const qkv_size = hidden_size + 2 * kv_hidden_size;
+  const DT *q_ptr =
+      query + first_token_idx * qkv_size + head_idx * per_head_size;
   __shared__ Q_vec q_vecs[THREADS_PER_KEY][K_VECS_PER_THREAD];
 
   // the start offset of the element eg. (0, 1, 2, 3) * K_VEC_SIZE
@@ -127,7 +131,8 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
   constexpr int K_PER_WARP = WARP_SIZE / THREADS_PER_KEY;
 
   DT const *k_cache_batch =
-      key_cache + batch_config_request_id * max_seq_length * hidden_size + ki;
+      key_cache + batch_config_request_id * max_seq_length * kv_hidden_size +
+      ki;
 
   int ti_end =
       div_up(totalCacheSize - first_step, K_PER_WARP) * K_PER_WARP + first_step;
@@ -136,8 +141,7 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
 #pragma unroll
     for (int ii = 0; ii < K_VECS_PER_THREAD; ++ii) {
       q_vecs[ki_o][ii] = *reinterpret_cast<Q_vec const *>(
-          q_ptr + (hidden_size * QKV_WEIGHT_NUM * qi) + ki +
-          ii * THREADS_PER_KEY * K_VEC_SIZE);
+          q_ptr + (qkv_size * qi) + ki + ii * THREADS_PER_KEY * K_VEC_SIZE);
     }
 
     int const query_token =
@@ -153,8 +157,8 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
         if (ti < totalCacheSize) {
 
           k[ii] = *reinterpret_cast<K_vec const *>(
-              k_cache_batch + ti_circ * hidden_size + head_idx * per_head_size +
-              jj);
+              k_cache_batch + ti_circ * kv_hidden_size +
+              kv_head_idx * per_head_size + jj);
         }
       }
       float qk = scale * Qk_dot<DT, THREADS_PER_KEY>::dot(q_vecs[ki_o], k);
@@ -163,8 +167,9 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
         // todo add alobi here
         // bool const mask = ti_circ >= totalCacheSize;
         bool const mask = (ti >= bitmask.non_tree_cache_size &&
-                           (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                              (1 << query_token))));
+                           !tree_mask_bit(bitmask,
+                                          ti - bitmask.non_tree_cache_size,
+                                          query_token));
 
         // if (head_idx == 0 && ti == 0 && request_idx == 15 && !mask) {
         //   printf("spec inc attn qkqkqk  request id %d,  %.10f, %d\n",
@@ -215,8 +220,9 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
     for (int ti = first_step + tidx; ti < totalCacheSize;
          ti += THREADS_PER_BLOCK) {
       bool const mask = (ti >= bitmask.non_tree_cache_size &&
-                         (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                            (1 << query_token))));
+                         !tree_mask_bit(bitmask,
+                                        ti - bitmask.non_tree_cache_size,
+                                        query_token));
       float logit = mask ? 0.0f : __expf(qk_smem[ti - first_step] - qk_max);
       exp_sum += logit;
       qk_smem[ti - first_step] = mask ? 0.0f : logit;
@@ -251,19 +257,21 @@ __global__ void compute_spec_inc_attention_kernel_generation_kernel(
 
     // The base pointer for the value in the cache buffer.
     DT const *v_cache_batch =
-        value_cache + batch_config_request_id * max_seq_length * hidden_size +
-        vi;
+        value_cache +
+        batch_config_request_id * max_seq_length * kv_hidden_size + vi;
 
     if (Dh == Dh_MAX || vi < Dh) {
       for (int ti = first_step + vo; ti < totalCacheSize; ti += V_PER_ITER) {
         // Load the values from the cache.
         int const ti_circ = ti % max_seq_length;
         V_vec v = *reinterpret_cast<V_vec const *>(
-            v_cache_batch + ti_circ * hidden_size + head_idx * per_head_size);
+            v_cache_batch + ti_circ * kv_hidden_size +
+            kv_head_idx * per_head_size);
 
         bool const mask = (ti >= bitmask.non_tree_cache_size &&
-                           (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                              (1 << query_token))));
+                           !tree_mask_bit(bitmask,
+                                          ti - bitmask.non_tree_cache_size,
+                                          query_token));
         float logit = mask ? 0.0f : qk_smem[ti - first_step];
         out = FlexFlow::fma(logit, cast_to_float(v), out);
       }
@@ -324,16 +332,17 @@ __global__ void spec_inc_store_kv_cache(
     int num_tokens,
     int max_seq_len,
     bool is_root,
-    int hidden_size) {
-  CUDA_KERNEL_LOOP(i, num_tokens * hidden_size) {
-    int token_idx = i / (hidden_size);
-    int offset = i % hidden_size;
+    int hidden_size,
+    int kv_hidden_size) {
+  CUDA_KERNEL_LOOP(i, num_tokens * kv_hidden_size) {
+    int token_idx = i / (kv_hidden_size);
+    int offset = i % kv_hidden_size;
 
-    size_t val_idx =
-        token_idx * QKV_WEIGHT_NUM * hidden_size + hidden_size + offset;
+    size_t val_idx = token_idx * (hidden_size + 2 * kv_hidden_size) +
+                     hidden_size + offset;
 
     DT kVal = devQKVProjArray[val_idx];
-    DT vVal = devQKVProjArray[val_idx + hidden_size];
+    DT vVal = devQKVProjArray[val_idx + kv_hidden_size];
 
     int const req_id = tokenInfos[token_idx].request_index;
     // int const tok_id = tokenInfos[token_idx].abs_depth_in_request;
@@ -341,7 +350,7 @@ __global__ void spec_inc_store_kv_cache(
     int const request_token_offset =
         requestInfo[req_id].first_token_offset_in_batch;
 
-    BatchConfig::BitMask bitmask = causalMask[req_id];
+    BatchConfig::BitMask const &bitmask = causalMask[req_id];
 
     // if prompt token -> token id
     // if tree token:
@@ -350,10 +359,10 @@ __global__ void spec_inc_store_kv_cache(
                           bitmask.tree_size - 1 - bitmask.this_layer_size +
                           token_idx - request_token_offset;
 
-    kCache_ptr[req_id * (hidden_size * max_seq_len) + (cache_idx)*hidden_size +
-               offset] = kVal;
-    vCache_ptr[req_id * (hidden_size * max_seq_len) + (cache_idx)*hidden_size +
-               offset] = vVal;
+    kCache_ptr[req_id * (kv_hidden_size * max_seq_len) +
+               (cache_idx)*kv_hidden_size + offset] = kVal;
+    vCache_ptr[req_id * (kv_hidden_size * max_seq_len) +
+               (cache_idx)*kv_hidden_size + offset] = vVal;
   }
 }
 
@@ -364,7 +373,7 @@ void update_kv_cache_kernel(SpecIncMultiHeadSelfAttentionMeta const *m,
   int num_tokens = bc->num_active_infr_tokens();
   int curr_depth = bc->beamRequestsInfo[0].current_depth;
   if (num_tokens > 0) {
-    int parallelism = m->hidden_size * KV_WEIGHT_NUM * num_tokens;
+    int parallelism = m->kv_hidden_size * num_tokens;
     spec_inc_store_kv_cache<<<GET_BLOCKS(parallelism),
                               min(CUDA_NUM_THREADS, parallelism),
                               0,
@@ -384,7 +393,8 @@ void update_kv_cache_kernel(SpecIncMultiHeadSelfAttentionMeta const *m,
         BatchConfig::max_sequence_length() +
             BatchConfig::max_spec_tree_token_num(),
         /*root*/ curr_depth == 0,
-        m->hidden_size);
+        m->hidden_size,
+        m->kv_hidden_size);
   }
 }
 
@@ -411,6 +421,7 @@ void update_kv_cache_kernel(SpecIncMultiHeadSelfAttentionMeta const *m,
               BatchConfig::max_spec_tree_token_num(),                          \
           m->qProjSize,                                                        \
           m->hidden_size,                                                      \
+          m->kv_hidden_size,                                                   \
           m->request_infos,                                                    \
           m->beam_request_infos,                                               \
           m->causalMask,                                                       \
@@ -466,10 +477,8 @@ void compute_attention_kernel_prompt(SpecIncMultiHeadSelfAttentionMeta const *m,
                                      cudaStream_t stream) {
   checkCUDA(cublasSetStream(m->handle.blas, stream));
   checkCUDNN(cudnnSetStream(m->handle.dnn, stream));
-  cudaDataType_t cublas_data_type = ff_to_cuda_datatype(m->output_type[0]);
   cudnnDataType_t cudnn_data_type = ff_to_cudnn_datatype(m->output_type[0]);
   assert(data_type_size(m->output_type[0]) == sizeof(DT));
-  cudaDataType_t compute_type = cublas_data_type;
 
   int num_tokens = bc->num_active_tokens();
   int tokens_previous_requests = 0;
@@ -477,11 +486,11 @@ void compute_attention_kernel_prompt(SpecIncMultiHeadSelfAttentionMeta const *m,
   int q_block_size = m->qProjSize;
 
   int kt_block_size = m->kProjSize;
-  int kt_req_block_size = kt_block_size * m->num_q_heads *
+  int kt_req_block_size = kt_block_size * m->num_kv_heads *
                           (BatchConfig::max_sequence_length() +
                            BatchConfig::max_spec_tree_token_num());
   int vt_block_size = m->vProjSize;
-  int vt_req_block_size = vt_block_size * m->num_q_heads *
+  int vt_req_block_size = vt_block_size * m->num_kv_heads *
                           (BatchConfig::max_sequence_length() +
                            BatchConfig::max_spec_tree_token_num());
   assert(m->qProjSize == m->kProjSize);
@@ -512,8 +521,8 @@ void compute_attention_kernel_prompt(SpecIncMultiHeadSelfAttentionMeta const *m,
     int m_ = num_new_tokens;
     int n = total_tokens;
     int k = m->qProjSize;
-    int lda = k * m->num_q_heads * QKV_WEIGHT_NUM, ldb = k * m->num_q_heads,
-        ldc = m_;
+    int lda = m->hidden_size + 2 * m->kv_hidden_size,
+        ldb = k * m->num_kv_heads, ldc = m_;
     int strideA = q_block_size;
     int strideB = kt_block_size;
     int strideC = num_new_tokens * total_tokens;
@@ -525,34 +534,28 @@ void compute_attention_kernel_prompt(SpecIncMultiHeadSelfAttentionMeta const *m,
     }
     // To get A, skip over Q entries from previous requests (same head)
     DT const *A = static_cast<DT *>(m->devQKVProjArray) +
-                  bc->requestsInfo[i].first_token_offset_in_batch *
-                      m->qProjSize * m->num_q_heads * QKV_WEIGHT_NUM;
+                  bc->requestsInfo[i].first_token_offset_in_batch * lda;
     DT const *B = static_cast<DT *>(m->keyCache) + i * kt_req_block_size;
     DT *C = static_cast<DT *>(m->qk_prods);
 
-    checkCUDA(cublasGemmStridedBatchedEx(m->handle.blas,
-                                         CUBLAS_OP_T,
-                                         CUBLAS_OP_N,
-                                         m_,
-                                         n,
-                                         k,
-                                         &alpha,
-                                         A,
-                                         cublas_data_type,
-                                         lda,
-                                         strideA,
-                                         B,
-                                         cublas_data_type,
-                                         ldb,
-                                         strideB,
-                                         &beta,
-                                         C,
-                                         cublas_data_type,
-                                         ldc,
-                                         strideC,
-                                         m->num_q_heads,
-                                         compute_type,
-                                         CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+    gemm_per_query_head<DT>(m,
+                            CUBLAS_OP_T,
+                            CUBLAS_OP_N,
+                            m_,
+                            n,
+                            k,
+                            &alpha,
+                            A,
+                            lda,
+                            strideA,
+                            B,
+                            ldb,
+                            strideB,
+                            &beta,
+                            C,
+                            ldc,
+                            strideC,
+                            false /*kv_is_a*/);
 
     // add alibi position bias to qk production
     if (*m->position_bias) {
@@ -624,7 +627,7 @@ void compute_attention_kernel_prompt(SpecIncMultiHeadSelfAttentionMeta const *m,
     m_ = m->vProjSize;
     n = num_new_tokens;
     k = total_tokens;
-    lda = m_ * m->num_q_heads, ldb = n, ldc = m_ * m->num_q_heads;
+    lda = m_ * m->num_kv_heads, ldb = n, ldc = m_ * m->num_q_heads;
     strideA = vt_block_size;
     strideB = num_new_tokens * total_tokens;
     strideC = m->vProjSize;
@@ -641,29 +644,24 @@ void compute_attention_kernel_prompt(SpecIncMultiHeadSelfAttentionMeta const *m,
 
     C = static_cast<DT *>(m->attn_heads) +
         (token_offset)*m->num_q_heads * m->vProjSize;
-    checkCUDA(cublasGemmStridedBatchedEx(m->handle.blas,
-                                         CUBLAS_OP_N,
-                                         CUBLAS_OP_T,
-                                         m_,
-                                         n,
-                                         k,
-                                         &alpha,
-                                         A,
-                                         cublas_data_type,
-                                         lda,
-                                         strideA,
-                                         B,
-                                         cublas_data_type,
-                                         ldb,
-                                         strideB,
-                                         &beta,
-                                         C,
-                                         cublas_data_type,
-                                         ldc,
-                                         strideC,
-                                         m->num_q_heads,
-                                         compute_type,
-                                         CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+    gemm_per_query_head<DT>(m,
+                            CUBLAS_OP_N,
+                            CUBLAS_OP_T,
+                            m_,
+                            n,
+                            k,
+                            &alpha,
+                            A,
+                            lda,
+                            strideA,
+                            B,
+                            ldb,
+                            strideB,
+                            &beta,
+                            C,
+                            ldc,
+                            strideC,
+                            true /*kv_is_a*/);
 
     tokens_previous_requests += num_new_tokens;
     tokens_prev_requests_squares += num_new_tokens * total_tokens;
@@ -687,9 +685,9 @@ void inference_kernel(SpecIncMultiHeadSelfAttentionMeta const *m,
                       cudaStream_t stream) {
 
   // phase 0: copy calculated qkv into devQKVProjArray
-  // [qProjSize, num_heads, 3, num_new_tokens]
+  // [qProjSize * num_q_heads + 2 * kProjSize * num_kv_heads, num_new_tokens]
   size_t qkv_proj_size =
-      m->qProjSize * m->num_q_heads * QKV_WEIGHT_NUM * bc->num_active_tokens();
+      (m->hidden_size + 2 * m->kv_hidden_size) * bc->num_active_tokens();
 
   cudaMemcpyAsync(m->devQKVProjArray,
                   qkv_ptr,
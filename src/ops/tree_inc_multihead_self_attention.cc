@@ -508,9 +508,11 @@ OpMeta *TreeIncMultiHeadSelfAttention::init_task(
   assert(attn->kvSeqLength == input.domain.hi()[1] - input.domain.lo()[1] + 1);
 
   int num_q_heads = attn->num_q_heads / attn->tensor_parallelism_degree;
-  int num_kv_heads =
-      attn->num_kv_heads / attn->tensor_parallelism_degree +
-      (attn->num_kv_heads % attn->tensor_parallelism_degree != 0);
+  // the input holds the K/V heads chosen by FFModel::get_num_stored_kv_heads
+  int num_stored_kv_heads =
+      (attn->qSize / attn->qProjSize - attn->num_q_heads) / 2;
+  assert(num_stored_kv_heads % attn->tensor_parallelism_degree == 0);
+  int num_kv_heads = num_stored_kv_heads / attn->tensor_parallelism_degree;
 
   Memory gpu_mem = get_proc_mem(Machine::get_machine(), task->target_proc);
   MemoryAllocator gpu_mem_allocator(gpu_mem);
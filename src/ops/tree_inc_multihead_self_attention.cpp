@@ -108,7 +108,7 @@ __global__ void compute_attention_kernel_fused_kernel(
   int const qlength =
       request_infos[batch_config_request_id].num_tokens_in_batch;
 
-  BatchConfig::BitMask bitmask = causalMask[batch_config_request_id];
+  BatchConfig::BitMask const &bitmask = causalMask[batch_config_request_id];
 
   int first_token_idx = 0;
   for (int r = 0; r < batch_config_request_id; r++) {
@@ -187,8 +187,9 @@ __global__ void compute_attention_kernel_fused_kernel(
         bool const mask =
             prompt_phase ? (qi + q_start < ti)
                          : (ti >= bitmask.non_tree_cache_size &&
-                            (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                               (1 << qi))));
+                            !tree_mask_bit(bitmask,
+                                           ti - bitmask.non_tree_cache_size,
+                                           qi));
 
         qk_max = mask ? qk_max : fmaxf(qk_max, qk);
 
@@ -245,8 +246,9 @@ __global__ void compute_attention_kernel_fused_kernel(
       bool const mask =
           prompt_phase ? (q_start + qi < ti)
                        : (ti >= bitmask.non_tree_cache_size &&
-                          (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                             (1 << qi))));
+                          !tree_mask_bit(bitmask,
+                                         ti - bitmask.non_tree_cache_size,
+                                         qi));
       float logit = mask ? 0.0f : __expf(qk_smem[ti - first_step] - qk_max);
       exp_sum += logit;
       qk_smem[ti - first_step] = mask ? 0.0f : logit;
@@ -296,8 +298,9 @@ __global__ void compute_attention_kernel_fused_kernel(
               prompt_phase
                   ? (q_start + qi < ti)
                   : (ti >= bitmask.non_tree_cache_size &&
-                     (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                        (1 << qi))));
+                     !tree_mask_bit(bitmask,
+                                    ti - bitmask.non_tree_cache_size,
+                                    qi));
           float logit = mask ? 0.0f : qk_smem[ti - first_step];
           out = FlexFlow::fma(logit, cast_to_float(v), out);
         }
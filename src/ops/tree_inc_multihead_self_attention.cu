@@ -48,6 +48,7 @@ __global__ void compute_attention_kernel_fused_kernel(
     int const max_token_per_batch,
     int per_head_size,
     int hidden_size,
+    int kv_hidden_size,
     BatchConfig::PerRequestInfo *request_infos,
     int num_heads,
     int num_requests,
@@ -72,6 +73,8 @@ __global__ void compute_attention_kernel_fused_kernel(
   int const tidx = threadIdx.x;
   // head id
   int const head_idx = blockIdx.x;
+  // the K/V head shared by this query head
+  int const kv_head_idx = head_idx / (hidden_size / kv_hidden_size);
   // request idx
   int const request_idx = blockIdx.y;
 
@@ -86,7 +89,7 @@ __global__ void compute_attention_kernel_fused_kernel(
   int const qlength =
       request_infos[batch_config_request_id].num_tokens_in_batch;
 
-  BatchConfig::BitMask bitmask = causalMask[batch_config_request_id];
+  BatchConfig::BitMask const &bitmask = causalMask[batch_config_request_id];
 
   int first_token_idx = 0;
   for (int r = 0; r < batch_config_request_id; r++) {
@@ -109,8 +112,9 @@ __global__ void compute_attention_kernel_fused_kernel(
   // first WARPS_PER_BLOCK for store qk_max, second WARPS_PER_BLOCK for sum
   __shared__ float red_smem[WARPS_PER_BLOCK * 2];
 
-  const DT *q_ptr = query + first_token_idx * hidden_size * QKV_WEIGHT_NUM +
-                    head_idx * per_head_size;
+  int const qkv_size = hidden_size + 2 * kv_hidden_size;
+  const DT *q_ptr =
+      query + first_token_idx * qkv_size + head_idx * per_head_size;
   __shared__ Q_vec q_vecs[THREADS_PER_KEY][K_VECS_PER_THREAD];
 
   // the start offset of the element eg. (0, 1, 2, 3) * K_VEC_SIZE
@@ -127,7 +131,8 @@ __global__ void compute_attention_kernel_fused_kernel(
   constexpr int K_PER_WARP = WARP_SIZE / THREADS_PER_KEY;
 
   DT const *k_cache_batch =
-      key_cache + batch_config_request_id * max_seq_length * hidden_size + ki;
+      key_cache + batch_config_request_id * max_seq_length * kv_hidden_size +
+      ki;
 
   int ti_end =
       div_up(tlength - first_step, K_PER_WARP) * K_PER_WARP + first_step;
@@ -136,8 +141,7 @@ __global__ void compute_attention_kernel_fused_kernel(
 #pragma unroll
     for (int ii = 0; ii < K_VECS_PER_THREAD; ++ii) {
       q_vecs[ki_o][ii] = *reinterpret_cast<Q_vec const *>(
-          q_ptr + (hidden_size * QKV_WEIGHT_NUM * qi) + ki +
-          ii * THREADS_PER_KEY * K_VEC_SIZE);
+          q_ptr + (qkv_size * qi) + ki + ii * THREADS_PER_KEY * K_VEC_SIZE);
 
       // if (head_idx == 0 && request_idx == 1 && tidx == 0) {
       //     printf("laod q %d,  %d %.10f\n",
@@ -155,8 +159,8 @@ __global__ void compute_attention_kernel_fused_kernel(
         int jj = ii * THREADS_PER_KEY * K_VEC_SIZE;
         if (ti < tlength) {
           k[ii] = *reinterpret_cast<K_vec const *>(
-              k_cache_batch + ti_circ * hidden_size + head_idx * per_head_size +
-              jj);
+              k_cache_batch + ti_circ * kv_hidden_size +
+              kv_head_idx * per_head_size + jj);
         }
       }
       float qk = scale * Qk_dot<DT, THREADS_PER_KEY>::dot(q_vecs[ki_o], k);
@@ -165,8 +169,9 @@ __global__ void compute_attention_kernel_fused_kernel(
         bool const mask =
             prompt_phase ? (qi + q_start < ti)
                          : (ti >= bitmask.non_tree_cache_size &&
-                            (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                               (1 << qi))));
+                            !tree_mask_bit(bitmask,
+                                           ti - bitmask.non_tree_cache_size,
+                                           qi));
 
         qk_max = mask ? qk_max : fmaxf(qk_max, qk);
 
@@ -223,8 +228,9 @@ __global__ void compute_attention_kernel_fused_kernel(
       bool const mask =
           prompt_phase ? (q_start + qi < ti)
                        : (ti >= bitmask.non_tree_cache_size &&
-                          (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                             (1 << qi))));
+                          !tree_mask_bit(bitmask,
+                                         ti - bitmask.non_tree_cache_size,
+                                         qi));
       float logit = mask ? 0.0f : __expf(qk_smem[ti - first_step] - qk_max);
       exp_sum += logit;
       qk_smem[ti - first_step] = mask ? 0.0f : logit;
@@ -258,8 +264,8 @@ __global__ void compute_attention_kernel_fused_kernel(
 
     // The base pointer for the value in the cache buffer.
     DT const *v_cache_batch =
-        value_cache + batch_config_request_id * max_seq_length * hidden_size +
-        vi;
+        value_cache +
+        batch_config_request_id * max_seq_length * kv_hidden_size + vi;
 
     if (Dh == Dh_MAX || vi < Dh) {
       for (int ti = first_step + vo; ti < tlength; ti += V_PER_ITER) {
@@ -267,15 +273,17 @@ __global__ void compute_attention_kernel_fused_kernel(
         int const ti_circ = ti % max_seq_length;
         // int const real_cache_idx = topology.real_token_pos[sub_req_idx][ti];
         V_vec v = *reinterpret_cast<V_vec const *>(
-            v_cache_batch + ti_circ * hidden_size + head_idx * per_head_size);
+            v_cache_batch + ti_circ * kv_hidden_size +
+            kv_head_idx * per_head_size);
 
         if (ti < tlength) {
           bool const mask =
               prompt_phase
                   ? (q_start + qi < ti)
                   : (ti >= bitmask.non_tree_cache_size &&
-                     (!(bitmask.mask[ti - bitmask.non_tree_cache_size] &
-                        (1 << qi))));
+                     !tree_mask_bit(bitmask,
+                                    ti - bitmask.non_tree_cache_size,
+                                    qi));
           float logit = mask ? 0.0f : qk_smem[ti - first_step];
           out = FlexFlow::fma(logit, cast_to_float(v), out);
         }
@@ -344,28 +352,30 @@ __global__ void commit_tokens_kernel(
     int num_tokens_to_commit,
     int num_active_tokens_in_last_batch,
     int max_seq_len,
-    int hidden_size) {
+    int hidden_size,
+    int kv_hidden_size) {
 
-  CUDA_KERNEL_LOOP(i, num_tokens_to_commit * hidden_size) {
+  CUDA_KERNEL_LOOP(i, num_tokens_to_commit * kv_hidden_size) {
 
-    int token_pos = i / (hidden_size);
+    int token_pos = i / (kv_hidden_size);
     int token_idx_in_last_batch = committedTokenInfos[token_pos].token_index;
-    int offset = i % hidden_size;
+    int offset = i % kv_hidden_size;
     assert(token_idx_in_last_batch < num_active_tokens_in_last_batch);
 
-    size_t val_idx = token_idx_in_last_batch * QKV_WEIGHT_NUM * hidden_size +
-                     hidden_size + offset;
+    size_t val_idx =
+        token_idx_in_last_batch * (hidden_size + 2 * kv_hidden_size) +
+        hidden_size + offset;
 
     DT kVal = devQKVProjArray[val_idx];
-    DT vVal = devQKVProjArray[val_idx + hidden_size];
+    DT vVal = devQKVProjArray[val_idx + kv_hidden_size];
 
     int const req_id = committedTokenInfos[token_pos].request_index;
     int const tok_id = committedTokenInfos[token_pos].token_depth;
 
-    kCache_ptr[req_id * (hidden_size * max_seq_len) + tok_id * hidden_size +
-               offset] = kVal;
-    vCache_ptr[req_id * (hidden_size * max_seq_len) + tok_id * hidden_size +
-               offset] = vVal;
+    kCache_ptr[req_id * (kv_hidden_size * max_seq_len) +
+               tok_id * kv_hidden_size + offset] = kVal;
+    vCache_ptr[req_id * (kv_hidden_size * max_seq_len) +
+               tok_id * kv_hidden_size + offset] = vVal;
   }
 }
 
@@ -375,7 +385,7 @@ void commit_tokens(TreeIncMultiHeadSelfAttentionMeta const *m,
                    cudaStream_t stream) {
   int num_tokens_to_commit = bc->num_tokens_to_commit;
   if (num_tokens_to_commit > 0) {
-    int parallelism = m->hidden_size * KV_WEIGHT_NUM * num_tokens_to_commit;
+    int parallelism = m->kv_hidden_size * num_tokens_to_commit;
     commit_tokens_kernel<<<GET_BLOCKS(parallelism),
                            min(CUDA_NUM_THREADS, parallelism),
                            0,
@@ -391,7 +401,8 @@ void commit_tokens(TreeIncMultiHeadSelfAttentionMeta const *m,
         m->num_active_infr_tokens, // number of active tokens in previous batch
         BatchConfig::max_sequence_length() +
             BatchConfig::max_spec_tree_token_num(),
-        m->hidden_size);
+        m->hidden_size,
+        m->kv_hidden_size);
   }
 }
 
@@ -408,25 +419,26 @@ __global__ void update_tree_branch_kv_cache(
     int processed_tokens_in_batch,
     int total_tokens_in_batch,
     int max_seq_len,
-    int hidden_size) {
-  CUDA_KERNEL_LOOP(i, num_tokens_in_branch * hidden_size) {
+    int hidden_size,
+    int kv_hidden_size) {
+  CUDA_KERNEL_LOOP(i, num_tokens_in_branch * kv_hidden_size) {
 
-    int token_idx = i / (hidden_size);
-    int offset = i % hidden_size;
+    int token_idx = i / (kv_hidden_size);
+    int offset = i % kv_hidden_size;
 
     token_idx += processed_tokens_in_batch; // get index in the whole batch
-    size_t val_idx =
-        token_idx * QKV_WEIGHT_NUM * hidden_size + hidden_size + offset;
+    size_t val_idx = token_idx * (hidden_size + 2 * kv_hidden_size) +
+                     hidden_size + offset;
 
     DT kVal = devQKVProjArray[val_idx];
-    DT vVal = devQKVProjArray[val_idx + hidden_size];
+    DT vVal = devQKVProjArray[val_idx + kv_hidden_size];
 
     int const req_id = tokenInfos[token_idx].request_index;
     int const tok_id = tokenInfos[token_idx].abs_depth_in_request;
-    kCache_ptr[req_id * (hidden_size * max_seq_len) + tok_id * hidden_size +
-               offset] = kVal;
-    vCache_ptr[req_id * (hidden_size * max_seq_len) + tok_id * hidden_size +
-               offset] = vVal;
+    kCache_ptr[req_id * (kv_hidden_size * max_seq_len) +
+               tok_id * kv_hidden_size + offset] = kVal;
+    vCache_ptr[req_id * (kv_hidden_size * max_seq_len) +
+               tok_id * kv_hidden_size + offset] = vVal;
   }
 }
 
@@ -442,16 +454,17 @@ __global__ void update_tree_branch_kv_cache_fused(
     int vProjSize,
     int num_new_tokens,
     int max_seq_len,
-    int hidden_size) {
-  CUDA_KERNEL_LOOP(i, num_new_tokens * hidden_size) {
+    int hidden_size,
+    int kv_hidden_size) {
+  CUDA_KERNEL_LOOP(i, num_new_tokens * kv_hidden_size) {
 
-    int token_idx = i / hidden_size;
-    int offset = i % hidden_size;
-    size_t val_idx =
-        token_idx * QKV_WEIGHT_NUM * hidden_size + hidden_size + offset;
+    int token_idx = i / kv_hidden_size;
+    int offset = i % kv_hidden_size;
+    size_t val_idx = token_idx * (hidden_size + 2 * kv_hidden_size) +
+                     hidden_size + offset;
 
     DT kVal = devQKVProjArray[val_idx];
-    DT vVal = devQKVProjArray[val_idx + hidden_size];
+    DT vVal = devQKVProjArray[val_idx + kv_hidden_size];
 
     int const req_id = tokenInfos[token_idx].request_index;
     // int const tok_id = tokenInfos[token_idx].abs_depth_in_request;
@@ -461,18 +474,18 @@ __global__ void update_tree_branch_kv_cache_fused(
     int const first_token_depth =
         request_infos[req_id].first_token_depth_in_request;
 
-    // if(i % hidden_size == 0){
+    // if(i % kv_hidden_size == 0){
     //   printf("update token request id: %d, %d, %d  real id %d, value%.10f\n",
     //   req_id, token_idx, request_token_offset,(token_idx + first_token_depth
     //   - request_token_offset), kVal);
     // }
-    kCache_ptr[req_id * (hidden_size * max_seq_len) +
+    kCache_ptr[req_id * (kv_hidden_size * max_seq_len) +
                (token_idx + first_token_depth - request_token_offset) *
-                   hidden_size +
+                   kv_hidden_size +
                offset] = kVal;
-    vCache_ptr[req_id * (hidden_size * max_seq_len) +
+    vCache_ptr[req_id * (kv_hidden_size * max_seq_len) +
                (token_idx + first_token_depth - request_token_offset) *
-                   hidden_size +
+                   kv_hidden_size +
                offset] = vVal;
   }
 }
@@ -520,6 +533,7 @@ __global__ void tree_fill_entries_above_diagonal(DT *matrix,
           BatchConfig::max_tokens_per_batch(),                                 \
           m->qProjSize,                                                        \
           m->hidden_size,                                                      \
+          m->kv_hidden_size,                                                   \
           m->request_infos,                                                    \
           m->num_q_heads,                                                      \
           bc->num_active_requests(),                                           \
@@ -536,7 +550,7 @@ void compute_attention_kernel_fused(TreeIncMultiHeadSelfAttentionMeta const *m,
   // update the kv cache
   //  update K-V cache
   int num_new_tokens = bc->num_active_tokens();
-  int parallelism = m->hidden_size * num_new_tokens;
+  int parallelism = m->kv_hidden_size * num_new_tokens;
   update_tree_branch_kv_cache_fused<<<GET_BLOCKS(parallelism),
                                       min(CUDA_NUM_THREADS, parallelism),
                                       0,
@@ -552,7 +566,8 @@ void compute_attention_kernel_fused(TreeIncMultiHeadSelfAttentionMeta const *m,
       num_new_tokens,
       BatchConfig::max_sequence_length() +
           BatchConfig::max_spec_tree_token_num(),
-      m->hidden_size);
+      m->hidden_size,
+      m->kv_hidden_size);
 
   dim3 grid(m->num_q_heads, bc->num_active_requests());
   int const per_head_size = m->qProjSize;
@@ -594,9 +609,9 @@ void inference_kernel(TreeIncMultiHeadSelfAttentionMeta *m,
   m->num_active_infr_tokens = bc->num_active_infr_tokens();
 
   // phase 0: copy calculated qkv into devQKVProjArray
-  // [qProjSize, num_heads, 3, num_new_tokens]
+  // [qProjSize * num_q_heads + 2 * kProjSize * num_kv_heads, num_new_tokens]
   size_t qkv_proj_size =
-      m->qProjSize * m->num_q_heads * QKV_WEIGHT_NUM * bc->num_active_tokens();
+      (m->hidden_size + 2 * m->kv_hidden_size) * bc->num_active_tokens();
 
   cudaMemcpyAsync(m->devQKVProjArray,
                   qkv_ptr,
@@ -16,8 +16,13 @@
 #include "flexflow/batch_config.h"
 #include "flexflow/request_manager.h"
 #include "legion.h"
+#include "legion/legion_utilities.h"
+#include <atomic>
 #include <cassert>
 #include <climits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace FlexFlow {
 
@@ -53,7 +58,8 @@ void set_optimizer_tasks(OptimizerTasks &tasks,
   }
 }
 
-BatchConfig::BatchConfig() : num_tokens(0), num_peft_tokens(0) {
+BatchConfig::BatchConfig()
+    : num_tokens(0), num_peft_tokens(0), num_kv_block_table_entries(0) {
   for (int i = 0; i < MAX_NUM_REQUESTS; i++) {
     requestsInfo[i].first_token_depth_in_request = 0;
     requestsInfo[i].first_token_offset_in_batch = 0;
@@ -67,23 +73,249 @@ BatchConfig::BatchConfig() : num_tokens(0), num_peft_tokens(0) {
   }
 }
 
+namespace {
+// Task-local variable holding the BatchConfigs materialized by a task
+Legion::LocalVariableID const MATERIALIZED_BATCHES_VARIABLE_ID = 1;
+
+struct TaskMaterializedBatches {
+  Legion::UniqueID task_id;
+  std::vector<std::shared_ptr<BatchConfig const>> batches;
+};
+
+// the TaskMaterializedBatches of the running tasks, by task
+std::mutex task_materialized_batches_mutex;
+std::unordered_map<Legion::UniqueID, TaskMaterializedBatches *>
+    task_materialized_batches;
+
+void delete_task_materialized_batches(void *value) {
+  TaskMaterializedBatches *batches =
+      static_cast<TaskMaterializedBatches *>(value);
+  {
+    std::lock_guard<std::mutex> lock(task_materialized_batches_mutex);
+    task_materialized_batches.erase(batches->task_id);
+  }
+  delete batches;
+}
+
+// keep `bc` alive until the current task finishes, since the task uses the
+// pointer returned by from_future until then
+void retain_until_task_end(std::shared_ptr<BatchConfig const> const &bc) {
+  Legion::Runtime *runtime = Legion::Runtime::get_runtime();
+  Legion::Context ctx = Legion::Runtime::get_context();
+  Legion::UniqueID task_id = runtime->get_current_task(ctx)->get_unique_id();
+  TaskMaterializedBatches *batches = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(task_materialized_batches_mutex);
+    auto it = task_materialized_batches.find(task_id);
+    if (it != task_materialized_batches.end()) {
+      batches = it->second;
+    } else {
+      batches = new TaskMaterializedBatches();
+      batches->task_id = task_id;
+      task_materialized_batches[task_id] = batches;
+    }
+  }
+  if (batches->batches.empty()) {
+    runtime->set_local_task_variable(ctx,
+                                     MATERIALIZED_BATCHES_VARIABLE_ID,
+                                     batches,
+                                     delete_task_materialized_batches);
+  }
+  batches->batches.push_back(bc);
+}
+} // namespace
+
 /*static*/
 BatchConfig const *BatchConfig::from_future(BatchConfigFuture const &future) {
-  BatchConfig const *bc = static_cast<BatchConfig const *>(
-      Future(future).get_buffer(Memory::SYSTEM_MEM));
-  // Check future size
-  if (bc->get_mode() == INC_DECODING_MODE) {
-    assert(Future(future).get_untyped_size() == sizeof(BatchConfig));
-  } else if (bc->get_mode() == BEAM_SEARCH_MODE) {
-    assert(Future(future).get_untyped_size() == sizeof(BeamSearchBatchConfig));
-  } else if (bc->get_mode() == TREE_VERIFY_MODE) {
-    assert(Future(future).get_untyped_size() == sizeof(TreeVerifyBatchConfig));
-  } else {
-    assert(false && "Unsupported inference mode");
+  void const *buffer = Future(future).get_buffer(Memory::SYSTEM_MEM);
+  size_t size = Future(future).get_untyped_size();
+  // Speculative inference batches are plain objects, incremental decoding
+  // batches are always smaller than a BatchConfig
+  if (size == sizeof(BeamSearchBatchConfig)) {
+    BatchConfig const *bc = static_cast<BatchConfig const *>(buffer);
+    assert(bc->get_mode() == BEAM_SEARCH_MODE);
+    return bc;
+  } else if (size == sizeof(TreeVerifyBatchConfig)) {
+    BatchConfig const *bc = static_cast<BatchConfig const *>(buffer);
+    assert(bc->get_mode() == TREE_VERIFY_MODE);
+    return bc;
   }
+  std::shared_ptr<BatchConfig const> bc =
+      SerializedBatchConfig::materialize(buffer, size);
+  retain_until_task_end(bc);
+  return bc.get();
+}
+
+void BatchConfig::serialize(Legion::Serializer &sez) const {
+  assert(get_mode() == INC_DECODING_MODE);
+  sez.serialize(num_tokens);
+  sez.serialize(num_peft_tokens);
+  sez.serialize(num_peft_label_tokens);
+  sez.serialize(num_generation_tokens);
+  int num_requests = 0;
+  for (int i = 0; i < MAX_NUM_REQUESTS; i++) {
+    if (!request_completed[i]) {
+      num_requests++;
+    }
+  }
+  sez.serialize(num_requests);
+  for (int i = 0; i < MAX_NUM_REQUESTS; i++) {
+    if (request_completed[i]) {
+      continue;
+    }
+    sez.serialize(i);
+    sez.serialize(requestsInfo[i]);
+  }
+  // the slots of the active requests, in the order of their tokens. The
+  // entries are packed at the front of requestsInfo, possibly in slots of
+  // completed requests.
+  for (int k = 0; k < num_requests; k++) {
+    sez.serialize(requestsInfo[k].batch_config_request_id);
+  }
+  sez.serialize(tokensInfo, sizeof(PerTokenInfo) * num_tokens);
+  sez.serialize(labelsInfo, sizeof(PerTokenInfo) * num_peft_label_tokens);
+  sez.serialize(num_kv_block_table_entries);
+  sez.serialize(kv_block_table, sizeof(int) * num_kv_block_table_entries);
+  int num_penalty_tokens = penalty_tokens.size();
+  sez.serialize(num_penalty_tokens);
+  sez.serialize(penalty_tokens.data(), sizeof(TokenId) * num_penalty_tokens);
+}
+
+void BatchConfig::deserialize(Legion::Deserializer &dez) {
+  assert(get_mode() == INC_DECODING_MODE);
+  // reset the requests of the batch previously stored in this object
+  for (int i = 0; i < MAX_NUM_REQUESTS; i++) {
+    if (!request_completed[i]) {
+      requestsInfo[i] = PerRequestInfo();
+      request_completed[i] = true;
+    }
+  }
+  dez.deserialize(num_tokens);
+  dez.deserialize(num_peft_tokens);
+  dez.deserialize(num_peft_label_tokens);
+  dez.deserialize(num_generation_tokens);
+  assert(num_tokens <= MAX_NUM_TOKENS);
+  assert(num_peft_label_tokens <= MAX_NUM_TOKENS);
+  int num_requests;
+  dez.deserialize(num_requests);
+  for (int r = 0; r < num_requests; r++) {
+    int i;
+    dez.deserialize(i);
+    assert(i >= 0 && i < MAX_NUM_REQUESTS);
+    dez.deserialize(requestsInfo[i]);
+    request_completed[i] = false;
+  }
+  for (int k = 0; k < num_requests; k++) {
+    dez.deserialize(requestsInfo[k].batch_config_request_id);
+  }
+  dez.deserialize(tokensInfo, sizeof(PerTokenInfo) * num_tokens);
+  dez.deserialize(labelsInfo, sizeof(PerTokenInfo) * num_peft_label_tokens);
+  dez.deserialize(num_kv_block_table_entries);
+  assert(num_kv_block_table_entries <= MAX_KV_BLOCK_TABLE_SIZE);
+  dez.deserialize(kv_block_table, sizeof(int) * num_kv_block_table_entries);
+  int num_penalty_tokens;
+  dez.deserialize(num_penalty_tokens);
+  assert(num_penalty_tokens <= MAX_PENALTY_TOKENS);
+  penalty_tokens.resize(num_penalty_tokens);
+  dez.deserialize(penalty_tokens.data(),
+                  sizeof(TokenId) * num_penalty_tokens);
+}
+
+namespace {
+// Number of recently materialized batches cached by
+// SerializedBatchConfig::materialize, so that the tasks of the ops of a step
+// deserialize their batch only once per process. Tasks that still use an
+// evicted batch hold their own reference to it.
+int const MAX_MATERIALIZED_BATCHES = 2 * BatchConfig::MAX_INFLIGHT_BATCHES;
+
+struct MaterializedBatch {
+  // 0 for slots that were never used, batch ids start from 1
+  size_t batch_id = 0;
+  void const *buffer = nullptr;
+  std::shared_ptr<BatchConfig const> bc;
+};
+
+std::mutex materialized_batches_mutex;
+MaterializedBatch materialized_batches[MAX_MATERIALIZED_BATCHES];
+int next_materialized_batch = 0;
+std::atomic<size_t> next_serialized_batch_id(1);
+} // namespace
+
+// the compact form never reaches the size of a plain BatchConfig, which is
+// how from_future tells them apart
+static_assert(2 * sizeof(size_t) + 7 * sizeof(int) +
+                      BatchConfig::MAX_NUM_REQUESTS *
+                          (2 * sizeof(int) +
+                           sizeof(BatchConfig::PerRequestInfo)) +
+                      2 * BatchConfig::MAX_NUM_TOKENS *
+                          sizeof(BatchConfig::PerTokenInfo) +
+                      BatchConfig::MAX_KV_BLOCK_TABLE_SIZE * sizeof(int) +
+                      BatchConfig::MAX_PENALTY_TOKENS *
+                          sizeof(BatchConfig::TokenId) <
+                  sizeof(BatchConfig),
+              "compact BatchConfig may collide with the plain layout");
+
+SerializedBatchConfig::SerializedBatchConfig(BatchConfig const &bc) {
+  Legion::Serializer sez;
+  // total size, filled in below
+  sez.serialize((size_t)0);
+  sez.serialize(next_serialized_batch_id.fetch_add(1));
+  bc.serialize(sez);
+  size_t size = sez.get_used_bytes();
+  data.resize(size);
+  std::memcpy(data.data(), sez.get_buffer(), size);
+  std::memcpy(data.data(), &size, sizeof(size_t));
+}
+
+BatchConfigFuture SerializedBatchConfig::to_future() const {
+  return Future::from_untyped_pointer(data.data(), data.size());
+}
+
+/*static*/
+std::shared_ptr<BatchConfig const>
+    SerializedBatchConfig::materialize(void const *buffer, size_t size) {
+  Legion::Deserializer dez(buffer, size);
+  size_t total_size, batch_id;
+  dez.deserialize(total_size);
+  dez.deserialize(batch_id);
+  assert(total_size == size);
+  std::lock_guard<std::mutex> lock(materialized_batches_mutex);
+  for (int i = 0; i < MAX_MATERIALIZED_BATCHES; i++) {
+    if (materialized_batches[i].batch_id == batch_id &&
+        materialized_batches[i].buffer == buffer) {
+      return materialized_batches[i].bc;
+    }
+  }
+  // a new object, since the evicted one may still be in use
+  std::shared_ptr<BatchConfig> bc = std::make_shared<BatchConfig>();
+  bc->deserialize(dez);
+  assert(dez.get_remaining_bytes() == 0);
+  MaterializedBatch &slot = materialized_batches[next_materialized_batch];
+  next_materialized_batch =
+      (next_materialized_batch + 1) % MAX_MATERIALIZED_BATCHES;
+  slot.batch_id = batch_id;
+  slot.buffer = buffer;
+  slot.bc = bc;
   return bc;
 }
 
+size_t SerializedBatchConfig::legion_buffer_size() const {
+  return data.size();
+}
+
+size_t SerializedBatchConfig::legion_serialize(void *buffer) const {
+  std::memcpy(buffer, data.data(), data.size());
+  return data.size();
+}
+
+size_t SerializedBatchConfig::legion_deserialize(void const *buffer) {
+  size_t size;
+  std::memcpy(&size, buffer, sizeof(size_t));
+  data.resize(size);
+  std::memcpy(data.data(), buffer, size);
+  return size;
+}
+
 InferenceMode BatchConfig::get_mode() const {
   return INC_DECODING_MODE;
 }
@@ -135,6 +367,16 @@ int BatchConfig::max_spec_tree_token_num() {
   return RequestManager::get_request_manager()->get_max_spec_tree_token_num();
 }
 
+/*static*/
+int BatchConfig::kv_cache_block_size() {
+  return RequestManager::get_request_manager()->get_kv_cache_block_size();
+}
+
+/*static*/
+int BatchConfig::num_kv_cache_blocks() {
+  return RequestManager::get_request_manager()->get_num_kv_cache_blocks();
+}
+
 std::ostream &operator<<(std::ostream &os, BatchConfig const &bc) {
   os << "@@@@@@@@@@@@@@ Batch Config (mode " << bc.get_mode()
      << ") @@@@@@@@@@@@@@" << std::endl;
@@ -183,6 +425,18 @@ std::ostream &operator<<(std::ostream &os, BatchConfig const &bc) {
          << ", save_updated_weights: "
          << bc.requestsInfo[i].optimizer_tasks.save_updated_weights << "}"
          << std::endl;
+      if (bc.num_kv_block_table_entries > 0) {
+        os << "    KV block table offset: "
+           << bc.requestsInfo[i].kv_block_table_offset << std::endl;
+      }
+      if (bc.requestsInfo[i].do_sample) {
+        os << "    Sampling: {temperature: " << bc.requestsInfo[i].temperature
+           << ", top_p: " << bc.requestsInfo[i].top_p
+           << ", top_k: " << bc.requestsInfo[i].top_k
+           << ", repetition_penalty: "
+           << bc.requestsInfo[i].repetition_penalty
+           << ", seed: " << bc.requestsInfo[i].seed << "}" << std::endl;
+      }
       os << "    Request completed: " << bc.request_completed[i] << std::endl;
       os << "    Request running: " << bc.request_running[i] << std::endl;
     }
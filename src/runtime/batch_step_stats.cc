@@ -0,0 +1,55 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/batch_step_stats.h"
+#include <algorithm>
+
+namespace FlexFlow {
+
+void BatchStepStatsBuffer::push(BatchStepStats const &stats) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (steps.size() < CAPACITY) {
+    steps.push_back(stats);
+  } else {
+    steps[num_steps % CAPACITY] = stats;
+  }
+  steps[num_steps % CAPACITY].step = num_steps;
+  num_steps++;
+}
+
+std::vector<BatchStepStats>
+    BatchStepStatsBuffer::get_recent(size_t max_steps) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t count = std::min(max_steps, steps.size());
+  std::vector<BatchStepStats> result;
+  result.reserve(count);
+  for (size_t step = num_steps - count; step < num_steps; step++) {
+    result.push_back(steps[step % CAPACITY]);
+  }
+  return result;
+}
+
+size_t BatchStepStatsBuffer::get_num_steps() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return num_steps;
+}
+
+void BatchStepStatsBuffer::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  steps.clear();
+  num_steps = 0;
+}
+
+}; // namespace FlexFlow
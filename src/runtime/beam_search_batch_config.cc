@@ -16,6 +16,7 @@
 #include "flexflow/batch_config.h"
 #include "flexflow/request_manager.h"
 #include "legion.h"
+#include <algorithm>
 #include <cassert>
 #include <climits>
 
@@ -85,6 +86,28 @@ int BeamSearchBatchConfig::max_beam_depth_all_requests() const {
   return max_depth_all_requests;
 }
 
+int BeamSearchBatchConfig::max_beam_size_all_requests() const {
+  int max_beam_size = 1;
+  for (int i = 0; i < BeamSearchBatchConfig::max_requests_per_batch(); i++) {
+    if (!request_completed[i]) {
+      max_beam_size = std::max(max_beam_size, beamRequestsInfo[i].beam_size);
+    }
+  }
+  assert(max_beam_size <= BeamSearchBatchConfig::MAX_BEAM_WIDTH);
+  return max_beam_size;
+}
+
+int BeamSearchBatchConfig::get_num_ssm_steps() const {
+  for (int i = 0; i < BeamSearchBatchConfig::max_requests_per_batch(); i++) {
+    if (!request_completed[i] && !request_running[i]) {
+      // prompts are loaded into the SSM's KV cache over the steps of a round
+      return BeamSearchBatchConfig::MAX_BEAM_DEPTH;
+    }
+  }
+  // every tree is complete once the deepest one is
+  return std::max(max_beam_depth_all_requests(), 1);
+}
+
 int BeamSearchBatchConfig::get_speculative_request_num() const {
   return speculative_request_num;
 }
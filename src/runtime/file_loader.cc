@@ -18,6 +18,11 @@
 #include "flexflow/inference.h"
 #include "flexflow/model.h"
 
+#include <fcntl.h>
+#include <filesystem>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 using namespace std;
 
@@ -35,7 +40,14 @@ FileDataLoader::FileDataLoader(std::string _prompts_filepath,
       num_heads(_num_heads), num_kv_heads(_num_kv_heads),
       hidden_dim(_hidden_dim), qkv_inner_dim(_qkv_inner_dim),
       tensor_parallelism_degree(_tensor_parallelism_degree),
-      use_full_precision(_use_full_precision){};
+      use_full_precision(_use_full_precision) {
+  std::string container_filepath =
+      join_path({weights_folder, WeightContainer::FILENAME});
+  if (std::filesystem::exists(container_filepath)) {
+    std::cout << "Loading weights from " << container_filepath << std::endl;
+    weight_container = std::make_unique<WeightContainer>(container_filepath);
+  }
+};
 
 BatchConfig::TokenId *FileDataLoader::generate_requests(int num, int length) {
 
@@ -80,6 +92,100 @@ std::string removeGuidOperatorName(std::string const &input) {
   }
 }
 
+// Reads ranges of elements of a weight file, so that a tensor parallel
+// shard only reads the parts of the file it owns. Ranges come from the
+// packed container of the weights folder when there is one, and from
+// positional reads of the file otherwise. Large ranges are split across the
+// threads of `io_pool`
+template <typename DT>
+class WeightFileReader {
+public:
+  // `size` is the number of elements the file must at least hold
+  WeightFileReader(WeightContainer const *container,
+                   WeightIOPool *_io_pool,
+                   std::string const &weights_folder,
+                   std::string const &_filename,
+                   size_t size)
+      : io_pool(_io_pool), filename(_filename) {
+    size_t file_size = 0;
+    if (container != nullptr) {
+      WeightContainer::TensorInfo const *info = container->find(filename);
+      if (info == nullptr) {
+        std::cout << "Could not find weight " << filename << " in "
+                  << WeightContainer::FILENAME << std::endl;
+        assert(false);
+      }
+      data = container->get_data(*info);
+      file_size = info->size;
+    } else {
+      std::string weight_filepath = join_path({weights_folder, filename});
+      fd = open(weight_filepath.c_str(), O_RDONLY);
+      if (fd < 0) {
+        std::cout << "Could not open file: " << weight_filepath << std::endl;
+      }
+      assert(fd >= 0 && "incorrect weight file path");
+      struct stat st;
+      int ret = fstat(fd, &st);
+      assert(ret == 0);
+      file_size = st.st_size;
+      // shards mostly read the file front to back
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    if (file_size < sizeof(DT) * size) {
+      std::cout << "load weight data error " << file_size << ", "
+                << sizeof(DT) * size << ", " << filename << std::endl;
+      assert(false);
+    }
+  }
+  ~WeightFileReader() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  WeightFileReader(WeightFileReader const &) = delete;
+  WeightFileReader &operator=(WeightFileReader const &) = delete;
+
+  // copies elements [offset, offset + count) of the file into `dst`
+  void read(size_t offset, size_t count, DT *dst) const {
+    if (data != nullptr) {
+      io_pool->copy(
+          data + sizeof(DT) * offset, sizeof(DT) * count, (char *)dst);
+      return;
+    }
+    if (!io_pool->pread(
+            fd, sizeof(DT) * offset, sizeof(DT) * count, (char *)dst)) {
+      std::cout << "load weight data error " << sizeof(DT) * count
+                << " bytes at " << sizeof(DT) * offset << ", " << filename
+                << std::endl;
+      assert(false);
+    }
+  }
+
+  // hands the bytes of elements [offset, offset + count) of the file to
+  // `consume`, chunk by chunk, for weights that are transformed while loaded
+  void read(size_t offset,
+            size_t count,
+            WeightIOPool::ChunkConsumer const &consume) const {
+    if (data != nullptr) {
+      io_pool->copy(data + sizeof(DT) * offset, sizeof(DT) * count, consume);
+      return;
+    }
+    if (!io_pool->pread(
+            fd, sizeof(DT) * offset, sizeof(DT) * count, consume)) {
+      std::cout << "load weight data error " << sizeof(DT) * count
+                << " bytes at " << sizeof(DT) * offset << ", " << filename
+                << std::endl;
+      assert(false);
+    }
+  }
+
+private:
+  WeightIOPool *io_pool;
+  std::string filename;
+  char const *data = nullptr;
+  int fd = -1;
+};
+
 template <typename DT>
 void load_attention_o_proj_bias_to_dense_v2(DT *ptr,
                                             int num_heads,
@@ -87,50 +193,19 @@ void load_attention_o_proj_bias_to_dense_v2(DT *ptr,
                                             size_t hidden_dim,
                                             size_t qkv_inner_dim,
                                             std::string layer_name,
-                                            std::string weights_folder) {
+                                            std::string weights_folder,
+                                            WeightContainer const *container,
+                                            WeightIOPool *io_pool) {
   std::string filename = layer_name + ".o_proj.bias";
 
-  int file_index = 0;
-
   // now only opt use this.
   // assert(num_heads == num_kv_heads);
-  int idx = 0;
-
   std::cout << "Loading weight file " << filename << std::endl;
-  std::string weight_filepath = join_path({weights_folder, filename});
 
-  int n_heads = num_heads;
-
-  int replicate_num = num_heads / num_kv_heads;
-
-  size_t out_partial_size = hidden_dim;
-  size_t partial_size = out_partial_size;
-  std::ifstream in(weight_filepath, std::ios::in | std::ios::binary);
-  assert(in.good() && "incorrect bias file path");
-  std::vector<DT> host_array(partial_size);
-  size_t loaded_data_size = sizeof(DT) * partial_size;
-  in.seekg(0, in.end);
-  in.seekg(0, in.beg);
-  in.read((char *)host_array.data(), loaded_data_size);
-  size_t in_get_size = in.gcount();
-
-  if (in_get_size != loaded_data_size) {
-    printf(
-        "load bias data error: in_get_size (%lu) != loaded_data_size (%lu)\n",
-        in_get_size,
-        loaded_data_size);
-    assert(false);
-  }
-  assert(partial_size == host_array.size());
-
-  size_t data_index = 0;
-
-  for (int i = 0; i < partial_size; i++) {
-    ptr[i] = host_array.at(data_index);
-    data_index++;
-  }
-
-  in.close();
+  size_t partial_size = hidden_dim;
+  WeightFileReader<DT> reader(
+      container, io_pool, weights_folder, filename, partial_size);
+  reader.read(0, partial_size, ptr);
 }
 
 template <typename DT>
@@ -142,6 +217,9 @@ void load_attention_bias_v2(DT *ptr,
                             bool final_bias,
                             std::string layer_name,
                             std::string weights_folder,
+                            WeightContainer const *container,
+                            WeightIOPool *io_pool,
+                            size_t volume,
                             int tp_degree) {
   std::string q_file = layer_name + ".q_proj.bias";
   std::string k_file = layer_name + ".k_proj.bias";
@@ -158,58 +236,55 @@ void load_attention_bias_v2(DT *ptr,
   // [v_heads_shard_0], ..., [q_heads_shard_n], [k_heads_shard_n],
   // [v_heads_shard_n]] where n = tp_degree
   assert(num_heads % tp_degree == 0);
-  assert(num_kv_heads % tp_degree == 0);
   assert(hidden_dim % num_heads == 0);
   assert(qkv_inner_dim == hidden_dim / num_heads);
+  // the kv heads may be replicated, as in load_attention_weights_to_dense_v2
+  assert(volume % qkv_inner_dim == 0);
+  int num_stored_kv_heads = (volume / qkv_inner_dim - num_heads) / 2;
+  assert(num_stored_kv_heads % num_kv_heads == 0);
+  assert(num_stored_kv_heads % tp_degree == 0);
+  int replicate_num = num_stored_kv_heads / num_kv_heads;
   size_t q_heads_per_shard = num_heads / tp_degree;
-  size_t kv_heads_per_shard = num_kv_heads / tp_degree;
+  size_t kv_heads_per_shard = num_stored_kv_heads / tp_degree;
   size_t shard_chunk_size =
       (q_heads_per_shard + 2 * kv_heads_per_shard) * qkv_inner_dim;
 
   int file_index = 0;
   for (auto filename : bias_files) {
     std::cout << "Loading weight file " << filename << std::endl;
-    std::string weight_filepath = join_path({weights_folder, filename});
 
-    int n_heads = file_index == 0 ? num_heads : num_kv_heads;
-    assert(n_heads % tp_degree == 0);
+    int n_heads = file_index == 0 ? num_heads : num_stored_kv_heads;
     int heads_per_shard = n_heads / tp_degree;
     int qkv_prev_heads_cur_shard =
-        (file_index == 2) ? num_heads + num_kv_heads : file_index * num_heads;
-    assert(qkv_prev_heads_cur_shard % tp_degree == 0);
-    qkv_prev_heads_cur_shard /= tp_degree;
-
-    // load into memory first
-    size_t bias_size = qkv_inner_dim * n_heads;
-    std::ifstream in(weight_filepath, std::ios::in | std::ios::binary);
-    assert(in.good() && "incorrect bias file path");
-    std::vector<DT> host_array(bias_size);
-    size_t loaded_data_size = sizeof(DT) * bias_size;
-    in.seekg(0, in.beg);
-    in.read((char *)host_array.data(), loaded_data_size);
-    size_t in_get_size = in.gcount();
-    if (in_get_size != loaded_data_size) {
-      printf(
-          "load bias data error: in_get_size (%lu) != loaded_data_size (%lu)\n",
-          in_get_size,
-          loaded_data_size);
-      assert(false);
-    }
-    assert(bias_size == host_array.size());
+        file_index == 0 ? 0
+                        : q_heads_per_shard +
+                              (file_index - 1) * kv_heads_per_shard;
+
+    size_t bias_size =
+        qkv_inner_dim * (file_index == 0 ? num_heads : num_kv_heads);
+    WeightFileReader<DT> reader(
+        container, io_pool, weights_folder, filename, bias_size);
 
-    // now copy chunks into ptr
     for (int i = 0; i < n_heads; i++) {
+      int head_idx = i % heads_per_shard;
       int shard_idx = i / heads_per_shard;
-      for (int j = 0; j < qkv_inner_dim; j++) {
-        int src_idx = i * qkv_inner_dim + j;
-        int dst_idx = shard_idx * shard_chunk_size +
-                      qkv_prev_heads_cur_shard * qkv_inner_dim +
-                      (i % heads_per_shard) * qkv_inner_dim + j;
-        ptr[dst_idx] = host_array.at(src_idx);
+      DT *dst = ptr + shard_idx * shard_chunk_size +
+                (qkv_prev_heads_cur_shard + head_idx) * qkv_inner_dim;
+      if (file_index == 0) {
+        // the q heads of a shard are contiguous in the file, so each shard
+        // reads its own chunk straight into place
+        if (head_idx == 0) {
+          reader.read(shard_idx * heads_per_shard * qkv_inner_dim,
+                      heads_per_shard * qkv_inner_dim,
+                      dst);
+        }
+      } else if (head_idx > 0 && (i - 1) / replicate_num == i / replicate_num) {
+        memcpy(dst, dst - qkv_inner_dim, sizeof(DT) * qkv_inner_dim);
+      } else {
+        reader.read((i / replicate_num) * qkv_inner_dim, qkv_inner_dim, dst);
       }
     }
     file_index++;
-    in.close();
   }
 }
 
@@ -221,6 +296,8 @@ void load_attention_weights_to_dense_v2(DT *ptr,
                                         size_t qkv_inner_dim,
                                         std::string layer_name,
                                         std::string weights_folder,
+                                        WeightContainer const *container,
+                                        WeightIOPool *io_pool,
                                         size_t volume,
                                         int tensor_parallelism_degree,
                                         bool load_o_proj) {
@@ -240,64 +317,51 @@ void load_attention_weights_to_dense_v2(DT *ptr,
   size_t one_weight_file_size =
       num_heads * single_proj_size; // size of each of Q/K/V/O for all heads
 
-  size_t q_size = one_weight_file_size, o_size = one_weight_file_size;
-  size_t k_size = single_proj_size * num_kv_heads,
-         v_size = single_proj_size * num_kv_heads;
-
-  size_t k_replicate_size = one_weight_file_size;
-  size_t v_replicate_size = one_weight_file_size;
-
-  int replicate_num = num_heads / num_kv_heads;
-
-  // stride for q, k, v, o
-  size_t stride_size = (q_size + v_replicate_size + k_replicate_size) /
-                       tensor_parallelism_degree;
   if (!load_o_proj) {
+    // the qkv projection holds either the kv heads themselves or a replica
+    // per q head, see FFModel::get_num_stored_kv_heads
+    assert(volume % single_proj_size == 0);
+    int num_stored_kv_heads = (volume / single_proj_size - num_heads) / 2;
+    assert(num_stored_kv_heads % num_kv_heads == 0);
+    assert(num_stored_kv_heads % tensor_parallelism_degree == 0);
+    int replicate_num = num_stored_kv_heads / num_kv_heads;
+    int stored_kv_heads_per_shard =
+        num_stored_kv_heads / tensor_parallelism_degree;
+    // stride for q, k, v
+    size_t stride_size = volume / tensor_parallelism_degree;
     for (auto filename : weight_filenames) {
       std::cout << "Loading weight file " << filename << std::endl;
-      std::string weight_filepath = join_path({weights_folder, filename});
 
-      int data_index = 0;
-      size_t partial_size = (file_index == 0 || file_index == 3)
-                                ? one_weight_file_size
-                                : single_proj_size * num_kv_heads;
+      size_t partial_size = file_index == 0 ? one_weight_file_size
+                                            : single_proj_size * num_kv_heads;
       size_t one_partition_size =
-          one_weight_file_size / tensor_parallelism_degree;
+          file_index == 0
+              ? one_weight_file_size / tensor_parallelism_degree
+              : single_proj_size * stored_kv_heads_per_shard;
 
-      std::ifstream in(weight_filepath, std::ios::in | std::ios::binary);
-      if (!in.good()) {
-        std::cout << "Could not open file: " << weight_filepath << std::endl;
-      }
-      assert(in.good() && "incorrect weight file path");
-      std::vector<DT> host_array(partial_size);
-      size_t loaded_data_size = sizeof(DT) * partial_size;
-      in.seekg(0, in.end);
-      in.seekg(0, in.beg);
-      in.read((char *)host_array.data(), loaded_data_size);
-      size_t in_get_size = in.gcount();
-
-      if (in_get_size != loaded_data_size) {
-        std::cout << "load attention data error " << in_get_size << ", "
-                  << loaded_data_size << ", " << file_index << ", "
-                  << weight_filepath << "\n";
-        assert(false && "data size mismatch");
-      }
-      // wq, wk, wo
+      WeightFileReader<DT> reader(
+          container, io_pool, weights_folder, filename, partial_size);
+      // each shard only reads the heads it owns, straight into place
       if (file_index == 0) {
+        // wq: the heads of a shard are contiguous in the file
         for (int i = 0; i < tensor_parallelism_degree; i++) {
-          for (int j = 0; j < one_partition_size; j++) {
-            ptr[base_index + i * stride_size + j] = host_array.at(data_index++);
-          }
+          reader.read(i * one_partition_size,
+                      one_partition_size,
+                      ptr + base_index + i * stride_size);
         }
       } else {
-        for (int i = 0; i < num_heads; i++) {
-          int kv_idx = i / (num_heads / num_kv_heads);
-          int head_idx = i % (num_heads / tensor_parallelism_degree);
-          int tp_idx = (i / (num_heads / tensor_parallelism_degree));
-          for (int j = 0; j < single_proj_size; j++) {
-            ptr[base_index + tp_idx * stride_size +
-                single_proj_size * head_idx + j] =
-                host_array.at(kv_idx * single_proj_size + j);
+        // wk, wv: each stored kv head of a shard is read once, and copied to
+        // its replicas if the kv heads are replicated
+        for (int i = 0; i < num_stored_kv_heads; i++) {
+          int kv_idx = i / replicate_num;
+          int head_idx = i % stored_kv_heads_per_shard;
+          int tp_idx = i / stored_kv_heads_per_shard;
+          DT *dst = ptr + base_index + tp_idx * stride_size +
+                    single_proj_size * head_idx;
+          if (head_idx > 0 && (i - 1) / replicate_num == kv_idx) {
+            memcpy(dst, dst - single_proj_size, sizeof(DT) * single_proj_size);
+          } else {
+            reader.read(kv_idx * single_proj_size, single_proj_size, dst);
           }
         }
       }
@@ -305,88 +369,25 @@ void load_attention_weights_to_dense_v2(DT *ptr,
       base_index += one_partition_size;
       file_index++;
     }
-    assert(base_index == (q_size + k_replicate_size + v_replicate_size) /
-                             tensor_parallelism_degree);
+    assert(base_index == stride_size);
   } else {
     std::cout << "Loading weight file " << o_file << std::endl;
-    std::string weight_filepath = join_path({weights_folder, o_file});
-
-    std::ifstream in(weight_filepath, std::ios::in | std::ios::binary);
-    if (!in.good()) {
-      std::cout << "Could not open file: " << weight_filepath << std::endl;
-    }
-    assert(in.good() && "incorrect weight file path");
-    std::vector<DT> host_array(one_weight_file_size);
-    size_t loaded_data_size = sizeof(DT) * one_weight_file_size;
-    in.seekg(0, in.end);
-    in.seekg(0, in.beg);
-    in.read((char *)host_array.data(), loaded_data_size);
-    size_t in_get_size = in.gcount();
-
-    DT temp;
-
-    for (int i = 0; i < one_weight_file_size; i++) {
-      temp = host_array.at(i);
-    }
-
-    // std::cout<<"o_proj loaded into host array, total size:
-    // "<<one_weight_file_size<<std::endl;
-
-    if (in_get_size != loaded_data_size) {
-      std::cout << "load data error" << std::endl;
-      assert(false);
-    }
-    assert(one_weight_file_size == host_array.size());
-    int data_index = 0;
-
-    // std::cout<<"read data size checked"<<std::endl;
-
-    for (int i = 0; i < one_weight_file_size; i++) {
-      ptr[i] = temp;
-    }
-
-    // std::cout<<"ptr allocation good"<<std::endl;
-
-    int one_partition_size =
-        qkv_inner_dim * (num_heads / tensor_parallelism_degree);
-    for (int i = 0; i < one_weight_file_size; i++) {
-      ptr[i] = host_array.at(data_index++);
-    }
-
-    in.close();
-
-    assert(data_index == one_weight_file_size);
-    // std::cout << "Loaded weight file " << o_file << std::endl;
+    WeightFileReader<DT> reader(
+        container, io_pool, weights_folder, o_file, one_weight_file_size);
+    reader.read(0, one_weight_file_size, ptr);
   }
 }
 
 template <typename DT>
-void load_from_file(DT *ptr, size_t size, std::string filepath) {
-  std::ifstream in(filepath, std::ios::in | std::ios::binary);
-  if (!in.good()) {
-    std::cout << "Could not open file: " << filepath << std::endl;
-  }
-  assert(in.good() && "incorrect weight file path");
-  std::vector<DT> host_array(size);
-  size_t loaded_data_size = sizeof(DT) * size;
-  in.seekg(0, in.end);
-  in.seekg(0, in.beg);
-  in.read((char *)host_array.data(), loaded_data_size);
-
-  size_t in_get_size = in.gcount();
-  if (in_get_size != loaded_data_size) {
-    std::cout << "load weight data error " << in_get_size << ", "
-              << loaded_data_size << ", " << sizeof(DT) << std::endl;
-    assert(false);
-  }
-  assert(size == host_array.size());
-
-  // normal
-  long data_index = 0;
-  for (auto v : host_array) {
-    ptr[data_index++] = v;
-  }
-  in.close();
+void load_from_file(DT *ptr,
+                    size_t size,
+                    std::string const &weights_folder,
+                    std::string const &filename,
+                    WeightContainer const *container,
+                    WeightIOPool *io_pool) {
+  WeightFileReader<DT> reader(
+      container, io_pool, weights_folder, filename, size);
+  reader.read(0, size, ptr);
 }
 
 void FileDataLoader::load_positions(FFModel *ff,
@@ -425,6 +426,8 @@ void load_attention_weights_quantized(char *ptr,
                                       size_t qkv_inner_dim,
                                       std::string layer_name,
                                       std::string weights_folder,
+                                      WeightContainer const *container,
+                                      WeightIOPool *io_pool,
                                       DataType data_type,
                                       bool use_full_precision) {
   std::string q_file = layer_name + ".q_proj.weight";
@@ -444,48 +447,39 @@ void load_attention_weights_quantized(char *ptr,
   // q, k, v, o -> 0, 1, 2, 3
   for (auto filename : weight_filenames) {
     std::cout << "Loading weight file " << filename << std::endl;
-    std::string weight_filepath = join_path({weights_folder, filename});
 
     size_t partial_size = one_weight_file_size;
-    std::ifstream in(weight_filepath, std::ios::in | std::ios::binary);
-    if (!in.good()) {
-      std::cout << "Could not open file: " << weight_filepath << std::endl;
-    }
-    assert(in.good() && "incorrect weight file path");
-    std::vector<char> host_array(partial_size);
-    size_t loaded_data_size = sizeof(char) * partial_size;
-    in.seekg(0, in.end);
-    in.seekg(0, in.beg);
-    in.read((char *)host_array.data(), loaded_data_size);
-    size_t in_get_size = in.gcount();
-
-    if (in_get_size != loaded_data_size) {
-      std::cout << "load data error";
-      return;
-    }
-    assert(partial_size == host_array.size());
+    WeightFileReader<char> reader(
+        container, io_pool, weights_folder, filename, partial_size);
 
     size_t one_head_size = data_type == DT_INT8
                                ? hidden_dim * (hidden_dim / num_heads)
                                : hidden_dim * (hidden_dim / num_heads) / 2;
-
-    size_t data_index = 0;
-    for (int i = 0; i < num_heads; i++) {
-      size_t start_index = i * one_head_size * 4 + file_index * one_head_size;
-      for (size_t j = start_index; j < start_index + one_head_size; j++) {
-        if (data_type == DT_INT4) {
-          char v1 = host_array.at(data_index);
-          char v2 = host_array.at(data_index + 1);
-          ptr[j] = (v2 & 0XF) | (v1 << 4);
-          data_index += 2;
-        } else {
-          ptr[j] = host_array.at(data_index);
-          data_index += 1;
-        }
-      }
-    }
+    // int4 values take one byte each in the file, and are packed in pairs
+    size_t file_bytes_per_value = data_type == DT_INT4 ? 2 : 1;
+
+    // the heads of the q, k, v and o weights are interleaved in ptr
+    reader.read(
+        0,
+        num_heads * one_head_size * file_bytes_per_value,
+        [&](char const *host_array, size_t begin, size_t size) {
+          assert(begin % file_bytes_per_value == 0 &&
+                 size % file_bytes_per_value == 0);
+          for (size_t k = 0; k < size; k += file_bytes_per_value) {
+            size_t value_index = (begin + k) / file_bytes_per_value;
+            size_t head = value_index / one_head_size;
+            size_t j = head * one_head_size * 4 + file_index * one_head_size +
+                       value_index % one_head_size;
+            if (data_type == DT_INT4) {
+              char v1 = host_array[k];
+              char v2 = host_array[k + 1];
+              ptr[j] = (v2 & 0XF) | (v1 << 4);
+            } else {
+              ptr[j] = host_array[k];
+            }
+          }
+        });
     file_index++;
-    in.close();
   }
 
   // load scale and offset to the end of weight tensor
@@ -494,64 +488,31 @@ void load_attention_weights_quantized(char *ptr,
                                        : (one_weight_file_size * 4) / 2;
   for (auto filename : weight_filenames) {
     std::cout << "Loading weight file " << filename << std::endl;
-    std::string weight_filepath = join_path({weights_folder, filename});
 
     for (int i = 0; i < 2; i++) {
       std::string meta_file =
-          i == 0 ? (weight_filepath + "_offset") : (weight_filepath + "_scale");
+          i == 0 ? (filename + "_offset") : (filename + "_scale");
       size_t partial_size =
           one_weight_file_size / INT4_NUM_OF_ELEMENTS_PER_GROUP;
-      std::ifstream in(meta_file, std::ios::in | std::ios::binary);
-      if (!in.good()) {
-        std::cout << "Could not open file: " << meta_file << std::endl;
-      }
-      assert(in.good() && "incorrect weight file path");
-
-      if (use_full_precision) {
-        // float
-        std::vector<float> host_array(partial_size);
-        size_t loaded_data_size = sizeof(float) * partial_size;
-        in.seekg(0, in.end);
-        in.seekg(0, in.beg);
-        in.read((char *)host_array.data(), loaded_data_size);
-        size_t in_get_size = in.gcount();
-
-        if (in_get_size != loaded_data_size) {
-          std::cout << "load data error";
-          return;
-        }
-        assert(partial_size == host_array.size());
-
-        for (auto v : host_array) {
-          *(float *)(ptr + offset) = v;
-          offset += sizeof(float);
-        }
-      } else {
-        // half
-        std::vector<half> host_array(partial_size);
-        size_t loaded_data_size = sizeof(half) * partial_size;
-        in.seekg(0, in.end);
-        in.seekg(0, in.beg);
-        in.read((char *)host_array.data(), loaded_data_size);
-        size_t in_get_size = in.gcount();
-
-        if (in_get_size != loaded_data_size) {
-          std::cout << "load data error";
-          return;
-        }
-        assert(partial_size == host_array.size());
-        for (auto v : host_array) {
-          *(half *)(ptr + offset) = v;
-          offset += sizeof(half);
-        }
-      }
+      // the offsets and scales are copied as is, in float or half
+      size_t element_size = use_full_precision ? sizeof(float) : sizeof(half);
+      WeightFileReader<char> reader(container,
+                                    io_pool,
+                                    weights_folder,
+                                    meta_file,
+                                    partial_size * element_size);
+      reader.read(0, partial_size * element_size, ptr + offset);
+      offset += partial_size * element_size;
     }
   }
 }
 
 void load_from_quantized_file(char *ptr,
                               size_t size,
-                              std::string filename,
+                              std::string const &weights_folder,
+                              std::string const &filename,
+                              WeightContainer const *container,
+                              WeightIOPool *io_pool,
                               DataType data_type,
                               bool use_full_precision) {
   assert(data_type == DT_INT4 || data_type == DT_INT8);
@@ -579,92 +540,30 @@ void load_from_quantized_file(char *ptr,
       value_file, offset_file, scaling_file};
   std::vector<size_t> quantized_sizes = {value_size, offset_size, scaling_size};
 
-  int file_idx = 0;
   long data_index = 0;
-  for (auto file : quantized_files) {
-    std::ifstream in(file, std::ios::in | std::ios::binary);
-    if (!in.good()) {
-      std::cout << "Could not open file: " << file << std::endl;
-    }
-    assert(in.good() && "incorrect weight file path");
+  for (int file_idx = 0; file_idx < quantized_files.size(); file_idx++) {
+    size = quantized_sizes.at(file_idx);
+    WeightFileReader<char> reader(
+        container, io_pool, weights_folder, quantized_files[file_idx], size);
 
     // value file, every element is in one byte
-    if (file_idx == 0) {
-      size = quantized_sizes.at(file_idx);
-      std::vector<char> host_array(size);
-      size_t loaded_data_size = size;
-      in.seekg(0, in.end);
-      in.seekg(0, in.beg);
-      in.read((char *)host_array.data(), loaded_data_size);
-
-      size_t in_get_size = in.gcount();
-      if (in_get_size != loaded_data_size) {
-        std::cout << "load weight data error quantized" << in_get_size << ", "
-                  << loaded_data_size << ", " << sizeof(char) << std::endl;
-        return;
-      }
-      assert(size == host_array.size());
-
-      // normal
-      size_t idx = 0;
-      while (idx < host_array.size()) {
-        if (data_type == DT_INT4) {
-          // pack 2 elements into one byte
-          char v1 = host_array.at(idx);
-          char v2 = host_array.at(idx + 1);
+    if (file_idx == 0 && data_type == DT_INT4) {
+      // pack 2 elements into one byte
+      reader.read(0, size, [&](char const *host_array, size_t begin, size_t n) {
+        assert(begin % 2 == 0 && n % 2 == 0);
+        for (size_t idx = 0; idx < n; idx += 2) {
+          char v1 = host_array[idx];
+          char v2 = host_array[idx + 1];
           // v1 in first 4 bit and v2 in last 4 bit;
-          ptr[data_index++] = (v2 & 0XF) | (v1 << 4);
-          idx += 2;
-        } else {
-          ptr[data_index++] = host_array.at(idx++);
+          ptr[data_index + (begin + idx) / 2] = (v2 & 0XF) | (v1 << 4);
         }
-      }
-    } else if (use_full_precision) {
-      // load offset/scale in float type;
-      size = quantized_sizes.at(file_idx);
-      std::vector<float> host_array(size / sizeof(float));
-      size_t loaded_data_size = size;
-      in.seekg(0, in.end);
-      in.seekg(0, in.beg);
-      in.read((char *)host_array.data(), loaded_data_size);
-
-      size_t in_get_size = in.gcount();
-      if (in_get_size != loaded_data_size) {
-        std::cout << "load weight data error scale/offset" << in_get_size
-                  << ", " << loaded_data_size << ", " << sizeof(float) << ", "
-                  << file << ", " << size << std::endl;
-        return;
-      }
-      assert(size / sizeof(float) == host_array.size());
-      for (auto v : host_array) {
-        *(float *)(ptr + data_index) = v;
-        data_index += sizeof(float);
-      }
-
+      });
+      data_index += size / 2;
     } else {
-      // load offset/scale in half type;
-      size = quantized_sizes.at(file_idx);
-      std::vector<half> host_array(size / sizeof(half));
-      size_t loaded_data_size = size;
-      in.seekg(0, in.end);
-      in.seekg(0, in.beg);
-      in.read((char *)host_array.data(), loaded_data_size);
-
-      size_t in_get_size = in.gcount();
-      if (in_get_size != loaded_data_size) {
-        std::cout << "load weight data error " << in_get_size << ", "
-                  << loaded_data_size << ", " << sizeof(half) << std::endl;
-        return;
-      }
-      assert(size / sizeof(half) == host_array.size());
-      // normal
-      for (auto v : host_array) {
-        *(half *)(ptr + data_index) = v;
-        data_index += sizeof(half);
-      }
+      // int8 values, and offset/scale in float or half type, copied as is
+      reader.read(0, size, ptr + data_index);
+      data_index += size;
     }
-    in.close();
-    file_idx++;
   }
 }
 
@@ -684,7 +583,8 @@ void FileDataLoader::load_quantization_weight(FFModel *ff,
     volume_ *= dim_i;
   }
   assert(volume_ == volume * num_replicas);
-  char *data = (char *)malloc(sizeof(char) * volume);
+  // load into the first replica, and copy it to the others
+  char *data = weight;
 
   std::string weight_filename = removeGuidOperatorName(std::string(l->name));
 
@@ -698,6 +598,8 @@ void FileDataLoader::load_quantization_weight(FFModel *ff,
                                        qkv_inner_dim,
                                        weight_filename,
                                        weights_folder,
+                                       weight_container.get(),
+                                       io_pool.get(),
                                        data_type,
                                        use_full_precision);
     }
@@ -719,18 +621,19 @@ void FileDataLoader::load_quantization_weight(FFModel *ff,
     }
     load_from_quantized_file(data,
                              volume,
-                             join_path({weights_folder, weight_filename}),
+                             weights_folder,
+                             weight_filename,
+                             weight_container.get(),
+                             io_pool.get(),
                              data_type,
                              use_full_precision);
   }
 
-  char *ptr = weight;
-  for (size_t i = 0; i < num_replicas; i++) {
-    memcpy(ptr, data, volume * sizeof(char));
+  char *ptr = weight + volume;
+  for (size_t i = 1; i < num_replicas; i++) {
+    io_pool->copy(data, volume * sizeof(char), ptr);
     ptr += volume;
   }
-
-  free(data);
 }
 
 template <typename DT>
@@ -752,7 +655,8 @@ void FileDataLoader::load_single_weight_tensor(FFModel *ff,
   }
   assert(volume_ == volume * num_replicas);
   // assert(data_type_size(weight->data_type) == sizeof(DT));
-  DT *data = (DT *)malloc(sizeof(DT) * volume);
+  // load into the first replica, and copy it to the others
+  DT *data = weight;
 
   std::string weight_filename = removeGuidOperatorName(std::string(l->name));
   bool is_attn_proj = false, is_o_proj = false;
@@ -797,6 +701,8 @@ void FileDataLoader::load_single_weight_tensor(FFModel *ff,
                                              qkv_inner_dim,
                                              weight_filename,
                                              weights_folder,
+                                             weight_container.get(),
+                                             io_pool.get(),
                                              volume,
                                              tensor_parallelism_degree,
                                              true);
@@ -807,7 +713,9 @@ void FileDataLoader::load_single_weight_tensor(FFModel *ff,
                                                  hidden_dim,
                                                  qkv_inner_dim,
                                                  weight_filename,
-                                                 weights_folder);
+                                                 weights_folder,
+                                                 weight_container.get(),
+                                                 io_pool.get());
         }
       } else {
         if (weight_idx == 0) {
@@ -818,6 +726,8 @@ void FileDataLoader::load_single_weight_tensor(FFModel *ff,
                                              qkv_inner_dim,
                                              weight_filename,
                                              weights_folder,
+                                             weight_container.get(),
+                                             io_pool.get(),
                                              volume,
                                              tensor_parallelism_degree,
                                              false);
@@ -830,6 +740,9 @@ void FileDataLoader::load_single_weight_tensor(FFModel *ff,
                                  false, // do not load o_proj bias
                                  weight_filename,
                                  weights_folder,
+                                 weight_container.get(),
+                                 io_pool.get(),
+                                 volume,
                                  tensor_parallelism_degree);
         }
       }
@@ -839,9 +752,12 @@ void FileDataLoader::load_single_weight_tensor(FFModel *ff,
                              ? ".attn_bias"
                              : ((weight_idx == 1) ? ".weight" : ".bias");
       std::cout << "Loading weight file " << weight_filename << std::endl;
-      std::string weight_filepath =
-          join_path({weights_folder, weight_filename});
-      load_from_file(data, volume, weight_filepath);
+      load_from_file(data,
+                     volume,
+                     weights_folder,
+                     weight_filename,
+                     weight_container.get(),
+                     io_pool.get());
     } else {
       // default op
       assert(weight_idx == 0 || weight_idx == 1);
@@ -850,21 +766,21 @@ void FileDataLoader::load_single_weight_tensor(FFModel *ff,
         weight_filename += weight_idx == 0 ? ".weight" : ".bias";
       }
       std::cout << "Loading weight file " << weight_filename << std::endl;
-      std::string weight_filepath =
-          join_path({weights_folder, weight_filename});
-      load_from_file(data, volume, weight_filepath);
+      load_from_file(data,
+                     volume,
+                     weights_folder,
+                     weight_filename,
+                     weight_container.get(),
+                     io_pool.get());
     }
   }
 
-  // Copy the weight data from the buffer to the weight
-  DT *ptr = weight;
-  for (size_t i = 0; i < num_replicas; i++) {
-    memcpy(ptr, data, volume * sizeof(DT));
+  // Copy the first replica to the others
+  DT *ptr = weight + volume;
+  for (size_t i = 1; i < num_replicas; i++) {
+    io_pool->copy((char const *)data, volume * sizeof(DT), (char *)ptr);
     ptr += volume;
   }
-
-  // Free buffer memory
-  free(data);
 }
 
 void FileDataLoader::load_weight_task(
@@ -881,6 +797,28 @@ void FileDataLoader::load_weight_task(
   Domain weight_domain = runtime->get_index_space_domain(
       ctx, task->regions[0].region.get_index_space());
 
+  FileDataLoader *loader = args->loader;
+  assert(loader->io_pool != nullptr);
+  // quantized weights are sized in bytes
+  size_t replica_size = (args->data_type == DT_INT4 ||
+                         args->data_type == DT_INT8)
+                            ? args->volume
+                            : args->volume * data_type_size(args->data_type);
+  std::string snapshot_name =
+      removeGuidOperatorName(std::string(args->layer->name)) + ".weight" +
+      std::to_string(args->weight_idx);
+  char *weight_ptr = (char *)weight.ptr;
+  if (loader->snapshot_cache != nullptr &&
+      loader->snapshot_cache->load(
+          snapshot_name, replica_size, weight_ptr, loader->io_pool.get())) {
+    // Copy the first replica to the others
+    for (size_t i = 1; i < args->num_replicas; i++) {
+      loader->io_pool->copy(
+          weight_ptr, replica_size, weight_ptr + i * replica_size);
+    }
+    return;
+  }
+
   switch (args->data_type) {
     case DT_HALF: {
       args->loader->load_single_weight_tensor<half>(args->ff,
@@ -917,12 +855,32 @@ void FileDataLoader::load_weight_task(
     default:
       assert(false && "Unsupported data type");
   }
+  if (loader->snapshot_cache != nullptr) {
+    loader->snapshot_cache->store(snapshot_name, replica_size, weight_ptr);
+  }
 }
 
 void FileDataLoader::load_weights_parallel(FFModel *ff,
                                            Context ctx,
                                            Runtime *runtime) {
   std::vector<Future> futures;
+  io_pool = WeightIOPool::acquire_shared();
+
+  // random weights are not worth caching
+  if (!ff->config.weight_cache_folder.empty() && !ff->config.benchmarking &&
+      snapshot_cache == nullptr) {
+    std::ostringstream settings;
+    settings << "heads " << num_heads << " kv_heads " << num_kv_heads
+             << " hidden_dim " << hidden_dim << " qkv_inner_dim "
+             << qkv_inner_dim << " tp " << tensor_parallelism_degree
+             << " full_precision " << use_full_precision << " quantization "
+             << ff->config.quantization_type << " peft "
+             << ff->config.enable_peft;
+    snapshot_cache = std::make_unique<WeightSnapshotCache>(
+        ff->config.weight_cache_folder, weights_folder, settings.str());
+    std::cout << "Caching weights in "
+              << snapshot_cache->get_snapshot_folder() << std::endl;
+  }
 
   for (Layer *l : ff->layers) {
     if (l->numWeights < 1 || l->name == NULL || strlen(l->name) < 1) {
@@ -975,4 +933,6 @@ void FileDataLoader::load_weights_parallel(FFModel *ff,
   for (Future &f : futures) {
     f.get_void_result();
   }
+  // let the I/O threads exit once no loader needs them
+  io_pool.reset();
 }
\ No newline at end of file
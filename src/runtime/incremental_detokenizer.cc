@@ -0,0 +1,84 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/utils/incremental_detokenizer.h"
+#include <algorithm>
+#include <cassert>
+
+namespace FlexFlow {
+
+IncrementalDetokenizer::IncrementalDetokenizer(
+    DecodeFunction _decode, std::vector<TokenId> const &prompt_tokens)
+    : decode(std::move(_decode)), tokens(prompt_tokens),
+      num_prompt_tokens(prompt_tokens.size()) {
+  assert(decode && "IncrementalDetokenizer needs a decode function");
+  if (!tokens.empty()) {
+    text = decode(tokens);
+  }
+  prefix_offset = std::max(num_prompt_tokens - NUM_CONTEXT_TOKENS, 0);
+  read_offset = num_prompt_tokens;
+}
+
+std::string
+    IncrementalDetokenizer::append(std::vector<TokenId> const &new_tokens) {
+  tokens.insert(tokens.end(), new_tokens.begin(), new_tokens.end());
+  return decode_unread_tokens(false /*flush*/);
+}
+
+std::string IncrementalDetokenizer::flush() {
+  return decode_unread_tokens(true /*flush*/);
+}
+
+std::vector<IncrementalDetokenizer::TokenId> const &
+    IncrementalDetokenizer::get_tokens() const {
+  return tokens;
+}
+
+std::string const &IncrementalDetokenizer::get_text() const {
+  return text;
+}
+
+int IncrementalDetokenizer::get_num_prompt_tokens() const {
+  return num_prompt_tokens;
+}
+
+std::string IncrementalDetokenizer::decode_unread_tokens(bool flush) {
+  if ((int)tokens.size() <= read_offset) {
+    return "";
+  }
+  std::string prefix_text;
+  if (prefix_offset < read_offset) {
+    prefix_text = decode(std::vector<TokenId>(tokens.begin() + prefix_offset,
+                                              tokens.begin() + read_offset));
+  }
+  std::string window_text = decode(
+      std::vector<TokenId>(tokens.begin() + prefix_offset, tokens.end()));
+  std::string const replacement_char = "\xEF\xBF\xBD";
+  bool incomplete =
+      window_text.size() >= replacement_char.size() &&
+      window_text.compare(window_text.size() - replacement_char.size(),
+                          replacement_char.size(),
+                          replacement_char) == 0;
+  if (window_text.size() <= prefix_text.size() || (incomplete && !flush)) {
+    return "";
+  }
+  std::string new_text = window_text.substr(prefix_text.size());
+  text += new_text;
+  prefix_offset = read_offset;
+  read_offset = tokens.size();
+  return new_text;
+}
+
+}; // namespace FlexFlow
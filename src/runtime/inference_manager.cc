@@ -384,9 +384,10 @@ FutureMap InferenceManager::inference(FFModel *model,
                                       int index,
                                       BatchConfig const &bc) {
   if (bc.get_mode() == INC_DECODING_MODE) {
-    BatchConfigFuture bcf = Future::from_value<BatchConfig>(bc);
+    BatchConfigFuture bcf = SerializedBatchConfig(bc).to_future();
     return inference(model, index, bcf);
   } else if (bc.get_mode() == BEAM_SEARCH_MODE) {
+    assert(bc.penalty_tokens.empty());
     BatchConfig const *bc_ptr = &bc;
     BeamSearchBatchConfig const *bsbc_ptr =
         static_cast<BeamSearchBatchConfig const *>(bc_ptr);
@@ -394,6 +395,7 @@ FutureMap InferenceManager::inference(FFModel *model,
         Future::from_value<BeamSearchBatchConfig>(*bsbc_ptr);
     return inference(model, index, bcf);
   } else if (bc.get_mode() == TREE_VERIFY_MODE) {
+    assert(bc.penalty_tokens.empty());
     BatchConfig const *bc_ptr = &bc;
     TreeVerifyBatchConfig const *tvbc_ptr =
         static_cast<TreeVerifyBatchConfig const *>(bc_ptr);
@@ -408,6 +410,9 @@ FutureMap InferenceManager::inference(FFModel *model,
 FutureMap InferenceManager::inference(FFModel *model,
                                       int index,
                                       BatchConfigFuture const &bc) {
+  if (is_mock_model(model)) {
+    return mock_inference(model, bc);
+  }
   // log_inf_mgr.print("mode(%d) num_active_infr_tokens(%d)
   // num_active_requests(%d)",
   //                   bc.get_mode(),
@@ -470,6 +475,10 @@ FutureMap InferenceManager::inference(FFModel *model,
 void InferenceManager::peft_bwd(FFModel *model,
                                 int index,
                                 BatchConfigFuture const &bc) {
+  if (is_mock_model(model)) {
+    // mock models have no weights to finetune
+    return;
+  }
   int batch_index = index % model->config.data_parallelism_degree;
   FutureMap fm;
   bool found_input_operator = false;
@@ -618,6 +627,36 @@ void InferenceManager::register_model_weights_loader(FFModel *model,
   model_weights_loaders[model] = loader;
 }
 
+void InferenceManager::register_mock_model(FFModel *model,
+                                           MockModelConfig const &config) {
+  assert(config.vocab_size > 0);
+  assert(config.mode == INC_DECODING_MODE ||
+         config.mode == TREE_VERIFY_MODE || config.mode == BEAM_SEARCH_MODE);
+  mock_models[model] = config;
+}
+
+bool InferenceManager::is_mock_model(FFModel *model) const {
+  return mock_models.find(model) != mock_models.end();
+}
+
+FutureMap InferenceManager::mock_inference(FFModel *model,
+                                           BatchConfigFuture const &bc) {
+  Context ctx = model->config.lg_ctx;
+  Runtime *runtime = model->config.lg_hlr;
+  MockModelConfig const &config = mock_models.at(model);
+  TaskLauncher launcher(config.mode == BEAM_SEARCH_MODE
+                            ? MOCK_MODEL_BEAM_INF_TASK_ID
+                            : MOCK_MODEL_INF_TASK_ID,
+                        TaskArgument(&config, sizeof(MockModelConfig)));
+  launcher.add_future(bc);
+  Future result = runtime->execute_task(ctx, launcher);
+  // the serving loops expect a single-point future map, as produced by the
+  // operators of a real model
+  std::map<DomainPoint, Future> results;
+  results[DomainPoint(0)] = result;
+  return runtime->construct_future_map(ctx, Domain(Rect<1>(0, 0)), results);
+}
+
 void FFModel::set_transformer_layer_id(int id) {
   // We assume that users call this function with
   // monotonically increasing ids
@@ -0,0 +1,286 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/utils/kv_cache_block_manager.h"
+#include "flexflow/utils/paged_kv_cache.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+namespace FlexFlow {
+
+KVCacheBlockManager::KVCacheBlockManager(int _num_blocks, int _block_size)
+    : num_blocks(_num_blocks), block_size(_block_size),
+      ref_counts(_num_blocks, 0), cached_nodes(_num_blocks, nullptr),
+      num_cached_blocks(0), num_evictable_blocks(0), access_clock(0) {
+  assert(num_blocks > 0 && "KV cache must contain at least one block");
+  assert(block_size > 0 && "KV cache block size must be positive");
+  free_blocks.reserve(num_blocks);
+  // push in reverse order so that block 0 is handed out first
+  for (int i = num_blocks - 1; i >= 0; i--) {
+    free_blocks.push_back(i);
+  }
+}
+
+int KVCacheBlockManager::get_num_blocks() const {
+  return num_blocks;
+}
+
+int KVCacheBlockManager::get_block_size() const {
+  return block_size;
+}
+
+int KVCacheBlockManager::get_num_free_blocks() const {
+  return (int)free_blocks.size();
+}
+
+int KVCacheBlockManager::get_num_evictable_blocks() const {
+  return num_evictable_blocks;
+}
+
+int KVCacheBlockManager::get_num_cached_blocks() const {
+  return num_cached_blocks;
+}
+
+int KVCacheBlockManager::num_blocks_needed(int num_tokens) const {
+  assert(num_tokens >= 0);
+  return (num_tokens + block_size - 1) / block_size;
+}
+
+bool KVCacheBlockManager::can_reserve(RequestGuid guid, int num_tokens) const {
+  int owned = 0;
+  auto it = block_tables.find(guid);
+  if (it != block_tables.end()) {
+    owned = (int)it->second.size();
+  }
+  int missing = num_blocks_needed(num_tokens) - owned;
+  return missing <= (int)free_blocks.size() + num_evictable_blocks;
+}
+
+bool KVCacheBlockManager::reserve(RequestGuid guid, int num_tokens) {
+  if (!can_reserve(guid, num_tokens)) {
+    return false;
+  }
+  std::vector<int> &table = block_tables[guid];
+  int needed = num_blocks_needed(num_tokens);
+  while ((int)table.size() < needed) {
+    if (free_blocks.empty()) {
+      bool evicted = evict_prefix_block();
+      assert(evicted);
+    }
+    int block_id = free_blocks.back();
+    free_blocks.pop_back();
+    assert(ref_counts[block_id] == 0);
+    ref_counts[block_id] = 1;
+    table.push_back(block_id);
+  }
+  return true;
+}
+
+void KVCacheBlockManager::release(RequestGuid guid) {
+  auto it = block_tables.find(guid);
+  if (it == block_tables.end()) {
+    return;
+  }
+  // release in reverse order so the next request gets them back in order
+  for (auto rit = it->second.rbegin(); rit != it->second.rend(); rit++) {
+    release_block(*rit);
+  }
+  block_tables.erase(it);
+  assert((int)free_blocks.size() <= num_blocks);
+}
+
+int KVCacheBlockManager::match_prefix(RequestGuid guid,
+                                      std::vector<TokenId> const &tokens) {
+  assert(!has_block_table(guid) && "Request already has a KV block table");
+  if (tokens.empty()) {
+    return 0;
+  }
+  int max_blocks = ((int)tokens.size() - 1) / block_size;
+  std::vector<int> table;
+  PrefixNode *node = &prefix_root;
+  for (int j = 0; j < max_blocks; j++) {
+    std::vector<TokenId> key(tokens.begin() + j * block_size,
+                             tokens.begin() + (j + 1) * block_size);
+    auto it = node->children.find(key);
+    if (it == node->children.end()) {
+      break;
+    }
+    node = it->second.get();
+    node->last_access = ++access_clock;
+    acquire_block(node->block_id);
+    table.push_back(node->block_id);
+  }
+  int num_matched_tokens = (int)table.size() * block_size;
+  if (!table.empty()) {
+    block_tables[guid] = std::move(table);
+  }
+  return num_matched_tokens;
+}
+
+void KVCacheBlockManager::cache_prefix(RequestGuid guid,
+                                       std::vector<TokenId> const &tokens,
+                                       int num_computed_tokens) {
+  assert(num_computed_tokens <= (int)tokens.size());
+  std::vector<int> const &table = get_block_table(guid);
+  int num_full_blocks =
+      std::min(num_computed_tokens / block_size, (int)table.size());
+  PrefixNode *node = &prefix_root;
+  for (int j = 0; j < num_full_blocks; j++) {
+    std::vector<TokenId> key(tokens.begin() + j * block_size,
+                             tokens.begin() + (j + 1) * block_size);
+    auto it = node->children.find(key);
+    if (it != node->children.end()) {
+      // Another request already cached this block. Only descend if it is the
+      // block we are using, so a cached block is never shared by a request
+      // that does not also hold all of its ancestors.
+      if (it->second->block_id != table[j]) {
+        break;
+      }
+      node = it->second.get();
+      node->last_access = ++access_clock;
+      continue;
+    }
+    int block_id = table[j];
+    assert(cached_nodes[block_id] == nullptr);
+    std::unique_ptr<PrefixNode> child(new PrefixNode());
+    child->block_id = block_id;
+    child->parent = node;
+    child->last_access = ++access_clock;
+    // the prefix cache holds its own reference on the block
+    acquire_block(block_id);
+    cached_nodes[block_id] = child.get();
+    num_cached_blocks++;
+    node = child.get();
+    node->parent->children.emplace(std::move(key), std::move(child));
+  }
+}
+
+void KVCacheBlockManager::acquire_block(int block_id) {
+  if (cached_nodes[block_id] != nullptr && ref_counts[block_id] == 1) {
+    // a cached block starts being used by a request again
+    num_evictable_blocks--;
+  }
+  ref_counts[block_id]++;
+}
+
+void KVCacheBlockManager::release_block(int block_id) {
+  assert(ref_counts[block_id] > 0);
+  ref_counts[block_id]--;
+  if (ref_counts[block_id] == 0) {
+    assert(cached_nodes[block_id] == nullptr);
+    free_blocks.push_back(block_id);
+  } else if (ref_counts[block_id] == 1 && cached_nodes[block_id] != nullptr) {
+    // only the prefix cache still references this block
+    num_evictable_blocks++;
+  }
+}
+
+bool KVCacheBlockManager::evict_prefix_block() {
+  // Find the least recently used leaf that no request is using. Since a
+  // request holding a cached block also holds all its ancestors, every unused
+  // cached block is either such a leaf or the ancestor of one.
+  PrefixNode *victim = nullptr;
+  std::vector<PrefixNode *> stack{&prefix_root};
+  while (!stack.empty()) {
+    PrefixNode *node = stack.back();
+    stack.pop_back();
+    for (auto const &child : node->children) {
+      stack.push_back(child.second.get());
+    }
+    if (node == &prefix_root || !node->children.empty() ||
+        ref_counts[node->block_id] != 1) {
+      continue;
+    }
+    if (victim == nullptr || node->last_access < victim->last_access) {
+      victim = node;
+    }
+  }
+  if (victim == nullptr) {
+    return false;
+  }
+  int block_id = victim->block_id;
+  cached_nodes[block_id] = nullptr;
+  num_cached_blocks--;
+  num_evictable_blocks--;
+  PrefixNode *parent = victim->parent;
+  for (auto it = parent->children.begin(); it != parent->children.end();
+       it++) {
+    if (it->second.get() == victim) {
+      parent->children.erase(it);
+      break;
+    }
+  }
+  release_block(block_id);
+  return true;
+}
+
+bool KVCacheBlockManager::has_block_table(RequestGuid guid) const {
+  return block_tables.find(guid) != block_tables.end();
+}
+
+std::vector<int> const &
+    KVCacheBlockManager::get_block_table(RequestGuid guid) const {
+  auto it = block_tables.find(guid);
+  assert(it != block_tables.end() && "Request has no KV cache block table");
+  return it->second;
+}
+
+void paged_attention_reference(float const *query,
+                               float const *key_cache,
+                               float const *value_cache,
+                               std::vector<int> const &block_table,
+                               int block_size,
+                               int num_tokens,
+                               int num_heads,
+                               int head_dim,
+                               float scale,
+                               float *output) {
+  assert(num_tokens <= (int)block_table.size() * block_size);
+  int hidden_size = num_heads * head_dim;
+  std::vector<float> logits(num_tokens);
+  for (int h = 0; h < num_heads; h++) {
+    float const *q = query + h * head_dim;
+    float qk_max = -FLT_MAX;
+    for (int t = 0; t < num_tokens; t++) {
+      size_t slot = paged_kv_cache_slot(block_table.data(), block_size, t);
+      float const *k = key_cache + slot * hidden_size + h * head_dim;
+      float qk = 0.0f;
+      for (int d = 0; d < head_dim; d++) {
+        qk += q[d] * k[d];
+      }
+      logits[t] = qk * scale;
+      qk_max = std::max(qk_max, logits[t]);
+    }
+    float exp_sum = 0.0f;
+    for (int t = 0; t < num_tokens; t++) {
+      logits[t] = std::exp(logits[t] - qk_max);
+      exp_sum += logits[t];
+    }
+    float *out = output + h * head_dim;
+    std::fill(out, out + head_dim, 0.0f);
+    for (int t = 0; t < num_tokens; t++) {
+      size_t slot = paged_kv_cache_slot(block_table.data(), block_size, t);
+      float const *v = value_cache + slot * hidden_size + h * head_dim;
+      float p = logits[t] / exp_sum;
+      for (int d = 0; d < head_dim; d++) {
+        out[d] += p * v[d];
+      }
+    }
+  }
+}
+
+}; // namespace FlexFlow
@@ -0,0 +1,149 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/mock_model.h"
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+namespace FlexFlow {
+
+using namespace Legion;
+
+namespace {
+
+// splitmix64 finalizer
+unsigned long long mix(unsigned long long x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+unsigned long long hash_token(unsigned long long seed,
+                              BatchConfig::TokenId token,
+                              int depth) {
+  return mix(mix(seed ^ (unsigned long long)(unsigned)token) ^
+             (unsigned long long)(unsigned)depth);
+}
+
+void simulate_latency(MockModelConfig const &config, int num_tokens) {
+  double latency_us =
+      config.step_latency_us + config.token_latency_us * num_tokens;
+  if (latency_us > 0) {
+    std::this_thread::sleep_for(
+        std::chrono::microseconds((long long)latency_us));
+  }
+}
+
+} // namespace
+
+/*static*/
+BatchConfig::TokenId MockModel::next_token(MockModelConfig const &config,
+                                           BatchConfig::TokenId token,
+                                           int depth) {
+  assert(config.vocab_size > 0);
+  return (BatchConfig::TokenId)(hash_token(config.seed, token, depth) %
+                                config.vocab_size);
+}
+
+/*static*/
+BatchConfig::TokenId MockModel::draft_token(MockModelConfig const &config,
+                                            BatchConfig::TokenId token,
+                                            int depth,
+                                            int k) {
+  // whether the top candidate is right is drawn from a different hash than
+  // the token itself, so that it does not depend on the token value
+  unsigned long long draw = hash_token(~config.seed, token, depth) % 1000000;
+  bool correct = draw < (unsigned long long)(config.draft_accuracy * 1000000);
+  // a wrong top candidate swaps the first two candidates
+  int offset = correct ? k : (k ^ 1);
+  return (next_token(config, token, depth) + offset) % config.vocab_size;
+}
+
+/*static*/
+void MockModel::generate(MockModelConfig const &config,
+                         BatchConfig const &bc,
+                         InferenceResult &ir) {
+  for (int i = 0; i < bc.num_active_tokens(); i++) {
+    ir.token_ids[i] = next_token(config,
+                                 bc.tokensInfo[i].token_id,
+                                 bc.tokensInfo[i].abs_depth_in_request);
+  }
+  ir.finetuning_loss = 0.0f;
+}
+
+/*static*/
+void MockModel::generate_beam(MockModelConfig const &config,
+                              BeamSearchBatchConfig const &bc,
+                              BeamInferenceResult &ir) {
+  int const stride = bc.max_beam_size_all_requests();
+  for (int i = 0; i < bc.num_active_tokens(); i++) {
+    BatchConfig::TokenId token = bc.tokensInfo[i].token_id;
+    int depth = bc.tokensInfo[i].abs_depth_in_request;
+    for (int k = 0; k < stride; k++) {
+      ir.token_ids[i * stride + k] = draft_token(config, token, depth, k);
+      ir.probs[i * stride + k] = 1.0f / (k + 2);
+      ir.parent_id[i * stride + k] = bc.beamTokenInfo[i].sub_request_index;
+    }
+  }
+}
+
+/*
+  futures[0]: the batch config
+*/
+/*static*/
+InferenceResult
+    MockModel::inference_task(Task const *task,
+                              std::vector<PhysicalRegion> const &regions,
+                              Context ctx,
+                              Runtime *runtime) {
+  assert(task->arglen == sizeof(MockModelConfig));
+  MockModelConfig const &config = *(MockModelConfig const *)task->args;
+  BatchConfig const *bc = BatchConfig::from_future(task->futures[0]);
+  assert(bc->get_mode() == INC_DECODING_MODE ||
+         bc->get_mode() == TREE_VERIFY_MODE);
+  InferenceResult ir;
+  if (bc->num_active_tokens() == 0) {
+    return ir;
+  }
+  simulate_latency(config, bc->num_active_tokens());
+  generate(config, *bc, ir);
+  return ir;
+}
+
+/*
+  futures[0]: the batch config
+*/
+/*static*/
+BeamInferenceResult
+    MockModel::beam_inference_task(Task const *task,
+                                   std::vector<PhysicalRegion> const &regions,
+                                   Context ctx,
+                                   Runtime *runtime) {
+  assert(task->arglen == sizeof(MockModelConfig));
+  MockModelConfig const &config = *(MockModelConfig const *)task->args;
+  BatchConfig const *bc = BatchConfig::from_future(task->futures[0]);
+  assert(bc->get_mode() == BEAM_SEARCH_MODE);
+  BeamInferenceResult ir;
+  if (bc->num_active_tokens() == 0) {
+    return ir;
+  }
+  simulate_latency(config, bc->num_active_tokens());
+  generate_beam(config, *static_cast<BeamSearchBatchConfig const *>(bc), ir);
+  return ir;
+}
+
+}; // namespace FlexFlow
@@ -3395,20 +3395,22 @@ bool FFModel::need_to_add_combine(int layer_idx) const {
     return false;
   }
   auto const &l = layers[layer_idx];
-  // softmax followed by argmax/arg_topk: add combine before softmax
+  // softmax followed by argmax/arg_topk/sampling: add combine before softmax
   if (layer_idx == layers.size() - 2) {
     auto const &l_next = layers[layer_idx + 1];
     if (l->op_type == OP_SOFTMAX &&
-        (l_next->op_type == OP_ARG_TOPK || l_next->op_type == OP_ARGMAX)) {
+        (l_next->op_type == OP_ARG_TOPK || l_next->op_type == OP_ARGMAX ||
+         l_next->op_type == OP_SAMPLING)) {
       return true;
     } else {
       return false;
     }
   }
-  // argmax/arg_topk not precedent by softmax: add combine before
-  // argmax/arg_topk
+  // argmax/arg_topk/sampling not precedent by softmax: add combine before
+  // argmax/arg_topk/sampling
   if (layer_idx == layers.size() - 1 &&
-      (l->op_type == OP_ARG_TOPK || l->op_type == OP_ARGMAX)) {
+      (l->op_type == OP_ARG_TOPK || l->op_type == OP_ARGMAX ||
+       l->op_type == OP_SAMPLING)) {
     auto const &l_prev = layers[layer_idx - 1];
     if (l_prev->op_type == OP_SOFTMAX) {
       return false;
@@ -4367,6 +4369,7 @@ FFConfig::FFConfig() {
   enable_peft = DefaultConfig::enablePeft;
   peft_activation_reserve_space_size =
       DefaultConfig::peftActivationReserveSpaceSize;
+  weight_cache_folder = "";
   quantization_type = DT_NONE;
   only_data_parallel = DefaultConfig::onlyDataParallel;
   data_parallelism_degree = 1;
@@ -4501,6 +4504,10 @@ void FFConfig::parse_args(char **argv, int argc) {
       peft_activation_reserve_space_size = atoll(argv[++i]) * 1024 * 1024;
       continue;
     }
+    if (!strcmp(argv[i], "-weight-cache-folder")) {
+      weight_cache_folder = std::string(argv[++i]);
+      continue;
+    }
     if ((!strcmp(argv[i], "--only-data-parallel"))) {
       only_data_parallel = true;
       continue;
@@ -4716,6 +4723,24 @@ void register_flexflow_internal_tasks(Runtime *runtime,
           registrar);
     }
   }
+  // RequestManager register PEFT config
+  {
+    TaskVariantRegistrar registrar(RM_REGISTER_PEFT_CONFIG_TASK_ID,
+                                   "RequestManager Register PEFT Config");
+    registrar.add_constraint(ProcessorConstraint(Processor::TOC_PROC));
+    registrar.set_leaf();
+    if (pre_register) {
+      Runtime::preregister_task_variant<
+          RequestManager::register_peft_config_task>(
+          registrar, "RequestManager Register PEFT Config Task");
+    } else {
+      if (enable_control_replication) {
+        registrar.global_registration = false;
+      }
+      runtime->register_task_variant<RequestManager::register_peft_config_task>(
+          registrar);
+    }
+  }
   // RequestManager prepare_next_batch
   {
     TaskVariantRegistrar registrar(RM_PREPARE_NEXT_BATCH_TASK_ID,
@@ -4724,14 +4749,14 @@ void register_flexflow_internal_tasks(Runtime *runtime,
     registrar.set_leaf();
     if (pre_register) {
       Runtime::preregister_task_variant<
-          BatchConfig,
+          SerializedBatchConfig,
           RequestManager::prepare_next_batch_task>(
           registrar, "RequestManager Prepare Next Batch Task");
     } else {
       if (enable_control_replication) {
         registrar.global_registration = false;
       }
-      runtime->register_task_variant<BatchConfig,
+      runtime->register_task_variant<SerializedBatchConfig,
                                      RequestManager::prepare_next_batch_task>(
           registrar);
     }
@@ -4832,6 +4857,43 @@ void register_flexflow_internal_tasks(Runtime *runtime,
           registrar);
     }
   }
+  // MockModel inference
+  {
+    TaskVariantRegistrar registrar(MOCK_MODEL_INF_TASK_ID,
+                                   "MockModel Inference");
+    registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+    registrar.set_leaf();
+    if (pre_register) {
+      Runtime::preregister_task_variant<InferenceResult,
+                                        MockModel::inference_task>(
+          registrar, "MockModel Inference Task");
+    } else {
+      if (enable_control_replication) {
+        registrar.global_registration = false;
+      }
+      runtime->register_task_variant<InferenceResult,
+                                     MockModel::inference_task>(registrar);
+    }
+  }
+  // MockModel beam search inference
+  {
+    TaskVariantRegistrar registrar(MOCK_MODEL_BEAM_INF_TASK_ID,
+                                   "MockModel Beam Inference");
+    registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+    registrar.set_leaf();
+    if (pre_register) {
+      Runtime::preregister_task_variant<BeamInferenceResult,
+                                        MockModel::beam_inference_task>(
+          registrar, "MockModel Beam Inference Task");
+    } else {
+      if (enable_control_replication) {
+        registrar.global_registration = false;
+      }
+      runtime->register_task_variant<BeamInferenceResult,
+                                     MockModel::beam_inference_task>(
+          registrar);
+    }
+  }
 #endif
   // ElementUnary task
   {
@@ -17,15 +17,23 @@
 #include "flexflow/ops/fused.h"
 #include "flexflow/ops/lora_linear.h"
 #include "flexflow/parallel_ops/parallel_op.h"
+#include "flexflow/utils/pipeline_depth_tuner.h"
+#include "flexflow/utils/speculative_tree.h"
+#include "legion/legion_utilities.h"
 // #include "flexflow/tokenizers.h"
+#include <algorithm>
 #include <bitset>
+#include <cmath>
 #include <filesystem>
 #include <future>
 #include <iomanip>
+#include <map>
 #include <new>
 #include <nlohmann/json.hpp>
-#include <stack>
+#include <random>
+#include <sstream>
 #include <stdexcept>
+#include <unordered_set>
 
 namespace FlexFlow {
 
@@ -111,6 +119,7 @@ RequestManager::RequestManager()
   max_tokens_per_batch = -1;
   max_spec_tree_token_num = -1;
   max_sequence_length = -1;
+  scheduling_policy = SchedulingPolicy::create(SCHEDULING_FCFS);
 }
 
 void RequestManager::set_max_requests_per_batch(int max_num_requests) {
@@ -148,6 +157,12 @@ int RequestManager::get_max_spec_tree_token_num() {
   return max_spec_tree_token_num;
 }
 
+int RequestManager::get_bitmask_words_per_row() {
+  int words_per_row = (get_max_spec_tree_token_num() + 63) / 64;
+  assert(words_per_row <= BatchConfig::BitMask::MAX_WORDS_PER_ROW);
+  return words_per_row;
+}
+
 int RequestManager::get_max_verify_tokens_per_batch() {
   assert(max_tokens_per_batch > 0);
   return max_tokens_per_batch +
@@ -164,15 +179,396 @@ int RequestManager::get_max_sequence_length() {
   return max_sequence_length;
 }
 
+void RequestManager::set_kv_cache_block_size(int block_size) {
+  assert(block_size >= 0);
+  assert(kv_block_manager == nullptr &&
+         "Cannot change the KV cache block size after serving started");
+  kv_cache_block_size = block_size;
+}
+
+int RequestManager::get_kv_cache_block_size() {
+  return kv_cache_block_size;
+}
+
+void RequestManager::set_num_kv_cache_blocks(int num_blocks) {
+  assert(num_blocks > 0);
+  assert(kv_block_manager == nullptr &&
+         "Cannot change the number of KV cache blocks after serving started");
+  num_kv_cache_blocks = num_blocks;
+}
+
+int RequestManager::get_num_kv_cache_blocks() {
+  assert(is_kv_cache_paged());
+  if (num_kv_cache_blocks == -1) {
+    // by default, use as much memory as the contiguous KV cache
+    return get_max_requests_per_batch() *
+           ((get_max_sequence_length() + kv_cache_block_size - 1) /
+            kv_cache_block_size);
+  }
+  return num_kv_cache_blocks;
+}
+
+bool RequestManager::is_kv_cache_paged() {
+  return kv_cache_block_size > 0;
+}
+
+void RequestManager::set_enable_prefix_caching(bool enable_prefix_caching_) {
+  enable_prefix_caching = enable_prefix_caching_;
+}
+
+void RequestManager::set_scheduling_policy(SchedulingPolicyType policy_type) {
+  const std::lock_guard<std::mutex> lock(request_queue_mutex);
+  drain_request_intake_queue();
+  assert(scheduling_policy->empty() &&
+         "Cannot change the scheduling policy with pending requests");
+  scheduling_policy = SchedulingPolicy::create(policy_type);
+}
+
+void RequestManager::set_max_prefill_tokens_per_batch(int max_num_tokens) {
+  assert(max_num_tokens > 0);
+  max_prefill_tokens_per_batch = max_num_tokens;
+}
+
+int RequestManager::get_max_prefill_tokens_per_batch() {
+  if (max_prefill_tokens_per_batch == -1) {
+    return get_max_tokens_per_batch();
+  }
+  return std::min(max_prefill_tokens_per_batch, get_max_tokens_per_batch());
+}
+
+void RequestManager::set_max_inflight_batches(int max_inflight_batches_) {
+  assert(max_inflight_batches_ >= 0 &&
+         max_inflight_batches_ <= BatchConfig::MAX_INFLIGHT_BATCHES);
+  max_inflight_batches = max_inflight_batches_;
+}
+
+int RequestManager::get_max_inflight_batches() {
+  return max_inflight_batches;
+}
+
+RequestMetricsCollector &RequestManager::get_request_metrics() {
+  return request_metrics;
+}
+
+BatchStepStatsBuffer &RequestManager::get_batch_step_stats() {
+  return batch_step_stats;
+}
+
+void RequestManager::record_batch_step_stats(BatchConfig const &bc,
+                                             int max_num_tokens) {
+  BatchStepStats stats;
+  stats.timestamp = Realm::Clock::current_time_in_microseconds();
+  stats.num_active_requests = bc.num_active_requests();
+  stats.num_decode_tokens = bc.num_generation_tokens;
+  stats.num_peft_tokens = bc.num_peft_tokens;
+  stats.num_prefill_tokens =
+      bc.num_tokens - bc.num_generation_tokens - bc.num_peft_tokens;
+  stats.num_padding_tokens = std::max(max_num_tokens - bc.num_tokens, 0);
+  long long scheduling_time = scheduling_time_us;
+  long long wait_time = inflight_wait_time_us;
+  stats.scheduling_time = scheduling_time - recorded_scheduling_time_us;
+  stats.wait_time = wait_time - recorded_wait_time_us;
+  recorded_scheduling_time_us = scheduling_time;
+  recorded_wait_time_us = wait_time;
+  if (is_kv_cache_paged()) {
+    KVCacheBlockManager *kv_block_manager = get_kv_block_manager();
+    int num_used_blocks = kv_block_manager->get_num_blocks() -
+                          kv_block_manager->get_num_free_blocks() -
+                          kv_block_manager->get_num_evictable_blocks();
+    stats.num_kv_tokens_in_use =
+        (long long)num_used_blocks * get_kv_cache_block_size();
+    stats.kv_token_capacity =
+        (long long)kv_block_manager->get_num_blocks() *
+        get_kv_cache_block_size();
+  } else {
+    for (int i = 0; i < BatchConfig::max_requests_per_batch(); i++) {
+      if (!bc.request_completed[i]) {
+        stats.num_kv_tokens_in_use +=
+            bc.requestsInfo[i].first_token_depth_in_request +
+            bc.requestsInfo[i].num_tokens_in_batch;
+      }
+    }
+    stats.kv_token_capacity = (long long)get_max_requests_per_batch() *
+                              get_max_sequence_length();
+  }
+  batch_step_stats.push(stats);
+}
+
+void RequestManager::record_request_metrics(Request const &request,
+                                            ProfileInfo const &profile_info) {
+  RequestMetrics metrics;
+  metrics.guid = request.guid;
+  metrics.warmup = request.warmup;
+  metrics.registration_time = request.registration_time;
+  metrics.start_time = profile_info.start_time;
+  if (profile_info.first_token_time_set) {
+    metrics.first_token_time = profile_info.first_token_time;
+  }
+  metrics.finish_time = profile_info.finish_time;
+  metrics.prompt_length = request.initial_len;
+  metrics.output_length = request.tokens.size() - request.initial_len;
+  metrics.llm_decoding_steps = profile_info.llm_decoding_steps;
+  metrics.num_preemptions = request.num_preemptions;
+  metrics.num_speculated_tokens = profile_info.num_speculated_tokens;
+  metrics.num_accepted_tokens = profile_info.num_accepted_tokens;
+  request_metrics.add(metrics);
+}
+
+KVCacheBlockManager *RequestManager::get_kv_block_manager() {
+  assert(is_kv_cache_paged());
+  if (kv_block_manager == nullptr) {
+    kv_block_manager = std::make_unique<KVCacheBlockManager>(
+        get_num_kv_cache_blocks(), kv_cache_block_size);
+  }
+  return kv_block_manager.get();
+}
+
+bool RequestManager::reserve_kv_cache(Request const &request, int num_tokens) {
+  KVCacheBlockManager *block_manager = get_kv_block_manager();
+  if (block_manager->has_block_table(request.guid) &&
+      (int)block_manager->get_block_table(request.guid).size() >=
+          block_manager->num_blocks_needed(num_tokens)) {
+    return true;
+  }
+  // the request never holds more than max_length tokens
+  int num_reserved_tokens = std::max(
+      num_tokens,
+      std::min(num_tokens + KV_CACHE_GROWTH_BLOCKS * kv_cache_block_size,
+               request.max_length));
+  return block_manager->reserve(request.guid, num_reserved_tokens) ||
+         block_manager->reserve(request.guid, num_tokens);
+}
+
+void RequestManager::fill_kv_block_tables(BatchConfig &bc) {
+  assert(get_num_ssms() == 0 &&
+         "The paged KV cache only supports incremental decoding");
+  assert(!enable_peft_finetuning &&
+         "The paged KV cache does not support PEFT finetuning");
+  KVCacheBlockManager *block_manager = get_kv_block_manager();
+  bc.num_kv_block_table_entries = 0;
+  for (int i = 0; i < bc.max_requests_per_batch(); i++) {
+    if (bc.request_completed[i]) {
+      continue;
+    }
+    std::vector<int> const &table =
+        block_manager->get_block_table(bc.requestsInfo[i].request_guid);
+    assert(bc.num_kv_block_table_entries + table.size() <=
+               BatchConfig::MAX_KV_BLOCK_TABLE_SIZE &&
+           "Too many KV cache blocks in one batch, increase the block size");
+    bc.requestsInfo[i].kv_block_table_offset = bc.num_kv_block_table_entries;
+    std::copy(table.begin(),
+              table.end(),
+              bc.kv_block_table + bc.num_kv_block_table_entries);
+    bc.num_kv_block_table_entries += table.size();
+  }
+}
+
+void RequestManager::set_default_generation_config(
+    GenerationConfig const &config) {
+  default_generation_config = config;
+}
+
+void RequestManager::fill_sampling_info(BatchConfig &bc) {
+  bc.penalty_tokens.clear();
+  for (int i = 0; i < bc.max_requests_per_batch(); i++) {
+    if (bc.request_completed[i]) {
+      continue;
+    }
+    BatchConfig::PerRequestInfo &info = bc.requestsInfo[i];
+    Request const &request = all_requests[info.request_guid];
+    if (!request.generation_config.has_value()) {
+      // finetuning requests do not sample
+      continue;
+    }
+    GenerationConfig const &config = request.generation_config.value();
+    info.do_sample = config.do_sample;
+    info.temperature = config.temperature;
+    info.top_p = config.topp;
+    info.top_k = config.topk;
+    info.repetition_penalty = config.repetition_penalty;
+    info.seed = config.seed;
+    info.penalty_tokens_offset = bc.penalty_tokens.size();
+    info.num_penalty_tokens = 0;
+    if (config.repetition_penalty == 1.0f) {
+      continue;
+    }
+    // penalize the most recent distinct tokens of the request
+    auto first = bc.penalty_tokens.begin() + info.penalty_tokens_offset;
+    for (int j = (int)request.tokens.size() - 1; j >= 0; j--) {
+      if (info.num_penalty_tokens ==
+          BatchConfig::MAX_PENALTY_TOKENS_PER_REQUEST) {
+        break;
+      }
+      TokenId token = request.tokens[j];
+      if (std::find(first, bc.penalty_tokens.end(), token) ==
+          bc.penalty_tokens.end()) {
+        bc.penalty_tokens.push_back(token);
+        first = bc.penalty_tokens.begin() + info.penalty_tokens_offset;
+        info.num_penalty_tokens++;
+      }
+    }
+  }
+}
+
+void RequestManager::set_enable_preemption(bool enable_preemption_) {
+  enable_preemption = enable_preemption_;
+}
+
+int RequestManager::select_preemption_victim(
+    BatchConfig const &bc,
+    int batch_size,
+    PendingRequest const &pending_request) {
+  // Only requests that the scheduling policy orders after the waiting one
+  // can be preempted, otherwise they would go back ahead of it in the queue
+  // and be admitted again in its place. Among those, preempt the one the
+  // policy would admit last (e.g. the lowest priority, or the latest
+  // arrival).
+  int victim = -1;
+  PendingRequest victim_info;
+  for (int i = 0; i < batch_size; i++) {
+    if (bc.request_completed[i]) {
+      continue;
+    }
+    Request const &request = all_requests[bc.requestsInfo[i].request_guid];
+    PendingRequest info = get_requeued_scheduling_info(request);
+    if (!scheduling_policy->admits_before(pending_request, info)) {
+      continue;
+    }
+    if (victim == -1 || scheduling_policy->admits_before(victim_info, info)) {
+      victim = i;
+      victim_info = info;
+    }
+  }
+  return victim;
+}
+
+PendingRequest
+    RequestManager::get_requeued_scheduling_info(Request const &request) {
+  PendingRequest pending_request = request.scheduling_info;
+  // the request resumes by recomputing all tokens generated so far
+  pending_request.prompt_length = request.tokens.size();
+  if (profiling_requests[request.guid].first_token_time_set) {
+    // the time to first token no longer matters
+    pending_request.deadline = -1;
+  }
+  return pending_request;
+}
+
+void RequestManager::preempt_request(BatchConfig &bc, int batch_idx) {
+  assert(!bc.request_completed[batch_idx]);
+  BatchConfig::PerRequestInfo &info = bc.requestsInfo[batch_idx];
+  Request &request = all_requests[info.request_guid];
+  // keys and values of the tokens before this batch are in the KV cache
+  int num_computed_tokens = info.first_token_depth_in_request;
+
+  // remove the tokens of the request from the batch
+  int offset = info.first_token_offset_in_batch;
+  int num_removed = info.num_tokens_in_batch;
+  for (int t = offset; t + num_removed < bc.num_tokens; t++) {
+    bc.tokensInfo[t] = bc.tokensInfo[t + num_removed];
+  }
+  bc.num_tokens -= num_removed;
+  for (int i = 0; i < bc.max_requests_per_batch(); i++) {
+    if (!bc.request_completed[i] &&
+        bc.requestsInfo[i].first_token_offset_in_batch > offset) {
+      bc.requestsInfo[i].first_token_offset_in_batch -= num_removed;
+    }
+  }
+  if (!info.prompt_phase) {
+    bc.num_generation_tokens--;
+  }
+  bc.request_completed[batch_idx] = true;
+  info.num_tokens_in_batch = 0;
+
+  // Drop the KV cache of the request; it will be recomputed when the request
+  // resumes. With prefix caching, its blocks stay cached until evicted, so
+  // resuming soon after is cheap.
+  if (is_kv_cache_paged()) {
+    if (enable_prefix_caching && request.peft_model_id == PEFTModelID::NO_ID) {
+      get_kv_block_manager()->cache_prefix(
+          request.guid, request.tokens, num_computed_tokens);
+    }
+    get_kv_block_manager()->release(request.guid);
+  }
+
+  // put the request back in the queue with all tokens generated so far
+  request.status = Request::PENDING;
+  request.num_preemptions++;
+  scheduling_policy->requeue(get_requeued_scheduling_info(request));
+  log_req_mgr.print("[Preempt] guid(%zu) after %zu tokens",
+                    request.guid,
+                    request.tokens.size());
+}
+
+void RequestManager::update_batch_config_request_ids(BatchConfig &bc,
+                                                     int batch_size) {
+  // the active requests, in the order of their tokens in the batch
+  std::vector<std::pair<int, int>> active_requests;
+  for (int i = 0; i < batch_size; i++) {
+    if (!bc.request_completed[i]) {
+      active_requests.push_back(
+          std::make_pair(bc.requestsInfo[i].first_token_offset_in_batch, i));
+    }
+  }
+  std::sort(active_requests.begin(), active_requests.end());
+  for (int k = 0; k < (int)active_requests.size(); k++) {
+    bc.requestsInfo[k].batch_config_request_id = active_requests[k].second;
+  }
+}
+
 void RequestManager::push_spec_infer_tree_width(int tree_width) {
   assert(tree_width <= BeamSearchBatchConfig::MAX_BEAM_WIDTH);
   spec_infer_tree_width.emplace_back(tree_width);
 }
 
+void RequestManager::update_spec_depth(Request &request,
+                                       int num_accepted_tokens) {
+  if (request.spec_drafted_depth <= 0) {
+    // nothing was drafted, e.g. right after the prompt
+    return;
+  }
+  // the tree may have been shallower than spec_depth
+  float acceptance_rate =
+      (float)num_accepted_tokens / request.spec_drafted_depth;
+  if (request.spec_accepted_tokens_avg < 0) {
+    request.spec_accepted_tokens_avg = num_accepted_tokens;
+    request.spec_acceptance_rate = acceptance_rate;
+  } else {
+    float w = SPEC_ACCEPTANCE_EMA_WEIGHT;
+    request.spec_accepted_tokens_avg =
+        w * num_accepted_tokens + (1 - w) * request.spec_accepted_tokens_avg;
+    request.spec_acceptance_rate =
+        w * acceptance_rate + (1 - w) * request.spec_acceptance_rate;
+  }
+  // speculate one token past the expected accepted length: the depth grows
+  // while whole trees are accepted and shrinks when most drafts are rejected
+  int depth = (int)std::ceil(request.spec_accepted_tokens_avg) + 1;
+  request.spec_depth =
+      std::max(1, std::min(depth, BeamSearchBatchConfig::MAX_BEAM_DEPTH));
+}
+
+int RequestManager::get_spec_tree_width(Request const &request,
+                                        int ssm_decoding_steps) {
+  if (request.spec_acceptance_rate >= SPEC_CHAIN_ACCEPTANCE_RATE) {
+    // the SSM's top token is almost always accepted, so extra branches
+    // would only add tokens to verify
+    return 1;
+  }
+  return spec_infer_tree_width.size() > ssm_decoding_steps
+             ? spec_infer_tree_width[ssm_decoding_steps]
+             : 1;
+}
+
 void RequestManager::set_enable_peft_finetuning(bool enable_peft_finetuning_) {
   enable_peft_finetuning = enable_peft_finetuning_;
 }
 
+void RequestManager::set_streaming_callback(StreamingCallback callback) {
+  const std::lock_guard<std::mutex> lock(streaming_callback_mutex);
+  streaming_callback = std::move(callback);
+  has_streaming_callback = (bool)streaming_callback;
+}
+
 void RequestManager::set_inference_finished(bool finished) {
   inference_finished = finished;
 }
@@ -197,8 +593,8 @@ void RequestManager::register_tokenizer(ModelType type,
     }
     if (std::filesystem::exists(tokenizer_json_path)) {
       // load from tokenizer.json
-      this->tokenizer_ = Tokenizer::FromBlobJSON(
-          LoadBytesFromFile(tokenizer_json_path.string()));
+      std::string blob = LoadBytesFromFile(tokenizer_json_path.string());
+      tokenizer_factory = [blob]() { return Tokenizer::FromBlobJSON(blob); };
     } else {
       // load from tokenizer.model
       std::filesystem::path tokenizer_model_path;
@@ -214,8 +610,10 @@ void RequestManager::register_tokenizer(ModelType type,
         assert(false);
       }
       old_llama_tokenizer = true;
-      this->tokenizer_ = Tokenizer::FromBlobSentencePiece(
-          LoadBytesFromFile(tokenizer_model_path.string()));
+      std::string blob = LoadBytesFromFile(tokenizer_model_path.string());
+      tokenizer_factory = [blob]() {
+        return Tokenizer::FromBlobSentencePiece(blob);
+      };
     }
   } else if (model_type == ModelType::OPT) {
     std::filesystem::path vocab_file = tokenizer_folder / "vocab.json";
@@ -231,14 +629,18 @@ void RequestManager::register_tokenizer(ModelType type,
     std::string merges = LoadBytesFromFile(merges_file.string());
     std::string added_tokens = LoadBytesFromFile(added_tokens_file.string());
 
-    this->tokenizer_ =
-        Tokenizer::FromBlobByteLevelBPE(vocab, merges, added_tokens);
+    tokenizer_factory = [vocab, merges, added_tokens]() {
+      return Tokenizer::FromBlobByteLevelBPE(vocab, merges, added_tokens);
+    };
   } else if (model_type == ModelType::FALCON ||
              model_type == ModelType::STARCODER ||
              model_type == ModelType::MPT) {
     std::string falcon_tokenizer_path = join_path({path, "tokenizer.json"});
-    this->tokenizer_ =
-        Tokenizer::FromBlobJSON(LoadBytesFromFile(falcon_tokenizer_path));
+    std::string blob = LoadBytesFromFile(falcon_tokenizer_path);
+    tokenizer_factory = [blob]() { return Tokenizer::FromBlobJSON(blob); };
+  }
+  if (tokenizer_factory) {
+    this->tokenizer_ = tokenizer_factory();
   }
 }
 
@@ -265,6 +667,7 @@ size_t RequestManager::get_num_ssms() {
 
 void RequestManager::set_peft_config(PEFTModelID const &peft_model_id,
                                      LoraLinearConfig const &peft_config) {
+  const std::lock_guard<std::mutex> lock(peft_config_mutex);
   // check that peft_model_id is not already in use
   assert(peft_configs.find(peft_model_id) == peft_configs.end() &&
          "PEFT model ID already in use");
@@ -276,6 +679,8 @@ void RequestManager::set_peft_config(PEFTModelID const &peft_model_id,
 
 LoraLinearConfig const &
     RequestManager::get_peft_config(PEFTModelID const &peft_model_id) {
+  const std::lock_guard<std::mutex> lock(peft_config_mutex);
+  // references to unordered_map elements stay valid after later insertions
   assert(peft_configs.find(peft_model_id) != peft_configs.end() &&
          "PEFT model ID not found");
   return peft_configs[peft_model_id];
@@ -327,12 +732,74 @@ PEFTModelID *
   PEFTModelID *peft_model_id = new PEFTModelID(peft_model_global_guid++);
   RequestManager *rm = RequestManager::get_request_manager();
   rm->set_peft_config(*peft_model_id, peft_config);
+
+  // Publish the config to the processes of all workers, so that batches only
+  // need to carry the adapter id
+  Context ctx = config.lg_ctx;
+  Runtime *runtime = config.lg_hlr;
+  Serializer sez;
+  std::string peft_config_str = peft_config.serialize_to_json_string();
+  sez.serialize(peft_model_id->id);
+  sez.serialize(peft_config_str.size());
+  sez.serialize(peft_config_str.c_str(), peft_config_str.size());
+  IndexLauncher launcher(RM_REGISTER_PEFT_CONFIG_TASK_ID,
+                         config.all_gpu_task_is,
+                         TaskArgument(sez.get_buffer(), sez.get_used_bytes()),
+                         ArgumentMap(),
+                         Predicate::TRUE_PRED,
+                         false /*must*/,
+                         0 /*mapper_id*/,
+                         FFConfig::DataParallelism_GPU);
+  FutureMap fm = runtime->execute_index_space(ctx, launcher);
+  // batches using the adapter must not run before it is registered
+  fm.wait_all_results();
   return peft_model_id;
 }
 
+/*static*/
+void RequestManager::register_peft_config_task(
+    Task const *task,
+    std::vector<PhysicalRegion> const &regions,
+    Context ctx,
+    Runtime *runtime) {
+  assert(regions.size() == 0);
+  assert(task->regions.size() == 0);
+  Deserializer dez(task->args, task->arglen);
+  size_t id, peft_config_size;
+  dez.deserialize(id);
+  dez.deserialize(peft_config_size);
+  std::string peft_config_str(peft_config_size, '\0');
+  dez.deserialize(&peft_config_str[0], peft_config_size);
+  PEFTModelID peft_model_id(id);
+
+  RequestManager *rm = RequestManager::get_request_manager();
+  const std::lock_guard<std::mutex> lock(rm->peft_config_mutex);
+  // the process that registered the adapter, and every worker after the
+  // first one in each process, already have it
+  if (rm->peft_configs.find(peft_model_id) == rm->peft_configs.end()) {
+    rm->peft_configs[peft_model_id] =
+        LoraLinearConfig::deserialize_from_json_string(peft_config_str);
+  }
+}
+
 RequestManager::RequestGuid
     RequestManager::register_new_request(Request const &request_) {
-  const std::lock_guard<std::mutex> lock(request_queue_mutex);
+  std::vector<int32_t> prompt_tokens;
+  if (request_.benchmarking_tokens < 0) {
+    const std::lock_guard<std::mutex> lock(tokenizer_mutex);
+    prompt_tokens = this->tokenizer_->Encode(request_.prompt);
+  }
+  std::vector<Request> new_requests;
+  RequestGuid guid =
+      add_tokenized_request(request_, prompt_tokens, new_requests);
+  enqueue_new_requests(std::move(new_requests));
+  return guid;
+}
+
+RequestManager::RequestGuid RequestManager::add_tokenized_request(
+    Request const &request_,
+    std::vector<int32_t> const &tokens,
+    std::vector<Request> &new_requests) {
   // Add a new request
   Request request;
   request.status = Request::PENDING;
@@ -340,6 +807,12 @@ RequestManager::RequestGuid
   request.max_length = request_.max_length;
   request.max_new_tokens = request_.max_new_tokens;
   request.add_special_tokens = request_.add_special_tokens;
+  request.generation_config =
+      request_.generation_config.value_or(default_generation_config);
+  if (request.generation_config->seed < 0) {
+    thread_local std::mt19937_64 seed_generator(std::random_device{}());
+    request.generation_config->seed = seed_generator() >> 1;
+  }
   // both unset
   if (request.max_length == -1 && request.max_new_tokens == -1) {
     request.max_length = get_max_sequence_length() - 1;
@@ -354,6 +827,8 @@ RequestManager::RequestGuid
   }
   request.peft_model_id = request_.peft_model_id;
   request.warmup = request_.warmup;
+  request.priority = request_.priority;
+  request.ttft_deadline_ms = request_.ttft_deadline_ms;
   if (bos_token_id >= 0 && model_type != ModelType::FALCON &&
       request.add_special_tokens) {
     request.tokens.push_back(bos_token_id);
@@ -366,7 +841,6 @@ RequestManager::RequestGuid
                           request_.benchmarking_tokens,
                           15); // insert random number
   } else {
-    std::vector<int32_t> tokens = this->tokenizer_->Encode(request_.prompt);
     // from here on, we will only use the max_length parameter
     if (request.max_new_tokens != -1) {
       request.max_length = tokens.size() + request.max_new_tokens;
@@ -386,31 +860,56 @@ RequestManager::RequestGuid
                 << get_max_sequence_length() << ".\n";
       return INVALID_GUID;
     }
-    for (int i = 0; i < tokens.size(); i++) {
-      std::cout << "[" << i << "]" << tokens.at(i) << "\n";
+    if (verbose) {
+      for (int i = 0; i < tokens.size(); i++) {
+        std::cout << "[" << i << "]" << tokens.at(i) << "\n";
+      }
     }
     request.tokens.insert(request.tokens.end(), tokens.begin(), tokens.end());
   }
 
   request.initial_len = request.tokens.size();
 
+  // with a paged KV cache, a request must fit in the whole cache, or it
+  // would wait at the head of the queue forever
+  if (is_kv_cache_paged()) {
+    int kv_cache_capacity = get_num_kv_cache_blocks() * kv_cache_block_size;
+    if (request.tokens.size() >= kv_cache_capacity) {
+      std::cout << "Error: prompt (" << request.tokens.size()
+                << " tokens) does not fit in the KV cache of "
+                << kv_cache_capacity << " tokens.\n";
+      return INVALID_GUID;
+    }
+    if (request.max_length > kv_cache_capacity) {
+      std::cout << "max_length (" << request.max_length
+                << ") exceeds the KV cache of " << kv_cache_capacity
+                << " tokens, and is truncated.\n";
+      request.max_length = kv_cache_capacity;
+    }
+  }
+
   if (get_num_ssms() == 0) {
-    std::cout << "No small speculative model registered, using incremental "
-                 "decoding."
-              << std::endl;
+    log_req_mgr.debug("No small speculative model registered, using "
+                      "incremental decoding.");
   } else {
-    std::cout << "Num of SSMs: " << get_num_ssms() << std::endl;
+    log_req_mgr.debug("Num of SSMs: %d", get_num_ssms());
     for (int i = 0; i < get_num_ssms(); i++) {
       BeamTree beam_tree = BeamTree{};
       request.beam_trees.push_back(beam_tree);
     }
   }
 
-  pending_infr_request_queue.push(request);
-  all_requests[request.guid] = request;
   {
-    const std::lock_guard<std::mutex> lock(request_to_promise_mutex);
-    request_to_promise[request.guid] = new std::promise<void>();
+    PendingRequest pending_request;
+    pending_request.guid = request.guid;
+    pending_request.prompt_length = request.tokens.size();
+    pending_request.peft_model_id = request.peft_model_id;
+    pending_request.priority = request.priority;
+    if (request.ttft_deadline_ms >= 0) {
+      pending_request.deadline = Realm::Clock::current_time_in_microseconds() +
+                                 request.ttft_deadline_ms * 1000;
+    }
+    request.scheduling_info = pending_request;
   }
 
   {
@@ -428,19 +927,36 @@ RequestManager::RequestGuid
   gr.input_tokens = request.tokens;
   gr.output_text = request_.prompt;
   gr.output_tokens = request.tokens;
-  request_generation_results[request.guid] = gr;
-
-  ProfileInfo profile_info;
-  profile_info.registration_time = Realm::Clock::current_time_in_microseconds();
-  profiling_requests[request.guid] = profile_info;
+  init_completion_state(gr);
 
+  request.registration_time = Realm::Clock::current_time_in_microseconds();
+  new_requests.push_back(request);
   return request.guid;
 }
 
 RequestManager::RequestGuid
     RequestManager::register_new_peft_request(Request const &request_) {
   assert(enable_peft_finetuning && "PEFT finetuning is not enabled");
-  const std::lock_guard<std::mutex> lock(request_queue_mutex);
+  Request::Dataset dataset;
+  if (request_.benchmarking_tokens < 0) {
+    const std::lock_guard<std::mutex> lock(tokenizer_mutex);
+    for (std::string const &text :
+         load_peft_dataset(request_.dataset_filepath)) {
+      dataset.push_back(tokenize_dataset_entry(*tokenizer_, text));
+    }
+  }
+  std::vector<Request> new_requests;
+  RequestGuid guid =
+      add_tokenized_peft_request(request_, dataset, new_requests);
+  enqueue_new_requests(std::move(new_requests));
+  return guid;
+}
+
+RequestManager::RequestGuid RequestManager::add_tokenized_peft_request(
+    Request const &request_,
+    Request::Dataset const &dataset,
+    std::vector<Request> &new_requests) {
+  assert(enable_peft_finetuning && "PEFT finetuning is not enabled");
   // Add a new request
   Request request;
   request.status = Request::PENDING;
@@ -483,25 +999,13 @@ RequestManager::RequestGuid
                         15); // insert random number
     request.dataset.push_back(std::make_pair(input_tokens, output_tokens));
   } else {
-    using json = nlohmann::json;
-    std::ifstream file_handle(request.dataset_filepath);
-    assert(file_handle.good() && "Dataset file does not exist.");
-    json dataset_json = json::parse(file_handle,
-                                    /*parser_callback_t */ nullptr,
-                                    /*allow_exceptions */ true,
-                                    /*ignore_comments */ true);
-
-    for (auto &prompt : dataset_json) {
-      std::string text = prompt.get<std::string>();
-      std::string output_text("");
-      std::vector<int32_t> input_tokens;
-      input_tokens = this->tokenizer_->Encode(text);
+    for (auto const &entry : dataset) {
+      std::vector<int32_t> input_tokens = entry.first;
+      std::vector<int32_t> const &output_tokens = entry.second;
       if (bos_token_id >= 0 && model_type != ModelType::FALCON &&
           request.add_special_tokens) {
         input_tokens.insert(input_tokens.begin(), bos_token_id);
       }
-      std::vector<int32_t> output_tokens =
-          this->tokenizer_->Encode(output_text);
       if (input_tokens.size() + output_tokens.size() >
           get_max_sequence_length()) {
         std::cout << "Error: sample in training dataset is "
@@ -527,24 +1031,16 @@ RequestManager::RequestGuid
   // Currently don't support speculative inference for PEFT
   assert(get_num_ssms() == 0);
   if (get_num_ssms() == 0) {
-    std::cout << "No small speculative model registered, using incremental "
-                 "decoding."
-              << std::endl;
+    log_req_mgr.debug("No small speculative model registered, using "
+                      "incremental decoding.");
   } else {
-    std::cout << "Num of SSMs: " << get_num_ssms() << std::endl;
+    log_req_mgr.debug("Num of SSMs: %d", get_num_ssms());
     for (int i = 0; i < get_num_ssms(); i++) {
       BeamTree beam_tree = BeamTree{};
       request.beam_trees.push_back(beam_tree);
     }
   }
 
-  pending_peft_request_queue.push(request);
-  all_requests[request.guid] = request;
-  {
-    const std::lock_guard<std::mutex> lock(request_to_promise_mutex);
-    request_to_promise[request.guid] = new std::promise<void>();
-  }
-
   for (size_t r = 0; r < request.dataset.size(); r++) {
     std::string input = "[" + std::to_string(r) + "] input:";
     std::string output = "[" + std::to_string(r) + "] output:";
@@ -564,40 +1060,174 @@ RequestManager::RequestGuid
   // gr.input_tokens = request.tokens;
   // gr.output_text = prompt;
   // gr.output_tokens = request.tokens;
-  request_generation_results[request.guid] = gr;
-
-  ProfileInfo profile_info;
-  profile_info.registration_time = Realm::Clock::current_time_in_microseconds();
-  profiling_requests[request.guid] = profile_info;
+  init_completion_state(gr);
 
+  request.registration_time = Realm::Clock::current_time_in_microseconds();
+  new_requests.push_back(request);
   return request.guid;
 }
 
+std::vector<RequestManager::RequestGuid> RequestManager::register_new_requests(
+    std::vector<Request> const &requests) {
+  // Tokenize all prompts and dataset entries on worker threads, without
+  // holding request_queue_mutex
+  std::vector<std::vector<int32_t>> prompt_tokens(requests.size());
+  std::vector<Request::Dataset> datasets(requests.size());
+  std::vector<std::vector<std::string>> dataset_texts(requests.size());
+  // (request index, dataset entry index or -1 for the prompt)
+  std::vector<std::pair<size_t, int>> items;
+  for (size_t i = 0; i < requests.size(); i++) {
+    Request const &request = requests[i];
+    if (request.benchmarking_tokens >= 0) {
+      continue;
+    }
+    if (request.req_type == RequestType::REQ_INFERENCE) {
+      items.push_back(std::make_pair(i, -1));
+    } else {
+      assert(enable_peft_finetuning && "PEFT finetuning is not enabled");
+      dataset_texts[i] = load_peft_dataset(request.dataset_filepath);
+      datasets[i].resize(dataset_texts[i].size());
+      for (int j = 0; j < dataset_texts[i].size(); j++) {
+        items.push_back(std::make_pair(i, j));
+      }
+    }
+  }
+  if (!items.empty()) {
+    assert(tokenizer_factory && "No tokenizer registered");
+    const std::lock_guard<std::mutex> lock(worker_tokenizers_mutex);
+    size_t max_threads =
+        (items.size() + MIN_TOKENIZATION_ITEMS_PER_THREAD - 1) /
+        MIN_TOKENIZATION_ITEMS_PER_THREAD;
+    size_t num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0) {
+      num_threads = 8;
+    }
+    num_threads = std::min(num_threads, max_threads);
+    while (worker_tokenizers.size() < num_threads) {
+      worker_tokenizers.push_back(tokenizer_factory());
+    }
+    std::atomic<size_t> next_item(0);
+    auto worker = [&](Tokenizer *tokenizer) {
+      for (size_t k = next_item++; k < items.size(); k = next_item++) {
+        size_t i = items[k].first;
+        int j = items[k].second;
+        if (j < 0) {
+          prompt_tokens[i] = tokenizer->Encode(requests[i].prompt);
+        } else {
+          datasets[i][j] =
+              tokenize_dataset_entry(*tokenizer, dataset_texts[i][j]);
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; t++) {
+      threads.emplace_back(worker, worker_tokenizers[t].get());
+    }
+    worker(worker_tokenizers[0].get());
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+  // Enqueue all the requests at once
+  std::vector<RequestGuid> guids;
+  std::vector<Request> new_requests;
+  for (size_t i = 0; i < requests.size(); i++) {
+    if (requests[i].req_type == RequestType::REQ_INFERENCE) {
+      guids.push_back(
+          add_tokenized_request(requests[i], prompt_tokens[i], new_requests));
+    } else {
+      guids.push_back(
+          add_tokenized_peft_request(requests[i], datasets[i], new_requests));
+    }
+  }
+  enqueue_new_requests(std::move(new_requests));
+  return guids;
+}
+
+void RequestManager::enqueue_new_requests(std::vector<Request> &&requests) {
+  if (!requests.empty()) {
+    request_intake_queue.push(std::move(requests));
+  }
+}
+
+void RequestManager::drain_request_intake_queue() {
+  std::vector<Request> requests;
+  while (request_intake_queue.try_pop(requests)) {
+    for (Request &request : requests) {
+      ProfileInfo profile_info;
+      profile_info.registration_time = request.registration_time;
+      profiling_requests[request.guid] = profile_info;
+      if (request.req_type == RequestType::REQ_FINETUNING) {
+        pending_peft_request_queue.push(request);
+      } else {
+        scheduling_policy->push(request.scheduling_info);
+      }
+      all_requests[request.guid] = std::move(request);
+    }
+  }
+}
+
+RequestManager::CompletionShard &
+    RequestManager::get_completion_shard(RequestGuid const &guid) {
+  return completion_shards[guid % NUM_COMPLETION_SHARDS];
+}
+
+void RequestManager::init_completion_state(GenerationResult const &result) {
+  CompletionShard &shard = get_completion_shard(result.guid);
+  const std::lock_guard<std::mutex> lock(shard.mutex);
+  assert(shard.states.find(result.guid) == shard.states.end());
+  CompletionState &state = shard.states[result.guid];
+  state.result = result;
+  state.future = state.promise.get_future().share();
+}
+
+std::vector<std::string>
+    RequestManager::load_peft_dataset(std::string const &dataset_filepath) {
+  using json = nlohmann::json;
+  std::ifstream file_handle(dataset_filepath);
+  assert(file_handle.good() && "Dataset file does not exist.");
+  json dataset_json = json::parse(file_handle,
+                                  /*parser_callback_t */ nullptr,
+                                  /*allow_exceptions */ true,
+                                  /*ignore_comments */ true);
+  std::vector<std::string> texts;
+  for (auto &prompt : dataset_json) {
+    texts.push_back(prompt.get<std::string>());
+  }
+  return texts;
+}
+
+std::pair<std::vector<int32_t>, std::vector<int32_t>>
+    RequestManager::tokenize_dataset_entry(Tokenizer &tokenizer,
+                                           std::string const &text) {
+  std::string output_text("");
+  return std::make_pair(tokenizer.Encode(text), tokenizer.Encode(output_text));
+}
+
 bool RequestManager::is_request_completed(RequestGuid const &guid) {
-  const std::lock_guard<std::mutex> lock(request_queue_mutex);
-  assert(all_requests.find(guid) != all_requests.end());
-  Request const &request = all_requests[guid];
-  // return request.tokens.size() >= request.max_sequence_length;
-  return request.status == Request::COMPLETED;
+  CompletionShard &shard = get_completion_shard(guid);
+  const std::lock_guard<std::mutex> lock(shard.mutex);
+  assert(shard.states.find(guid) != shard.states.end());
+  return shard.states[guid].completed;
 }
 
 GenerationResult
     RequestManager::get_generation_result(RequestGuid const &guid) {
+  CompletionShard &shard = get_completion_shard(guid);
   // First get the future of the request
-  std::future<void> future;
+  std::shared_future<void> future;
   {
-    const std::lock_guard<std::mutex> lock(request_to_promise_mutex);
-    assert(request_to_promise.find(guid) != request_to_promise.end());
-    future = request_to_promise[guid]->get_future();
+    const std::lock_guard<std::mutex> lock(shard.mutex);
+    assert(shard.states.find(guid) != shard.states.end());
+    future = shard.states[guid].future;
   }
   // Wait until the result is completed
   future.get();
   // Get the generation result
   {
-    const std::lock_guard<std::mutex> lock(request_queue_mutex);
-    assert(request_generation_results.find(guid) !=
-           request_generation_results.end());
-    return request_generation_results[guid];
+    const std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.states[guid].result;
   }
 }
 
@@ -618,7 +1248,7 @@ BatchConfigFuture
   return runtime->execute_task(ctx, launcher);
 }
 
-BatchConfig RequestManager::prepare_next_batch_task(
+SerializedBatchConfig RequestManager::prepare_next_batch_task(
     Task const *task,
     std::vector<PhysicalRegion> const &regions,
     Context ctx,
@@ -627,7 +1257,12 @@ BatchConfig RequestManager::prepare_next_batch_task(
   BatchConfig const *bc = BatchConfig::from_future(task->futures[0]);
   InferenceResult const &result =
       Future(task->futures[1]).get_result<InferenceResult>();
-  return rm->prepare_next_batch(*bc, result);
+  long long start_time = Realm::Clock::current_time_in_microseconds();
+  BatchConfig new_bc = rm->prepare_next_batch(*bc, result);
+  rm->scheduling_time_us +=
+      Realm::Clock::current_time_in_microseconds() - start_time;
+  rm->record_batch_step_stats(new_bc, rm->get_max_tokens_per_batch());
+  return SerializedBatchConfig(new_bc);
 }
 
 bool RequestManager::is_eos_token(int token_id) {
@@ -695,21 +1330,10 @@ void RequestManager::check_batch(BatchConfig const &old_bc,
   }
 }
 
-void RequestManager::add_peft_config_to_request_info(
-    BatchConfig &bc, int req_idx, LoraLinearConfig const &peft_config) {
-  std::memset(bc.requestsInfo[req_idx].peft_model_config_str,
-              0,
-              BatchConfig::MAX_PEFT_CONFIG_SIZE);
-  std::string peft_config_str = peft_config.serialize_to_json_string();
-  std::strcpy(bc.requestsInfo[req_idx].peft_model_config_str,
-              peft_config_str.c_str());
-  // std::cout << "Added PEFT config to request info: "
-  //           << bc.requestsInfo[req_idx].peft_model_config_str << std::endl;
-}
-
 BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
                                                InferenceResult const &result) {
   const std::lock_guard<std::mutex> lock(request_queue_mutex);
+  drain_request_intake_queue();
   // Step 1: append result from previous iteration to request's tokens
   for (int i = 0; i < old_bc.num_active_tokens(); i++) {
     size_t guid =
@@ -747,6 +1371,31 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
 
   int num_concurrent_adapters = 0;
 
+  // Split the token budget between decoding and prefilling: each request in
+  // the decoding phase gets one token and prompts are chunked to fit in the
+  // rest, up to max_prefill_tokens_per_batch
+  int num_decoding_requests = 0, num_prefilling_requests = 0;
+  for (int i = 0; i < inference_batch_size; i++) {
+    if (old_bc.request_completed[i] || check_inf_req_completion(old_bc, i)) {
+      continue;
+    }
+    Request &request = all_requests[old_bc.requestsInfo[i].request_guid];
+    int processed_tokens = old_bc.requestsInfo[i].first_token_depth_in_request +
+                           old_bc.requestsInfo[i].num_tokens_in_batch;
+    if (processed_tokens + 1 == request.tokens.size()) {
+      num_decoding_requests++;
+    } else {
+      num_prefilling_requests++;
+    }
+  }
+  int prefill_budget =
+      std::min(get_max_prefill_tokens_per_batch(),
+               get_max_tokens_per_batch() - num_decoding_requests);
+  int num_prefill_tokens = 0;
+
+  // requests preempted in this step, which do not resume before the next
+  std::unordered_set<RequestGuid> preempted_guids;
+
   // Step 2: prepare the next batch for existing inference requests
   BatchConfig new_bc;
   for (int i = 0; i < inference_batch_size; i++) {
@@ -769,33 +1418,25 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
           // remove the EOS token
           request.tokens.pop_back();
         }
-        std::string output = this->tokenizer_->Decode(request.tokens);
-        // Unlike Huggingface, the sentencepiece C++ library automatically
-        // removes the BOS token
-        if (model_type == ModelType::LLAMA && old_llama_tokenizer &&
-            request.add_special_tokens &&
-            request.tokens.at(0) == bos_token_id) {
-          output = "<s> " + output;
-        }
-        {
-          // update generation result
-          GenerationResult &gr = request_generation_results[request.guid];
-          assert(gr.guid == request.guid);
-          gr.output_tokens = request.tokens;
-          gr.output_text = output;
-        }
         request.status = Request::COMPLETED;
-        trigger_request_completion_future(request.guid);
+        if (is_kv_cache_paged()) {
+          if (enable_prefix_caching &&
+              request.peft_model_id == PEFTModelID::NO_ID) {
+            get_kv_block_manager()->cache_prefix(
+                request.guid, request.tokens, processed_tokens);
+          }
+          get_kv_block_manager()->release(request.guid);
+        }
         log_req_mgr.print("[Done] guid(%zu) final_length(%zu)",
                           old_bc.requestsInfo[i].request_guid,
                           request.tokens.size());
-        log_req_mgr.print("Final output: %s", output.c_str());
         num_processed_requests++;
         ProfileInfo profile_info = profiling_requests[request.guid];
         profile_info.finish_time = Realm::Clock::current_time_in_microseconds();
         total_request_run_time +=
             profile_info.finish_time - profile_info.start_time;
         profiling_requests[request.guid] = profile_info;
+        record_request_metrics(request, profile_info);
         log_req_mgr.print("[%s] guid(%zu) llm_decoding_steps(%d) start(%.1lf) "
                           "finish(%.1lf) latency(%.1lf) ttft(%.1lf)",
                           request.warmup ? "Warmup" : "Profile",
@@ -806,38 +1447,26 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
                           profile_info.finish_time - profile_info.start_time,
                           profile_info.first_token_time -
                               profile_info.registration_time);
-        // Write output to file if needed:
+        // The output thread decodes the output, writes it to the output file
+        // and completes the request's GenerationResult
+        std::ostringstream file_header;
         if (!output_filepath.empty()) {
-          std::ofstream outputFile(output_filepath, std::ios::app);
-          if (outputFile.is_open()) {
-            outputFile << "[" << (request.warmup ? "Warmup" : "Profile")
-                       << "] guid(" << request.guid << ") llm_decoding_steps("
-                       << profile_info.llm_decoding_steps << ") latency("
-                       << std::fixed << std::setprecision(3)
-                       << (profile_info.finish_time - profile_info.start_time)
-                       << ") ttft(" << std::fixed << std::setprecision(3)
-                       << (profile_info.first_token_time -
-                           profile_info.registration_time)
-                       << ")\n";
-            if (request.benchmarking_tokens <= 0) {
-              outputFile << "token IDs: ";
-              for (int i = 0; i < request.tokens.size(); i++) {
-                outputFile << request.tokens[i];
-                if (i < request.tokens.size() - 1) {
-                  outputFile << ",";
-                }
-              }
-              outputFile << std::endl;
-              outputFile << output;
-            }
-            outputFile.close();
-          } else {
-            std::cout << "Unable to open the output file: " << output_filepath
-                      << std::endl;
-            assert(false);
-          }
+          file_header << "[" << (request.warmup ? "Warmup" : "Profile")
+                      << "] guid(" << request.guid << ") llm_decoding_steps("
+                      << profile_info.llm_decoding_steps << ") latency("
+                      << std::fixed << std::setprecision(3)
+                      << (profile_info.finish_time - profile_info.start_time)
+                      << ") ttft(" << std::fixed << std::setprecision(3)
+                      << (profile_info.first_token_time -
+                          profile_info.registration_time)
+                      << ")\n";
         }
+        push_output_event(request,
+                          true /*finished*/,
+                          file_header.str(),
+                          request.benchmarking_tokens <= 0);
       } else {
+        push_output_event(request, false /*finished*/);
         new_bc.request_completed[i] = false;
         new_bc.requestsInfo[i].first_token_depth_in_request = processed_tokens;
         new_bc.requestsInfo[i].first_token_offset_in_batch = new_bc.num_tokens;
@@ -845,8 +1474,6 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
             old_bc.requestsInfo[i].request_guid;
         new_bc.requestsInfo[i].peft_model_id =
             old_bc.requestsInfo[i].peft_model_id;
-        std::strcpy(new_bc.requestsInfo[i].peft_model_config_str,
-                    old_bc.requestsInfo[i].peft_model_config_str);
         if (old_bc.requestsInfo[i].peft_model_id != PEFTModelID::NO_ID) {
           num_concurrent_adapters += 1;
         }
@@ -857,32 +1484,31 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
         if (new_bc.requestsInfo[i].first_token_depth_in_request + 1 ==
             request.tokens.size()) {
           // Incremental phase
+          if (old_bc.requestsInfo[i].prompt_phase && enable_prefix_caching &&
+              is_kv_cache_paged() &&
+              request.peft_model_id == PEFTModelID::NO_ID) {
+            // the whole prompt is now in the KV cache, make its blocks
+            // available to later requests with the same prefix
+            get_kv_block_manager()->cache_prefix(
+                request.guid, request.tokens, processed_tokens);
+          }
           new_bc.requestsInfo[i].num_tokens_in_batch = 1;
           num_generation_tokens++;
           new_bc.requestsInfo[i].prompt_phase = false;
         } else {
           // Prompt phase
           assert(old_bc.requestsInfo[i].prompt_phase == true);
-          int space_for_incr_dec_requests = 0;
-          // If the prompt can't fit in the batch, compute how much space we
-          // need to leave out for incomplete requests in decoding phase at
-          // higher indices.
-          for (int ii = i + 1; ii < inference_batch_size; ii++) {
-            if (old_bc.request_completed[ii]) {
-              continue;
-            }
-            Request &old_request =
-                all_requests[old_bc.requestsInfo[ii].request_guid];
-            bool req_completed = check_inf_req_completion(old_bc, ii);
-            if (!req_completed) {
-              space_for_incr_dec_requests++;
-            }
-          }
+          num_prefilling_requests--;
+          // leave at least one token for each of the remaining prompts so
+          // that all running requests make progress
+          int chunk_size = std::max(1,
+                                    prefill_budget - num_prefill_tokens -
+                                        num_prefilling_requests);
           new_bc.requestsInfo[i].num_tokens_in_batch =
-              std::min(get_max_tokens_per_batch() - new_bc.num_tokens -
-                           space_for_incr_dec_requests,
+              std::min(chunk_size,
                        (int)request.tokens.size() -
                            new_bc.requestsInfo[i].first_token_depth_in_request);
+          num_prefill_tokens += new_bc.requestsInfo[i].num_tokens_in_batch;
           new_bc.requestsInfo[i].prompt_phase = true;
         }
         for (int j = 0; j < new_bc.requestsInfo[i].num_tokens_in_batch; j++) {
@@ -893,6 +1519,26 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
           new_bc.tokensInfo[new_bc.num_tokens].token_id = request.tokens[depth];
           new_bc.num_tokens++;
         }
+        // grow the block table to hold the new tokens. If the KV cache is
+        // full, the request gives up its blocks and waits in the queue
+        if (is_kv_cache_paged() &&
+            !reserve_kv_cache(
+                request,
+                new_bc.requestsInfo[i].first_token_depth_in_request +
+                    new_bc.requestsInfo[i].num_tokens_in_batch)) {
+          if (new_bc.requestsInfo[i].prompt_phase) {
+            num_prefill_tokens -= new_bc.requestsInfo[i].num_tokens_in_batch;
+          } else {
+            // new_bc.num_generation_tokens is only set after this loop
+            num_generation_tokens--;
+          }
+          if (new_bc.requestsInfo[i].peft_model_id != PEFTModelID::NO_ID) {
+            num_concurrent_adapters--;
+          }
+          preempted_guids.insert(request.guid);
+          preempt_request(new_bc, i);
+          continue;
+        }
         // Update profiling
         profiling_requests[new_bc.requestsInfo[i].request_guid]
             .llm_decoding_steps++;
@@ -904,59 +1550,131 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
   assert(num_concurrent_adapters <= get_max_concurrent_adapters() &&
          "Number of concurrent adapters exceeded the limit");
 
-  // Step 3: add new inference requests to the next batch if there is space
-  for (int i = 0; i < inference_batch_size; i++) {
-    if (new_bc.request_completed[i]) {
-      if (!pending_infr_request_queue.empty() &&
-          new_bc.num_tokens < get_max_tokens_per_batch()) {
-        Request new_request = pending_infr_request_queue.front();
-        assert(new_request.req_type == RequestType::REQ_INFERENCE);
-
-        // if the request has peft adapters and we are at capacity, don't add it
-        // yet
-        if (new_request.peft_model_id != PEFTModelID::NO_ID &&
-            num_concurrent_adapters == get_max_concurrent_adapters()) {
-          break;
-        }
+  // Step 3: add new inference requests to the next batch if there is space.
+  // With preemption enabled, running requests that the scheduling policy
+  // orders after the next request are evicted to make room (batch slots or
+  // KV cache blocks) for it.
+  while (!scheduling_policy->empty() && num_prefill_tokens < prefill_budget) {
+    PendingRequest pending_request = scheduling_policy->front();
+    Request new_request = all_requests[pending_request.guid];
+    assert(new_request.req_type == RequestType::REQ_INFERENCE);
+    // do not resume a request in the step it was preempted
+    if (preempted_guids.count(new_request.guid) > 0) {
+      break;
+    }
 
-        pending_infr_request_queue.pop();
-        // all_requests[new_request.guid] = new_request;
+    // if the request has peft adapters and we are at capacity, don't add it
+    // yet
+    if (new_request.peft_model_id != PEFTModelID::NO_ID &&
+        num_concurrent_adapters == get_max_concurrent_adapters()) {
+      break;
+    }
 
-        new_bc.requestsInfo[i].first_token_depth_in_request = 0;
-        new_bc.requestsInfo[i].first_token_offset_in_batch = new_bc.num_tokens;
-        new_bc.requestsInfo[i].request_guid = new_request.guid;
-        new_bc.requestsInfo[i].num_tokens_in_batch =
-            std::min(get_max_tokens_per_batch() - new_bc.num_tokens,
-                     (int)new_request.tokens.size());
-        new_bc.requestsInfo[i].max_length = new_request.max_length;
-        new_bc.requestsInfo[i].peft_model_id = new_request.peft_model_id;
-        if (new_request.peft_model_id != PEFTModelID::NO_ID) {
-          add_peft_config_to_request_info(
-              new_bc, i, get_peft_config(new_request.peft_model_id));
-        }
-        new_bc.requestsInfo[i].peft_bwd = false;
-        new_bc.request_completed[i] = false;
-        new_bc.requestsInfo[i].prompt_phase = true;
-        num_active_req++;
-        new_bc.requestsInfo[num_active_req].batch_config_request_id = i;
-        // add start time to profile_info for the new request
-        profiling_requests[new_request.guid].llm_decoding_steps = 1;
-        profiling_requests[new_request.guid].start_time =
-            Realm::Clock::current_time_in_microseconds();
-        for (int j = 0; j < new_bc.requestsInfo[i].num_tokens_in_batch; j++) {
-          int depth = new_bc.requestsInfo[i].first_token_depth_in_request + j;
-          new_bc.tokensInfo[new_bc.num_tokens].request_index = i;
-          new_bc.tokensInfo[new_bc.num_tokens].abs_depth_in_request = depth;
-          assert(depth < new_request.tokens.size());
-          new_bc.tokensInfo[new_bc.num_tokens].token_id =
-              new_request.tokens[depth];
-          new_bc.num_tokens++;
+    // find a free batch slot and, with a paged KV cache, enough free blocks
+    // to hold the prompt of the request
+    int i = -1, num_cached_tokens = 0;
+    bool has_space = false;
+    while (true) {
+      i = 0;
+      while (i < inference_batch_size && !new_bc.request_completed[i]) {
+        i++;
+      }
+      has_space = i < inference_batch_size;
+      if (has_space && is_kv_cache_paged()) {
+        KVCacheBlockManager *block_manager = get_kv_block_manager();
+        // skip the prefill of the longest prompt prefix already in the KV
+        // cache. LoRA adapters change the keys and values, so requests
+        // with adapters do not share prefixes.
+        if (enable_prefix_caching &&
+            new_request.peft_model_id == PEFTModelID::NO_ID) {
+          num_cached_tokens = block_manager->match_prefix(new_request.guid,
+                                                          new_request.tokens);
         }
-        if (new_bc.num_tokens == get_max_tokens_per_batch()) {
-          break;
+        if (!reserve_kv_cache(new_request, new_request.tokens.size())) {
+          block_manager->release(new_request.guid);
+          num_cached_tokens = 0;
+          has_space = false;
         }
       }
+      if (has_space || !enable_preemption) {
+        break;
+      }
+      int victim = select_preemption_victim(
+          new_bc, inference_batch_size, pending_request);
+      if (victim < 0) {
+        break;
+      }
+      if (new_bc.requestsInfo[victim].prompt_phase) {
+        num_prefill_tokens -= new_bc.requestsInfo[victim].num_tokens_in_batch;
+      }
+      if (new_bc.requestsInfo[victim].peft_model_id != PEFTModelID::NO_ID) {
+        num_concurrent_adapters--;
+      }
+      preempted_guids.insert(new_bc.requestsInfo[victim].request_guid);
+      preempt_request(new_bc, victim);
+    }
+    if (!has_space) {
+      break;
+    }
+    if (scheduling_policy->front().guid != new_request.guid) {
+      // a preempted request moved ahead of this one in the queue
+      if (is_kv_cache_paged()) {
+        get_kv_block_manager()->release(new_request.guid);
+      }
+      continue;
     }
+    if (num_cached_tokens > 0) {
+      log_req_mgr.print("[Prefix cache] guid(%zu) reused %d of %zu "
+                        "prompt tokens",
+                        new_request.guid,
+                        num_cached_tokens,
+                        new_request.tokens.size());
+    }
+
+    all_requests[new_request.guid].scheduling_info =
+        scheduling_policy->front();
+    scheduling_policy->pop();
+    // all_requests[new_request.guid] = new_request;
+
+    new_bc.requestsInfo[i].first_token_depth_in_request = num_cached_tokens;
+    new_bc.requestsInfo[i].first_token_offset_in_batch = new_bc.num_tokens;
+    new_bc.requestsInfo[i].request_guid = new_request.guid;
+    new_bc.requestsInfo[i].num_tokens_in_batch =
+        std::min(prefill_budget - num_prefill_tokens,
+                 (int)new_request.tokens.size() - num_cached_tokens);
+    num_prefill_tokens += new_bc.requestsInfo[i].num_tokens_in_batch;
+    new_bc.requestsInfo[i].max_length = new_request.max_length;
+    new_bc.requestsInfo[i].peft_model_id = new_request.peft_model_id;
+    if (new_request.peft_model_id != PEFTModelID::NO_ID) {
+      num_concurrent_adapters += 1;
+    }
+    new_bc.requestsInfo[i].peft_bwd = false;
+    new_bc.request_completed[i] = false;
+    new_bc.requestsInfo[i].prompt_phase = true;
+    num_active_req++;
+    new_bc.requestsInfo[num_active_req].batch_config_request_id = i;
+    if (new_request.num_preemptions == 0) {
+      // add start time to profile_info for the new request
+      profiling_requests[new_request.guid].llm_decoding_steps = 1;
+      profiling_requests[new_request.guid].start_time =
+          Realm::Clock::current_time_in_microseconds();
+    } else {
+      profiling_requests[new_request.guid].llm_decoding_steps++;
+      log_req_mgr.print("[Resume] guid(%zu) recomputing %zu tokens",
+                        new_request.guid,
+                        new_request.tokens.size() - num_cached_tokens);
+    }
+    for (int j = 0; j < new_bc.requestsInfo[i].num_tokens_in_batch; j++) {
+      int depth = new_bc.requestsInfo[i].first_token_depth_in_request + j;
+      new_bc.tokensInfo[new_bc.num_tokens].request_index = i;
+      new_bc.tokensInfo[new_bc.num_tokens].abs_depth_in_request = depth;
+      assert(depth < new_request.tokens.size());
+      new_bc.tokensInfo[new_bc.num_tokens].token_id = new_request.tokens[depth];
+      new_bc.num_tokens++;
+    }
+  }
+  if (!preempted_guids.empty()) {
+    update_batch_config_request_ids(new_bc, inference_batch_size);
   }
 
   if (enable_peft_finetuning &&
@@ -993,9 +1711,14 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
       // check if the fine tuning request has completed
       request.status = Request::COMPLETED;
 
-      GenerationResult &gr = request_generation_results[request.guid];
-      assert(gr.guid == request.guid);
-      gr.finetuning_losses = request.finetuning_losses;
+      {
+        // update generation result
+        CompletionShard &shard = get_completion_shard(request.guid);
+        const std::lock_guard<std::mutex> lock(shard.mutex);
+        GenerationResult &gr = shard.states[request.guid].result;
+        assert(gr.guid == request.guid);
+        gr.finetuning_losses = request.finetuning_losses;
+      }
       trigger_request_completion_future(request.guid);
       num_processed_requests++;
 
@@ -1012,33 +1735,25 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
                         request.processed_finetuning_tokens,
                         profile_info.finish_time - profile_info.start_time);
       if (!output_filepath.empty()) {
-        std::ofstream outputFile(output_filepath, std::ios::app);
-        if (outputFile.is_open()) {
-          std::string tokens_str = "[";
-          for (size_t i = 0; i < request.finetuning_tokens_per_batch.size();
-               i++) {
-            tokens_str +=
-                std::to_string(request.finetuning_tokens_per_batch[i]);
-            if (i != request.finetuning_tokens_per_batch.size() - 1) {
-              tokens_str += ", ";
-            }
+        std::string tokens_str = "[";
+        for (size_t i = 0; i < request.finetuning_tokens_per_batch.size();
+             i++) {
+          tokens_str += std::to_string(request.finetuning_tokens_per_batch[i]);
+          if (i != request.finetuning_tokens_per_batch.size() - 1) {
+            tokens_str += ", ";
           }
-          tokens_str += "]";
-          outputFile << "[" << (request.warmup ? "Warmup" : "Finetuning")
-                     << "] guid(" << request.guid
-                     << ") completed_training_steps("
-                     << request.completed_training_steps
-                     << ") processed_finetuning_tokens("
-                     << request.processed_finetuning_tokens << ") latency("
-                     << std::fixed << std::setprecision(3)
-                     << (profile_info.finish_time - profile_info.start_time)
-                     << ") tokens_per_batch(" << tokens_str << ")\n";
-          outputFile.close();
-        } else {
-          std::cout << "Unable to open the output file: " << output_filepath
-                    << std::endl;
-          assert(false);
         }
+        tokens_str += "]";
+        std::ostringstream output;
+        output << "[" << (request.warmup ? "Warmup" : "Finetuning")
+               << "] guid(" << request.guid << ") completed_training_steps("
+               << request.completed_training_steps
+               << ") processed_finetuning_tokens("
+               << request.processed_finetuning_tokens << ") latency("
+               << std::fixed << std::setprecision(3)
+               << (profile_info.finish_time - profile_info.start_time)
+               << ") tokens_per_batch(" << tokens_str << ")\n";
+        push_output_file_text(output.str());
       }
     }
   }
@@ -1104,8 +1819,6 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
       new_bc.requestsInfo[inference_batch_size].peft_bwd = true;
       new_bc.requestsInfo[inference_batch_size].peft_model_id =
           request.peft_model_id;
-      add_peft_config_to_request_info(
-          new_bc, inference_batch_size, get_peft_config(request.peft_model_id));
       set_optimizer_tasks(
           new_bc.requestsInfo[inference_batch_size].optimizer_tasks,
           request.max_training_steps,
@@ -1128,6 +1841,17 @@ BatchConfig RequestManager::prepare_next_batch(BatchConfig const &old_bc,
   }
   assert(num_concurrent_adapters <= get_max_concurrent_adapters() &&
          "Number of concurrent adapters exceeded the limit");
+  for (int i = 0; i < inference_batch_size; i++) {
+    if (!new_bc.request_completed[i]) {
+      scheduling_policy->on_tokens_scheduled(
+          new_bc.requestsInfo[i].peft_model_id,
+          new_bc.requestsInfo[i].num_tokens_in_batch);
+    }
+  }
+  if (is_kv_cache_paged()) {
+    fill_kv_block_tables(new_bc);
+  }
+  fill_sampling_info(new_bc);
   return new_bc;
 }
 
@@ -1161,7 +1885,12 @@ BeamSearchBatchConfig RequestManager::prepare_next_batch_init_task(
   InferenceResult const &result =
       Future(task->futures[1]).get_result<InferenceResult>();
   int model_id = Future(task->futures[2]).get_result<int>();
-  return rm->prepare_next_batch_init(bc, result, model_id);
+  long long start_time = Realm::Clock::current_time_in_microseconds();
+  BeamSearchBatchConfig new_bc =
+      rm->prepare_next_batch_init(bc, result, model_id);
+  rm->scheduling_time_us +=
+      Realm::Clock::current_time_in_microseconds() - start_time;
+  return new_bc;
 }
 
 BeamSearchBatchConfig
@@ -1169,6 +1898,7 @@ BeamSearchBatchConfig
                                             InferenceResult const &result,
                                             int model_id) {
   const std::lock_guard<std::mutex> lock(request_queue_mutex);
+  drain_request_intake_queue();
   if (verbose) {
     std::cout << "\n############### prepare_next_batch_init ###############\n";
   }
@@ -1241,10 +1971,26 @@ BeamSearchBatchConfig
     if (request.status == Request::RUNNING) {
 
       std::vector<std::pair<BatchConfig::TokenId, int>> verified_tokens =
-          traverse_verify_tree(guid, dfs_tree_inputs.at(guid), tree_outputs);
+          traverse_verify_tree(guid,
+                               dfs_tree_inputs.at(guid),
+                               tree_outputs,
+                               old_bc.causalMask[i]);
 
       log_req_mgr.print("Number of Verified Tokens = %zu",
                         verified_tokens.size());
+      {
+        ProfileInfo &profile_info = profiling_requests[guid];
+        if (!profile_info.first_token_time_set) {
+          profile_info.first_token_time =
+              Realm::Clock::current_time_in_microseconds();
+          profile_info.first_token_time_set = true;
+        }
+        // the draft tree starts with the last committed token, and the last
+        // verified token is the LLM's own prediction
+        profile_info.num_speculated_tokens +=
+            dfs_tree_inputs.at(guid).size() - 1;
+        profile_info.num_accepted_tokens += verified_tokens.size() - 1;
+      }
       // check if the request is finished
       if (verified_tokens.size() + request.tokens.size() >=
           request.max_length) {
@@ -1257,24 +2003,7 @@ BeamSearchBatchConfig
         log_req_mgr.print("[Done] guid(%zu) with final length(%zu)",
                           request.guid,
                           request.tokens.size());
-        std::string output = this->tokenizer_->Decode(request.tokens);
-        // Unlike Huggingface, the sentencepiece C++ library automatically
-        // removes the BOS token
-        if (model_type == ModelType::LLAMA && old_llama_tokenizer &&
-            request.add_special_tokens &&
-            request.tokens.at(0) == bos_token_id) {
-          output = "<s> " + output;
-        }
-        {
-          // update generation result
-          GenerationResult &gr = request_generation_results[request.guid];
-          assert(gr.guid == request.guid);
-          gr.output_tokens = request.tokens;
-          gr.output_text = output;
-        }
         request.status = Request::COMPLETED;
-        trigger_request_completion_future(request.guid);
-        log_req_mgr.print("Final output: %s", output.c_str());
 
         new_bc.request_completed[i] = true;
         new_bc.request_running[i] = false;
@@ -1287,6 +2016,7 @@ BeamSearchBatchConfig
         total_request_run_time +=
             profile_info.finish_time - profile_info.start_time;
         profiling_requests[request.guid] = profile_info;
+        record_request_metrics(request, profile_info);
         log_req_mgr.print(
             "[Profile] guid(%zu) llm_decoding_steps(%d) start(%.1lf) "
             "finish(%.1lf) latency(%.1lf)",
@@ -1296,37 +2026,21 @@ BeamSearchBatchConfig
             profile_info.finish_time,
             profile_info.finish_time - profile_info.start_time);
 
-        // Write output to file if needed:
+        // The output thread decodes the output, writes it to the output file
+        // and completes the request's GenerationResult
+        std::ostringstream file_header;
         if (!output_filepath.empty()) {
-          std::ofstream outputFile(output_filepath, std::ios::app);
-          if (outputFile.is_open()) {
-            outputFile << "[Profile] guid(" << request.guid
-                       << ") llm_decoding_steps("
-                       << profile_info.llm_decoding_steps << ") latency("
-                       << std::fixed << std::setprecision(3)
-                       << (profile_info.finish_time - profile_info.start_time)
-                       << ")\n";
-            // outputFile << "end-to-end latency: " << std::fixed
-            //            << std::setprecision(3) << total_request_run_time
-            //            << std::endl;
-            // outputFile << "num decoding steps: "
-            //            << profile_info.llm_decoding_steps << std::endl;
-            outputFile << "token IDs: ";
-            for (int i = 0; i < request.tokens.size(); i++) {
-              outputFile << request.tokens[i];
-              if (i < request.tokens.size() - 1) {
-                outputFile << ",";
-              }
-            }
-            outputFile << std::endl;
-            outputFile << output;
-            outputFile.close();
-          } else {
-            std::cout << "Unable to open the output file: " << output_filepath
-                      << std::endl;
-            assert(false);
-          }
+          file_header << "[Profile] guid(" << request.guid
+                      << ") llm_decoding_steps("
+                      << profile_info.llm_decoding_steps << ") latency("
+                      << std::fixed << std::setprecision(3)
+                      << (profile_info.finish_time - profile_info.start_time)
+                      << ")\n";
         }
+        push_output_event(request,
+                          true /*finished*/,
+                          file_header.str(),
+                          true /*write_output*/);
 
         // delete the old input tree from cache
         dfs_tree_inputs.erase(request.guid);
@@ -1357,13 +2071,14 @@ BeamSearchBatchConfig
         profiling_requests[request.guid].ssm_decoding_steps = 0;
         new_bc.requestsInfo[i].prompt_phase = true;
 
+        // the last verified token is the LLM's own prediction
+        update_spec_depth(request, (int)verified_tokens.size() - 1);
         int ssm_decoding_steps = 0;
         new_bc.beamRequestsInfo[i].beam_size =
-            spec_infer_tree_width.size() > ssm_decoding_steps
-                ? spec_infer_tree_width[ssm_decoding_steps]
-                : 1;
+            get_spec_tree_width(request, ssm_decoding_steps);
         new_bc.beamRequestsInfo[i].max_depth =
-            std::min(new_max_depth, BeamSearchBatchConfig::MAX_BEAM_DEPTH);
+            std::min(new_max_depth, request.spec_depth);
+        request.spec_drafted_depth = new_bc.beamRequestsInfo[i].max_depth;
         for (int j = 0;
              j < BeamSearchBatchConfig::MAX_SPECULATIVE_TREE_BRANCHES;
              j++) {
@@ -1400,16 +2115,7 @@ BeamSearchBatchConfig
             break;
           }
         }
-
-        std::string output = this->tokenizer_->Decode(request.tokens);
-        // Unlike Huggingface, the sentencepiece C++ library automatically
-        // removes the BOS token
-        if (model_type == ModelType::LLAMA && old_llama_tokenizer &&
-            request.add_special_tokens &&
-            request.tokens.at(0) == bos_token_id) {
-          output = "<s> " + output;
-        }
-        log_req_mgr.print("Output: %s", output.c_str());
+        push_output_event(request, false /*finished*/);
       }
 
     } else if (request.status == Request::PENDING) {
@@ -1435,10 +2141,9 @@ BeamSearchBatchConfig
       int ssm_decoding_steps =
           profiling_requests[request.guid].ssm_decoding_steps;
       new_bc.beamRequestsInfo[i].beam_size =
-          spec_infer_tree_width.size() > ssm_decoding_steps
-              ? spec_infer_tree_width[ssm_decoding_steps]
-              : 1;
+          get_spec_tree_width(request, ssm_decoding_steps);
       new_bc.beamRequestsInfo[i].max_depth = 0;
+      request.spec_drafted_depth = 0;
       for (int j = 0; j < BeamSearchBatchConfig::MAX_SPECULATIVE_TREE_BRANCHES;
            j++) {
         new_bc.beamRequestsInfo[i].parent_id[j] = 0;
@@ -1448,16 +2153,6 @@ BeamSearchBatchConfig
       new_bc.beamRequestsInfo[i].sub_request_num = 1;
 
       new_bc.sub_requests[i] = 1;
-
-      // Token Info
-      std::string output = this->tokenizer_->Decode(request.tokens);
-      // Unlike Huggingface, the sentencepiece C++ library automatically removes
-      // the BOS token
-      if (model_type == ModelType::LLAMA && old_llama_tokenizer &&
-          request.add_special_tokens && request.tokens.at(0) == bos_token_id) {
-        output = "<s> " + output;
-      }
-      log_req_mgr.print("Output: %s", output.c_str());
     } else {
       assert(false);
     }
@@ -1466,10 +2161,10 @@ BeamSearchBatchConfig
   // Step 2: Initialize new request
   for (int i = 0; i < BeamSearchBatchConfig::max_requests_per_batch(); i++) {
     if (new_bc.request_completed[i]) {
-      if (!pending_infr_request_queue.empty() &&
+      if (!scheduling_policy->empty() &&
           new_bc.num_tokens < get_max_tokens_per_batch()) {
-        Request new_request = pending_infr_request_queue.front();
-        pending_infr_request_queue.pop();
+        Request new_request = all_requests[scheduling_policy->front().guid];
+        scheduling_policy->pop();
         // all_requests[new_request.guid] = new_request;
         num_active_req++;
         new_bc.requestsInfo[i].first_token_depth_in_request = 0;
@@ -1491,14 +2186,14 @@ BeamSearchBatchConfig
             profiling_requests[new_request.guid].ssm_decoding_steps;
 
         new_bc.beamRequestsInfo[i].beam_size =
-            spec_infer_tree_width.size() > ssm_decoding_steps
-                ? spec_infer_tree_width[ssm_decoding_steps]
-                : 1;
+            get_spec_tree_width(new_request, ssm_decoding_steps);
         new_bc.beamRequestsInfo[i].current_depth = 1;
         new_bc.beamRequestsInfo[i].max_depth =
-            std::min(BeamSearchBatchConfig::MAX_BEAM_DEPTH,
+            std::min(new_request.spec_depth,
                      get_max_tokens_per_batch() -
                          new_bc.requestsInfo[i].num_tokens_in_batch - 1);
+        all_requests[new_request.guid].spec_drafted_depth =
+            new_bc.beamRequestsInfo[i].max_depth;
         for (int j = 0;
              j < BeamSearchBatchConfig::MAX_SPECULATIVE_TREE_BRANCHES;
              j++) {
@@ -1579,6 +2274,7 @@ BeamSearchBatchConfig
 BeamSearchBatchConfigFuture RequestManager::prepare_next_batch_beam(
     BeamSearchBatchConfigFuture const &old_bc,
     BeamInferenceResultFuture const &result,
+    int model_id,
     Context ctx,
     Runtime *runtime) {
 
@@ -1587,6 +2283,7 @@ BeamSearchBatchConfigFuture RequestManager::prepare_next_batch_beam(
                         TaskArgument(&rm, sizeof(RequestManager *)));
   launcher.add_future(old_bc);
   launcher.add_future(result);
+  launcher.add_future(Future::from_value<int>(model_id));
   return runtime->execute_task(ctx, launcher);
 }
 
@@ -1600,13 +2297,20 @@ BeamSearchBatchConfig RequestManager::prepare_next_batch_beam_task(
       Future(task->futures[0]).get_result<BeamSearchBatchConfig>();
   BeamInferenceResult const &result =
       Future(task->futures[1]).get_result<BeamInferenceResult>();
-  return rm->prepare_next_batch_beam(bc, result);
+  int model_id = Future(task->futures[2]).get_result<int>();
+  long long start_time = Realm::Clock::current_time_in_microseconds();
+  BeamSearchBatchConfig new_bc =
+      rm->prepare_next_batch_beam(bc, result, model_id);
+  rm->scheduling_time_us +=
+      Realm::Clock::current_time_in_microseconds() - start_time;
+  return new_bc;
 }
 
 // update beam search metadata
 BeamSearchBatchConfig
     RequestManager::prepare_next_batch_beam(BeamSearchBatchConfig const &old_bc,
-                                            BeamInferenceResult const &result) {
+                                            BeamInferenceResult const &result,
+                                            int model_id) {
   const std::lock_guard<std::mutex> lock(request_queue_mutex);
   if (verbose) {
     std::cout << "\n############### prepare_next_batch_beam ###############\n";
@@ -1623,11 +2327,11 @@ BeamSearchBatchConfig
               << old_bc.beamRequestsInfo[0].sub_request_num << "\n";
   }
   // Step 1: Store result to the beam tree struct
-  store_beam_metadata(old_bc, result);
+  store_beam_metadata(old_bc, result, model_id);
 
   // Step 2: preparing the next batch for existing requests
   BeamSearchBatchConfig new_bc;
-  new_bc.model_id = old_bc.model_id;
+  new_bc.model_id = model_id;
   // std::cout << "old_bc.model_id: " << old_bc.model_id << "\n";
   int num_generation_tokens = 0;
 
@@ -1655,20 +2359,20 @@ BeamSearchBatchConfig
       new_bc.requestsInfo[i].first_token_offset_in_batch = new_bc.num_tokens;
       new_bc.requestsInfo[i].request_guid = old_bc.requestsInfo[i].request_guid;
       new_bc.requestsInfo[i].max_length = old_bc.requestsInfo[i].max_length;
-      profiling_requests[request.guid].ssm_decoding_steps += 1;
+      // the per-request state shared by all ssms is updated by the first one
+      if (model_id == 0) {
+        profiling_requests[request.guid].ssm_decoding_steps += 1;
+      }
       new_bc.requestsInfo[num_active_req].batch_config_request_id = i;
       // update the beam search metadata
       // how many sub request in current request
       // why is sub_requests has max_requests_per_batch() * MAX_BEAM_WIDTH
       // entries?
       // update the parentid, accumalated_probs, depth, and token_ids
-      int ssm_decoding_steps =
-          profiling_requests[request.guid].ssm_decoding_steps;
-
-      new_bc.beamRequestsInfo[i].beam_size =
-          spec_infer_tree_width.size() > ssm_decoding_steps
-              ? spec_infer_tree_width[ssm_decoding_steps]
-              : 1;
+      // the width of the next level follows this ssm's own depth, since
+      // ssm_decoding_steps only advances with the first ssm
+      new_bc.beamRequestsInfo[i].beam_size = get_spec_tree_width(
+          request, old_bc.beamRequestsInfo[i].current_depth);
 
       new_bc.beamRequestsInfo[i].max_depth =
           old_bc.beamRequestsInfo[i].max_depth;
@@ -1689,7 +2393,7 @@ BeamSearchBatchConfig
         new_bc.request_running[i] = true;
         // do the slot exchange to minimize the cache exchange in kernel.
         update_beam_metadata(
-            new_bc, old_bc, request.beam_trees.at(old_bc.model_id), i);
+            new_bc, old_bc, request.beam_trees.at(model_id), i);
 
       } else {
         assert(false && "Request should not be pending in beam search phase");
@@ -1730,7 +2434,7 @@ BeamSearchBatchConfig
       memcpy(&new_bc.causalMask[i],
              &old_bc.causalMask[i],
              sizeof(BatchConfig::BitMask));
-      BeamTree tree = request.beam_trees[old_bc.model_id];
+      BeamTree tree = request.beam_trees[model_id];
       appendBitMask(new_bc.causalMask[i],
                     new_bc.beamRequestsInfo[i].sub_request_num,
                     old_bc.beamRequestsInfo[i].beam_size,
@@ -1839,8 +2543,9 @@ BeamSearchBatchConfig
                          BatchConfig::max_requests_per_batch() + i,
                      (int)request.tokens.size() -
                          new_bc.requestsInfo[i].first_token_depth_in_request);
-        request.ssm_cache_size += new_bc.requestsInfo[i].num_tokens_in_batch;
-        BeamTree tree = request.beam_trees[old_bc.model_id];
+        if (model_id == 0) {
+          request.ssm_cache_size += new_bc.requestsInfo[i].num_tokens_in_batch;
+        }
         appendPendingRequest(new_bc.causalMask[i],
                              new_bc.requestsInfo[i].num_tokens_in_batch);
       }
@@ -1914,7 +2619,12 @@ TreeVerifyBatchConfig RequestManager::prepare_next_batch_verify_task(
   for (auto const &bcf : task->futures) {
     old_batches.push_back(Future(bcf).get_result<BeamSearchBatchConfig>());
   }
-  return rm->prepare_next_batch_verify(old_batches);
+  long long start_time = Realm::Clock::current_time_in_microseconds();
+  TreeVerifyBatchConfig new_bc = rm->prepare_next_batch_verify(old_batches);
+  rm->scheduling_time_us +=
+      Realm::Clock::current_time_in_microseconds() - start_time;
+  rm->record_batch_step_stats(new_bc, rm->get_max_verify_tokens_per_batch());
+  return new_bc;
 }
 
 TreeVerifyBatchConfig RequestManager::prepare_next_batch_verify(
@@ -1932,15 +2642,38 @@ TreeVerifyBatchConfig RequestManager::prepare_next_batch_verify(
   new_bc.num_tokens_to_commit = 0;
   new_bc.num_tokens = 0;
 
+  // Merge the dfs trees of the ssms for every running request first, so that
+  // the prompt tokens loaded below only use the space the merged trees leave
+  std::vector<std::vector<std::pair<BatchConfig::TokenId, int>>> merged_trees(
+      TreeVerifyBatchConfig::max_requests_per_batch());
   int max_prompt_load_size = get_max_verify_tokens_per_batch();
   for (int i = 0; i < TreeVerifyBatchConfig::max_requests_per_batch(); i++) {
     if (old_batches.at(0).request_completed[i]) {
       continue;
-    } else if (old_batches.at(0).request_running[i]) {
-      max_prompt_load_size -= (BeamSearchBatchConfig::MAX_BEAM_DEPTH + 1);
-    } else {
+    }
+    size_t guid = old_batches.at(0).requestsInfo[i].request_guid;
+    Request &request = all_requests[guid];
+    if (request.status != Request::RUNNING) {
       max_prompt_load_size -= 1;
+      continue;
     }
+    // Get the dfs tree of every ssm
+    std::vector<std::vector<std::pair<BatchConfig::TokenId, int>>>
+        all_dfs_trees;
+    std::vector<BatchConfig::BitMask const *> all_masks;
+    for (int j = 0; j < old_batches.size(); j++) {
+      all_dfs_trees.push_back(
+          traverse_beam_tree(old_batches.at(j), i, request.tokens.size() - 1));
+      all_masks.push_back(&old_batches.at(j).causalMask[i]);
+    }
+    // the llm verifies the merged tree, so its mask replaces the ones of
+    // the ssms
+    merged_trees[i] = merge_dfs_trees(all_dfs_trees,
+                                      all_masks,
+                                      request.tokens.size() - 1,
+                                      guid,
+                                      new_bc.causalMask[i]);
+    max_prompt_load_size -= merged_trees[i].size();
   }
   int num_active_req = -1;
   for (int i = 0; i < TreeVerifyBatchConfig::max_requests_per_batch(); i++) {
@@ -1956,19 +2689,9 @@ TreeVerifyBatchConfig RequestManager::prepare_next_batch_verify(
 
     if (request.status == Request::RUNNING) {
       new_bc.request_running[i] = true;
-
-      // Get the dfs tree
-      std::vector<std::vector<std::pair<BatchConfig::TokenId, int>>>
-          all_dfs_trees;
-
-      for (int j = 0; j < old_batches.size(); j++) {
-        std::vector<std::pair<BatchConfig::TokenId, int>> new_tree =
-            traverse_beam_tree(old_batches.at(j), i, request.tokens.size() - 1);
-        all_dfs_trees.push_back(new_tree);
-      }
-      assert(all_dfs_trees.size() == old_batches.size());
-      std::vector<std::pair<BatchConfig::TokenId, int>> dfs_tree_inputs =
-          merge_dfs_trees(all_dfs_trees, request.tokens.size() - 1, guid);
+      std::vector<std::pair<BatchConfig::TokenId, int>> const
+          &dfs_tree_inputs = merged_trees[i];
+      assert(dfs_tree_inputs.size() > 0);
 
       if (verbose) {
         std::cout << "Request Tokens Size: " << request.tokens.size()
@@ -1988,10 +2711,6 @@ TreeVerifyBatchConfig RequestManager::prepare_next_batch_verify(
           old_batches.at(0).requestsInfo[i].max_length;
       new_bc.requestsInfo[num_active_req].batch_config_request_id = i;
 
-      // copy bitmask to verify batchconfig
-      memcpy(&(new_bc.causalMask[i]),
-             &(old_batches.at(0).causalMask[i]),
-             sizeof(BatchConfig::BitMask));
       // TODO: Check this
       new_bc.requestsInfo[i].num_tokens_in_batch = 0;
       new_bc.request_completed[i] = false;
@@ -2212,7 +2931,8 @@ TreeVerifyBatchConfig RequestManager::prepare_next_batch_verify(
 }
 
 void RequestManager::store_beam_metadata(BeamSearchBatchConfig const &old_bc,
-                                         BeamInferenceResult const &result) {
+                                         BeamInferenceResult const &result,
+                                         int model_id) {
   // step1 store the outputs
   if (old_bc.num_tokens <= 0) {
     return;
@@ -2221,6 +2941,8 @@ void RequestManager::store_beam_metadata(BeamSearchBatchConfig const &old_bc,
       old_bc.requestsInfo[old_bc.tokensInfo[0].request_index].request_guid;
   auto start_depth = old_bc.tokensInfo[0].abs_depth_in_request;
   int result_index = 0;
+  // every token yields the candidates of the widest tree in the batch
+  int const result_stride = old_bc.max_beam_size_all_requests();
 
   if (verbose) {
     std::cout << "Store total of " << old_bc.num_tokens
@@ -2252,7 +2974,7 @@ void RequestManager::store_beam_metadata(BeamSearchBatchConfig const &old_bc,
       // index
       result_index +=
           (old_bc.tokensInfo[i - 1].abs_depth_in_request - start_depth) *
-          beam_size;
+          result_stride;
 
       if (verbose) {
         std::cout << "i = " << i << ", result index = " << result_index
@@ -2274,43 +2996,41 @@ void RequestManager::store_beam_metadata(BeamSearchBatchConfig const &old_bc,
                     << "\n";
         }
 
-        request.beam_trees.at(old_bc.model_id).treeLayers[0].tokens[0] =
+        request.beam_trees.at(model_id).treeLayers[0].tokens[0] =
             request.tokens.back();
-        request.beam_trees.at(old_bc.model_id).treeLayers[0].probs[0] = 1;
-        request.beam_trees.at(old_bc.model_id).treeLayers[0].parent_ids[0] = -1;
-        request.beam_trees.at(old_bc.model_id)
-            .treeLayers[0]
-            .nodes_num_this_layer = 1;
+        request.beam_trees.at(model_id).treeLayers[0].probs[0] = 1;
+        request.beam_trees.at(model_id).treeLayers[0].parent_ids[0] = -1;
+        request.beam_trees.at(model_id).treeLayers[0].nodes_num_this_layer = 1;
 
         if (verbose) {
           std::cout << "Store the previous last token to the tree root: "
                     << request.tokens.back() << "\n";
         }
       }
-      request.beam_trees.at(old_bc.model_id)
+      request.beam_trees.at(model_id)
           .treeLayers[depth]
           .nodes_num_this_layer = leaf_node_num;
       for (int beam_id = 0; beam_id < leaf_node_num; beam_id++) {
-
-        request.beam_trees.at(old_bc.model_id)
-            .treeLayers[depth]
-            .tokens[beam_id] = result.token_ids[result_index];
-        request.beam_trees.at(old_bc.model_id)
-            .treeLayers[depth]
-            .probs[beam_id] = result.probs[result_index];
-        request.beam_trees.at(old_bc.model_id)
-            .treeLayers[depth]
-            .parent_ids[beam_id] = result.parent_id[result_index];
+        // the first beam_size candidates of each sub request
+        int candidate = result_index + beam_id / beam_size * result_stride +
+                        beam_id % beam_size;
+        request.beam_trees.at(model_id).treeLayers[depth].tokens[beam_id] =
+            result.token_ids[candidate];
+        request.beam_trees.at(model_id).treeLayers[depth].probs[beam_id] =
+            result.probs[candidate];
+        request.beam_trees.at(model_id).treeLayers[depth].parent_ids[beam_id] =
+            result.parent_id[candidate];
 
         if (verbose) {
           std::cout << "tree value: " << depth << "token: "
-                    << request.beam_trees.at(old_bc.model_id)
+                    << request.beam_trees.at(model_id)
                            .treeLayers[depth]
                            .tokens[beam_id]
-                    << "result tokens: " << result.token_ids[result_index];
+                    << "result tokens: " << result.token_ids[candidate];
         }
-        result_index += 1;
       }
+      result_index +=
+          old_bc.beamRequestsInfo[index].sub_request_num * result_stride;
       // update the guid and start_depth for current request
       if (i < old_bc.num_tokens) {
         int new_req_idx = old_bc.tokensInfo[i].request_index;
@@ -2381,6 +3101,7 @@ void RequestManager::initBitMask(BatchConfig::BitMask &bitmask,
   assert(initLength > 0);
   // eg. 4 tokens: t1: 0000000..1111, t2: 0000000..1110, t3: 0000000..1100, t4:
   // 0000000..1000
+  bitmask.words_per_row = get_bitmask_words_per_row();
   bitmask.non_tree_cache_size = 0;
   bitmask.tree_size = 1;
 
@@ -2399,13 +3120,14 @@ void RequestManager::updateBitMask(BatchConfig::BitMask &bitmask,
   // assert(initLength == 1);
   // eg. 4 tokens: t1: 0000000..1111, t2: 0000000..1110, t3: 0000000..1100, t4:
   // 0000000..1000
-  assert(initLength <= BatchConfig::MAX_SPEC_TREE_TOKEN_NUM &&
-         "do not support tree size > 64");
+  assert(initLength <= get_max_spec_tree_token_num() &&
+         "verified token num exceeds max_spec_tree_token_num");
   assert(initLength >= 1 && "verified token num should >= 1");
 
   // std::cout << "non tree size: " << non_tree_size << ", "
   //           << bitmask.non_tree_cache_size << "\n";
 
+  bitmask.words_per_row = get_bitmask_words_per_row();
   bitmask.non_tree_cache_size = non_tree_size + initLength - 1;
   bitmask.tree_size = 1;
   bitmask.this_layer_size = initLength;
@@ -2413,7 +3135,7 @@ void RequestManager::updateBitMask(BatchConfig::BitMask &bitmask,
   bitmask.prompt_size = 1;
   for (int i = 0; i < bitmask.prompt_size; i++) {
     for (int j = i; j < bitmask.prompt_size; j++) {
-      bitmask.mask[i] |= (1 << j);
+      bitmask.set_bit(i, j);
     }
   }
 
@@ -2452,13 +3174,14 @@ void RequestManager::appendBitMask(BatchConfig::BitMask &bitmask,
   bitmask.tree_size += newNodes;
   bitmask.this_layer_size = newNodes;
   assert(bitmask.tree_size <= BatchConfig::MAX_SPEC_TREE_TOKEN_NUM &&
-         "do not support tree size > 64");
+         bitmask.tree_size <= bitmask.words_per_row * 64 &&
+         "tree size exceeds the width of the bit mask");
   // preBeamSize: replicate num
 
   // add relationship with input/prompt
   for (int i = 0; i < bitmask.prompt_size; i++) {
     for (int j = pre_tree_size; j < bitmask.tree_size; j++) {
-      bitmask.mask[i] |= (1 << j);
+      bitmask.set_bit(i, j);
       // std::cout << "see bit mask append: " << i << ", to" << j
       //           << std::bitset<64>(bitmask.mask[i]) << "\n";
     }
@@ -2486,7 +3209,7 @@ void RequestManager::appendBitMask(BatchConfig::BitMask &bitmask,
     for (int j = 0; j < nodes_this_layer; j++) {
       int group_size = newNodes / nodes_this_layer;
       for (int k = 0; k < group_size; k++) {
-        bitmask.mask[token_idx] |= (1 << new_nodes_start_idx);
+        bitmask.set_bit(token_idx, new_nodes_start_idx);
         new_nodes_start_idx += 1;
       }
       token_idx += 1;
@@ -2499,7 +3222,7 @@ void RequestManager::appendBitMask(BatchConfig::BitMask &bitmask,
   // assert(currentDepth <= 2);
   // set last layer, all tokens are only relevant to it self;
   for (int i = token_idx; i < bitmask.tree_size; i++) {
-    bitmask.mask[i] |= (1 << i);
+    bitmask.set_bit(i, i);
     // std::cout << "set rel: " << i << "to: " << i << "\n";
   }
 
@@ -2583,7 +3306,8 @@ std::vector<std::pair<BatchConfig::TokenId, int>>
         std::vector<std::pair<BatchConfig::TokenId, int>> const
             &inputSerializedTree,
         std::vector<std::pair<BatchConfig::TokenId, int>> const
-            &outputSerializedTree) {
+            &outputSerializedTree,
+        BatchConfig::BitMask const &bitmask) {
   std::vector<std::pair<BeamSearchBatchConfig::TokenId, int>> verifiedTree;
   // verifiedTree.push_back(inputSerializedTree.at(0));
   std::vector<std::pair<int, int>> new_committed_tokens =
@@ -2624,95 +3348,14 @@ std::vector<std::pair<BatchConfig::TokenId, int>>
     log_req_mgr.print("Committed tokens:%s", oss.str().c_str());
   }
 
-  // It's safe to have inputSerializedTree.size() > outputSerializedTree.size()
-  // In this case the inputSeriedTree ends with padding 0s
-  assert(inputSerializedTree.size() >= outputSerializedTree.size());
-
-  int *treeLayers = new int[inputSerializedTree.size()];
-  int node_num = 1;
-  int layer_num = 0;
-  for (int token_id = 0; token_id < inputSerializedTree.size(); token_id++) {
-    if (token_id == (inputSerializedTree.size() - 1) ||
-        inputSerializedTree.at(token_id + 1).second !=
-            inputSerializedTree.at(token_id).second) {
-      treeLayers[layer_num] = node_num;
-      layer_num += 1;
-      node_num = 1;
-    } else {
-      node_num++;
-    }
-  }
-
-  // to avoid branch switch when same tokens in input tree.
-  // todo, only checked for N->1->1->1 cases
-
-  bool findFirst = false;
-  layer_num = -1;
-  int first_layer_slot = 0;
-  int first_layer_slot_total = 0;
-  int processed_whole_layer_tokens = 0;
-
-  for (int i = 0; i < outputSerializedTree.size(); i++) {
-    auto input = inputSerializedTree.at(i);
-    auto output = outputSerializedTree.at(i);
-
-    if (i == 0 || inputSerializedTree.at(i - 1).second !=
-                      inputSerializedTree.at(i).second) {
-      layer_num += 1;
-      processed_whole_layer_tokens += i == 0 ? 0 : treeLayers[layer_num - 1];
-    }
-
-    if (i == 0) {
-      verifiedTree.push_back(output);
-
-      new_committed_tokens.push_back(std::make_pair(
-          input.second,
-          committed_tokens.at(guid).at(i).second)); // <input_abs_depth,
-                                                    // input_index_in_batch>
-      // std::cout << committed_tokens.at(guid).at(i).first << ", "
-      //           << committed_tokens.at(guid).at(i).second << std::endl;
-      // std::cout << input.first << ", " << input.second << std::endl;
-
-      assert(committed_tokens.at(guid).at(i).first == input.second);
-      continue;
-    }
-
-    if (input.first == verifiedTree.back().first &&
-        input.second == verifiedTree.back().second) {
-      if (findFirst) {
-        // must in this branch.
-        int layer_slot = i - processed_whole_layer_tokens;
-        int layer_slot_total = treeLayers[layer_num];
-        if (first_layer_slot == layer_slot) {
-          verifiedTree.push_back(output);
-          new_committed_tokens.push_back(std::make_pair(
-              input.second, committed_tokens.at(guid).at(i).second));
-          // at this point, you'll not go other branches
-          // std::cout << "verify tree push back: " << output.first
-          //           << ", tree size is: " << verifiedTree.size()
-          //           << ", ??: " << input.first << ", " << input.second <<
-          //           "\n";
-
-        } else {
-          printf("not correct slot\n");
-        }
-      } else {
-        verifiedTree.push_back(output);
-        first_layer_slot = i - processed_whole_layer_tokens;
-        first_layer_slot_total = treeLayers[layer_num];
-        findFirst = true;
-        new_committed_tokens.push_back(std::make_pair(
-            input.second,
-            committed_tokens.at(guid).at(i).second)); // <input_abs_depth,
-                                                      // input_index_in_batch>
-        // at this point, you'll not go other branches
-        // std::cout << "verify tree push back: " << output.first
-        //           << ", tree size is: " << verifiedTree.size()
-        //           << ", ??: " << input.first << ", " << input.second << "\n";
-      }
-
-      assert(committed_tokens.at(guid).at(i).first == input.second);
-    }
+  // <input_abs_depth, input_index_in_batch> of the accepted tokens
+  for (int i : accept_speculative_tokens(
+           inputSerializedTree, outputSerializedTree, bitmask)) {
+    auto const &input = inputSerializedTree.at(i);
+    verifiedTree.push_back(outputSerializedTree.at(i));
+    new_committed_tokens.push_back(
+        std::make_pair(input.second, committed_tokens.at(guid).at(i).second));
+    assert(committed_tokens.at(guid).at(i).first == input.second);
   }
   committed_tokens[guid] = new_committed_tokens;
   {
@@ -2813,55 +3456,19 @@ std::vector<std::pair<BatchConfig::TokenId, int>>
 
 std::vector<std::pair<BatchConfig::TokenId, int>>
     RequestManager::merge_dfs_trees(
-        std::vector<std::vector<std::pair<BatchConfig::TokenId, int>>>
-            input_trees,
+        std::vector<std::vector<std::pair<BatchConfig::TokenId, int>>> const
+            &input_trees,
+        std::vector<BatchConfig::BitMask const *> const &input_masks,
         int root_depth,
-        RequestGuid guid) {
-  assert(input_trees.size() == 1 && "currently using one ssm");
-  dfs_tree_inputs[guid] = input_trees.at(0);
-  return input_trees.at(0);
-
-  std::vector<std::pair<BatchConfig::TokenId, int>> merged_tree;
-
-  std::unordered_map<int, std::set<int>> childrens;
-  std::unordered_map<int, int> curr_path;
-
-  // convert <token_id, depth> pair to an integer
-  auto root = input_trees.at(0).at(0);
-  int root_id = root.first * 10000 + root.second;
-
-  for (int i = 0; i < input_trees.size(); i++) {
-    auto tree = input_trees.at(i);
-    // all trees should have the same root
-    assert(tree.at(0) == root);
-
-    for (auto const &pair : tree) {
-      int id = pair.first * 10000 + pair.second; // current node
-      curr_path[pair.second] = id;               // log node in current search
-
-      if (childrens.find(id) == childrens.end()) {
-        // init empty set
-        childrens[id] = std::set<int>();
-      }
-
-      if (pair.second > root_depth) {
-        int parent_id = curr_path[pair.second - 1];
-        childrens[parent_id].insert(id);
-      }
-    }
-  }
-
-  std::stack<int> q;
-  q.push(root_id);
-
-  while (!q.empty()) {
-    int curr = q.top();
-    q.pop();
-    merged_tree.push_back(std::make_pair(curr / 10000, curr % 10000));
-    for (int child : childrens[curr]) {
-      q.push(child);
-    }
-  }
+        RequestGuid guid,
+        BatchConfig::BitMask &merged_mask) {
+  assert(input_trees.size() > 0 && input_trees.at(0).size() > 0);
+  assert(input_trees.at(0).at(0).second == root_depth);
+  std::vector<std::pair<BatchConfig::TokenId, int>> merged_tree =
+      merge_speculative_trees(input_trees,
+                              input_masks,
+                              get_max_spec_tree_token_num(),
+                              merged_mask);
 
   if (verbose) {
     for (auto &pair : merged_tree) {
@@ -2880,18 +3487,16 @@ std::vector<GenerationResult>
   // reset inference_finished flag
   rm->set_inference_finished(false);
   std::vector<RequestManager::RequestGuid> inf_guids, peft_guids;
+  std::vector<RequestManager::RequestGuid> guids =
+      rm->register_new_requests(requests);
   for (int i = 0; i < requests.size(); i++) {
-    RequestManager::RequestGuid guid;
+    if (guids[i] == RequestManager::INVALID_GUID) {
+      continue;
+    }
     if (requests.at(i).req_type == RequestType::REQ_INFERENCE) {
-      guid = rm->register_new_request(requests.at(i));
-      if (guid != RequestManager::INVALID_GUID) {
-        inf_guids.push_back(guid);
-      }
+      inf_guids.push_back(guids[i]);
     } else {
-      guid = rm->register_new_peft_request(requests.at(i));
-      if (guid != RequestManager::INVALID_GUID) {
-        peft_guids.push_back(guid);
-      }
+      peft_guids.push_back(guids[i]);
     }
   }
   std::vector<GenerationResult> results;
@@ -3019,15 +3624,17 @@ void RequestManager::serve_incr_decoding(FFModel *llm) {
 
   Context ctx = llm->config.lg_ctx;
   Runtime *runtime = llm->config.lg_hlr;
-  // Compile the llm
   InferenceManager *im = InferenceManager::get_inference_manager();
-  im->compile_model_and_allocate_buffer(llm);
-  assert(im->model_weights_loaders.find(llm) !=
-         im->model_weights_loaders.end());
-  // Load model weights
-  im->model_weights_loaders[llm]->load_weights_parallel(llm, ctx, runtime);
-  // init operators
-  im->init_operators_inference(llm);
+  if (!im->is_mock_model(llm)) {
+    // Compile the llm
+    im->compile_model_and_allocate_buffer(llm);
+    assert(im->model_weights_loaders.find(llm) !=
+           im->model_weights_loaders.end());
+    // Load model weights
+    im->model_weights_loaders[llm]->load_weights_parallel(llm, ctx, runtime);
+    // init operators
+    im->init_operators_inference(llm);
+  }
   // Legion futures for inc_decoding and spec_infer
   BatchConfigFuture last_bcf;
   InferenceResultFuture last_irf;
@@ -3035,20 +3642,32 @@ void RequestManager::serve_incr_decoding(FFModel *llm) {
     // Initialize futures for incr decoding
     BatchConfig bc;
     InferenceResult ir;
-    last_bcf = Future::from_value<BatchConfig>(bc);
+    last_bcf = SerializedBatchConfig(bc).to_future();
     last_irf = Future::from_value<InferenceResult>(ir);
   }
 
   std::queue<std::pair<BatchConfigFuture, InferenceResultFuture>>
       batch_pipeline;
   { batch_pipeline.push(std::make_pair(last_bcf, last_irf)); }
+  // the tuner starts from the default depth and is only used when no fixed
+  // depth was set
+  PipelineDepthTuner depth_tuner(2, BatchConfig::MAX_INFLIGHT_BATCHES, 4);
+  bool const auto_tune_depth = get_max_inflight_batches() == 0;
+  long long last_launch_time = Realm::Clock::current_time_in_microseconds();
+  long long last_scheduling_time = scheduling_time_us;
 
   while (!is_background_server_terminated()) {
 
-    if (batch_pipeline.size() >= 4) {
+    int max_inflight_batches =
+        auto_tune_depth ? depth_tuner.depth() : get_max_inflight_batches();
+    long long blocked_time = 0;
+    if ((int)batch_pipeline.size() >= max_inflight_batches) {
       // Block here to avoid launching too many batches
       auto const &batch = batch_pipeline.front();
+      long long start_time = Realm::Clock::current_time_in_microseconds();
       batch.second.get_void_result();
+      blocked_time = Realm::Clock::current_time_in_microseconds() - start_time;
+      inflight_wait_time_us += blocked_time;
     }
     // deque finished batches
     while (batch_pipeline.size() > 1) {
@@ -3073,6 +3692,15 @@ void RequestManager::serve_incr_decoding(FFModel *llm) {
     last_bcf = bcf;
     last_irf = irf;
     runtime->end_trace(ctx, 12346 /*trace_id*/);
+    if (auto_tune_depth) {
+      long long now = Realm::Clock::current_time_in_microseconds();
+      long long scheduling_time = scheduling_time_us;
+      depth_tuner.record_batch(blocked_time,
+                               scheduling_time - last_scheduling_time,
+                               now - last_launch_time);
+      last_launch_time = now;
+      last_scheduling_time = scheduling_time;
+    }
   }
 }
 
@@ -3081,7 +3709,7 @@ void RequestManager::serve_spec_infer(FFModel *llm) {
   Context ctx = llm->config.lg_ctx;
   Runtime *runtime = llm->config.lg_hlr;
   InferenceManager *im = InferenceManager::get_inference_manager();
-  {
+  if (!im->is_mock_model(llm)) {
     // Compile the llm
     im->compile_model_and_allocate_buffer(llm);
     assert(im->model_weights_loaders.find(llm) !=
@@ -3094,6 +3722,9 @@ void RequestManager::serve_spec_infer(FFModel *llm) {
   for (size_t i = 0; i < get_num_ssms(); i++) {
     // Compile the i-th ssm
     FFModel *ssm = get_ssm_model(i);
+    if (im->is_mock_model(ssm)) {
+      continue;
+    }
     im->compile_model_and_allocate_buffer(ssm);
     assert(im->model_weights_loaders.find(llm) !=
            im->model_weights_loaders.end());
@@ -3116,13 +3747,25 @@ void RequestManager::serve_spec_infer(FFModel *llm) {
     last_tree_irf = Future::from_value<InferenceResult>(tree_ir);
   }
   batch_pipeline.push(std::make_pair(last_tree_bcf, last_tree_irf));
+  // the tuner starts from the default depth and is only used when no fixed
+  // depth was set
+  PipelineDepthTuner depth_tuner(2, BatchConfig::MAX_INFLIGHT_BATCHES, 4);
+  bool const auto_tune_depth = get_max_inflight_batches() == 0;
+  long long last_launch_time = Realm::Clock::current_time_in_microseconds();
+  long long last_scheduling_time = scheduling_time_us;
 
   while (!is_background_server_terminated()) {
 
-    if (batch_pipeline.size() >= 4) {
+    int max_inflight_batches =
+        auto_tune_depth ? depth_tuner.depth() : get_max_inflight_batches();
+    long long blocked_time = 0;
+    if ((int)batch_pipeline.size() >= max_inflight_batches) {
       // Block here to avoid launching too many batches
       auto const &batch = batch_pipeline.front();
+      long long start_time = Realm::Clock::current_time_in_microseconds();
       batch.second.get_void_result();
+      blocked_time = Realm::Clock::current_time_in_microseconds() - start_time;
+      inflight_wait_time_us += blocked_time;
     }
     // deque finished batches
     while (batch_pipeline.size() > 1) {
@@ -3136,22 +3779,26 @@ void RequestManager::serve_spec_infer(FFModel *llm) {
     auto const &next_batch = batch_pipeline.back();
     BeamSearchBatchConfigFuture beam_bcf = prepare_next_batch_init(
         next_batch.first, next_batch.second, 0, ctx, runtime);
-    std::vector<BeamSearchBatchConfigFuture> beam_bcf_vec(get_num_ssms());
-    for (size_t ssm_id = 0; ssm_id < get_num_ssms(); ssm_id++) {
-      beam_bcf_vec[ssm_id] = beam_bcf;
-    }
-    runtime->begin_trace(ctx, 12345 /*trace_id*/);
-
-    for (size_t i = 0; i < get_num_ssms(); i++) {
-      for (int depth = 0; depth < BeamSearchBatchConfig::MAX_BEAM_DEPTH;
-           depth++) {
-        beam_bcf = beam_bcf_vec[i];
-
+    std::vector<BeamSearchBatchConfigFuture> beam_bcf_vec(get_num_ssms(),
+                                                         beam_bcf);
+    // stop drafting once every request's tree reached the depth chosen from
+    // its acceptance rate. The round already depends on the previous
+    // verification, so waiting for its first batch costs little
+    int num_ssm_steps =
+        beam_bcf.get_result<BeamSearchBatchConfig>().get_num_ssm_steps();
+    // a Legion trace must replay the same operations, so keep one trace per
+    // number of steps
+    runtime->begin_trace(ctx, 12345 + 16 * num_ssm_steps /*trace_id*/);
+
+    // the ssms draft independently of each other, so launch each step of all
+    // of them before the next one to let their steps run concurrently
+    for (int depth = 0; depth < num_ssm_steps; depth++) {
+      for (size_t i = 0; i < get_num_ssms(); i++) {
         FutureMap fm = im->inference(get_ssm_model(i), 0, beam_bcf_vec[i]);
         assert(fm.get_future_map_domain().get_volume() == 1);
         BeamInferenceResultFuture beam_irf = fm.get_future(0);
         beam_bcf_vec[i] =
-            prepare_next_batch_beam(beam_bcf_vec[i], beam_irf, ctx, runtime);
+            prepare_next_batch_beam(beam_bcf_vec[i], beam_irf, i, ctx, runtime);
       }
     }
     // Token Tree Verification
@@ -3165,16 +3812,226 @@ void RequestManager::serve_spec_infer(FFModel *llm) {
       last_tree_bcf = tree_bcf;
       last_tree_irf = tree_irf;
     }
-    runtime->end_trace(ctx, 12345 /*trace_id*/);
+    runtime->end_trace(ctx, 12345 + 16 * num_ssm_steps /*trace_id*/);
+    if (auto_tune_depth) {
+      long long now = Realm::Clock::current_time_in_microseconds();
+      long long scheduling_time = scheduling_time_us;
+      depth_tuner.record_batch(blocked_time,
+                               scheduling_time - last_scheduling_time,
+                               now - last_launch_time);
+      last_launch_time = now;
+      last_scheduling_time = scheduling_time;
+    }
   }
 }
 
 void RequestManager::trigger_request_completion_future(
     RequestGuid const &guid) {
-  const std::lock_guard<std::mutex> lock(request_to_promise_mutex);
-  assert(request_to_promise.find(guid) != request_to_promise.end());
+  CompletionShard &shard = get_completion_shard(guid);
+  const std::lock_guard<std::mutex> lock(shard.mutex);
+  assert(shard.states.find(guid) != shard.states.end());
+  CompletionState &state = shard.states[guid];
+  state.completed = true;
   // Set the completion promise in case other threads are waiting
-  request_to_promise[guid]->set_value();
+  state.promise.set_value();
+}
+
+void RequestManager::push_output_event(Request &request,
+                                       bool finished,
+                                       std::string const &file_header,
+                                       bool write_output) {
+  // unfinished requests only produce events when their tokens are streamed
+  if (!finished && !has_streaming_callback) {
+    return;
+  }
+  int first_new_token =
+      std::max(request.num_output_tokens, request.initial_len);
+  if (!finished && (int)request.tokens.size() <= first_new_token) {
+    return;
+  }
+  OutputEvent event;
+  event.guid = request.guid;
+  event.finished = finished;
+  event.file_header = file_header;
+  event.write_output = write_output;
+  if (request.num_output_tokens == 0) {
+    event.new_tokens = request.tokens;
+    event.num_prompt_tokens = request.initial_len;
+    event.add_special_tokens = request.add_special_tokens;
+  } else {
+    event.new_tokens.assign(request.tokens.begin() + request.num_output_tokens,
+                            request.tokens.end());
+  }
+  request.num_output_tokens = request.tokens.size();
+  enqueue_output_event(std::move(event));
+}
+
+void RequestManager::push_output_file_text(std::string const &text) {
+  OutputEvent event;
+  event.file_header = text;
+  enqueue_output_event(std::move(event));
+}
+
+void RequestManager::enqueue_output_event(OutputEvent &&event) {
+  std::call_once(output_thread_started, [this]() {
+    output_thread = std::thread(&RequestManager::output_thread_loop, this);
+  });
+  output_queue.push(std::move(event));
+  // pairs with the fence in output_thread_loop: either the output thread
+  // sees the new event before sleeping, or we see that it is sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (output_thread_sleeping) {
+    const std::lock_guard<std::mutex> lock(output_thread_mutex);
+    output_thread_cv.notify_one();
+  }
+}
+
+void RequestManager::output_thread_loop() {
+  // tokenizers are not thread safe, so the output thread uses its own
+  if (tokenizer_factory) {
+    output_tokenizer_ = tokenizer_factory();
+  }
+  OutputEvent event;
+  while (true) {
+    while (output_queue.try_pop(event)) {
+      process_output_event(event);
+    }
+    if (output_thread_stopping && output_queue.empty()) {
+      break;
+    }
+    std::unique_lock<std::mutex> lock(output_thread_mutex);
+    output_thread_sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    output_thread_cv.wait(lock, [this]() {
+      return !output_queue.empty() || output_thread_stopping;
+    });
+    output_thread_sleeping = false;
+  }
+}
+
+void RequestManager::stop_output_thread() {
+  if (!output_thread.joinable()) {
+    return;
+  }
+  {
+    const std::lock_guard<std::mutex> lock(output_thread_mutex);
+    output_thread_stopping = true;
+    output_thread_cv.notify_one();
+  }
+  output_thread.join();
+}
+
+void RequestManager::process_output_event(OutputEvent &event) {
+  if (event.guid == INVALID_GUID) {
+    write_to_output_file(event.file_header);
+    return;
+  }
+  auto it = output_states.find(event.guid);
+  std::vector<TokenId> new_tokens;
+  if (it == output_states.end()) {
+    // the first event of a request starts with its prompt
+    assert(event.num_prompt_tokens <= (int)event.new_tokens.size());
+    std::vector<TokenId> prompt_tokens(
+        event.new_tokens.begin(),
+        event.new_tokens.begin() + event.num_prompt_tokens);
+    new_tokens.assign(event.new_tokens.begin() + event.num_prompt_tokens,
+                      event.new_tokens.end());
+    IncrementalDetokenizer detokenizer(
+        [this](std::vector<TokenId> const &tokens) {
+          if (!this->output_tokenizer_) {
+            // no tokenizer was registered, e.g. for a mock model: the text
+            // is the token ids
+            std::string text;
+            for (TokenId token : tokens) {
+              text += std::to_string(token) + " ";
+            }
+            return text;
+          }
+          return this->output_tokenizer_->Decode(tokens);
+        },
+        prompt_tokens);
+    it = output_states
+             .emplace(event.guid,
+                      OutputState{std::move(detokenizer),
+                                  event.add_special_tokens})
+             .first;
+  } else {
+    new_tokens = std::move(event.new_tokens);
+  }
+  OutputState &state = it->second;
+  std::string new_text = state.detokenizer.append(new_tokens);
+  if (event.finished) {
+    new_text += state.detokenizer.flush();
+  }
+
+  StreamingCallback callback;
+  if (has_streaming_callback) {
+    const std::lock_guard<std::mutex> lock(streaming_callback_mutex);
+    callback = streaming_callback;
+  }
+  StreamingOutput streaming_output;
+  if (callback) {
+    streaming_output.guid = event.guid;
+    streaming_output.new_tokens = std::move(new_tokens);
+    streaming_output.new_text = std::move(new_text);
+    streaming_output.finished = event.finished;
+  }
+
+  if (event.finished) {
+    std::vector<TokenId> const &tokens = state.detokenizer.get_tokens();
+    std::string output = state.detokenizer.get_text();
+    // Unlike Huggingface, the sentencepiece C++ library automatically
+    // removes the BOS token
+    if (model_type == ModelType::LLAMA && old_llama_tokenizer &&
+        state.add_special_tokens && tokens.at(0) == bos_token_id) {
+      output = "<s> " + output;
+    }
+    {
+      // update generation result
+      CompletionShard &shard = get_completion_shard(event.guid);
+      const std::lock_guard<std::mutex> lock(shard.mutex);
+      GenerationResult &gr = shard.states[event.guid].result;
+      assert(gr.guid == event.guid);
+      gr.output_tokens = tokens;
+      gr.output_text = output;
+    }
+    log_req_mgr.print("Final output: %s", output.c_str());
+    // Write output to file if needed:
+    if (!output_filepath.empty()) {
+      std::ostringstream text;
+      text << event.file_header;
+      if (event.write_output) {
+        text << "token IDs: ";
+        for (size_t i = 0; i < tokens.size(); i++) {
+          text << tokens[i];
+          if (i < tokens.size() - 1) {
+            text << ",";
+          }
+        }
+        text << std::endl;
+        text << output;
+      }
+      write_to_output_file(text.str());
+    }
+    trigger_request_completion_future(event.guid);
+    output_states.erase(it);
+  }
+
+  if (callback) {
+    callback(streaming_output);
+  }
+}
+
+void RequestManager::write_to_output_file(std::string const &text) {
+  std::ofstream outputFile(output_filepath, std::ios::app);
+  if (outputFile.is_open()) {
+    outputFile << text;
+    outputFile.close();
+  } else {
+    std::cout << "Unable to open the output file: " << output_filepath
+              << std::endl;
+    assert(false);
+  }
 }
 
 /*static*/
@@ -3191,6 +4048,9 @@ void RequestManager::terminate_background_server() {
     Context ctx = Runtime::get_context();
     background_server_handler.get_void_result();
   }
+  // flush the outputs of the last requests
+  stop_output_thread();
+  request_metrics.flush();
 }
 
 bool RequestManager::is_background_server_terminated() {
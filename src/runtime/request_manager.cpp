@@ -73,18 +73,31 @@ void RequestManager::load_batch_config_task(
 
   // copy meta data to workSpace
   FFHandler handle = *((FFHandler const *)task->local_args);
+  // only the active tokens and the request slots that can be used
   checkCUDA(hipMemcpyAsync(handle.batch_config_metadata->tokens_info,
                            &(batch_config->tokensInfo),
-                           sizeof(BatchConfig::tokensInfo),
+                           sizeof(BatchConfig::PerTokenInfo) *
+                               batch_config->num_active_tokens(),
                            hipMemcpyHostToDevice,
                            stream));
 
   checkCUDA(hipMemcpyAsync(handle.batch_config_metadata->requestsInfo,
                            &(batch_config->requestsInfo),
-                           sizeof(BatchConfig::requestsInfo),
+                           sizeof(BatchConfig::PerRequestInfo) *
+                               BatchConfig::max_requests_per_batch(),
                            hipMemcpyHostToDevice,
                            stream));
 
+  // load the block tables of the paged KV cache
+  if (batch_config->num_kv_block_table_entries > 0) {
+    checkCUDA(hipMemcpyAsync(handle.batch_config_metadata->kv_block_table,
+                             &(batch_config->kv_block_table),
+                             sizeof(int) *
+                                 batch_config->num_kv_block_table_entries,
+                             hipMemcpyHostToDevice,
+                             stream));
+  }
+
   // load speculative metadata
   if (batch_config->get_mode() == BEAM_SEARCH_MODE) {
     BeamSearchBatchConfig const *beam_batch_config =
@@ -102,11 +115,17 @@ void RequestManager::load_batch_config_task(
                              hipMemcpyHostToDevice,
                              stream));
 
-    checkCUDA(hipMemcpyAsync(handle.batch_config_metadata->causalMask,
-                             &(beam_batch_config->causalMask),
-                             sizeof(BatchConfig::causalMask),
-                             hipMemcpyHostToDevice,
-                             stream));
+    // only the part of each mask that the configured tree size uses
+    size_t mask_width = BatchConfig::BitMask::used_size(
+        BatchConfig::max_spec_tree_token_num());
+    checkCUDA(hipMemcpy2DAsync(handle.batch_config_metadata->causalMask,
+                               sizeof(BatchConfig::BitMask),
+                               &(beam_batch_config->causalMask),
+                               sizeof(BatchConfig::BitMask),
+                               mask_width,
+                               BatchConfig::max_requests_per_batch(),
+                               hipMemcpyHostToDevice,
+                               stream));
 
     checkCUDA(hipMemcpyAsync(handle.batch_config_metadata->request_completed,
                              &(batch_config->request_completed),
@@ -118,11 +137,17 @@ void RequestManager::load_batch_config_task(
     TreeVerifyBatchConfig const *tree_batch_config =
         static_cast<TreeVerifyBatchConfig const *>(batch_config);
 
-    checkCUDA(hipMemcpyAsync(handle.batch_config_metadata->causalMask,
-                             &(tree_batch_config->causalMask),
-                             sizeof(BatchConfig::causalMask),
-                             hipMemcpyHostToDevice,
-                             stream));
+    // only the part of each mask that the configured tree size uses
+    size_t mask_width = BatchConfig::BitMask::used_size(
+        BatchConfig::max_spec_tree_token_num());
+    checkCUDA(hipMemcpy2DAsync(handle.batch_config_metadata->causalMask,
+                               sizeof(BatchConfig::BitMask),
+                               &(tree_batch_config->causalMask),
+                               sizeof(BatchConfig::BitMask),
+                               mask_width,
+                               BatchConfig::max_requests_per_batch(),
+                               hipMemcpyHostToDevice,
+                               stream));
 
     checkCUDA(hipMemcpyAsync(handle.batch_config_metadata->committed_tokens,
                              &(tree_batch_config->committed_tokens),
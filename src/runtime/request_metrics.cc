@@ -0,0 +1,193 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/request_metrics.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+namespace FlexFlow {
+
+bool request_metric_type_from_string(std::string const &name,
+                                     RequestMetricType &type) {
+  if (name == "queue_time") {
+    type = METRIC_QUEUE_TIME;
+  } else if (name == "ttft") {
+    type = METRIC_TTFT;
+  } else if (name == "tpot") {
+    type = METRIC_TPOT;
+  } else if (name == "e2e_latency") {
+    type = METRIC_E2E_LATENCY;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+double RequestMetrics::get(RequestMetricType type) const {
+  switch (type) {
+    case METRIC_QUEUE_TIME:
+      return (start_time - registration_time) / 1000;
+    case METRIC_TTFT:
+      if (first_token_time <= 0) {
+        return -1;
+      }
+      return (first_token_time - registration_time) / 1000;
+    case METRIC_TPOT:
+      if (first_token_time <= 0 || output_length < 2) {
+        return -1;
+      }
+      return (finish_time - first_token_time) / 1000 / (output_length - 1);
+    case METRIC_E2E_LATENCY:
+      return (finish_time - registration_time) / 1000;
+  }
+  assert(false);
+  return -1;
+}
+
+std::string RequestMetrics::to_json() const {
+  nlohmann::json record = {
+      {"guid", guid},
+      {"warmup", warmup},
+      {"registration_time_us", registration_time},
+      {"start_time_us", start_time},
+      {"first_token_time_us", first_token_time},
+      {"finish_time_us", finish_time},
+      {"prompt_length", prompt_length},
+      {"output_length", output_length},
+      {"llm_decoding_steps", llm_decoding_steps},
+      {"num_preemptions", num_preemptions},
+      {"num_speculated_tokens", num_speculated_tokens},
+      {"num_accepted_tokens", num_accepted_tokens},
+      {"queue_time_ms", get(METRIC_QUEUE_TIME)},
+      {"ttft_ms", get(METRIC_TTFT)},
+      {"tpot_ms", get(METRIC_TPOT)},
+      {"e2e_latency_ms", get(METRIC_E2E_LATENCY)},
+  };
+  return record.dump();
+}
+
+void RequestMetricsCollector::add(RequestMetrics const &metrics) {
+  // called with the request manager's lock held: format the record before
+  // taking our own lock, and let the stream buffer the writes
+  std::string json = metrics.to_json();
+  std::lock_guard<std::mutex> lock(mutex);
+  if (records.size() == MAX_RECORDS) {
+    records.pop_front();
+  }
+  records.push_back(metrics);
+  if (output_file.is_open()) {
+    output_file << json << '\n';
+  }
+}
+
+void RequestMetricsCollector::flush() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (output_file.is_open()) {
+    output_file.flush();
+  }
+}
+
+void RequestMetricsCollector::set_output_filepath(
+    std::string const &filepath) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (output_file.is_open()) {
+    output_file.close();
+  }
+  output_file.open(filepath, std::ios::app);
+  if (!output_file.is_open()) {
+    std::cerr << "Unable to open request metrics file: " << filepath
+              << std::endl;
+    assert(false);
+  }
+}
+
+std::vector<RequestMetrics> RequestMetricsCollector::get_records() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return std::vector<RequestMetrics>(records.begin(), records.end());
+}
+
+std::vector<double>
+    RequestMetricsCollector::values(RequestMetricType type) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<double> result;
+  for (RequestMetrics const &metrics : records) {
+    double value = metrics.get(type);
+    if (!metrics.warmup && value >= 0) {
+      result.push_back(value);
+    }
+  }
+  return result;
+}
+
+RequestMetricsSummary
+    RequestMetricsCollector::summarize(RequestMetricType type) const {
+  std::vector<double> sorted = values(type);
+  RequestMetricsSummary summary;
+  if (sorted.empty()) {
+    return summary;
+  }
+  std::sort(sorted.begin(), sorted.end());
+  // nearest-rank percentile: the smallest value with at least p% of the
+  // values at or below it
+  auto percentile = [&sorted](double p) {
+    size_t rank = (size_t)std::ceil(p / 100 * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+  };
+  summary.count = sorted.size();
+  double total = 0;
+  for (double value : sorted) {
+    total += value;
+  }
+  summary.mean = total / sorted.size();
+  summary.min = sorted.front();
+  summary.max = sorted.back();
+  summary.p50 = percentile(50);
+  summary.p90 = percentile(90);
+  summary.p95 = percentile(95);
+  summary.p99 = percentile(99);
+  return summary;
+}
+
+std::vector<size_t> RequestMetricsCollector::histogram(
+    RequestMetricType type, std::vector<double> const &bounds) const {
+  assert(std::is_sorted(bounds.begin(), bounds.end()));
+  std::vector<size_t> counts(bounds.size() + 1, 0);
+  for (double value : values(type)) {
+    counts[std::upper_bound(bounds.begin(), bounds.end(), value) -
+           bounds.begin()]++;
+  }
+  return counts;
+}
+
+bool RequestMetricsCollector::dump(std::string const &filepath) const {
+  std::ofstream file(filepath);
+  if (!file.is_open()) {
+    return false;
+  }
+  for (RequestMetrics const &metrics : get_records()) {
+    file << metrics.to_json() << "\n";
+  }
+  return true;
+}
+
+void RequestMetricsCollector::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  records.clear();
+}
+
+}; // namespace FlexFlow
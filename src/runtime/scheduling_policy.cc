@@ -0,0 +1,175 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/scheduling_policy.h"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <unordered_map>
+
+namespace FlexFlow {
+
+SchedulingPolicyType
+    scheduling_policy_type_from_string(std::string const &name) {
+  if (name == "fcfs") {
+    return SCHEDULING_FCFS;
+  } else if (name == "spf" || name == "shortest-prompt-first") {
+    return SCHEDULING_SHORTEST_PROMPT_FIRST;
+  } else if (name == "priority") {
+    return SCHEDULING_PRIORITY;
+  } else if (name == "fair-share") {
+    return SCHEDULING_FAIR_SHARE;
+  }
+  std::cerr << "Unknown scheduling policy: " << name << std::endl;
+  assert(false);
+  return SCHEDULING_FCFS;
+}
+
+void SchedulingPolicy::push(PendingRequest const &request) {
+  pending.push_back(request);
+  pending.back().arrival_order = next_arrival_order++;
+  if (is_heap) {
+    std::push_heap(pending.begin(), pending.end(), HeapOrder{this});
+  }
+}
+
+void SchedulingPolicy::requeue(PendingRequest const &request) {
+  assert(request.arrival_order < next_arrival_order);
+  pending.push_back(request);
+  if (is_heap) {
+    std::push_heap(pending.begin(), pending.end(), HeapOrder{this});
+  }
+}
+
+bool SchedulingPolicy::empty() const {
+  return pending.empty();
+}
+
+size_t SchedulingPolicy::size() const {
+  return pending.size();
+}
+
+PendingRequest const &SchedulingPolicy::front() {
+  assert(!pending.empty());
+  if (!is_heap) {
+    std::make_heap(pending.begin(), pending.end(), HeapOrder{this});
+    is_heap = true;
+  }
+  return pending.front();
+}
+
+void SchedulingPolicy::pop() {
+  front();
+  std::pop_heap(pending.begin(), pending.end(), HeapOrder{this});
+  pending.pop_back();
+}
+
+bool SchedulingPolicy::admits_before(PendingRequest const &a,
+                                     PendingRequest const &b) const {
+  return before(a, b);
+}
+
+void SchedulingPolicy::on_tokens_scheduled(PEFTModelID const &peft_model_id,
+                                           int num_tokens) {}
+
+void SchedulingPolicy::invalidate_front() {
+  is_heap = false;
+}
+
+class FCFSSchedulingPolicy : public SchedulingPolicy {
+protected:
+  bool before(PendingRequest const &a, PendingRequest const &b) const override {
+    return a.arrival_order < b.arrival_order;
+  }
+};
+
+class ShortestPromptFirstSchedulingPolicy : public SchedulingPolicy {
+protected:
+  bool before(PendingRequest const &a, PendingRequest const &b) const override {
+    if (a.prompt_length != b.prompt_length) {
+      return a.prompt_length < b.prompt_length;
+    }
+    return a.arrival_order < b.arrival_order;
+  }
+};
+
+class PrioritySchedulingPolicy : public SchedulingPolicy {
+protected:
+  bool before(PendingRequest const &a, PendingRequest const &b) const override {
+    if (a.priority != b.priority) {
+      return a.priority > b.priority;
+    }
+    // requests with a deadline go first, earliest deadline first
+    bool a_has_deadline = a.deadline >= 0, b_has_deadline = b.deadline >= 0;
+    if (a_has_deadline != b_has_deadline) {
+      return a_has_deadline;
+    }
+    if (a_has_deadline && a.deadline != b.deadline) {
+      return a.deadline < b.deadline;
+    }
+    return a.arrival_order < b.arrival_order;
+  }
+};
+
+class FairShareSchedulingPolicy : public SchedulingPolicy {
+public:
+  void on_tokens_scheduled(PEFTModelID const &peft_model_id,
+                           int num_tokens) override {
+    served_tokens[peft_model_id] += num_tokens;
+    invalidate_front();
+  }
+
+protected:
+  bool before(PendingRequest const &a, PendingRequest const &b) const override {
+    size_t a_served = get_served_tokens(a.peft_model_id);
+    size_t b_served = get_served_tokens(b.peft_model_id);
+    if (a_served != b_served) {
+      return a_served < b_served;
+    }
+    return a.arrival_order < b.arrival_order;
+  }
+
+private:
+  size_t get_served_tokens(PEFTModelID const &peft_model_id) const {
+    auto it = served_tokens.find(peft_model_id);
+    return it == served_tokens.end() ? 0 : it->second;
+  }
+
+  // number of tokens scheduled so far for each adapter (NO_ID for requests
+  // of the base model)
+  std::unordered_map<PEFTModelID, size_t> served_tokens;
+};
+
+/*static*/
+std::unique_ptr<SchedulingPolicy>
+    SchedulingPolicy::create(SchedulingPolicyType type) {
+  switch (type) {
+    case SCHEDULING_FCFS:
+      return std::unique_ptr<SchedulingPolicy>(new FCFSSchedulingPolicy());
+    case SCHEDULING_SHORTEST_PROMPT_FIRST:
+      return std::unique_ptr<SchedulingPolicy>(
+          new ShortestPromptFirstSchedulingPolicy());
+    case SCHEDULING_PRIORITY:
+      return std::unique_ptr<SchedulingPolicy>(new PrioritySchedulingPolicy());
+    case SCHEDULING_FAIR_SHARE:
+      return std::unique_ptr<SchedulingPolicy>(
+          new FairShareSchedulingPolicy());
+    default:
+      assert(false && "Unknown scheduling policy");
+  }
+  return nullptr;
+}
+
+}; // namespace FlexFlow
@@ -0,0 +1,115 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/utils/speculative_tree.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <map>
+
+namespace FlexFlow {
+
+SerializedTokenTree merge_speculative_trees(
+    std::vector<SerializedTokenTree> const &trees,
+    std::vector<BatchConfig::BitMask const *> const &masks,
+    int max_tree_size,
+    BatchConfig::BitMask &merged_mask) {
+  assert(trees.size() > 0 && trees.size() == masks.size());
+  // all trees share the root, i.e. the last committed token
+  auto const &root = trees.at(0).at(0);
+
+  // nodes of the merged tree and the index of their parents
+  SerializedTokenTree nodes = {root};
+  std::vector<int> parents = {-1};
+  // (parent, token id) -> index in the merged tree
+  std::map<std::pair<int, BatchConfig::TokenId>, int> node_ids;
+  for (int t = 0; t < trees.size(); t++) {
+    auto const &tree = trees.at(t);
+    BatchConfig::BitMask const &mask = *masks.at(t);
+    assert(tree.at(0) == root);
+    std::vector<int> merged_ids(tree.size(), 0);
+    for (int q = 1; q < tree.size(); q++) {
+      // the parent of a token is its ancestor in the layer above; layers are
+      // serialized in order, so it comes before the token
+      int parent = -1;
+      for (int k = q - 1; k >= 0 && parent < 0; k--) {
+        if (tree[k].second == tree[q].second - 1 && mask.test_bit(k, q)) {
+          parent = k;
+        }
+      }
+      assert(parent >= 0 && "draft token without a parent");
+      auto key = std::make_pair(merged_ids[parent], tree[q].first);
+      auto it = node_ids.find(key);
+      if (it == node_ids.end()) {
+        it = node_ids.emplace(key, (int)nodes.size()).first;
+        nodes.push_back(tree[q]);
+        parents.push_back(merged_ids[parent]);
+      }
+      merged_ids[q] = it->second;
+    }
+  }
+
+  // serialize the merged tree layer by layer, as expected by the verify
+  // phase, and keep at most max_tree_size tokens. Parents always come
+  // first, so every kept token also keeps its ancestors
+  std::vector<int> order(nodes.size());
+  for (int k = 0; k < nodes.size(); k++) {
+    order[k] = k;
+  }
+  std::stable_sort(order.begin(), order.end(), [&nodes](int a, int b) {
+    return nodes[a].second < nodes[b].second;
+  });
+  int merged_size = std::min((int)nodes.size(), max_tree_size);
+  std::vector<int> position(nodes.size(), -1);
+  SerializedTokenTree merged_tree;
+  for (int k = 0; k < merged_size; k++) {
+    position[order[k]] = k;
+    merged_tree.push_back(nodes[order[k]]);
+  }
+
+  // token q attends to itself and all its ancestors
+  merged_mask = *masks.at(0);
+  std::fill(std::begin(merged_mask.mask), std::end(merged_mask.mask), 0ULL);
+  merged_mask.tree_size = merged_size;
+  assert(merged_size <= merged_mask.words_per_row * 64);
+  for (int k = 0; k < merged_size; k++) {
+    for (int a = order[k]; a >= 0; a = parents[a]) {
+      merged_mask.set_bit(position[a], k);
+    }
+  }
+  return merged_tree;
+}
+
+std::vector<int>
+    accept_speculative_tokens(SerializedTokenTree const &input_tree,
+                              SerializedTokenTree const &output_tree,
+                              BatchConfig::BitMask const &mask) {
+  // input_tree may end with padding
+  assert(input_tree.size() >= output_tree.size());
+  std::vector<int> accepted = {0};
+  int last_accepted = 0;
+  for (int i = 1; i < output_tree.size(); i++) {
+    // other branches of the tree may contain the same token at the same
+    // depth, so the token must also be a child of the last accepted one
+    if (input_tree[i] == output_tree[last_accepted] &&
+        mask.test_bit(last_accepted, i)) {
+      accepted.push_back(i);
+      last_accepted = i;
+    }
+  }
+  return accepted;
+}
+
+}; // namespace FlexFlow
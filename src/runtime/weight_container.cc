@@ -0,0 +1,220 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/utils/weight_container.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace FlexFlow {
+
+namespace {
+
+size_t align_up(size_t offset) {
+  return (offset + WeightContainer::ALIGNMENT - 1) /
+         WeightContainer::ALIGNMENT * WeightContainer::ALIGNMENT;
+}
+
+// Reads the fields of the index, checking that they are in the file
+class IndexReader {
+public:
+  IndexReader(char const *data, size_t size) : data(data), size(size) {}
+
+  template <typename T>
+  T read() {
+    T value;
+    read_bytes(&value, sizeof(T));
+    return value;
+  }
+  std::string read_string(size_t length) {
+    std::string value(length, '\0');
+    read_bytes(&value[0], length);
+    return value;
+  }
+
+private:
+  void read_bytes(void *dst, size_t length) {
+    assert(offset + length <= size && "truncated weight container index");
+    std::memcpy(dst, data + offset, length);
+    offset += length;
+  }
+
+  char const *data;
+  size_t size, offset = 0;
+};
+
+template <typename T>
+void write_value(std::ofstream &out, T value) {
+  out.write((char const *)&value, sizeof(T));
+}
+
+} // namespace
+
+WeightContainer::WeightContainer(std::string const &_filepath)
+    : filepath(_filepath) {
+  int fd = open(filepath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Could not open weight container " << filepath << std::endl;
+    assert(false);
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  mapped_size = st.st_size;
+  void *addr = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    std::cerr << "Could not map weight container " << filepath << std::endl;
+    assert(false);
+  }
+  mapped = (char const *)addr;
+  // tensors are mostly read once, front to back
+  madvise(addr, mapped_size, MADV_SEQUENTIAL);
+
+  IndexReader reader(mapped, mapped_size);
+  if (reader.read_string(std::strlen(MAGIC)) != MAGIC) {
+    std::cerr << filepath << " is not a weight container" << std::endl;
+    assert(false);
+  }
+  unsigned version = reader.read<uint32_t>();
+  if (version != VERSION) {
+    std::cerr << "Unsupported weight container version " << version
+              << " in " << filepath << std::endl;
+    assert(false);
+  }
+  uint32_t num_tensors = reader.read<uint32_t>();
+  tensors.resize(num_tensors);
+  for (uint32_t i = 0; i < num_tensors; i++) {
+    TensorInfo &info = tensors[i];
+    info.name = reader.read_string(reader.read<uint32_t>());
+    info.data_type = (DataType)reader.read<int32_t>();
+    uint32_t num_dims = reader.read<uint32_t>();
+    for (uint32_t j = 0; j < num_dims; j++) {
+      info.dims.push_back(reader.read<uint64_t>());
+    }
+    info.offset = reader.read<uint64_t>();
+    info.size = reader.read<uint64_t>();
+    assert(info.offset % ALIGNMENT == 0);
+    assert(info.offset + info.size <= mapped_size &&
+           "weight container payload out of bounds");
+    tensor_index[info.name] = i;
+  }
+}
+
+WeightContainer::~WeightContainer() {
+  if (mapped != nullptr) {
+    munmap((void *)mapped, mapped_size);
+  }
+}
+
+WeightContainer::TensorInfo const *
+    WeightContainer::find(std::string const &name) const {
+  auto it = tensor_index.find(name);
+  if (it == tensor_index.end()) {
+    return nullptr;
+  }
+  return &tensors[it->second];
+}
+
+char const *WeightContainer::get_data(TensorInfo const &info) const {
+  return mapped + info.offset;
+}
+
+std::vector<WeightContainer::TensorInfo> const &
+    WeightContainer::get_tensors() const {
+  return tensors;
+}
+
+void WeightContainerWriter::add_tensor(std::string const &name,
+                                       DataType data_type,
+                                       std::vector<size_t> const &dims,
+                                       std::string const &source_filepath) {
+  WeightContainer::TensorInfo info;
+  info.name = name;
+  info.data_type = data_type;
+  info.dims = dims;
+  info.offset = 0;
+  info.size = std::filesystem::file_size(source_filepath);
+  tensors.push_back(info);
+  source_filepaths.push_back(source_filepath);
+}
+
+void WeightContainerWriter::write(std::string const &filepath) const {
+  // the index comes first, so compute its size to place the payloads
+  size_t index_size =
+      std::strlen(WeightContainer::MAGIC) + 2 * sizeof(uint32_t);
+  for (WeightContainer::TensorInfo const &info : tensors) {
+    index_size += sizeof(uint32_t) + info.name.size() + sizeof(int32_t) +
+                  sizeof(uint32_t) + info.dims.size() * sizeof(uint64_t) +
+                  2 * sizeof(uint64_t);
+  }
+  std::vector<size_t> offsets;
+  size_t offset = index_size;
+  for (WeightContainer::TensorInfo const &info : tensors) {
+    offset = align_up(offset);
+    offsets.push_back(offset);
+    offset += info.size;
+  }
+
+  std::ofstream out(filepath, std::ios::out | std::ios::binary);
+  if (!out.good()) {
+    std::cerr << "Could not open " << filepath << " for writing" << std::endl;
+    assert(false);
+  }
+  out.write(WeightContainer::MAGIC, std::strlen(WeightContainer::MAGIC));
+  write_value<uint32_t>(out, WeightContainer::VERSION);
+  write_value<uint32_t>(out, tensors.size());
+  for (size_t i = 0; i < tensors.size(); i++) {
+    WeightContainer::TensorInfo const &info = tensors[i];
+    write_value<uint32_t>(out, info.name.size());
+    out.write(info.name.data(), info.name.size());
+    write_value<int32_t>(out, info.data_type);
+    write_value<uint32_t>(out, info.dims.size());
+    for (size_t dim : info.dims) {
+      write_value<uint64_t>(out, dim);
+    }
+    write_value<uint64_t>(out, offsets[i]);
+    write_value<uint64_t>(out, info.size);
+  }
+  assert((size_t)out.tellp() == index_size);
+
+  std::vector<char> buffer(1 << 24);
+  for (size_t i = 0; i < tensors.size(); i++) {
+    std::vector<char> padding(offsets[i] - (size_t)out.tellp(), '\0');
+    out.write(padding.data(), padding.size());
+    std::ifstream in(source_filepaths[i], std::ios::in | std::ios::binary);
+    assert(in.good() && "incorrect weight file path");
+    size_t remaining = tensors[i].size;
+    while (remaining > 0) {
+      size_t chunk = std::min(remaining, buffer.size());
+      in.read(buffer.data(), chunk);
+      assert((size_t)in.gcount() == chunk);
+      out.write(buffer.data(), chunk);
+      remaining -= chunk;
+    }
+  }
+  out.close();
+  assert(!out.fail() && "failed to write weight container");
+}
+
+}; // namespace FlexFlow
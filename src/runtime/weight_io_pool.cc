@@ -0,0 +1,191 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/utils/weight_io_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace FlexFlow {
+
+WeightIOPool::WeightIOPool(int num_threads,
+                           size_t _chunk_size,
+                           size_t _max_pending_chunks)
+    : chunk_size(_chunk_size), max_pending_chunks(_max_pending_chunks) {
+  assert(chunk_size > 0);
+  if (num_threads <= 0) {
+    num_threads = std::thread::hardware_concurrency();
+    if (num_threads <= 0 || num_threads > MAX_DEFAULT_THREADS) {
+      num_threads = MAX_DEFAULT_THREADS;
+    }
+  }
+  if (max_pending_chunks == 0) {
+    // enough for each thread to have its next chunk queued
+    max_pending_chunks = 2 * num_threads;
+  }
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back(&WeightIOPool::worker, this);
+  }
+}
+
+WeightIOPool::~WeightIOPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queue_not_empty.notify_all();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+bool WeightIOPool::pread(int fd, size_t offset, size_t size, char *dst) {
+  assert(fd >= 0);
+  return run_batch(fd, nullptr, offset, size, dst, nullptr);
+}
+
+void WeightIOPool::copy(char const *src, size_t size, char *dst) {
+  bool ok = run_batch(-1, src, 0, size, dst, nullptr);
+  assert(ok);
+}
+
+bool WeightIOPool::pread(int fd,
+                         size_t offset,
+                         size_t size,
+                         ChunkConsumer const &consume) {
+  assert(fd >= 0);
+  return run_batch(fd, nullptr, offset, size, nullptr, &consume);
+}
+
+void WeightIOPool::copy(char const *src,
+                        size_t size,
+                        ChunkConsumer const &consume) {
+  bool ok = run_batch(-1, src, 0, size, nullptr, &consume);
+  assert(ok);
+}
+
+int WeightIOPool::get_num_threads() const {
+  return threads.size();
+}
+
+size_t WeightIOPool::get_chunk_size() const {
+  return chunk_size;
+}
+
+/*static*/
+std::shared_ptr<WeightIOPool> WeightIOPool::acquire_shared() {
+  static std::mutex shared_pool_mutex;
+  static std::weak_ptr<WeightIOPool> shared_pool;
+  std::lock_guard<std::mutex> lock(shared_pool_mutex);
+  std::shared_ptr<WeightIOPool> pool = shared_pool.lock();
+  if (pool == nullptr) {
+    pool = std::make_shared<WeightIOPool>();
+    shared_pool = pool;
+  }
+  return pool;
+}
+
+bool WeightIOPool::run_batch(int fd,
+                             char const *src,
+                             size_t offset,
+                             size_t size,
+                             char *dst,
+                             ChunkConsumer const *consume) {
+  // small ranges are not worth a round trip through the queue
+  if (size <= chunk_size) {
+    std::vector<char> staging_buffer;
+    return run_chunk(Chunk{nullptr, fd, src, offset, size, dst, consume, 0},
+                     staging_buffer);
+  }
+  Batch batch;
+  std::unique_lock<std::mutex> lock(mutex);
+  for (size_t begin = 0; begin < size; begin += chunk_size) {
+    queue_not_full.wait(lock,
+                        [&] { return queue.size() < max_pending_chunks; });
+    queue.push_back(Chunk{&batch,
+                          fd,
+                          src,
+                          offset + begin,
+                          std::min(chunk_size, size - begin),
+                          dst == nullptr ? nullptr : dst + begin,
+                          consume,
+                          begin});
+    batch.num_pending++;
+    queue_not_empty.notify_one();
+  }
+  batch_done.wait(lock, [&] { return batch.num_pending == 0; });
+  return !batch.failed;
+}
+
+/*static*/
+bool WeightIOPool::run_chunk(Chunk const &chunk,
+                             std::vector<char> &staging_buffer) {
+  if (chunk.fd < 0) {
+    if (chunk.consume != nullptr) {
+      (*chunk.consume)(chunk.src + chunk.offset, chunk.begin, chunk.size);
+    } else {
+      memcpy(chunk.dst, chunk.src + chunk.offset, chunk.size);
+    }
+    return true;
+  }
+  char *buf = chunk.dst;
+  if (chunk.consume != nullptr) {
+    staging_buffer.resize(std::max(staging_buffer.size(), chunk.size));
+    buf = staging_buffer.data();
+  }
+  size_t remaining = chunk.size;
+  off_t file_offset = chunk.offset;
+  while (remaining > 0) {
+    ssize_t ret = ::pread(chunk.fd, buf, remaining, file_offset);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    buf += ret;
+    file_offset += ret;
+    remaining -= ret;
+  }
+  if (chunk.consume != nullptr) {
+    (*chunk.consume)(staging_buffer.data(), chunk.begin, chunk.size);
+  }
+  return true;
+}
+
+void WeightIOPool::worker() {
+  std::vector<char> staging_buffer;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    queue_not_empty.wait(lock, [&] { return stopping || !queue.empty(); });
+    if (queue.empty()) {
+      return;
+    }
+    Chunk chunk = queue.front();
+    queue.pop_front();
+    queue_not_full.notify_one();
+    lock.unlock();
+    bool ok = run_chunk(chunk, staging_buffer);
+    lock.lock();
+    chunk.batch->failed |= !ok;
+    if (--chunk.batch->num_pending == 0) {
+      batch_done.notify_all();
+    }
+  }
+}
+
+}; // namespace FlexFlow
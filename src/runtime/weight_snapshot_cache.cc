@@ -0,0 +1,141 @@
+/* Copyright 2023 CMU, Facebook, LANL, MIT, NVIDIA, and Stanford (alphabetical)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flexflow/utils/weight_snapshot_cache.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace FlexFlow {
+
+namespace {
+
+// FNV-1a
+void hash_bytes(uint64_t &hash, void const *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    hash ^= ((unsigned char const *)data)[i];
+    hash *= 0x100000001b3ULL;
+  }
+}
+
+void hash_string(uint64_t &hash, std::string const &value) {
+  uint64_t length = value.size();
+  hash_bytes(hash, &length, sizeof(length));
+  hash_bytes(hash, value.data(), value.size());
+}
+
+// hashes the settings with the name, size and modification time of every
+// file of the weights folder, which is much cheaper than their contents
+std::string get_snapshot_key(std::string const &weights_folder,
+                             std::string const &settings) {
+  namespace fs = std::filesystem;
+  std::vector<fs::path> files;
+  for (fs::directory_entry const &entry :
+       fs::directory_iterator(weights_folder)) {
+    if (entry.is_regular_file()) {
+      files.push_back(entry.path());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  unsigned version = WeightSnapshotCache::FORMAT_VERSION;
+  hash_bytes(hash, &version, sizeof(version));
+  hash_string(hash, settings);
+  for (fs::path const &file : files) {
+    hash_string(hash, file.filename().string());
+    uint64_t size = fs::file_size(file);
+    int64_t mtime = fs::last_write_time(file).time_since_epoch().count();
+    hash_bytes(hash, &size, sizeof(size));
+    hash_bytes(hash, &mtime, sizeof(mtime));
+  }
+  std::ostringstream key;
+  key << std::hex << hash;
+  return key.str();
+}
+
+} // namespace
+
+WeightSnapshotCache::WeightSnapshotCache(std::string const &cache_folder,
+                                         std::string const &weights_folder,
+                                         std::string const &settings) {
+  snapshot_folder = (std::filesystem::path(cache_folder) /
+                     get_snapshot_key(weights_folder, settings))
+                        .string();
+  std::error_code error;
+  std::filesystem::create_directories(snapshot_folder, error);
+  if (error) {
+    std::cerr << "Could not create weight cache folder " << snapshot_folder
+              << ": " << error.message() << std::endl;
+    assert(false);
+  }
+}
+
+bool WeightSnapshotCache::load(std::string const &name,
+                               size_t size,
+                               char *dst,
+                               WeightIOPool *io_pool) const {
+  int fd = open(get_filepath(name).c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  bool loaded = fstat(fd, &st) == 0 && (size_t)st.st_size == size &&
+                io_pool->pread(fd, 0, size, dst);
+  close(fd);
+  return loaded;
+}
+
+void WeightSnapshotCache::store(std::string const &name,
+                                size_t size,
+                                char const *src) const {
+  // written aside and renamed, as a rename within a folder is atomic
+  std::string filepath = get_filepath(name);
+  std::string tmp_filepath = filepath + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream out(tmp_filepath, std::ios::out | std::ios::binary);
+    out.write(src, size);
+    out.close();
+    if (out.fail()) {
+      // the cache is only an optimization, so go on without it
+      std::cerr << "Could not write weight snapshot " << tmp_filepath
+                << std::endl;
+      std::remove(tmp_filepath.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmp_filepath.c_str(), filepath.c_str()) != 0) {
+    std::cerr << "Could not write weight snapshot " << filepath << std::endl;
+    std::remove(tmp_filepath.c_str());
+  }
+}
+
+std::string const &WeightSnapshotCache::get_snapshot_folder() const {
+  return snapshot_folder;
+}
+
+std::string WeightSnapshotCache::get_filepath(std::string const &name) const {
+  return (std::filesystem::path(snapshot_folder) / (name + ".bin")).string();
+}
+
+}; // namespace FlexFlow
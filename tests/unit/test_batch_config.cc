@@ -0,0 +1,165 @@
+#include "flexflow/batch_config.h"
+#include "gtest/gtest.h"
+#include <memory>
+#include <vector>
+
+using namespace FlexFlow;
+
+namespace {
+
+std::vector<char> serialize(BatchConfig const &bc) {
+  SerializedBatchConfig serialized(bc);
+  std::vector<char> buffer(serialized.legion_buffer_size());
+  EXPECT_EQ(serialized.legion_serialize(buffer.data()), buffer.size());
+  return buffer;
+}
+
+} // namespace
+
+TEST(batch_config, compact_round_trip) {
+  BatchConfig bc;
+  bc.num_tokens = 3;
+  bc.num_generation_tokens = 1;
+  // a decoding request in slot 0 and a prompt in slot 2
+  bc.request_completed[0] = false;
+  bc.requestsInfo[0].first_token_depth_in_request = 10;
+  bc.requestsInfo[0].first_token_offset_in_batch = 0;
+  bc.requestsInfo[0].num_tokens_in_batch = 1;
+  bc.requestsInfo[0].request_guid = 1000;
+  bc.requestsInfo[0].kv_block_table_offset = 0;
+  bc.request_completed[2] = false;
+  bc.requestsInfo[2].first_token_offset_in_batch = 1;
+  bc.requestsInfo[2].num_tokens_in_batch = 2;
+  bc.requestsInfo[2].prompt_phase = true;
+  bc.requestsInfo[2].request_guid = 1001;
+  bc.requestsInfo[2].peft_model_id = PEFTModelID(7);
+  bc.requestsInfo[2].kv_block_table_offset = 1;
+  // the dense ids of the active requests, one of them in the empty slot 1
+  bc.requestsInfo[0].batch_config_request_id = 0;
+  bc.requestsInfo[1].batch_config_request_id = 2;
+  for (int i = 0; i < bc.num_tokens; i++) {
+    bc.tokensInfo[i].abs_depth_in_request = i == 0 ? 10 : i - 1;
+    bc.tokensInfo[i].request_index = i == 0 ? 0 : 2;
+    bc.tokensInfo[i].token_id = 100 + i;
+  }
+  bc.num_kv_block_table_entries = 2;
+  bc.kv_block_table[0] = 5;
+  bc.kv_block_table[1] = 3;
+  bc.requestsInfo[0].do_sample = true;
+  bc.requestsInfo[0].temperature = 0.7f;
+  bc.requestsInfo[0].top_k = 40;
+  bc.requestsInfo[0].repetition_penalty = 1.2f;
+  bc.requestsInfo[0].seed = 1234;
+  bc.requestsInfo[0].num_penalty_tokens = 2;
+  bc.penalty_tokens = {100, 42};
+
+  std::vector<char> buffer = serialize(bc);
+  EXPECT_LT(buffer.size(), sizeof(BatchConfig) / 100);
+  std::shared_ptr<BatchConfig const> copy =
+      SerializedBatchConfig::materialize(buffer.data(), buffer.size());
+  EXPECT_EQ(copy->num_tokens, 3);
+  EXPECT_EQ(copy->num_generation_tokens, 1);
+  EXPECT_FALSE(copy->request_completed[0]);
+  EXPECT_TRUE(copy->request_completed[1]);
+  EXPECT_FALSE(copy->request_completed[2]);
+  EXPECT_EQ(copy->requestsInfo[0].first_token_depth_in_request, 10);
+  EXPECT_EQ(copy->requestsInfo[0].request_guid, 1000);
+  EXPECT_EQ(copy->requestsInfo[2].num_tokens_in_batch, 2);
+  EXPECT_TRUE(copy->requestsInfo[2].prompt_phase);
+  EXPECT_EQ(copy->requestsInfo[2].peft_model_id, PEFTModelID(7));
+  EXPECT_EQ(copy->requestsInfo[2].kv_block_table_offset, 1);
+  EXPECT_EQ(copy->requestsInfo[0].batch_config_request_id, 0);
+  EXPECT_EQ(copy->requestsInfo[1].batch_config_request_id, 2);
+  for (int i = 0; i < bc.num_tokens; i++) {
+    EXPECT_EQ(copy->tokensInfo[i].abs_depth_in_request,
+              bc.tokensInfo[i].abs_depth_in_request);
+    EXPECT_EQ(copy->tokensInfo[i].request_index,
+              bc.tokensInfo[i].request_index);
+    EXPECT_EQ(copy->tokensInfo[i].token_id, bc.tokensInfo[i].token_id);
+  }
+  EXPECT_EQ(copy->num_kv_block_table_entries, 2);
+  EXPECT_EQ(copy->kv_block_table[0], 5);
+  EXPECT_EQ(copy->kv_block_table[1], 3);
+  EXPECT_TRUE(copy->requestsInfo[0].do_sample);
+  EXPECT_FLOAT_EQ(copy->requestsInfo[0].temperature, 0.7f);
+  EXPECT_EQ(copy->requestsInfo[0].top_k, 40);
+  EXPECT_FLOAT_EQ(copy->requestsInfo[0].repetition_penalty, 1.2f);
+  EXPECT_EQ(copy->requestsInfo[0].seed, 1234);
+  EXPECT_FALSE(copy->requestsInfo[2].do_sample);
+  EXPECT_EQ(copy->penalty_tokens,
+            (std::vector<BatchConfig::TokenId>{100, 42}));
+
+  // the same buffer is only materialized once
+  EXPECT_EQ(
+      SerializedBatchConfig::materialize(buffer.data(), buffer.size()).get(),
+      copy.get());
+}
+
+TEST(batch_config, compact_requests_do_not_leak) {
+  BatchConfig first;
+  first.num_tokens = 1;
+  first.request_completed[4] = false;
+  first.requestsInfo[4].num_tokens_in_batch = 1;
+  first.requestsInfo[4].request_guid = 1;
+  BatchConfig second;
+  second.num_tokens = 1;
+  second.request_completed[1] = false;
+  second.requestsInfo[1].num_tokens_in_batch = 1;
+  second.requestsInfo[1].request_guid = 2;
+
+  // materialize enough batches to reuse every cached BatchConfig
+  std::vector<std::vector<char>> buffers;
+  for (int i = 0; i < 64; i++) {
+    buffers.push_back(serialize(i % 2 == 0 ? first : second));
+    std::shared_ptr<BatchConfig const> bc = SerializedBatchConfig::materialize(
+        buffers.back().data(), buffers.back().size());
+    EXPECT_EQ(bc->request_completed[4], i % 2 != 0);
+    EXPECT_EQ(bc->request_completed[1], i % 2 == 0);
+  }
+}
+
+TEST(batch_config, materialized_batch_outlives_cache) {
+  BatchConfig first;
+  first.num_tokens = 1;
+  first.request_completed[3] = false;
+  first.requestsInfo[3].num_tokens_in_batch = 1;
+  first.requestsInfo[3].request_guid = 1;
+  std::vector<char> first_buffer = serialize(first);
+  std::shared_ptr<BatchConfig const> in_use =
+      SerializedBatchConfig::materialize(first_buffer.data(),
+                                         first_buffer.size());
+
+  // later batches evict it from the cache, but do not overwrite it
+  BatchConfig second;
+  second.num_tokens = 1;
+  second.request_completed[5] = false;
+  second.requestsInfo[5].num_tokens_in_batch = 1;
+  second.requestsInfo[5].request_guid = 2;
+  std::vector<std::vector<char>> buffers;
+  for (int i = 0; i < 64; i++) {
+    buffers.push_back(serialize(second));
+    SerializedBatchConfig::materialize(buffers.back().data(),
+                                       buffers.back().size());
+  }
+  EXPECT_FALSE(in_use->request_completed[3]);
+  EXPECT_TRUE(in_use->request_completed[5]);
+  EXPECT_EQ(in_use->requestsInfo[3].request_guid, 1);
+}
+
+TEST(batch_config, bit_mask_wide_rows) {
+  BatchConfig::BitMask bitmask;
+  bitmask.words_per_row = 2;
+  bitmask.set_bit(0, 0);
+  bitmask.set_bit(0, 100);
+  bitmask.set_bit(1, 63);
+  bitmask.set_bit(1, 64);
+  EXPECT_TRUE(bitmask.test_bit(0, 0));
+  EXPECT_TRUE(bitmask.test_bit(0, 100));
+  EXPECT_FALSE(bitmask.test_bit(0, 36));
+  EXPECT_TRUE(bitmask.test_bit(1, 63));
+  EXPECT_TRUE(bitmask.test_bit(1, 64));
+  // rows do not overlap
+  EXPECT_FALSE(bitmask.test_bit(1, 0));
+  EXPECT_FALSE(bitmask.test_bit(1, 100));
+  EXPECT_EQ(bitmask.mask[1], 1ULL << 36);
+}
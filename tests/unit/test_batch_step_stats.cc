@@ -0,0 +1,31 @@
+#include "flexflow/batch_step_stats.h"
+#include "gtest/gtest.h"
+
+using namespace FlexFlow;
+
+TEST(batch_step_stats, keeps_most_recent_steps) {
+  BatchStepStatsBuffer buffer;
+  EXPECT_TRUE(buffer.get_recent(10).empty());
+  size_t const num_steps = BatchStepStatsBuffer::CAPACITY + 10;
+  for (size_t i = 0; i < num_steps; i++) {
+    BatchStepStats stats;
+    stats.num_decode_tokens = (int)i;
+    buffer.push(stats);
+  }
+  EXPECT_EQ(buffer.get_num_steps(), num_steps);
+
+  std::vector<BatchStepStats> recent = buffer.get_recent(3);
+  ASSERT_EQ(recent.size(), 3);
+  for (size_t i = 0; i < recent.size(); i++) {
+    EXPECT_EQ(recent[i].step, num_steps - 3 + i);
+    EXPECT_EQ(recent[i].num_decode_tokens, (int)(num_steps - 3 + i));
+  }
+  // older steps were overwritten
+  recent = buffer.get_recent(num_steps);
+  ASSERT_EQ(recent.size(), BatchStepStatsBuffer::CAPACITY);
+  EXPECT_EQ(recent.front().step, 10);
+
+  buffer.clear();
+  EXPECT_EQ(buffer.get_num_steps(), 0);
+  EXPECT_TRUE(buffer.get_recent(10).empty());
+}
@@ -0,0 +1,61 @@
+#include "flexflow/utils/incremental_detokenizer.h"
+#include "gtest/gtest.h"
+#include <map>
+
+using namespace FlexFlow;
+
+namespace {
+
+// Mimics sentencepiece: words start with a space that is stripped at the
+// start of the decoded text, and a lone UTF-8 lead byte decodes to U+FFFD
+std::string decode(std::vector<int> const &tokens) {
+  static std::map<int, std::string> const vocab = {{1, " Hello"},
+                                                   {2, " world"},
+                                                   {3, ","},
+                                                   {4, " caf"},
+                                                   {5, "\xC3"},
+                                                   {6, "\xA9"},
+                                                   {7, "!"}};
+  std::string text;
+  for (int token : tokens) {
+    text += vocab.at(token);
+  }
+  if (!text.empty() && text[0] == ' ') {
+    text = text.substr(1);
+  }
+  if (!text.empty() && text.back() == '\xC3') {
+    text.back() = '\xEF';
+    text += "\xBF\xBD";
+  }
+  return text;
+}
+
+} // namespace
+
+TEST(incremental_detokenizer, matches_full_decode) {
+  std::vector<int> prompt = {1, 3};
+  IncrementalDetokenizer detokenizer(decode, prompt);
+  EXPECT_EQ(detokenizer.get_text(), "Hello,");
+  EXPECT_EQ(detokenizer.append({2}), " world");
+  EXPECT_EQ(detokenizer.append({}), "");
+  EXPECT_EQ(detokenizer.append({3, 1, 2}), ", Hello world");
+  EXPECT_EQ(detokenizer.flush(), "");
+  std::vector<int> tokens = {1, 3, 2, 3, 1, 2};
+  EXPECT_EQ(detokenizer.get_tokens(), tokens);
+  EXPECT_EQ(detokenizer.get_text(), decode(tokens));
+  EXPECT_EQ(detokenizer.get_num_prompt_tokens(), 2);
+}
+
+TEST(incremental_detokenizer, holds_back_incomplete_utf8) {
+  IncrementalDetokenizer detokenizer(decode, {});
+  EXPECT_EQ(detokenizer.append({1}), "Hello");
+  EXPECT_EQ(detokenizer.append({4}), " caf");
+  // the first byte of "é" is held back until the second one arrives
+  EXPECT_EQ(detokenizer.append({5}), "");
+  EXPECT_EQ(detokenizer.append({6}), "\xC3\xA9");
+  EXPECT_EQ(detokenizer.append({7}), "!");
+  EXPECT_EQ(detokenizer.get_text(), "Hello caf\xC3\xA9!");
+  // flush() returns whatever is held back
+  EXPECT_EQ(detokenizer.append({5}), "");
+  EXPECT_EQ(detokenizer.flush(), "\xEF\xBF\xBD");
+}
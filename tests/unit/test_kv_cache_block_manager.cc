@@ -0,0 +1,227 @@
+#include "flexflow/utils/kv_cache_block_manager.h"
+#include "flexflow/utils/paged_kv_cache.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+using namespace FlexFlow;
+
+TEST(kv_cache_block_manager, reserve_and_release) {
+  KVCacheBlockManager manager(8, 4);
+  EXPECT_EQ(manager.num_blocks_needed(0), 0);
+  EXPECT_EQ(manager.num_blocks_needed(4), 1);
+  EXPECT_EQ(manager.num_blocks_needed(5), 2);
+
+  EXPECT_TRUE(manager.reserve(1, 10));
+  EXPECT_EQ(manager.get_block_table(1).size(), 3);
+  EXPECT_EQ(manager.get_num_free_blocks(), 5);
+
+  // growing an existing table only allocates the missing blocks
+  EXPECT_TRUE(manager.reserve(1, 12));
+  EXPECT_EQ(manager.get_block_table(1).size(), 3);
+  EXPECT_TRUE(manager.reserve(1, 13));
+  EXPECT_EQ(manager.get_block_table(1).size(), 4);
+
+  EXPECT_TRUE(manager.reserve(2, 16));
+  EXPECT_EQ(manager.get_num_free_blocks(), 0);
+  EXPECT_FALSE(manager.can_reserve(3, 1));
+  EXPECT_FALSE(manager.reserve(3, 1));
+  EXPECT_FALSE(manager.has_block_table(3));
+
+  std::set<int> blocks;
+  for (int b : manager.get_block_table(1)) {
+    blocks.insert(b);
+  }
+  for (int b : manager.get_block_table(2)) {
+    blocks.insert(b);
+  }
+  EXPECT_EQ(blocks.size(), 8);
+
+  manager.release(1);
+  EXPECT_FALSE(manager.has_block_table(1));
+  EXPECT_EQ(manager.get_num_free_blocks(), 4);
+  EXPECT_TRUE(manager.reserve(3, 16));
+  EXPECT_EQ(manager.get_num_free_blocks(), 0);
+}
+
+TEST(kv_cache_block_manager, failed_reserve_is_noop) {
+  KVCacheBlockManager manager(2, 4);
+  EXPECT_TRUE(manager.reserve(1, 4));
+  EXPECT_FALSE(manager.reserve(1, 12));
+  EXPECT_EQ(manager.get_block_table(1).size(), 1);
+  EXPECT_EQ(manager.get_num_free_blocks(), 1);
+}
+
+TEST(kv_cache_block_manager, prefix_sharing) {
+  KVCacheBlockManager manager(8, 2);
+  std::vector<int> prompt{1, 2, 3, 4, 5, 6, 7};
+  EXPECT_EQ(manager.match_prefix(1, prompt), 0);
+  EXPECT_TRUE(manager.reserve(1, 8));
+  manager.cache_prefix(1, prompt, 7);
+  EXPECT_EQ(manager.get_num_cached_blocks(), 3);
+  EXPECT_EQ(manager.get_num_evictable_blocks(), 0);
+
+  // a request with the same prompt reuses the first three blocks
+  EXPECT_EQ(manager.match_prefix(2, prompt), 6);
+  std::vector<int> const &table1 = manager.get_block_table(1);
+  std::vector<int> const &table2 = manager.get_block_table(2);
+  EXPECT_EQ(std::vector<int>(table1.begin(), table1.begin() + 3), table2);
+  EXPECT_TRUE(manager.reserve(2, 8));
+  EXPECT_NE(manager.get_block_table(2)[3], table1[3]);
+  EXPECT_EQ(manager.get_num_free_blocks(), 3);
+
+  // the last prompt token is never matched, even if its block is cached
+  std::vector<int> short_prompt{1, 2, 3, 4};
+  EXPECT_EQ(manager.match_prefix(3, short_prompt), 2);
+  manager.release(3);
+
+  // a diverging prompt only shares the common blocks
+  std::vector<int> other{1, 2, 9, 9, 9};
+  EXPECT_EQ(manager.match_prefix(4, other), 2);
+  manager.release(4);
+
+  manager.release(1);
+  manager.release(2);
+  EXPECT_EQ(manager.get_num_cached_blocks(), 3);
+  EXPECT_EQ(manager.get_num_evictable_blocks(), 3);
+  EXPECT_EQ(manager.get_num_free_blocks(), 5);
+}
+
+TEST(kv_cache_block_manager, prefix_eviction) {
+  KVCacheBlockManager manager(4, 2);
+  std::vector<int> prompt_a{1, 2, 3, 4, 5};
+  std::vector<int> prompt_b{6, 7, 8};
+  EXPECT_TRUE(manager.reserve(1, 5));
+  manager.cache_prefix(1, prompt_a, 5);
+  manager.release(1);
+  EXPECT_TRUE(manager.reserve(2, 3));
+  manager.cache_prefix(2, prompt_b, 3);
+  manager.release(2);
+  EXPECT_EQ(manager.get_num_cached_blocks(), 3);
+  EXPECT_EQ(manager.get_num_free_blocks(), 1);
+
+  // touch prompt_a so that prompt_b becomes the least recently used
+  EXPECT_EQ(manager.match_prefix(3, prompt_a), 4);
+  manager.release(3);
+
+  // needs three blocks: takes the free one, evicts the block of prompt_b,
+  // then the leaf of prompt_a
+  EXPECT_TRUE(manager.reserve(4, 6));
+  EXPECT_EQ(manager.get_num_cached_blocks(), 1);
+  EXPECT_EQ(manager.match_prefix(5, prompt_b), 0);
+  EXPECT_EQ(manager.match_prefix(6, prompt_a), 2);
+
+  // blocks used by a request are never evicted
+  EXPECT_FALSE(manager.can_reserve(7, 4));
+  EXPECT_FALSE(manager.reserve(7, 4));
+  EXPECT_EQ(manager.get_num_cached_blocks(), 1);
+}
+
+namespace {
+
+// a request's keys and values, both contiguous ([num_tokens, hidden_size])
+// and scattered over the non-contiguous, out-of-order blocks of a paged
+// cache ([num_blocks, block_size, hidden_size])
+struct PagedKVCacheFixture {
+  static int const num_heads = 2, head_dim = 4, block_size = 3;
+  static int const num_tokens = 7, num_blocks = 5;
+  static int const hidden_size = num_heads * head_dim;
+  std::vector<int> block_table{4, 0, 2};
+  std::vector<float> contiguous_k, contiguous_v, paged_k, paged_v;
+
+  PagedKVCacheFixture()
+      : contiguous_k(num_tokens * hidden_size),
+        contiguous_v(num_tokens * hidden_size),
+        paged_k(num_blocks * block_size * hidden_size, 0.0f),
+        paged_v(num_blocks * block_size * hidden_size, 0.0f) {
+    for (int i = 0; i < num_tokens * hidden_size; i++) {
+      contiguous_k[i] = std::cos(0.1f * i);
+      contiguous_v[i] = std::sin(0.2f * i + 1.0f);
+    }
+    // fill the paged cache block by block
+    for (size_t b = 0; b < block_table.size(); b++) {
+      float *k_block =
+          paged_k.data() + block_table[b] * block_size * hidden_size;
+      float *v_block =
+          paged_v.data() + block_table[b] * block_size * hidden_size;
+      int first = b * block_size;
+      int last = std::min(first + block_size, (int)num_tokens);
+      std::copy(contiguous_k.begin() + first * hidden_size,
+                contiguous_k.begin() + last * hidden_size,
+                k_block);
+      std::copy(contiguous_v.begin() + first * hidden_size,
+                contiguous_v.begin() + last * hidden_size,
+                v_block);
+    }
+  }
+};
+
+} // namespace
+
+TEST(paged_kv_cache, slot) {
+  std::vector<int> block_table{4, 0, 2};
+  EXPECT_EQ(paged_kv_cache_slot(block_table.data(), 3, 0), 12);
+  EXPECT_EQ(paged_kv_cache_slot(block_table.data(), 3, 2), 14);
+  EXPECT_EQ(paged_kv_cache_slot(block_table.data(), 3, 3), 0);
+  EXPECT_EQ(paged_kv_cache_slot(block_table.data(), 3, 7), 7);
+}
+
+TEST(paged_kv_cache, gather_matches_contiguous_cache) {
+  PagedKVCacheFixture cache;
+  int const hidden_size = PagedKVCacheFixture::hidden_size;
+  // what gather_paged_kv_cache does, one element per kernel thread
+  size_t num_elements = PagedKVCacheFixture::num_tokens * hidden_size;
+  std::vector<float> gathered_k(num_elements), gathered_v(num_elements);
+  for (size_t i = 0; i < num_elements; i++) {
+    size_t idx =
+        paged_kv_cache_gather_index(cache.block_table.data(),
+                                    PagedKVCacheFixture::block_size,
+                                    hidden_size,
+                                    i);
+    gathered_k[i] = cache.paged_k[idx];
+    gathered_v[i] = cache.paged_v[idx];
+  }
+  EXPECT_EQ(gathered_k, cache.contiguous_k);
+  EXPECT_EQ(gathered_v, cache.contiguous_v);
+}
+
+TEST(paged_attention_reference, matches_contiguous_cache) {
+  PagedKVCacheFixture cache;
+  int const num_heads = PagedKVCacheFixture::num_heads;
+  int const head_dim = PagedKVCacheFixture::head_dim;
+  int const block_size = PagedKVCacheFixture::block_size;
+  int const num_tokens = PagedKVCacheFixture::num_tokens;
+  int const hidden_size = PagedKVCacheFixture::hidden_size;
+  std::vector<float> query(hidden_size);
+  for (int i = 0; i < hidden_size; i++) {
+    query[i] = std::sin(0.3f * i);
+  }
+
+  float const scale = 1.0f / std::sqrt((float)head_dim);
+  std::vector<float> expected(hidden_size), actual(hidden_size);
+  std::vector<int> identity_table{0, 1, 2};
+  paged_attention_reference(query.data(),
+                            cache.contiguous_k.data(),
+                            cache.contiguous_v.data(),
+                            identity_table,
+                            block_size,
+                            num_tokens,
+                            num_heads,
+                            head_dim,
+                            scale,
+                            expected.data());
+  paged_attention_reference(query.data(),
+                            cache.paged_k.data(),
+                            cache.paged_v.data(),
+                            cache.block_table,
+                            block_size,
+                            num_tokens,
+                            num_heads,
+                            head_dim,
+                            scale,
+                            actual.data());
+  for (int i = 0; i < hidden_size; i++) {
+    EXPECT_FLOAT_EQ(actual[i], expected[i]);
+  }
+}
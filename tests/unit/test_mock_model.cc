@@ -0,0 +1,69 @@
+#include "flexflow/mock_model.h"
+#include "gtest/gtest.h"
+#include <memory>
+
+using namespace FlexFlow;
+
+TEST(mock_model, deterministic_tokens) {
+  MockModelConfig config;
+  config.vocab_size = 100;
+  for (int token = 0; token < 50; token++) {
+    BatchConfig::TokenId next = MockModel::next_token(config, token, 7);
+    EXPECT_GE(next, 0);
+    EXPECT_LT(next, config.vocab_size);
+    EXPECT_EQ(next, MockModel::next_token(config, token, 7));
+  }
+  MockModelConfig other = config;
+  other.seed = 1;
+  int num_different = 0;
+  for (int token = 0; token < 50; token++) {
+    num_different += MockModel::next_token(config, token, 7) !=
+                     MockModel::next_token(other, token, 7);
+  }
+  EXPECT_GT(num_different, 0);
+}
+
+TEST(mock_model, draft_tokens) {
+  MockModelConfig config;
+  config.vocab_size = 100;
+  config.draft_accuracy = 1.0f;
+  for (int token = 0; token < 50; token++) {
+    EXPECT_EQ(MockModel::draft_token(config, token, 3, 0),
+              MockModel::next_token(config, token, 3));
+  }
+  // wrong drafts still have the right token as their second candidate
+  config.draft_accuracy = 0.0f;
+  for (int token = 0; token < 50; token++) {
+    EXPECT_NE(MockModel::draft_token(config, token, 3, 0),
+              MockModel::next_token(config, token, 3));
+    EXPECT_EQ(MockModel::draft_token(config, token, 3, 1),
+              MockModel::next_token(config, token, 3));
+  }
+  config.draft_accuracy = 0.5f;
+  int num_correct = 0;
+  for (int token = 0; token < 1000; token++) {
+    num_correct += MockModel::draft_token(config, token, 3, 0) ==
+                   MockModel::next_token(config, token, 3);
+  }
+  EXPECT_GT(num_correct, 400);
+  EXPECT_LT(num_correct, 600);
+}
+
+TEST(mock_model, generate) {
+  MockModelConfig config;
+  config.vocab_size = 100;
+  auto bc = std::make_unique<BatchConfig>();
+  bc->num_tokens = 3;
+  bc->request_completed[0] = false;
+  bc->requestsInfo[0].num_tokens_in_batch = 3;
+  for (int i = 0; i < bc->num_tokens; i++) {
+    bc->tokensInfo[i].abs_depth_in_request = i;
+    bc->tokensInfo[i].request_index = 0;
+    bc->tokensInfo[i].token_id = 10 + i;
+  }
+  auto ir = std::make_unique<InferenceResult>();
+  MockModel::generate(config, *bc, *ir);
+  for (int i = 0; i < bc->num_tokens; i++) {
+    EXPECT_EQ(ir->token_ids[i], MockModel::next_token(config, 10 + i, i));
+  }
+}
@@ -0,0 +1,50 @@
+#include "flexflow/utils/mpsc_queue.h"
+#include "gtest/gtest.h"
+#include <thread>
+#include <vector>
+
+using namespace FlexFlow;
+
+TEST(mpsc_queue, fifo) {
+  MPSCQueue<int> queue;
+  int value;
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.try_pop(value));
+  for (int i = 0; i < 5; i++) {
+    queue.push(i);
+  }
+  EXPECT_FALSE(queue.empty());
+  for (int i = 0; i < 5; i++) {
+    EXPECT_TRUE(queue.try_pop(value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(mpsc_queue, concurrent_producers) {
+  int const num_producers = 4, num_items = 10000;
+  MPSCQueue<std::pair<int, int>> queue;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < num_producers; p++) {
+    producers.emplace_back([&queue, p]() {
+      for (int i = 0; i < num_items; i++) {
+        queue.push(std::make_pair(p, i));
+      }
+    });
+  }
+  // items of each producer come out in the order they were pushed
+  std::vector<int> next_item(num_producers, 0);
+  int num_popped = 0;
+  std::pair<int, int> item;
+  while (num_popped < num_producers * num_items) {
+    if (queue.try_pop(item)) {
+      EXPECT_EQ(item.second, next_item[item.first]);
+      next_item[item.first]++;
+      num_popped++;
+    }
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  EXPECT_TRUE(queue.empty());
+}
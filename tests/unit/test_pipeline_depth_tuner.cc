@@ -0,0 +1,53 @@
+#include "flexflow/utils/pipeline_depth_tuner.h"
+#include "gtest/gtest.h"
+
+using namespace FlexFlow;
+
+namespace {
+
+void record_window(PipelineDepthTuner &tuner,
+                   double blocked_us,
+                   double scheduling_us,
+                   double elapsed_us) {
+  for (int i = 0; i < PipelineDepthTuner::WINDOW; i++) {
+    tuner.record_batch(blocked_us, scheduling_us, elapsed_us);
+  }
+}
+
+} // namespace
+
+TEST(pipeline_depth_tuner, grows_when_scheduling_is_slow) {
+  PipelineDepthTuner tuner(2, 8, 4);
+  // the depth only changes at the end of a window
+  for (int i = 0; i < PipelineDepthTuner::WINDOW - 1; i++) {
+    tuner.record_batch(0, 500, 1000);
+  }
+  EXPECT_EQ(tuner.depth(), 4);
+  tuner.record_batch(0, 500, 1000);
+  EXPECT_EQ(tuner.depth(), 5);
+  for (int i = 0; i < 10; i++) {
+    record_window(tuner, 0, 500, 1000);
+  }
+  EXPECT_EQ(tuner.depth(), 8);
+}
+
+TEST(pipeline_depth_tuner, shrinks_when_blocked_on_inference) {
+  PipelineDepthTuner tuner(2, 8, 4);
+  record_window(tuner, 900, 10, 1000);
+  EXPECT_EQ(tuner.depth(), 3);
+  for (int i = 0; i < 10; i++) {
+    record_window(tuner, 900, 10, 1000);
+  }
+  EXPECT_EQ(tuner.depth(), 2);
+}
+
+TEST(pipeline_depth_tuner, keeps_depth_in_between) {
+  PipelineDepthTuner tuner(2, 8, 4);
+  // cheap scheduling, but the pipeline is not the bottleneck
+  record_window(tuner, 100, 10, 1000);
+  EXPECT_EQ(tuner.depth(), 4);
+  record_window(tuner, 900, 100, 1000);
+  EXPECT_EQ(tuner.depth(), 4);
+  // the initial depth is clamped to the bounds
+  EXPECT_EQ(PipelineDepthTuner(2, 8, 16).depth(), 8);
+}
@@ -0,0 +1,113 @@
+#include "flexflow/request_metrics.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+using namespace FlexFlow;
+
+namespace {
+
+// a request registered at time 0, with times given in milliseconds
+RequestMetrics make_metrics(size_t guid,
+                            double start_ms,
+                            double first_token_ms,
+                            double finish_ms,
+                            int output_length) {
+  RequestMetrics metrics;
+  metrics.guid = guid;
+  metrics.start_time = start_ms * 1000;
+  metrics.first_token_time = first_token_ms * 1000;
+  metrics.finish_time = finish_ms * 1000;
+  metrics.prompt_length = 16;
+  metrics.output_length = output_length;
+  return metrics;
+}
+
+} // namespace
+
+TEST(request_metrics, derived_latencies) {
+  RequestMetrics metrics = make_metrics(1, 5, 20, 110, 11);
+  EXPECT_DOUBLE_EQ(metrics.get(METRIC_QUEUE_TIME), 5);
+  EXPECT_DOUBLE_EQ(metrics.get(METRIC_TTFT), 20);
+  EXPECT_DOUBLE_EQ(metrics.get(METRIC_TPOT), 9);
+  EXPECT_DOUBLE_EQ(metrics.get(METRIC_E2E_LATENCY), 110);
+  // no time per output token with a single output token
+  EXPECT_EQ(make_metrics(2, 5, 20, 20, 1).get(METRIC_TPOT), -1);
+
+  nlohmann::json record = nlohmann::json::parse(metrics.to_json());
+  EXPECT_EQ(record["guid"], 1);
+  EXPECT_EQ(record["output_length"], 11);
+  EXPECT_DOUBLE_EQ(record["ttft_ms"].get<double>(), 20);
+}
+
+TEST(request_metrics, summary_and_histogram) {
+  RequestMetricsCollector collector;
+  for (int i = 1; i <= 100; i++) {
+    collector.add(make_metrics(i, 0, i, 200, 2));
+  }
+  RequestMetrics warmup = make_metrics(101, 0, 1000, 2000, 2);
+  warmup.warmup = true;
+  collector.add(warmup);
+  EXPECT_EQ(collector.get_records().size(), 101);
+
+  // warmup requests are not aggregated
+  RequestMetricsSummary ttft = collector.summarize(METRIC_TTFT);
+  EXPECT_EQ(ttft.count, 100);
+  EXPECT_DOUBLE_EQ(ttft.mean, 50.5);
+  EXPECT_DOUBLE_EQ(ttft.min, 1);
+  EXPECT_DOUBLE_EQ(ttft.max, 100);
+  EXPECT_DOUBLE_EQ(ttft.p50, 50);
+  EXPECT_DOUBLE_EQ(ttft.p90, 90);
+  EXPECT_DOUBLE_EQ(ttft.p99, 99);
+
+  EXPECT_EQ(collector.histogram(METRIC_TTFT, {10, 50}),
+            (std::vector<size_t>{9, 40, 51}));
+
+  collector.clear();
+  EXPECT_EQ(collector.summarize(METRIC_TTFT).count, 0);
+}
+
+TEST(request_metrics, small_sample_percentiles) {
+  RequestMetricsCollector collector;
+  for (int i = 1; i <= 6; i++) {
+    collector.add(make_metrics(i, 0, 10 * i, 200, 2));
+  }
+  // nearest rank: ceil(p / 100 * 6)
+  RequestMetricsSummary ttft = collector.summarize(METRIC_TTFT);
+  EXPECT_DOUBLE_EQ(ttft.p50, 30);
+  EXPECT_DOUBLE_EQ(ttft.p90, 60);
+  EXPECT_DOUBLE_EQ(ttft.p95, 60);
+
+  collector.clear();
+  collector.add(make_metrics(1, 0, 10, 200, 2));
+  ttft = collector.summarize(METRIC_TTFT);
+  EXPECT_DOUBLE_EQ(ttft.p50, 10);
+  EXPECT_DOUBLE_EQ(ttft.p99, 10);
+}
+
+TEST(request_metrics, metric_names) {
+  RequestMetricType type = METRIC_QUEUE_TIME;
+  EXPECT_TRUE(request_metric_type_from_string("tpot", type));
+  EXPECT_EQ(type, METRIC_TPOT);
+  EXPECT_FALSE(request_metric_type_from_string("tpto", type));
+  EXPECT_EQ(type, METRIC_TPOT);
+}
+
+TEST(request_metrics, json_lines) {
+  std::string const filepath = "request_metrics_test.jsonl";
+  std::remove(filepath.c_str());
+  RequestMetricsCollector collector;
+  collector.set_output_filepath(filepath);
+  collector.add(make_metrics(1, 1, 2, 3, 2));
+  collector.add(make_metrics(2, 1, 2, 3, 2));
+  collector.flush();
+  std::ifstream file(filepath);
+  std::string line;
+  size_t guid = 1;
+  while (std::getline(file, line)) {
+    EXPECT_EQ(nlohmann::json::parse(line)["guid"], guid++);
+  }
+  EXPECT_EQ(guid, 3);
+  std::remove(filepath.c_str());
+}
@@ -0,0 +1,154 @@
+#include "flexflow/scheduling_policy.h"
+#include "gtest/gtest.h"
+#include <set>
+
+using namespace FlexFlow;
+
+namespace {
+
+PendingRequest make_request(size_t guid,
+                            int prompt_length,
+                            int priority = 0,
+                            double deadline = -1,
+                            PEFTModelID peft_model_id = PEFTModelID::NO_ID) {
+  PendingRequest request;
+  request.guid = guid;
+  request.prompt_length = prompt_length;
+  request.priority = priority;
+  request.deadline = deadline;
+  request.peft_model_id = peft_model_id;
+  return request;
+}
+
+std::vector<size_t> drain(SchedulingPolicy &policy) {
+  std::vector<size_t> order;
+  while (!policy.empty()) {
+    order.push_back(policy.front().guid);
+    policy.pop();
+  }
+  return order;
+}
+
+} // namespace
+
+TEST(scheduling_policy, fcfs) {
+  auto policy = SchedulingPolicy::create(SCHEDULING_FCFS);
+  policy->push(make_request(1, 100));
+  policy->push(make_request(2, 10));
+  policy->push(make_request(3, 50));
+  EXPECT_EQ(policy->size(), 3);
+  EXPECT_EQ(drain(*policy), (std::vector<size_t>{1, 2, 3}));
+}
+
+TEST(scheduling_policy, shortest_prompt_first) {
+  auto policy = SchedulingPolicy::create(SCHEDULING_SHORTEST_PROMPT_FIRST);
+  policy->push(make_request(1, 100));
+  policy->push(make_request(2, 10));
+  policy->push(make_request(3, 50));
+  policy->push(make_request(4, 10));
+  EXPECT_EQ(drain(*policy), (std::vector<size_t>{2, 4, 3, 1}));
+}
+
+TEST(scheduling_policy, priority_and_deadline) {
+  auto policy = SchedulingPolicy::create(SCHEDULING_PRIORITY);
+  policy->push(make_request(1, 10, 0));
+  policy->push(make_request(2, 10, 1, -1));
+  policy->push(make_request(3, 10, 1, 2000));
+  policy->push(make_request(4, 10, 1, 1000));
+  policy->push(make_request(5, 10, 0));
+  EXPECT_EQ(drain(*policy), (std::vector<size_t>{4, 3, 2, 1, 5}));
+}
+
+TEST(scheduling_policy, fair_share) {
+  auto policy = SchedulingPolicy::create(SCHEDULING_FAIR_SHARE);
+  PEFTModelID adapter_a(1), adapter_b(2);
+  policy->push(make_request(1, 10, 0, -1, adapter_a));
+  policy->push(make_request(2, 10, 0, -1, adapter_a));
+  policy->push(make_request(3, 10, 0, -1, adapter_b));
+  EXPECT_EQ(policy->front().guid, 1);
+  policy->on_tokens_scheduled(adapter_a, 10);
+  // adapter_b has not been served yet, so it goes before adapter_a
+  EXPECT_EQ(policy->front().guid, 3);
+  policy->pop();
+  policy->on_tokens_scheduled(adapter_b, 20);
+  EXPECT_EQ(policy->front().guid, 1);
+  EXPECT_EQ(scheduling_policy_type_from_string("fair-share"),
+            SCHEDULING_FAIR_SHARE);
+}
+
+TEST(scheduling_policy, requeue_keeps_arrival_order) {
+  auto policy = SchedulingPolicy::create(SCHEDULING_FCFS);
+  policy->push(make_request(1, 10));
+  policy->push(make_request(2, 10));
+  PendingRequest first = policy->front();
+  policy->pop();
+  policy->push(make_request(3, 10));
+  // a preempted request goes back ahead of requests that arrived later
+  policy->requeue(first);
+  EXPECT_EQ(drain(*policy), (std::vector<size_t>{1, 2, 3}));
+}
+
+TEST(scheduling_policy, interleaved_push_and_pop) {
+  auto policy = SchedulingPolicy::create(SCHEDULING_SHORTEST_PROMPT_FIRST);
+  std::multiset<int> lengths;
+  for (int i = 0; i < 1000; i++) {
+    int prompt_length = (i * 7919) % 613;
+    policy->push(make_request(i, prompt_length));
+    lengths.insert(prompt_length);
+    if (i % 3 == 2) {
+      // the shortest prompt queued so far comes out first
+      EXPECT_EQ(policy->front().prompt_length, *lengths.begin());
+      lengths.erase(lengths.begin());
+      policy->pop();
+    }
+  }
+  while (!policy->empty()) {
+    EXPECT_EQ(policy->front().prompt_length, *lengths.begin());
+    lengths.erase(lengths.begin());
+    policy->pop();
+  }
+  EXPECT_TRUE(lengths.empty());
+}
+
+TEST(scheduling_policy, preemption_follows_policy_order) {
+  // under fcfs, a new request never preempts one that arrived earlier, but
+  // a requeued request may preempt one that arrived after it
+  auto fcfs = SchedulingPolicy::create(SCHEDULING_FCFS);
+  fcfs->push(make_request(1, 10));
+  PendingRequest running = fcfs->front();
+  fcfs->pop();
+  fcfs->push(make_request(2, 10));
+  PendingRequest waiting = fcfs->front();
+  EXPECT_FALSE(fcfs->admits_before(waiting, running));
+  EXPECT_TRUE(fcfs->admits_before(running, waiting));
+
+  // under spf, a short prompt preempts a long running request, which is
+  // requeued with all its tokens behind the request that preempted it
+  auto spf = SchedulingPolicy::create(SCHEDULING_SHORTEST_PROMPT_FIRST);
+  spf->push(make_request(1, 100));
+  running = spf->front();
+  spf->pop();
+  spf->push(make_request(2, 10));
+  waiting = spf->front();
+  ASSERT_TRUE(spf->admits_before(waiting, running));
+  running.prompt_length = 120;
+  spf->requeue(running);
+  EXPECT_EQ(spf->front().guid, 2);
+  spf->pop();
+  // the request that was admitted is not preempted back
+  EXPECT_FALSE(spf->admits_before(spf->front(), waiting));
+
+  // under fair-share, a request of an adapter that was served less preempts
+  // one of an adapter that was served more
+  auto fair_share = SchedulingPolicy::create(SCHEDULING_FAIR_SHARE);
+  PEFTModelID adapter_a(1), adapter_b(2);
+  fair_share->push(make_request(1, 10, 0, -1, adapter_a));
+  running = fair_share->front();
+  fair_share->pop();
+  fair_share->on_tokens_scheduled(adapter_a, 10);
+  fair_share->push(make_request(2, 10, 0, -1, adapter_b));
+  waiting = fair_share->front();
+  ASSERT_TRUE(fair_share->admits_before(waiting, running));
+  fair_share->requeue(running);
+  EXPECT_EQ(drain(*fair_share), (std::vector<size_t>{2, 1}));
+}
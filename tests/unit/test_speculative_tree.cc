@@ -0,0 +1,128 @@
+#include "flexflow/utils/speculative_tree.h"
+#include "gtest/gtest.h"
+
+using namespace FlexFlow;
+
+namespace {
+
+// builds a serialized tree and its causal mask from the parent of each token
+// (-1 for the root)
+SerializedTokenTree make_tree(std::vector<BatchConfig::TokenId> const &tokens,
+                              std::vector<int> const &parents,
+                              int root_depth,
+                              BatchConfig::BitMask &mask) {
+  SerializedTokenTree tree;
+  for (int q = 0; q < tokens.size(); q++) {
+    int depth = parents[q] < 0 ? root_depth : tree[parents[q]].second + 1;
+    tree.push_back(std::make_pair(tokens[q], depth));
+    for (int a = q; a >= 0; a = parents[a]) {
+      mask.set_bit(a, q);
+    }
+  }
+  mask.tree_size = tokens.size();
+  return tree;
+}
+
+int find_token(SerializedTokenTree const &tree,
+               BatchConfig::TokenId token,
+               BatchConfig::BitMask const &mask,
+               int ancestor) {
+  for (int q = 0; q < tree.size(); q++) {
+    if (tree[q].first == token && mask.test_bit(ancestor, q)) {
+      return q;
+    }
+  }
+  return -1;
+}
+
+} // namespace
+
+TEST(speculative_tree, merge_two_ssms) {
+  // root 1 at depth 5; ssm a drafts 10 -> 20 and 11, ssm b drafts 10 -> 21
+  // and 12 -> 20
+  BatchConfig::BitMask mask_a, mask_b, merged_mask;
+  SerializedTokenTree tree_a =
+      make_tree({1, 10, 11, 20}, {-1, 0, 0, 1}, 5, mask_a);
+  SerializedTokenTree tree_b =
+      make_tree({1, 10, 12, 21, 20}, {-1, 0, 0, 1, 2}, 5, mask_b);
+  SerializedTokenTree merged =
+      merge_speculative_trees(
+          {tree_a, tree_b}, {&mask_a, &mask_b}, 64, merged_mask);
+
+  // the shared prefix 1 -> 10 appears once
+  ASSERT_EQ(merged.size(), 7);
+  EXPECT_EQ(merged_mask.tree_size, 7);
+  EXPECT_EQ(merged[0], std::make_pair(1, 5));
+  for (int q = 1; q < merged.size(); q++) {
+    // serialized layer by layer
+    EXPECT_LE(merged[q - 1].second, merged[q].second);
+    // every token attends to the root and to itself
+    EXPECT_TRUE(merged_mask.test_bit(0, q));
+    EXPECT_TRUE(merged_mask.test_bit(q, q));
+  }
+  int t10 = find_token(merged, 10, merged_mask, 0);
+  int t12 = find_token(merged, 12, merged_mask, 0);
+  ASSERT_GE(t10, 0);
+  ASSERT_GE(t12, 0);
+  int t21 = find_token(merged, 21, merged_mask, t10);
+  int t20_under_10 = find_token(merged, 20, merged_mask, t10);
+  int t20_under_12 = find_token(merged, 20, merged_mask, t12);
+  ASSERT_GE(t21, 0);
+  ASSERT_GE(t20_under_10, 0);
+  ASSERT_GE(t20_under_12, 0);
+  EXPECT_NE(t20_under_10, t20_under_12);
+  // token 20 of ssm b does not attend to token 10
+  EXPECT_FALSE(merged_mask.test_bit(t10, t20_under_12));
+  EXPECT_FALSE(merged_mask.test_bit(t12, t21));
+}
+
+TEST(speculative_tree, merge_keeps_shallow_layers) {
+  BatchConfig::BitMask mask_a, mask_b, merged_mask;
+  SerializedTokenTree tree_a =
+      make_tree({1, 10, 20, 30}, {-1, 0, 1, 2}, 0, mask_a);
+  SerializedTokenTree tree_b = make_tree({1, 11, 21}, {-1, 0, 1}, 0, mask_b);
+  SerializedTokenTree merged =
+      merge_speculative_trees(
+          {tree_a, tree_b}, {&mask_a, &mask_b}, 4, merged_mask);
+  // the deepest layers are dropped first
+  ASSERT_EQ(merged.size(), 4);
+  EXPECT_EQ(merged_mask.tree_size, 4);
+  for (auto const &token : merged) {
+    EXPECT_LE(token.second, 2);
+  }
+  EXPECT_LT(find_token(merged, 30, merged_mask, 0), 0);
+}
+
+TEST(speculative_tree, accept_follows_tree_branches) {
+  BatchConfig::BitMask mask_a, mask_b, merged_mask;
+  SerializedTokenTree tree_a = make_tree({1, 10, 20}, {-1, 0, 1}, 5, mask_a);
+  SerializedTokenTree tree_b = make_tree({1, 12, 20}, {-1, 0, 1}, 5, mask_b);
+  SerializedTokenTree input =
+      merge_speculative_trees(
+          {tree_a, tree_b}, {&mask_a, &mask_b}, 64, merged_mask);
+  ASSERT_EQ(input.size(), 5);
+  int t10 = find_token(input, 10, merged_mask, 0);
+  int t12 = find_token(input, 12, merged_mask, 0);
+  int t20_under_10 = find_token(input, 20, merged_mask, t10);
+  int t20_under_12 = find_token(input, 20, merged_mask, t12);
+
+  // the llm predicts 12 after the root and 20 after 12, and something else
+  // after every other token
+  SerializedTokenTree output;
+  for (int q = 0; q < input.size(); q++) {
+    output.push_back(std::make_pair(99, input[q].second + 1));
+  }
+  output[0] = std::make_pair(12, 6);
+  output[t12] = std::make_pair(20, 7);
+  output[t20_under_12] = std::make_pair(30, 8);
+  // 20 under 10 matches the prediction after 12 too, but is not its child
+  output[t20_under_10] = std::make_pair(40, 8);
+
+  std::vector<int> accepted =
+      accept_speculative_tokens(input, output, merged_mask);
+  EXPECT_EQ(accepted, (std::vector<int>{0, t12, t20_under_12}));
+  // nothing but the root is accepted if the first prediction is not drafted
+  output[0] = std::make_pair(77, 6);
+  EXPECT_EQ(accept_speculative_tokens(input, output, merged_mask),
+            (std::vector<int>{0}));
+}
@@ -0,0 +1,58 @@
+#include "flexflow/utils/weight_container.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace FlexFlow;
+
+namespace {
+
+std::string write_tensor_file(std::string const &filepath,
+                              std::vector<float> const &values) {
+  std::ofstream out(filepath, std::ios::out | std::ios::binary);
+  out.write((char const *)values.data(), values.size() * sizeof(float));
+  return filepath;
+}
+
+} // namespace
+
+TEST(weight_container, round_trip) {
+  std::vector<float> q = {1, 2, 3, 4, 5, 6};
+  std::vector<float> bias = {7};
+  WeightContainerWriter writer;
+  writer.add_tensor("layers.0.self_attn.q_proj.weight",
+                    DT_FLOAT,
+                    {2, 3},
+                    write_tensor_file("weight_container_q.bin", q));
+  writer.add_tensor("layers.0.self_attn.q_proj.bias",
+                    DT_FLOAT,
+                    {1},
+                    write_tensor_file("weight_container_bias.bin", bias));
+  std::string const filepath = "weight_container_test.ffw";
+  writer.write(filepath);
+  std::remove("weight_container_q.bin");
+  std::remove("weight_container_bias.bin");
+
+  {
+    WeightContainer container(filepath);
+    EXPECT_EQ(container.get_tensors().size(), 2);
+    EXPECT_EQ(container.find("layers.0.self_attn.k_proj.weight"), nullptr);
+
+    WeightContainer::TensorInfo const *info =
+        container.find("layers.0.self_attn.q_proj.weight");
+    ASSERT_NE(info, nullptr);
+    EXPECT_EQ(info->data_type, DT_FLOAT);
+    EXPECT_EQ(info->dims, (std::vector<size_t>{2, 3}));
+    EXPECT_EQ(info->size, q.size() * sizeof(float));
+    EXPECT_EQ(info->offset % WeightContainer::ALIGNMENT, 0);
+    EXPECT_EQ(std::memcmp(container.get_data(*info), q.data(), info->size), 0);
+
+    info = container.find("layers.0.self_attn.q_proj.bias");
+    ASSERT_NE(info, nullptr);
+    EXPECT_EQ(info->offset % WeightContainer::ALIGNMENT, 0);
+    EXPECT_EQ(*(float const *)container.get_data(*info), 7);
+  }
+  std::remove(filepath.c_str());
+}
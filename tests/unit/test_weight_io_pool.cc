@@ -0,0 +1,100 @@
+#include "flexflow/utils/weight_io_pool.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+using namespace FlexFlow;
+
+namespace {
+
+std::vector<char> make_data(size_t size) {
+  std::vector<char> data(size);
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (char)(i * 131 + i / 7);
+  }
+  return data;
+}
+
+} // namespace
+
+TEST(weight_io_pool, pread) {
+  std::vector<char> data = make_data(100000);
+  std::string const filepath = "weight_io_pool_test.bin";
+  {
+    std::ofstream out(filepath, std::ios::out | std::ios::binary);
+    out.write(data.data(), data.size());
+  }
+  int fd = open(filepath.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  // small chunks and a short queue, so that callers wait for room
+  WeightIOPool pool(4, 1000, 3);
+  EXPECT_EQ(pool.get_num_threads(), 4);
+  std::vector<char> dst(data.size() - 1234);
+  EXPECT_TRUE(pool.pread(fd, 1234, dst.size(), dst.data()));
+  EXPECT_TRUE(std::equal(dst.begin(), dst.end(), data.begin() + 1234));
+  // a range that fits in one chunk is read by the caller
+  EXPECT_TRUE(pool.pread(fd, 7, 10, dst.data()));
+  EXPECT_TRUE(std::equal(dst.begin(), dst.begin() + 10, data.begin() + 7));
+  // past the end of the file
+  EXPECT_FALSE(pool.pread(fd, 50000, 60000, dst.data()));
+  close(fd);
+  std::remove(filepath.c_str());
+}
+
+TEST(weight_io_pool, copy) {
+  std::vector<char> data = make_data(54321);
+  WeightIOPool pool(3, 4096);
+  std::vector<char> dst(data.size());
+  pool.copy(data.data(), data.size(), dst.data());
+  EXPECT_EQ(dst, data);
+}
+
+TEST(weight_io_pool, shared_pool) {
+  std::shared_ptr<WeightIOPool> first = WeightIOPool::acquire_shared();
+  std::shared_ptr<WeightIOPool> second = WeightIOPool::acquire_shared();
+  EXPECT_EQ(first.get(), second.get());
+  EXPECT_GT(first->get_num_threads(), 0);
+  // the threads exit with the last holder
+  std::weak_ptr<WeightIOPool> pool = first;
+  first.reset();
+  EXPECT_FALSE(pool.expired());
+  second.reset();
+  EXPECT_TRUE(pool.expired());
+}
+
+TEST(weight_io_pool, chunk_consumer) {
+  std::vector<char> data = make_data(100000);
+  std::string const filepath = "weight_io_pool_consumer_test.bin";
+  {
+    std::ofstream out(filepath, std::ios::out | std::ios::binary);
+    out.write(data.data(), data.size());
+  }
+  int fd = open(filepath.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  WeightIOPool pool(4, 1000, 3);
+  // chunks arrive from several threads, each one transformed in place
+  std::vector<char> negated(data.size() - 1234);
+  auto negate = [&](char const *src, size_t begin, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      negated[begin + i] = -src[i];
+    }
+  };
+  EXPECT_TRUE(pool.pread(fd, 1234, negated.size(), negate));
+  for (size_t i = 0; i < negated.size(); i++) {
+    ASSERT_EQ(negated[i], (char)-data[1234 + i]);
+  }
+  EXPECT_FALSE(pool.pread(fd, 50000, 60000, negate));
+
+  std::fill(negated.begin(), negated.end(), 0);
+  pool.copy(data.data() + 1234, negated.size(), negate);
+  for (size_t i = 0; i < negated.size(); i++) {
+    ASSERT_EQ(negated[i], (char)-data[1234 + i]);
+  }
+  close(fd);
+  std::remove(filepath.c_str());
+}
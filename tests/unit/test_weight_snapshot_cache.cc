@@ -0,0 +1,58 @@
+#include "flexflow/utils/weight_snapshot_cache.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+using namespace FlexFlow;
+
+namespace {
+
+void write_file(std::string const &filepath, std::vector<char> const &data) {
+  std::ofstream out(filepath, std::ios::out | std::ios::binary);
+  out.write(data.data(), data.size());
+}
+
+} // namespace
+
+TEST(weight_snapshot_cache, store_and_load) {
+  namespace fs = std::filesystem;
+  std::string const weights_folder = "weight_snapshot_test_weights";
+  std::string const cache_folder = "weight_snapshot_test_cache";
+  fs::create_directories(weights_folder);
+  write_file(weights_folder + "/layers.0.weight", {1, 2, 3, 4});
+  WeightIOPool pool(2);
+
+  std::vector<char> tensor = {5, 6, 7, 8, 9, 10};
+  std::vector<char> dst(tensor.size());
+  std::string snapshot_folder;
+  {
+    WeightSnapshotCache cache(cache_folder, weights_folder, "tp 1");
+    snapshot_folder = cache.get_snapshot_folder();
+    EXPECT_FALSE(cache.load("layers.0.weight0", dst.size(), dst.data(), &pool));
+    cache.store("layers.0.weight0", tensor.size(), tensor.data());
+    EXPECT_TRUE(cache.load("layers.0.weight0", dst.size(), dst.data(), &pool));
+    EXPECT_EQ(dst, tensor);
+    // a snapshot of another size is a miss
+    EXPECT_FALSE(cache.load("layers.0.weight0", 4, dst.data(), &pool));
+  }
+  {
+    // same weights and settings, e.g. after a restart
+    WeightSnapshotCache cache(cache_folder, weights_folder, "tp 1");
+    EXPECT_EQ(cache.get_snapshot_folder(), snapshot_folder);
+    EXPECT_TRUE(cache.load("layers.0.weight0", dst.size(), dst.data(), &pool));
+  }
+  {
+    WeightSnapshotCache cache(cache_folder, weights_folder, "tp 2");
+    EXPECT_NE(cache.get_snapshot_folder(), snapshot_folder);
+    EXPECT_FALSE(cache.load("layers.0.weight0", dst.size(), dst.data(), &pool));
+  }
+  {
+    // changed weights
+    write_file(weights_folder + "/layers.0.weight", {1, 2, 3, 4, 5});
+    WeightSnapshotCache cache(cache_folder, weights_folder, "tp 1");
+    EXPECT_NE(cache.get_snapshot_folder(), snapshot_folder);
+  }
+  fs::remove_all(weights_folder);
+  fs::remove_all(cache_folder);
+}
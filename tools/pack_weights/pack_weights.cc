@@ -0,0 +1,69 @@
+#include "flexflow/utils/weight_container.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <string>
+
+using FlexFlow::WeightContainer;
+using FlexFlow::WeightContainerWriter;
+
+namespace fs = std::filesystem;
+
+bool ends_with(std::string const &s, std::string const &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Packs a folder of per-tensor weight files, as written by the Python
+// weight converters, into a single WeightContainer in the same folder.
+int main(int argc, char **argv) {
+  if (argc != 2 && !(argc == 4 && std::string(argv[2]) == "--dtype")) {
+    std::cerr << "Usage: " << argv[0]
+              << " <weights-folder> [--dtype half|float]" << std::endl;
+    return 1;
+  }
+  fs::path folder(argv[1]);
+  std::string dtype_name = argc == 4 ? argv[3] : "half";
+  if (dtype_name != "half" && dtype_name != "float") {
+    std::cerr << "Unknown dtype " << dtype_name << std::endl;
+    return 1;
+  }
+  DataType dtype = dtype_name == "half" ? DT_HALF : DT_FLOAT;
+  size_t const dtype_size = dtype == DT_HALF ? 2 : 4;
+
+  std::set<std::string> filenames;
+  for (fs::directory_entry const &entry : fs::directory_iterator(folder)) {
+    std::string filename = entry.path().filename().string();
+    if (entry.is_regular_file() && filename != WeightContainer::FILENAME) {
+      filenames.insert(filename);
+    }
+  }
+
+  WeightContainerWriter writer;
+  for (std::string const &filename : filenames) {
+    // the per-tensor files carry no shape, so tensors are packed flat.
+    // Quantized weights are stored one byte per element, next to their
+    // _offset and _scale files, which hold values in the model precision.
+    bool quantized = !ends_with(filename, "_offset") &&
+                     !ends_with(filename, "_scale") &&
+                     filenames.count(filename + "_scale") > 0;
+    DataType data_type = quantized ? DT_INT8 : dtype;
+    size_t element_size = quantized ? 1 : dtype_size;
+    size_t size = fs::file_size(folder / filename);
+    if (size % element_size != 0) {
+      std::cerr << "Size of " << filename << " is not a multiple of "
+                << element_size << " bytes" << std::endl;
+      return 1;
+    }
+    writer.add_tensor(filename,
+                      data_type,
+                      {size / element_size},
+                      (folder / filename).string());
+  }
+  fs::path output = folder / WeightContainer::FILENAME;
+  writer.write(output.string());
+  std::cout << "Packed " << filenames.size() << " tensors into "
+            << output.string() << std::endl;
+  return 0;
+}